@@ -0,0 +1,2026 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  End-to-end upgrade benchmark. Generates a synthetic package (tar.gz
+  holding a rootfs.rpi-sdimg with a FAT boot partition and a rootfs),
+  and a sparse disk image standing in for /dev/mmcblk0, with the same
+  four partitions as the box. The passive bank is seeded with the new
+  rootfs except for a configurable ratio of changed chunks, so delta
+  mode has something to skip. Sparse mode flashes a package of its
+  own, whose rootfs is a half full ext4 file system made by mkfs.ext4,
+  and the flashed bank has to pass e2fsck. The pipe and callback
+  modes stream the package with its SHA-256, as a downloader would,
+  and the mismatch mode streams it with a wrong one: that upgrade has
+  to abort and leave the boot partition on the active bank.
+
+  The other modes exercise the upgrade worker rather than time a
+  flash. The cancel mode cancels a throttled flash half way through the
+  rootfs: it has to abort with mfrERR_INVALID_STATE, leave the boot
+  partition on the active bank and the bank untouched past what it
+  wrote. The term mode queues the package until the queue refuses it,
+  then stops the worker, which has to flash every queued upgrade and
+  notify its end exactly once. The resume mode cancels a flash in
+  resume mode once the journal vouches for the start of the rootfs,
+  then flashes the package again, which has to resume rather than
+  write the rootfs over. The progress mode flashes throttled with a
+  one second notify interval and checks the callbacks: their pace,
+  the percentage, and the throughput and completion estimate against
+  what the bench measured. The unpack mode unpacks the package to a
+  sink comparing the tar stream with the one the bench generated.
+
+  Every run flashes the package through the public upgrade API from a
+  forked child, so peak RSS and the /proc/self/io system call counts
+  only cover that run. The boot partition and the flashed bank are
+  then compared with the package, a run that wrote anything else
+  fails. Results are written as JSON.
+
+  The disk image is reached through the file backend by default, with
+  a device model giving it the latency and bandwidth of the eMMC when
+  asked, or attached to a loop device with --backend loop.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <zlib.h>
+#include "string.h"
+#include <mfrApi.h>
+
+#define BENCH_MB                (1024 * 1024)
+#define BENCH_SECTOR            512
+#define BENCH_BOOT_START        (4 * BENCH_MB)
+#define BENCH_PAGE              4096
+#define BENCH_CHUNK             (64 * 1024)     /* granularity of the changes between the banks */
+#define BENCH_IO_SIZE           BENCH_MB
+#define BENCH_STORAGE_MB        16
+#define BENCH_PACKAGE_NAME      "bench.tar.gz"
+#define BENCH_SPARSE_NAME       "bench-sparse.tar.gz"
+#define BENCH_SDIMG_NAME        "core-image-bench.rootfs.rpi-sdimg"
+#define BENCH_VERSION_NAME      "version.txt"
+#define BENCH_CMDLINE           "console=serial0,115200 root=/dev/mmcblk0p2 rootfstype=ext4 rootwait\n"
+/* cmdline.txt once the upgrade switched to the passive bank, same length */
+#define BENCH_CMDLINE_FLASHED   "console=serial0,115200 root=/dev/mmcblk0p3 rootfstype=ext4 rootwait\n"
+#define BENCH_RESULT_MAX        8192
+#define BENCH_BUDGET_KB         2048            /* memory budget of the budget mode */
+#define BENCH_QUEUE_TRIES       16              /* upgrades the term mode queues at most, the queue is shorter */
+#define BENCH_THROTTLE_SECONDS  4               /* a throttled flash writes the partitions in about this long */
+#define BENCH_POLL_US           10000
+#define BENCH_JOURNAL_MB        64              /* resume mode syncs the bank and its journal this often */
+#define BENCH_PROGRESS_MAX      64              /* callbacks the progress mode records */
+
+typedef struct bench_Options {
+    const char *dir;
+    const char *out;
+    const char *modes;
+    unsigned int rootfsMB;
+    unsigned int bootMB;
+    double change;
+    int level;
+    unsigned int runs;
+    unsigned int writeDepth;
+    uint64_t seed;
+    int verbose;
+    unsigned int blockKB;
+    mfrBlockBackend_t backend;
+    unsigned int latencyUs;         /* device model of the disk image */
+    unsigned int readMBps;
+    unsigned int writeMBps;
+    unsigned int syncUs;
+} bench_Options_t;
+
+static const char *g_backends[] = { "auto", "mmc", "loop", "file" };
+static const char *g_writeBackends[] = { "auto", "io_uring", "threads", "sync" };
+static const char *g_stages[mfrUPGRADE_STAGE_MAX] = { "read", "decompress", "hash", "write" };
+static const char *g_bootFiles[] = { "CMDLINE TXT", "CONFIG  TXT", "KERNEL  IMG" };
+static const char g_version[] = "imagename:fwupgrade-bench\n";
+
+/* How the package reaches the upgrade */
+typedef enum bench_Source {
+    BENCH_SOURCE_FILE = 0,          /* mfrWriteImageEx on the package file */
+    BENCH_SOURCE_PIPE,              /* mfrWriteImageStream, written into a pipe by a producer thread */
+    BENCH_SOURCE_CALLBACK,          /* mfrWriteImageStream, pulled by the read callback */
+    BENCH_SOURCE_MISMATCH,          /* same as the pipe with a wrong digest, the upgrade has to abort */
+} bench_Source_t;
+
+/* What a run does with the package */
+typedef enum bench_Scenario {
+    BENCH_SCENARIO_FLASH = 0,       /* flashes it once */
+    BENCH_SCENARIO_CANCEL,          /* cancels a throttled flash half way through the rootfs */
+    BENCH_SCENARIO_TERM,            /* queues it until the queue is full, then stops the worker */
+    BENCH_SCENARIO_RESUME,          /* cancels a flash in resume mode past a checkpoint, then flashes again */
+    BENCH_SCENARIO_PROGRESS,        /* flashes it throttled and records the progress callbacks */
+    BENCH_SCENARIO_UNPACK,          /* unpacks it rather than flashing it */
+} bench_Scenario_t;
+
+typedef struct bench_Stream {
+    int fd;                         /* package, read by the producer or the callback */
+    int pipeFd[2];
+    int producing;
+    pthread_t producer;
+} bench_Stream_t;
+
+typedef struct bench_Fixture {
+    char package[PATH_MAX];
+    char sparsePackage[PATH_MAX];   /* package of sparse mode, its rootfs is sparseImage */
+    char sparseImage[PATH_MAX];
+    char disk[PATH_MAX];
+    char cmdline[PATH_MAX];
+    char workDir[PATH_MAX];
+    uint64_t bootSize;
+    uint64_t rootfsSize;
+    uint64_t bankStart[2];
+    uint64_t bankSize;
+    uint64_t packageBytes;
+    uint64_t sparsePackageBytes;
+    char digest[65];                /* SHA-256 of the package, for the streaming modes */
+    uint64_t changedBytes;
+    double generateMs;
+} bench_Fixture_t;
+
+static const char *g_words[] = {
+    "lib", "usr", "bin", "share", "locale", "systemd", "rdk", "config", "media", "player",
+    "gstreamer", "plugin", "so", "conf", "the", "of", "and", "init", "service", "network",
+};
+
+static uint64_t benchMix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static double benchMs(const struct timespec *a, const struct timespec *b)
+{
+    return (double)(b->tv_sec - a->tv_sec) * 1000.0 + (double)(b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/* Whether the passive bank differs from the package in the chunk */
+static int benchChanged(const bench_Options_t *opt, uint64_t chunk)
+{
+    return (double)(benchMix(chunk ^ (opt->seed << 1)) >> 11) / (double)(1ull << 53) < opt->change;
+}
+
+/* Rootfs-like content: about 30% zero pages, 40% text, 30% incompressible */
+static void benchFillPage(uint8_t *page, uint64_t index, uint64_t seed)
+{
+    uint64_t state = benchMix(index ^ seed);
+    size_t pos = 0;
+    size_t i;
+
+    switch (state % 10)
+    {
+    case 0:
+    case 1:
+    case 2:
+        memset(page, 0, BENCH_PAGE);
+        break;
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+        while (pos < BENCH_PAGE)
+        {
+            state = benchMix(state);
+            const char *word = g_words[state % (sizeof(g_words) / sizeof(g_words[0]))];
+            size_t len = strlen(word);
+            for (i = 0; i < len && pos < BENCH_PAGE; i++)
+            {
+                page[pos++] = (uint8_t)word[i];
+            }
+            if (pos < BENCH_PAGE)
+            {
+                page[pos++] = (state >> 32) % 7 ? '/' : '\n';
+            }
+        }
+        break;
+    default:
+        for (pos = 0; pos < BENCH_PAGE; pos += sizeof(uint64_t))
+        {
+            state = benchMix(state);
+            memcpy(page + pos, &state, sizeof(state));
+        }
+        break;
+    }
+}
+
+/* Fills [offset, offset + len) of the rootfs, as packaged or as left on the passive bank */
+static void benchFillRootfs(const bench_Options_t *opt, uint8_t *buf, size_t len, uint64_t offset, int passive)
+{
+    size_t pos;
+
+    for (pos = 0; pos < len; pos += BENCH_PAGE)
+    {
+        uint64_t page = (offset + pos) / BENCH_PAGE;
+        uint64_t seed = opt->seed;
+        if (passive && benchChanged(opt, (offset + pos) / BENCH_CHUNK))
+        {
+            seed = ~seed;
+        }
+        benchFillPage(buf + pos, page, seed);
+    }
+}
+
+static void benchPut16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void benchPut32(uint8_t *p, uint32_t v)
+{
+    benchPut16(p, (uint16_t)v);
+    benchPut16(p + 2, (uint16_t)(v >> 16));
+}
+
+/* FAT16 boot partition holding cmdline.txt, config.txt and a kernel */
+static uint8_t *benchMakeBoot(const bench_Options_t *opt, uint64_t size, const char *cmdline)
+{
+    const uint32_t reserved = 4, fats = 2, rootEntries = 512;
+    uint32_t sectors = (uint32_t)(size / BENCH_SECTOR);
+    uint32_t spc = 1;
+    uint8_t *img = (uint8_t *)calloc(1, size);
+    struct {
+        const char *name;
+        size_t len;
+    } files[3] = { { g_bootFiles[0], sizeof(BENCH_CMDLINE) - 1 }, { g_bootFiles[1], 12 }, { g_bootFiles[2], 0 } };
+    uint32_t cluster = 2;
+    uint32_t i;
+
+    if (!img)
+    {
+        return NULL;
+    }
+    while (sectors / spc > 60000)
+    {
+        spc <<= 1;
+    }
+    uint32_t clusters = (sectors - reserved - rootEntries * 32 / BENCH_SECTOR) / spc;
+    uint32_t fatSectors = ((clusters + 2) * 2 + BENCH_SECTOR - 1) / BENCH_SECTOR;
+    uint64_t rootOffset = (uint64_t)(reserved + fats * fatSectors) * BENCH_SECTOR;
+    uint64_t dataOffset = rootOffset + rootEntries * 32;
+    uint64_t clusterBytes = (uint64_t)spc * BENCH_SECTOR;
+    uint8_t *fat = img + reserved * BENCH_SECTOR;
+
+    files[2].len = (size_t)(size / 4);
+    memcpy(img, "\xeb\x3c\x90MSWIN4.1", 11);
+    benchPut16(img + 11, BENCH_SECTOR);
+    img[13] = (uint8_t)spc;
+    benchPut16(img + 14, (uint16_t)reserved);
+    img[16] = (uint8_t)fats;
+    benchPut16(img + 17, (uint16_t)rootEntries);
+    benchPut16(img + 19, sectors > 0xffff ? 0 : (uint16_t)sectors);
+    img[21] = 0xf8;
+    benchPut16(img + 22, (uint16_t)fatSectors);
+    benchPut32(img + 32, sectors > 0xffff ? sectors : 0);
+    img[510] = 0x55;
+    img[511] = 0xaa;
+    benchPut16(fat, 0xfff8);
+    benchPut16(fat + 2, 0xffff);
+
+    for (i = 0; i < 3; i++)
+    {
+        uint32_t count = (uint32_t)((files[i].len + clusterBytes - 1) / clusterBytes);
+        uint8_t *entry = img + rootOffset + i * 32;
+        uint8_t *data = img + dataOffset + (cluster - 2) * clusterBytes;
+        uint32_t c;
+
+        memcpy(entry, files[i].name, 11);
+        entry[11] = 0x20;
+        benchPut16(entry + 26, (uint16_t)cluster);
+        benchPut32(entry + 28, (uint32_t)files[i].len);
+        for (c = 0; c < count; c++)
+        {
+            benchPut16(fat + (cluster + c) * 2, c + 1 == count ? 0xffff : (uint16_t)(cluster + c + 1));
+        }
+        if (i == 0)
+        {
+            memcpy(data, cmdline, files[i].len);
+        }
+        else if (i == 1)
+        {
+            memcpy(data, "gpu_mem=256\n", files[i].len);
+        }
+        else
+        {
+            size_t pos;
+            for (pos = 0; pos + BENCH_PAGE <= files[i].len; pos += BENCH_PAGE)
+            {
+                benchFillPage(data + pos, pos / BENCH_PAGE, opt->seed ^ 0x6b65726e656cull);
+            }
+        }
+        cluster += count;
+    }
+    memcpy(img + (reserved + fatSectors) * BENCH_SECTOR, fat, (size_t)fatSectors * BENCH_SECTOR);
+    return img;
+}
+
+static uint16_t benchGet16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t benchGet32(const uint8_t *p)
+{
+    return benchGet16(p) | (uint32_t)benchGet16(p + 2) << 16;
+}
+
+/* Copy of a file of the root directory of a FAT16 image, NULL when it is not there or its chain is broken */
+static uint8_t *benchFatRead(const uint8_t *img, uint64_t size, const char *name, uint32_t *len)
+{
+    uint32_t bps = benchGet16(img + 11), reserved = benchGet16(img + 14), fatSectors = benchGet16(img + 22);
+    uint32_t rootEntries = benchGet16(img + 17);
+    uint64_t rootOffset = (uint64_t)(reserved + img[16] * fatSectors) * bps;
+    uint64_t dataOffset = rootOffset + (uint64_t)rootEntries * 32;
+    uint64_t clusterBytes = (uint64_t)img[13] * bps;
+    uint32_t clusters = fatSectors * bps / 2;
+    const uint8_t *fat = img + (uint64_t)reserved * bps;
+    uint32_t i;
+
+    for (i = 0; clusterBytes && dataOffset <= size && i < rootEntries; i++)
+    {
+        const uint8_t *entry = img + rootOffset + (uint64_t)i * 32;
+        if (!entry[0])
+        {
+            break;
+        }
+        if (entry[0] == 0xe5 || (entry[11] & 0x08) || memcmp(entry, name, 11))
+        {
+            continue;
+        }
+        uint32_t cluster = benchGet16(entry + 26);
+        uint32_t pos = 0;
+        uint8_t *data;
+
+        *len = benchGet32(entry + 28);
+        data = (uint8_t *)malloc(*len ? *len : 1);
+        while (data && pos < *len)
+        {
+            uint64_t offset = dataOffset + (uint64_t)(cluster - 2) * clusterBytes;
+            size_t take = *len - pos < clusterBytes ? (size_t)(*len - pos) : (size_t)clusterBytes;
+            if (cluster < 2 || cluster >= clusters || offset + take > size)
+            {
+                free(data);
+                return NULL;
+            }
+            memcpy(data + pos, img + offset, take);
+            pos += (uint32_t)take;
+            cluster = benchGet16(fat + cluster * 2);
+        }
+        return data;
+    }
+    return NULL;
+}
+
+static void benchPartEntry(uint8_t *mbr, int index, uint8_t type, uint64_t start, uint64_t size)
+{
+    uint8_t *entry = mbr + 446 + index * 16;
+
+    entry[4] = type;
+    benchPut32(entry + 8, (uint32_t)(start / BENCH_SECTOR));
+    benchPut32(entry + 12, (uint32_t)(size / BENCH_SECTOR));
+}
+
+static void benchTarFill(uint8_t *header, const char *name, uint64_t size)
+{
+    unsigned int sum = 0;
+    int i;
+
+    memset(header, 0, BENCH_SECTOR);
+    snprintf((char *)header, 100, "%s", name);
+    snprintf((char *)header + 100, 8, "%07o", 0644);
+    snprintf((char *)header + 108, 8, "%07o", 0);
+    snprintf((char *)header + 116, 8, "%07o", 0);
+    snprintf((char *)header + 124, 12, "%011llo", (unsigned long long)size);
+    snprintf((char *)header + 136, 12, "%011o", 0);
+    header[156] = '0';
+    memcpy(header + 257, "ustar\0" "00", 8);
+    memset(header + 148, ' ', 8);
+    for (i = 0; i < BENCH_SECTOR; i++)
+    {
+        sum += header[i];
+    }
+    snprintf((char *)header + 148, 8, "%06o", sum);
+}
+
+static int benchTarHeader(gzFile gz, const char *name, uint64_t size)
+{
+    uint8_t header[BENCH_SECTOR];
+
+    benchTarFill(header, name, size);
+    return gzwrite(gz, header, sizeof(header)) == (int)sizeof(header) ? 0 : -1;
+}
+
+/* Partition table of the sdimg: boot partition at 4MB, rootfs right after it */
+static void benchMakeMbr(const bench_Fixture_t *fx, uint8_t *mbr)
+{
+    memset(mbr, 0, BENCH_SECTOR);
+    benchPartEntry(mbr, 0, 0x0c, BENCH_BOOT_START, fx->bootSize);
+    benchPartEntry(mbr, 1, 0x83, BENCH_BOOT_START + fx->bootSize, fx->rootfsSize);
+    mbr[510] = 0x55;
+    mbr[511] = 0xaa;
+}
+
+static int benchWriteAll(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len)
+    {
+        ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int benchIsZero(const uint8_t *p, size_t len)
+{
+    return !len || (!p[0] && !memcmp(p, p + 1, len - 1));
+}
+
+static int benchReadAll(int fd, void *buf, size_t len, uint64_t offset)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len)
+    {
+        ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+/* Rootfs of the package: the ext4 image of sparse mode when image is open, the synthetic one otherwise */
+static int benchReadRootfs(const bench_Options_t *opt, int image, uint8_t *buf, size_t len, uint64_t offset)
+{
+    if (image >= 0)
+    {
+        return benchReadAll(image, buf, len, offset);
+    }
+    benchFillRootfs(opt, buf, len, offset, 0);
+    return 0;
+}
+
+/* tar.gz holding version.txt and the sdimg: MBR, boot partition at 4MB, rootfs right after it */
+static int benchMakePackage(const bench_Options_t *opt, bench_Fixture_t *fx, const char *path, int image,
+                            const uint8_t *boot, uint8_t *buf)
+{
+    uint64_t sdimgSize = BENCH_BOOT_START + fx->bootSize + fx->rootfsSize;
+    uint8_t mbr[BENCH_SECTOR];
+    char mode[8];
+    uint64_t pos;
+    int ret = 0;
+    gzFile gz;
+
+    snprintf(mode, sizeof(mode), "wb%d", opt->level);
+    if (!(gz = gzopen(path, mode)))
+    {
+        return -1;
+    }
+    gzbuffer(gz, 256 * 1024);
+    benchMakeMbr(fx, mbr);
+
+    ret |= benchTarHeader(gz, BENCH_VERSION_NAME, sizeof(g_version) - 1);
+    memset(buf, 0, BENCH_IO_SIZE);
+    memcpy(buf, g_version, sizeof(g_version) - 1);
+    ret |= gzwrite(gz, buf, 512) == 512 ? 0 : -1;
+    ret |= benchTarHeader(gz, BENCH_SDIMG_NAME, sdimgSize);
+    memset(buf, 0, BENCH_IO_SIZE);
+    memcpy(buf, mbr, sizeof(mbr));
+    for (pos = 0; pos < BENCH_BOOT_START && !ret; pos += BENCH_IO_SIZE)
+    {
+        ret |= gzwrite(gz, buf, BENCH_IO_SIZE) == BENCH_IO_SIZE ? 0 : -1;
+        memset(buf, 0, sizeof(mbr));
+    }
+    ret |= gzwrite(gz, boot, (unsigned int)fx->bootSize) == (int)fx->bootSize ? 0 : -1;
+    for (pos = 0; pos < fx->rootfsSize && !ret; pos += BENCH_IO_SIZE)
+    {
+        size_t len = fx->rootfsSize - pos < BENCH_IO_SIZE ? (size_t)(fx->rootfsSize - pos) : BENCH_IO_SIZE;
+        ret |= benchReadRootfs(opt, image, buf, len, pos);
+        ret |= gzwrite(gz, buf, (unsigned int)len) == (int)len ? 0 : -1;
+    }
+    // sdimg sizes are sector multiples, pad to the tar record and close the archive
+    memset(buf, 0, 1024 + 512);
+    ret |= gzwrite(gz, buf, (unsigned int)((512 - sdimgSize % 512) % 512 + 1024)) >= 1024 ? 0 : -1;
+    ret |= gzclose(gz) == Z_OK ? 0 : -1;
+    return ret;
+}
+
+/* Rewrites the passive bank with the old rootfs, leaving the changed chunks for the flash */
+static int benchSeedPassive(const bench_Options_t *opt, const bench_Fixture_t *fx, uint8_t *buf)
+{
+    int fd = open(fx->disk, O_WRONLY | O_CLOEXEC);
+    uint64_t pos;
+    int ret = fd < 0 ? -1 : 0;
+
+    for (pos = 0; pos < fx->rootfsSize && !ret; pos += BENCH_IO_SIZE)
+    {
+        size_t len = fx->rootfsSize - pos < BENCH_IO_SIZE ? (size_t)(fx->rootfsSize - pos) : BENCH_IO_SIZE;
+        benchFillRootfs(opt, buf, len, pos, 1);
+        ret = benchWriteAll(fd, buf, len, fx->bankStart[1] + pos);
+    }
+    if (fd >= 0)
+    {
+        ret |= fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    return ret;
+}
+
+/* Compares the files of the boot partition with those of the package, cmdline.txt being the given one. The
+   partition is not compared as a whole: cmdline.txt may have moved to other clusters. */
+static int benchCheckBoot(const bench_Options_t *opt, const bench_Fixture_t *fx, const char *cmdline)
+{
+    uint8_t *boot = benchMakeBoot(opt, fx->bootSize, cmdline);
+    uint8_t *disk = (uint8_t *)malloc(fx->bootSize);
+    int fd = open(fx->disk, O_RDONLY | O_CLOEXEC);
+    int ret = !boot || !disk || fd < 0 ? -1 : 0;
+    size_t i;
+
+    if (!ret)
+    {
+        ret = benchReadAll(fd, disk, (size_t)fx->bootSize, BENCH_BOOT_START);
+    }
+    for (i = 0; i < sizeof(g_bootFiles) / sizeof(g_bootFiles[0]) && !ret; i++)
+    {
+        uint32_t wantLen = 0, gotLen = 0;
+        uint8_t *want = benchFatRead(boot, fx->bootSize, g_bootFiles[i], &wantLen);
+        uint8_t *got = benchFatRead(disk, fx->bootSize, g_bootFiles[i], &gotLen);
+        if (!want || !got || wantLen != gotLen || memcmp(want, got, wantLen))
+        {
+            fprintf(stderr, "%.11s of the boot partition differs from the package\n", g_bootFiles[i]);
+            ret = -1;
+        }
+        free(want);
+        free(got);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(disk);
+    free(boot);
+    return ret;
+}
+
+/* Compares the boot partition and the flashed bank with the package, once the upgrade switched banks. Sparse
+   mode leaves the free space of the ext4 image as the discards left it, zero pages of the image are skipped
+   and e2fsck checks the file system instead. */
+static int benchCheck(const bench_Options_t *opt, const bench_Fixture_t *fx, int sparse)
+{
+    uint8_t *expected = (uint8_t *)malloc(BENCH_IO_SIZE);
+    uint8_t *buf = (uint8_t *)malloc(BENCH_IO_SIZE);
+    int fd = open(fx->disk, O_RDONLY | O_CLOEXEC);
+    int image = sparse ? open(fx->sparseImage, O_RDONLY | O_CLOEXEC) : -1;
+    char command[3 * PATH_MAX];
+    uint64_t pos;
+    int ret = !expected || !buf || fd < 0 || (sparse && image < 0) ? -1 : 0;
+    size_t i;
+
+    if (!ret)
+    {
+        ret = benchCheckBoot(opt, fx, BENCH_CMDLINE_FLASHED);
+    }
+    for (pos = 0; pos < fx->rootfsSize && !ret; pos += BENCH_IO_SIZE)
+    {
+        size_t len = fx->rootfsSize - pos < BENCH_IO_SIZE ? (size_t)(fx->rootfsSize - pos) : BENCH_IO_SIZE;
+        ret = benchReadRootfs(opt, image, expected, len, pos);
+        ret |= benchReadAll(fd, buf, len, fx->bankStart[1] + pos);
+        for (i = 0; i < len && !ret; i += BENCH_PAGE)
+        {
+            if ((!sparse || !benchIsZero(expected + i, BENCH_PAGE)) &&
+                memcmp(buf + i, expected + i, BENCH_PAGE))
+            {
+                fprintf(stderr, "passive bank differs from the rootfs at %llu\n", (unsigned long long)(pos + i));
+                ret = -1;
+            }
+        }
+    }
+    if (!ret && sparse)
+    {
+        // its report goes to stdout with the engine log
+        snprintf(command, sizeof(command), "e2fsck -fn '%s?offset=%llu' 2>&1", fx->disk,
+                 (unsigned long long)fx->bankStart[1]);
+        if (system(command))
+        {
+            fprintf(stderr, "e2fsck failed on the passive bank, --verbose shows its report\n");
+            ret = -1;
+        }
+    }
+    if (image >= 0)
+    {
+        close(image);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(buf);
+    free(expected);
+    return ret;
+}
+
+/* Puts the boot partition of the package back, cmdline.txt on the active bank */
+static int benchRestoreBoot(const bench_Options_t *opt, const bench_Fixture_t *fx)
+{
+    uint8_t *boot = benchMakeBoot(opt, fx->bootSize, BENCH_CMDLINE);
+    int fd = open(fx->disk, O_WRONLY | O_CLOEXEC);
+    int ret = !boot || fd < 0 ? -1 : benchWriteAll(fd, boot, (size_t)fx->bootSize, BENCH_BOOT_START);
+
+    if (fd >= 0)
+    {
+        ret |= fsync(fd);
+        close(fd);
+    }
+    free(boot);
+    return ret;
+}
+
+/* Sparse disk image: p1 boot, p2 active bank, p3 passive bank, p4 storage */
+static int benchMakeDisk(const bench_Options_t *opt, bench_Fixture_t *fx, const uint8_t *boot)
+{
+    uint8_t mbr[BENCH_SECTOR];
+    uint64_t storageStart = fx->bankStart[1] + fx->bankSize;
+    int fd = open(fx->disk, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ret;
+
+    (void)opt;
+    if (fd < 0)
+    {
+        return -1;
+    }
+    memset(mbr, 0, sizeof(mbr));
+    benchPartEntry(mbr, 0, 0x0c, BENCH_BOOT_START, fx->bootSize);
+    benchPartEntry(mbr, 1, 0x83, fx->bankStart[0], fx->bankSize);
+    benchPartEntry(mbr, 2, 0x83, fx->bankStart[1], fx->bankSize);
+    benchPartEntry(mbr, 3, 0x83, storageStart, (uint64_t)BENCH_STORAGE_MB * BENCH_MB);
+    mbr[510] = 0x55;
+    mbr[511] = 0xaa;
+    ret = ftruncate(fd, (off_t)(storageStart + (uint64_t)BENCH_STORAGE_MB * BENCH_MB));
+    ret |= benchWriteAll(fd, mbr, sizeof(mbr), 0);
+    ret |= benchWriteAll(fd, boot, (size_t)fx->bootSize, BENCH_BOOT_START);
+    close(fd);
+    return ret;
+}
+
+static int benchRemove(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Files of rootfs-like content filling half of the rootfs, in one directory per word */
+static int benchMakeTree(const bench_Options_t *opt, const char *dir, uint64_t bytes, uint8_t *buf)
+{
+    char path[PATH_MAX];
+    uint64_t total = 0;
+    uint64_t page = 0;
+    unsigned int file;
+    size_t i;
+
+    if (mkdir(dir, 0755) < 0)
+    {
+        return -1;
+    }
+    for (i = 0; i < sizeof(g_words) / sizeof(g_words[0]); i++)
+    {
+        if (snprintf(path, sizeof(path), "%s/%s", dir, g_words[i]) >= (int)sizeof(path) || mkdir(path, 0755) < 0)
+        {
+            return -1;
+        }
+    }
+    for (file = 0; total < bytes; file++)
+    {
+        uint64_t state = benchMix(file ^ opt->seed);
+        size_t len = BENCH_PAGE * (size_t)(1 + state % 64);
+        int n = snprintf(path, sizeof(path), "%s/%s/%s%u", dir,
+                         g_words[file % (sizeof(g_words) / sizeof(g_words[0]))],
+                         g_words[(state >> 8) % (sizeof(g_words) / sizeof(g_words[0]))], file);
+        int fd = n < (int)sizeof(path) ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+        if (fd < 0)
+        {
+            return -1;
+        }
+        for (i = 0; i < len; i += BENCH_PAGE)
+        {
+            benchFillPage(buf + i, page++, opt->seed);
+        }
+        int ret = benchWriteAll(fd, buf, len, 0);
+        close(fd);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        total += len;
+    }
+    return 0;
+}
+
+/* Package of sparse mode: the rootfs is an ext4 file system half full of files, made by mkfs.ext4 */
+static int benchMakeSparse(const bench_Options_t *opt, bench_Fixture_t *fx, const uint8_t *boot, uint8_t *buf)
+{
+    char tree[PATH_MAX];
+    char command[3 * PATH_MAX];
+    struct stat st;
+    int image;
+    int ret;
+
+    snprintf(fx->sparsePackage, sizeof(fx->sparsePackage), "%s/%s", opt->dir, BENCH_SPARSE_NAME);
+    snprintf(fx->sparseImage, sizeof(fx->sparseImage), "%s/rootfs.ext4", opt->dir);
+    snprintf(tree, sizeof(tree), "%s/rootfs.d", opt->dir);
+    nftw(tree, benchRemove, 16, FTW_DEPTH | FTW_PHYS);
+    unlink(fx->sparseImage);
+    if (benchMakeTree(opt, tree, fx->rootfsSize / 2, buf) < 0)
+    {
+        return -1;
+    }
+    snprintf(command, sizeof(command), "mkfs.ext4 -q -F -b 4096 -E root_owner=0:0 -d '%s' '%s' %lluk >/dev/null",
+             tree, fx->sparseImage, (unsigned long long)(fx->rootfsSize / 1024));
+    ret = system(command) ? -1 : 0;
+    nftw(tree, benchRemove, 16, FTW_DEPTH | FTW_PHYS);
+    if (ret < 0)
+    {
+        fprintf(stderr, "mkfs.ext4 failed, sparse mode needs e2fsprogs 1.43 or later\n");
+        return -1;
+    }
+    if ((image = open(fx->sparseImage, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+    ret = benchMakePackage(opt, fx, fx->sparsePackage, image, boot, buf);
+    close(image);
+    if (ret || stat(fx->sparsePackage, &st) < 0)
+    {
+        return -1;
+    }
+    fx->sparsePackageBytes = (uint64_t)st.st_size;
+    return 0;
+}
+
+/* SHA-256 of the package as 64 hex digits, from sha256sum */
+static int benchDigest(const char *path, char *digest, size_t size)
+{
+    char command[PATH_MAX + 32];
+    FILE *fp;
+    int ret;
+
+    snprintf(command, sizeof(command), "sha256sum '%s'", path);
+    if (size < 65 || !(fp = popen(command, "r")))
+    {
+        return -1;
+    }
+    ret = fscanf(fp, "%64[0-9a-f]", digest) == 1 && strlen(digest) == 64 ? 0 : -1;
+    ret |= pclose(fp) ? -1 : 0;
+    return ret;
+}
+
+static int benchSetup(const bench_Options_t *opt, bench_Fixture_t *fx, int sparse)
+{
+    struct timespec start, end;
+    struct stat st;
+    uint8_t *boot = NULL;
+    uint8_t *buf = (uint8_t *)malloc(BENCH_IO_SIZE);
+    FILE *fp;
+    uint64_t chunk;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    snprintf(fx->package, sizeof(fx->package), "%s/%s", opt->dir, BENCH_PACKAGE_NAME);
+    snprintf(fx->disk, sizeof(fx->disk), "%s/mmcblk0.img", opt->dir);
+    snprintf(fx->cmdline, sizeof(fx->cmdline), "%s/cmdline", opt->dir);
+    snprintf(fx->workDir, sizeof(fx->workDir), "%s/imageblk", opt->dir);
+    fx->bootSize = (uint64_t)opt->bootMB * BENCH_MB;
+    fx->rootfsSize = (uint64_t)opt->rootfsMB * BENCH_MB;
+    fx->bankSize = fx->rootfsSize + 8 * BENCH_MB;
+    fx->bankStart[0] = BENCH_BOOT_START + fx->bootSize;
+    fx->bankStart[1] = fx->bankStart[0] + fx->bankSize;
+    for (chunk = 0; chunk < fx->rootfsSize / BENCH_CHUNK; chunk++)
+    {
+        fx->changedBytes += benchChanged(opt, chunk) ? BENCH_CHUNK : 0;
+    }
+
+    if ((mkdir(opt->dir, 0755) < 0 && errno != EEXIST) || !buf ||
+        !(boot = benchMakeBoot(opt, fx->bootSize, BENCH_CMDLINE)))
+    {
+        free(buf);
+        return -1;
+    }
+    ret = benchMakePackage(opt, fx, fx->package, -1, boot, buf);
+    if (!ret && sparse)
+    {
+        ret = benchMakeSparse(opt, fx, boot, buf);
+    }
+    ret |= benchMakeDisk(opt, fx, boot);
+    if (!(fp = fopen(fx->cmdline, "w")))
+    {
+        ret = -1;
+    }
+    else
+    {
+        fputs(BENCH_CMDLINE, fp);
+        fclose(fp);
+    }
+    free(boot);
+    free(buf);
+    if (ret || stat(fx->package, &st) < 0)
+    {
+        return -1;
+    }
+    fx->packageBytes = (uint64_t)st.st_size;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fx->generateMs = benchMs(&start, &end);
+    return 0;
+}
+
+static bench_Source_t benchSourceOf(const char *mode)
+{
+    return !strcmp(mode, "pipe") ? BENCH_SOURCE_PIPE : !strcmp(mode, "callback") ? BENCH_SOURCE_CALLBACK :
+           !strcmp(mode, "mismatch") ? BENCH_SOURCE_MISMATCH : BENCH_SOURCE_FILE;
+}
+
+static bench_Scenario_t benchScenarioOf(const char *mode)
+{
+    return !strcmp(mode, "cancel") ? BENCH_SCENARIO_CANCEL : !strcmp(mode, "term") ? BENCH_SCENARIO_TERM :
+           !strcmp(mode, "resume") ? BENCH_SCENARIO_RESUME : !strcmp(mode, "progress") ? BENCH_SCENARIO_PROGRESS :
+           !strcmp(mode, "unpack") ? BENCH_SCENARIO_UNPACK : BENCH_SCENARIO_FLASH;
+}
+
+/* Turns a mode name into the engine configuration it benchmarks */
+static int benchConfigure(const bench_Options_t *opt, const bench_Fixture_t *fx, const char *mode,
+                          mfrFWUpgradeConfig_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->diskDevice = fx->disk;
+    config->storageDevice = "";
+    config->workDir = fx->workDir;
+    config->cmdlinePath = fx->cmdline;
+    config->writeDepth = opt->writeDepth;
+    config->blockSize = opt->blockKB * 1024;
+    config->blockBackend = opt->backend;
+    config->modelLatencyUs = opt->latencyUs;
+    config->modelReadKBps = opt->readMBps * 1024;
+    config->modelWriteKBps = opt->writeMBps * 1024;
+    config->modelFlushUs = opt->syncUs;
+    if (!strcmp(mode, "delta"))
+    {
+        config->deltaMode = 1;
+    }
+    else if (!strcmp(mode, "sparse"))
+    {
+        config->sparseMode = 1;
+    }
+    else if (!strcmp(mode, "budget"))
+    {
+        config->memoryBudgetKB = BENCH_BUDGET_KB;
+    }
+    else if (!strcmp(mode, "sync"))
+    {
+        config->writeBackend = mfrWRITE_BACKEND_SYNC;
+    }
+    else if (!strcmp(mode, "threads"))
+    {
+        config->writeBackend = mfrWRITE_BACKEND_THREADS;
+    }
+    else if (!strcmp(mode, "buffered"))
+    {
+        config->bufferedWrites = 1;
+    }
+    else if (!strcmp(mode, "noreadback"))
+    {
+        config->skipReadback = 1;
+    }
+    else if (!strcmp(mode, "tree"))
+    {
+        config->hashTree = 1;
+    }
+    else if (!strcmp(mode, "resume"))
+    {
+        config->resumeMode = 1;
+    }
+    else if (strcmp(mode, "full") && benchSourceOf(mode) == BENCH_SOURCE_FILE &&
+             benchScenarioOf(mode) == BENCH_SCENARIO_FLASH)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* syscr/syscw of /proc/self/io: read and write family system calls */
+static void benchReadIo(uint64_t *syscr, uint64_t *syscw)
+{
+    char line[128];
+    FILE *fp = fopen("/proc/self/io", "r");
+    unsigned long long value;
+
+    *syscr = *syscw = 0;
+    while (fp && fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "syscr: %llu", &value) == 1)
+        {
+            *syscr = value;
+        }
+        else if (sscanf(line, "syscw: %llu", &value) == 1)
+        {
+            *syscw = value;
+        }
+    }
+    if (fp)
+    {
+        fclose(fp);
+    }
+}
+
+/* Final notification of the upgrade, the bench waits for it */
+typedef struct bench_Wait {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;                       /* final notifications received, one is expected */
+    mfrError_t error;
+} bench_Wait_t;
+
+static void benchNotify(mfrUpgradeStatusEx_t status, void *cbData)
+{
+    bench_Wait_t *wait = (bench_Wait_t *)cbData;
+
+    if (status.status.progress != mfrUPGRADE_PROGRESS_COMPLETED &&
+        status.status.progress != mfrUPGRADE_PROGRESS_ABORTED)
+    {
+        return;
+    }
+    pthread_mutex_lock(&wait->lock);
+    wait->done++;
+    wait->error = status.status.progress == mfrUPGRADE_PROGRESS_COMPLETED ? mfrERR_NONE :
+                  status.status.error != mfrERR_NONE ? status.status.error : mfrERR_GENERAL;
+    pthread_cond_signal(&wait->cond);
+    pthread_mutex_unlock(&wait->lock);
+}
+
+static mfrError_t benchWaitFinal(bench_Wait_t *wait)
+{
+    mfrError_t ret;
+
+    pthread_mutex_lock(&wait->lock);
+    while (!wait->done)
+    {
+        pthread_cond_wait(&wait->cond, &wait->lock);
+    }
+    ret = wait->error;
+    pthread_mutex_unlock(&wait->lock);
+    return ret;
+}
+
+/* Producer of the pipe: copies the package into it like a download, until the upgrade closed the other end */
+static void *benchProduce(void *arg)
+{
+    bench_Stream_t *stream = (bench_Stream_t *)arg;
+    uint8_t *buf = (uint8_t *)malloc(BENCH_IO_SIZE);
+    ssize_t n = 0;
+
+    while (buf && (n = read(stream->fd, buf, BENCH_IO_SIZE)) != 0)
+    {
+        ssize_t done = 0;
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        while (n > 0 && done < n)
+        {
+            ssize_t w = write(stream->pipeFd[1], buf + done, (size_t)(n - done));
+            if (w < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (w <= 0)
+            {
+                n = -1;
+                break;
+            }
+            done += w;
+        }
+        if (n < 0)
+        {
+            break;
+        }
+    }
+    close(stream->pipeFd[1]);
+    free(buf);
+    return NULL;
+}
+
+static mfrError_t benchSourceRead(void *ctx, void *buf, size_t len, size_t *got)
+{
+    bench_Stream_t *stream = (bench_Stream_t *)ctx;
+    ssize_t n;
+
+    while ((n = read(stream->fd, buf, len)) < 0 && errno == EINTR)
+    {
+    }
+    *got = n > 0 ? (size_t)n : 0;
+    return n < 0 ? mfrERR_GENERAL : mfrERR_NONE;
+}
+
+/* The upgrade is over with the source: a producer still writing gets EPIPE */
+static void benchSourceRelease(void *ctx)
+{
+    bench_Stream_t *stream = (bench_Stream_t *)ctx;
+
+    if (stream->pipeFd[0] >= 0)
+    {
+        close(stream->pipeFd[0]);
+        stream->pipeFd[0] = -1;
+    }
+}
+
+/* Streams the package to the upgrade, with its digest or with a wrong one */
+static mfrError_t benchStream(const bench_Fixture_t *fx, bench_Source_t source, bench_Stream_t *stream,
+                              mfrUpgradeStatusNotifyEx_t notify)
+{
+    mfrImageSource_t image;
+    char digest[sizeof(fx->digest)];
+    mfrError_t ret;
+
+    memset(&image, 0, sizeof(image));
+    snprintf(digest, sizeof(digest), "%s", fx->digest);
+    if (source == BENCH_SOURCE_MISMATCH)
+    {
+        digest[0] = digest[0] == '0' ? '1' : '0';
+    }
+    if ((stream->fd = open(fx->package, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    image.fd = -1;
+    image.ctx = stream;
+    image.release = benchSourceRelease;
+    image.size = fx->packageBytes;
+    image.sha256 = digest;
+    if (source == BENCH_SOURCE_CALLBACK)
+    {
+        image.read = benchSourceRead;
+    }
+    else
+    {
+        if (pipe2(stream->pipeFd, O_CLOEXEC) < 0)
+        {
+            return mfrERR_GENERAL;
+        }
+        if (pthread_create(&stream->producer, NULL, benchProduce, stream))
+        {
+            close(stream->pipeFd[1]);
+            benchSourceRelease(stream);
+            return mfrERR_GENERAL;
+        }
+        stream->producing = 1;
+        image.fd = stream->pipeFd[0];
+    }
+    ret = mfrWriteImageStream(&image, mfrIMAGE_TYPE_RCDL, notify);
+    if (ret != mfrERR_NONE)
+    {
+        // release is only called for a queued upgrade
+        benchSourceRelease(stream);
+    }
+    return ret;
+}
+
+/* Once the upgrade released the source */
+static void benchStreamEnd(bench_Stream_t *stream)
+{
+    if (stream->producing)
+    {
+        pthread_join(stream->producer, NULL);
+        stream->producing = 0;
+    }
+    benchSourceRelease(stream);
+    if (stream->fd >= 0)
+    {
+        close(stream->fd);
+        stream->fd = -1;
+    }
+}
+
+/* Queues the package, from its file or streamed, and waits for the end of the upgrade */
+static mfrError_t benchFlash(const bench_Options_t *opt, const bench_Fixture_t *fx, int sparse,
+                             bench_Source_t source, bench_Stream_t *stream)
+{
+    bench_Wait_t wait = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, mfrERR_NONE };
+    mfrUpgradeStatusNotifyEx_t notify = { &wait, benchNotify, 0 };
+    mfrError_t ret;
+
+    if (source == BENCH_SOURCE_FILE)
+    {
+        ret = mfrWriteImageEx(sparse ? BENCH_SPARSE_NAME : BENCH_PACKAGE_NAME, opt->dir, mfrIMAGE_TYPE_RCDL, notify);
+    }
+    else
+    {
+        ret = benchStream(fx, source, stream, notify);
+    }
+    return ret == mfrERR_NONE ? benchWaitFinal(&wait) : ret;
+}
+
+/* Background mode slow enough for the flash to take about BENCH_THROTTLE_SECONDS */
+static void benchThrottle(const bench_Fixture_t *fx)
+{
+    mfrUpgradeThrottle_t throttle;
+
+    memset(&throttle, 0, sizeof(throttle));
+    throttle.background = 1;
+    throttle.writeBytesPerSec = (fx->bootSize + fx->rootfsSize) / BENCH_THROTTLE_SECONDS;
+    mfrSetUpgradeThrottle(&throttle);
+}
+
+/* Flashes the package throttled and cancels it once it wrote the given bytes. Returns the result of the
+   cancelled upgrade, with its counters in stats. */
+static mfrError_t benchCancelAt(const bench_Options_t *opt, const bench_Fixture_t *fx, uint64_t written,
+                                mfrUpgradeStats_t *stats)
+{
+    bench_Wait_t wait = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, mfrERR_NONE };
+    mfrUpgradeStatusNotifyEx_t notify = { &wait, benchNotify, 0 };
+    mfrError_t ret;
+    int done = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    benchThrottle(fx);
+    ret = mfrWriteImageEx(BENCH_PACKAGE_NAME, opt->dir, mfrIMAGE_TYPE_RCDL, notify);
+    while (ret == mfrERR_NONE && !done)
+    {
+        mfrGetUpgradeStats(stats);
+        if (stats->bytesWritten >= written)
+        {
+            break;
+        }
+        usleep(BENCH_POLL_US);
+        pthread_mutex_lock(&wait.lock);
+        done = wait.done;
+        pthread_mutex_unlock(&wait.lock);
+    }
+    if (ret == mfrERR_NONE && done)
+    {
+        fprintf(stderr, "the upgrade ended before it could be cancelled\n");
+    }
+    else if (ret == mfrERR_NONE && mfrCancelUpgrade() != mfrERR_NONE)
+    {
+        fprintf(stderr, "mfrCancelUpgrade found nothing to cancel\n");
+    }
+    mfrSetUpgradeThrottle(NULL);
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    // mfrCancelUpgrade returns once the final notification went out
+    pthread_mutex_lock(&wait.lock);
+    done = wait.done;
+    pthread_mutex_unlock(&wait.lock);
+    ret = benchWaitFinal(&wait);
+    if (done != 1)
+    {
+        fprintf(stderr, "the cancelled upgrade notified its end %d times before mfrCancelUpgrade returned\n", done);
+        ret = mfrERR_GENERAL;
+    }
+    mfrGetUpgradeStats(stats);
+    return ret;
+}
+
+/* Cancels the flash half way through the rootfs. The upgrade has to end aborted with mfrERR_INVALID_STATE,
+   with the boot partition on the active bank and the passive bank as seeded past what it wrote. */
+static mfrError_t benchCancel(const bench_Options_t *opt, const bench_Fixture_t *fx, int *checks)
+{
+    uint8_t *expected = (uint8_t *)malloc(BENCH_IO_SIZE);
+    uint8_t *buf = (uint8_t *)malloc(BENCH_IO_SIZE);
+    int fd = open(fx->disk, O_RDONLY | O_CLOEXEC);
+    mfrUpgradeStats_t stats;
+    mfrError_t ret = benchCancelAt(opt, fx, fx->bootSize + fx->rootfsSize / 2, &stats);
+    uint64_t pos;
+    size_t len;
+
+    *checks = !expected || !buf || fd < 0 ? -1 : 0;
+    if (!*checks && (ret != mfrERR_INVALID_STATE || stats.progress != mfrUPGRADE_PROGRESS_ABORTED ||
+                     stats.bytesWritten >= fx->bootSize + fx->rootfsSize))
+    {
+        fprintf(stderr, "the cancelled upgrade ended with %d, state %d, after %llu bytes\n", (int)ret,
+                (int)stats.progress, (unsigned long long)stats.bytesWritten);
+        *checks = -1;
+    }
+    // the start of the rootfs went to the bank
+    len = fx->rootfsSize < BENCH_IO_SIZE ? (size_t)fx->rootfsSize : BENCH_IO_SIZE;
+    if (!*checks)
+    {
+        benchFillRootfs(opt, expected, len, 0, 0);
+        if (benchReadAll(fd, buf, len, fx->bankStart[1]) || memcmp(buf, expected, len))
+        {
+            fprintf(stderr, "the cancelled upgrade did not write the start of the rootfs\n");
+            *checks = -1;
+        }
+    }
+    // the boot partition counts in bytesWritten, the rootfs is untouched from there on at least
+    for (pos = (stats.bytesWritten + BENCH_PAGE - 1) / BENCH_PAGE * BENCH_PAGE; pos < fx->rootfsSize && !*checks;
+         pos += len)
+    {
+        len = fx->rootfsSize - pos < BENCH_IO_SIZE ? (size_t)(fx->rootfsSize - pos) : BENCH_IO_SIZE;
+        benchFillRootfs(opt, expected, len, pos, 1);
+        if (benchReadAll(fd, buf, len, fx->bankStart[1] + pos) || memcmp(buf, expected, len))
+        {
+            fprintf(stderr, "the cancelled upgrade wrote the passive bank past %llu\n",
+                    (unsigned long long)stats.bytesWritten);
+            *checks = -1;
+        }
+    }
+    if (!*checks)
+    {
+        *checks = benchCheckBoot(opt, fx, BENCH_CMDLINE);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(buf);
+    free(expected);
+    return ret;
+}
+
+/* Cancels a flash once the journal vouches for its first interval of the rootfs, then flashes the package
+   again: that upgrade has to take the interval from the bank rather than write it */
+static mfrError_t benchResume(const bench_Options_t *opt, const bench_Fixture_t *fx, int *checks)
+{
+    uint64_t journal = (uint64_t)BENCH_JOURNAL_MB * BENCH_MB;
+    mfrUpgradeStats_t stats;
+    // the bank is synced and the journal recorded before the blocks past the interval are written
+    mfrError_t ret = benchCancelAt(opt, fx, fx->bootSize + journal + journal / 8, &stats);
+
+    *checks = 0;
+    if (ret != mfrERR_INVALID_STATE)
+    {
+        fprintf(stderr, "the upgrade to resume ended with %d rather than being cancelled\n", (int)ret);
+        *checks = -1;
+        return ret == mfrERR_NONE ? mfrERR_GENERAL : ret;
+    }
+    ret = benchFlash(opt, fx, 0, BENCH_SOURCE_FILE, NULL);
+    mfrGetUpgradeStats(&stats);
+    if (ret == mfrERR_NONE && (stats.bytesResumed < journal || stats.bytesWritten >= fx->bootSize + fx->rootfsSize))
+    {
+        fprintf(stderr, "the upgrade resumed %llu bytes and wrote %llu, the journal vouched for %llu\n",
+                (unsigned long long)stats.bytesResumed, (unsigned long long)stats.bytesWritten,
+                (unsigned long long)journal);
+        *checks = -1;
+    }
+    return ret;
+}
+
+/* Callbacks of a flash, with when the bench got them */
+typedef struct bench_Progress {
+    bench_Wait_t wait;
+    struct timespec start;
+    int count;                      /* callbacks received, only the first BENCH_PROGRESS_MAX are recorded */
+    double atMs[BENCH_PROGRESS_MAX];
+    mfrUpgradeStatusEx_t status[BENCH_PROGRESS_MAX];
+} bench_Progress_t;
+
+static void benchRecord(mfrUpgradeStatusEx_t status, void *cbData)
+{
+    bench_Progress_t *progress = (bench_Progress_t *)cbData;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&progress->wait.lock);
+    if (progress->count < BENCH_PROGRESS_MAX)
+    {
+        progress->atMs[progress->count] = benchMs(&progress->start, &now);
+        progress->status[progress->count] = status;
+    }
+    progress->count++;
+    pthread_mutex_unlock(&progress->wait.lock);
+    benchNotify(status, &progress->wait);
+}
+
+/* Whether a rate or estimate the library reported is within tolerance of the one the bench measured */
+static int benchNear(double reported, double measured, double tolerance, double slack)
+{
+    return reported >= measured * (1.0 - tolerance) - slack && reported <= measured * (1.0 + tolerance) + slack;
+}
+
+/* Checks the callbacks of a completed flash: one at the start, then one per interval with the percentage and
+   the bytes consumed never going back, the last one alone reporting the end. The rates and the completion
+   estimate are compared with what the bench measured between the callbacks. */
+static int benchCheckProgress(const bench_Progress_t *progress, int interval)
+{
+    const mfrUpgradeStatusEx_t *status = progress->status;
+    const double *atMs = progress->atMs;
+    int last = progress->count - 1;
+    int i;
+
+    if (progress->count > BENCH_PROGRESS_MAX || progress->count < 3)
+    {
+        fprintf(stderr, "the flash made %d progress callbacks\n", progress->count);
+        return -1;
+    }
+    if (status[last].status.progress != mfrUPGRADE_PROGRESS_COMPLETED || status[last].status.percentage != 100 ||
+        status[last].etaSeconds != 0 || status[last].bytesConsumed != status[last].bytesTotal)
+    {
+        fprintf(stderr, "the last callback reported state %d at %d%%, %llu of %llu bytes, eta %d\n",
+                (int)status[last].status.progress, status[last].status.percentage,
+                status[last].bytesConsumed, status[last].bytesTotal, status[last].etaSeconds);
+        return -1;
+    }
+    for (i = 0; i < last; i++)
+    {
+        const mfrUpgradeStatusEx_t *s = &status[i];
+        double remainingMs = atMs[last] - atMs[i];
+
+        if (s->status.progress != mfrUPGRADE_PROGRESS_STARTED || s->status.percentage > 99 ||
+            s->bytesConsumed > s->bytesTotal || !s->bytesTotal || (i && (s->status.percentage <
+            status[i - 1].status.percentage || s->bytesConsumed < status[i - 1].bytesConsumed)))
+        {
+            fprintf(stderr, "callback %d reported state %d at %d%%, %llu of %llu bytes\n", i,
+                    (int)s->status.progress, s->status.percentage, s->bytesConsumed, s->bytesTotal);
+            return -1;
+        }
+        if (!i)
+        {
+            continue;
+        }
+        // the library samples on deadlines from the start of the flash
+        if (atMs[i] - atMs[i - 1] < interval * 500.0 || atMs[i] - atMs[i - 1] > interval * 1500.0)
+        {
+            fprintf(stderr, "callback %d came %.1f ms after the previous one\n", i, atMs[i] - atMs[i - 1]);
+            return -1;
+        }
+        if (!benchNear((double)s->throughput, (s->bytesConsumed - status[i - 1].bytesConsumed) * 1000.0 /
+                       (atMs[i] - atMs[i - 1]), 0.25, BENCH_MB) ||
+            !benchNear((double)s->avgThroughput, s->bytesConsumed * 1000.0 / (atMs[i] - atMs[0]), 0.25, BENCH_MB))
+        {
+            fprintf(stderr, "callback %d reported %llu B/s, %llu B/s on average, after %.1f ms\n", i,
+                    s->throughput, s->avgThroughput, atMs[i] - atMs[0]);
+            return -1;
+        }
+        // the estimate assumes the average rate holds, the throttle keeps it close
+        if (s->avgThroughput && (s->etaSeconds < 0 || !benchNear(s->etaSeconds * 1000.0, remainingMs, 0.5, 1500.0)))
+        {
+            fprintf(stderr, "callback %d expected completion in %d s, it took %.1f ms\n", i, s->etaSeconds,
+                    remainingMs);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Flashes the package throttled with a one second notify interval and checks the callbacks */
+static mfrError_t benchProgress(const bench_Options_t *opt, const bench_Fixture_t *fx, int *checks)
+{
+    bench_Progress_t *progress = (bench_Progress_t *)calloc(1, sizeof(*progress));
+    mfrUpgradeStatusNotifyEx_t notify = { progress, benchRecord, 1 };
+    mfrError_t ret;
+
+    *checks = -1;
+    if (!progress)
+    {
+        return mfrERR_GENERAL;
+    }
+    progress->wait = (bench_Wait_t){ PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, mfrERR_NONE };
+    benchThrottle(fx);
+    clock_gettime(CLOCK_MONOTONIC, &progress->start);
+    ret = mfrWriteImageEx(BENCH_PACKAGE_NAME, opt->dir, mfrIMAGE_TYPE_RCDL, notify);
+    if (ret == mfrERR_NONE)
+    {
+        ret = benchWaitFinal(&progress->wait);
+    }
+    mfrSetUpgradeThrottle(NULL);
+    if (ret == mfrERR_NONE)
+    {
+        *checks = benchCheckProgress(progress, notify.interval);
+    }
+    free(progress);
+    return ret;
+}
+
+/* Sink of the unpack mode: the tar stream of the package, version.txt then the sdimg, each behind its header
+   and padded to the record, then the two zero records ending the archive */
+typedef struct bench_Unpack {
+    const bench_Options_t *opt;
+    const bench_Fixture_t *fx;
+    uint8_t *boot;
+    uint64_t sdimgSize;
+    uint64_t total;                 /* size of the tar stream */
+    uint64_t pos;                   /* bytes received */
+    uint64_t page;                  /* rootfs page held in expected, UINT64_MAX for none */
+    int failed;
+    uint8_t version[2 * BENCH_SECTOR];  /* header and data of version.txt */
+    uint8_t sdimg[BENCH_SECTOR];        /* header of the sdimg */
+    uint8_t mbr[BENCH_SECTOR];
+    uint8_t expected[BENCH_PAGE];
+} bench_Unpack_t;
+
+/* Expected bytes of the tar stream at pos, returns how many follow there and names the member they belong to */
+static size_t benchUnpackExpect(bench_Unpack_t *unpack, uint64_t pos, const uint8_t **expected, const char **member)
+{
+    static const uint8_t zeros[BENCH_PAGE];
+    uint64_t sdimgStart = sizeof(unpack->version) + sizeof(unpack->sdimg);
+    uint64_t bootEnd = BENCH_BOOT_START + unpack->fx->bootSize;
+    uint64_t offset = pos - sdimgStart;
+
+    *member = BENCH_SDIMG_NAME;
+    if (pos < sizeof(unpack->version))
+    {
+        *member = BENCH_VERSION_NAME;
+        *expected = unpack->version + pos;
+        return (size_t)(sizeof(unpack->version) - pos);
+    }
+    if (pos < sdimgStart)
+    {
+        *expected = unpack->sdimg + (pos - sizeof(unpack->version));
+        return (size_t)(sdimgStart - pos);
+    }
+    if (pos >= sdimgStart + unpack->sdimgSize)
+    {
+        // record padding and the end of the archive
+        *member = "end of the archive";
+        *expected = zeros;
+        return unpack->total - pos < sizeof(zeros) ? (size_t)(unpack->total - pos) : sizeof(zeros);
+    }
+    if (offset < BENCH_SECTOR)
+    {
+        *expected = unpack->mbr + offset;
+        return (size_t)(BENCH_SECTOR - offset);
+    }
+    if (offset < BENCH_BOOT_START)
+    {
+        *expected = zeros;
+        return BENCH_BOOT_START - offset < sizeof(zeros) ? (size_t)(BENCH_BOOT_START - offset) : sizeof(zeros);
+    }
+    if (offset < bootEnd)
+    {
+        *expected = unpack->boot + (offset - BENCH_BOOT_START);
+        return (size_t)(bootEnd - offset);
+    }
+    offset -= bootEnd;
+    if (unpack->page != offset / BENCH_PAGE)
+    {
+        unpack->page = offset / BENCH_PAGE;
+        benchFillRootfs(unpack->opt, unpack->expected, BENCH_PAGE, unpack->page * BENCH_PAGE, 0);
+    }
+    *expected = unpack->expected + offset % BENCH_PAGE;
+    return (size_t)(BENCH_PAGE - offset % BENCH_PAGE);
+}
+
+static mfrError_t benchUnpackWrite(void *ctx, const void *data, size_t len)
+{
+    bench_Unpack_t *unpack = (bench_Unpack_t *)ctx;
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len)
+    {
+        const uint8_t *expected;
+        const char *member;
+        size_t n;
+
+        if (unpack->pos >= unpack->total)
+        {
+            fprintf(stderr, "the package unpacked to more than the %llu bytes of its tar stream\n",
+                    (unsigned long long)unpack->total);
+            unpack->failed = 1;
+            return mfrERR_GENERAL;
+        }
+        n = benchUnpackExpect(unpack, unpack->pos, &expected, &member);
+        n = n < len ? n : len;
+        if (memcmp(p, expected, n))
+        {
+            fprintf(stderr, "the package unpacked to a tar stream differing at %llu, in %s\n",
+                    (unsigned long long)unpack->pos, member);
+            unpack->failed = 1;
+            return mfrERR_GENERAL;
+        }
+        unpack->pos += n;
+        p += n;
+        len -= n;
+    }
+    return mfrERR_NONE;
+}
+
+/* Unpacks the package and checks that the sink got the tar stream the bench generated, whole */
+static mfrError_t benchUnpack(const bench_Options_t *opt, const bench_Fixture_t *fx, int *checks)
+{
+    bench_Unpack_t *unpack = (bench_Unpack_t *)calloc(1, sizeof(*unpack));
+    mfrUnpackSink_t sink = { unpack, benchUnpackWrite };
+    mfrError_t ret;
+
+    *checks = -1;
+    if (!unpack || !(unpack->boot = benchMakeBoot(opt, fx->bootSize, BENCH_CMDLINE)))
+    {
+        free(unpack);
+        return mfrERR_GENERAL;
+    }
+    unpack->opt = opt;
+    unpack->fx = fx;
+    unpack->sdimgSize = BENCH_BOOT_START + fx->bootSize + fx->rootfsSize;
+    unpack->total = sizeof(unpack->version) + sizeof(unpack->sdimg) +
+                    (unpack->sdimgSize + BENCH_SECTOR - 1) / BENCH_SECTOR * BENCH_SECTOR + 2 * BENCH_SECTOR;
+    unpack->page = UINT64_MAX;
+    benchTarFill(unpack->version, BENCH_VERSION_NAME, sizeof(g_version) - 1);
+    memcpy(unpack->version + BENCH_SECTOR, g_version, sizeof(g_version) - 1);
+    benchTarFill(unpack->sdimg, BENCH_SDIMG_NAME, unpack->sdimgSize);
+    benchMakeMbr(fx, unpack->mbr);
+
+    ret = mfrUnpackImageEx(BENCH_PACKAGE_NAME, opt->dir, sink);
+    if (ret == mfrERR_NONE && !unpack->failed)
+    {
+        *checks = 0;
+        if (unpack->pos != unpack->total)
+        {
+            fprintf(stderr, "the package unpacked to %llu of the %llu bytes of its tar stream\n",
+                    (unsigned long long)unpack->pos, (unsigned long long)unpack->total);
+            *checks = -1;
+        }
+    }
+    free(unpack->boot);
+    free(unpack);
+    return ret;
+}
+
+/* Queues the package until the queue refuses it with mfrERR_INVALID_STATE, then stops the worker: every queued
+   upgrade has to be flashed and notify its end exactly once before mfrFWUpgradeTerm returns */
+static mfrError_t benchTerm(const bench_Options_t *opt, int *checks)
+{
+    bench_Wait_t wait[BENCH_QUEUE_TRIES];
+    mfrError_t refused = mfrERR_NONE;
+    mfrError_t ret;
+    unsigned int queued;
+    unsigned int accepted;
+    unsigned int i;
+
+    for (queued = 0; queued < BENCH_QUEUE_TRIES && refused == mfrERR_NONE; queued++)
+    {
+        mfrUpgradeStatusNotifyEx_t notify = { &wait[queued], benchNotify, 0 };
+        wait[queued] = (bench_Wait_t){ PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, mfrERR_NONE };
+        refused = mfrWriteImageEx(BENCH_PACKAGE_NAME, opt->dir, mfrIMAGE_TYPE_RCDL, notify);
+    }
+    accepted = refused == mfrERR_NONE ? queued : queued - 1;
+    ret = mfrFWUpgradeTerm();
+    *checks = 0;
+    if (refused != mfrERR_INVALID_STATE || accepted < 2)
+    {
+        fprintf(stderr, "%u upgrades queued, then %d where a full queue refuses with %d\n", accepted, (int)refused,
+                (int)mfrERR_INVALID_STATE);
+        *checks = -1;
+    }
+    for (i = 0; i < queued; i++)
+    {
+        // the refused one is never notified
+        int expected = i < accepted ? 1 : 0;
+        pthread_mutex_lock(&wait[i].lock);
+        if (wait[i].done != expected || wait[i].error != mfrERR_NONE)
+        {
+            fprintf(stderr, "upgrade %u notified its end %d times, result %d\n", i + 1, wait[i].done,
+                    (int)wait[i].error);
+            ret = ret == mfrERR_NONE && wait[i].error != mfrERR_NONE ? wait[i].error : ret;
+            *checks = -1;
+        }
+        pthread_mutex_unlock(&wait[i].lock);
+    }
+    return ret;
+}
+
+/* Flashes once, or runs the scenario of the mode, and prints the JSON object of the run to out. Runs in the
+   forked child. matches tells whether the disk and the upgrade ended as expected: the package flashed, or the
+   active bank kept by the mismatch and cancel modes. */
+static int benchRun(const bench_Options_t *opt, const bench_Fixture_t *fx, const char *mode, unsigned int run,
+                    FILE *out)
+{
+    bench_Source_t source = benchSourceOf(mode);
+    bench_Scenario_t scenario = benchScenarioOf(mode);
+    bench_Stream_t stream = { .fd = -1, .pipeFd = { -1, -1 } };
+    mfrFWUpgradeConfig_t config;
+    mfrUpgradeStats_t stats;
+    struct timespec start, end;
+    struct rusage usage;
+    uint64_t syscr0, syscw0, syscr1, syscw1;
+    double wallMs;
+    mfrError_t ret;
+    int matches = 0;
+    int checks = 0;
+    int i;
+
+    if (benchConfigure(opt, fx, mode, &config) < 0)
+    {
+        return -1;
+    }
+    // the producer learns from EPIPE that the upgrade stopped reading
+    signal(SIGPIPE, SIG_IGN);
+    if ((source == BENCH_SOURCE_MISMATCH || scenario == BENCH_SCENARIO_CANCEL) && benchRestoreBoot(opt, fx) < 0)
+    {
+        return -1;
+    }
+    // the worker and its buffers are up before the package arrives, as on the box
+    ret = mfrFWUpgradeSetConfig(&config);
+    if (ret == mfrERR_NONE)
+    {
+        ret = mfrFWUpgradeInit();
+    }
+    benchReadIo(&syscr0, &syscw0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ret == mfrERR_NONE && scenario == BENCH_SCENARIO_CANCEL)
+    {
+        ret = benchCancel(opt, fx, &checks);
+    }
+    else if (ret == mfrERR_NONE && scenario == BENCH_SCENARIO_TERM)
+    {
+        ret = benchTerm(opt, &checks);
+    }
+    else if (ret == mfrERR_NONE && scenario == BENCH_SCENARIO_RESUME)
+    {
+        ret = benchResume(opt, fx, &checks);
+    }
+    else if (ret == mfrERR_NONE && scenario == BENCH_SCENARIO_PROGRESS)
+    {
+        ret = benchProgress(opt, fx, &checks);
+    }
+    else if (ret == mfrERR_NONE && scenario == BENCH_SCENARIO_UNPACK)
+    {
+        ret = benchUnpack(opt, fx, &checks);
+    }
+    else if (ret == mfrERR_NONE)
+    {
+        ret = benchFlash(opt, fx, config.sparseMode, source, &stream);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    benchReadIo(&syscr1, &syscw1);
+    getrusage(RUSAGE_SELF, &usage);
+    mfrGetUpgradeStats(&stats);
+    mfrFWUpgradeTerm();
+    benchStreamEnd(&stream);
+    wallMs = benchMs(&start, &end);
+    if (source == BENCH_SOURCE_MISMATCH)
+    {
+        matches = ret == mfrERR_DECRYPTION_FAILED && benchCheckBoot(opt, fx, BENCH_CMDLINE) == 0;
+    }
+    else if (scenario == BENCH_SCENARIO_CANCEL)
+    {
+        // checked with the upgrade stopped
+        matches = ret == mfrERR_INVALID_STATE && !checks;
+    }
+    else if (scenario == BENCH_SCENARIO_UNPACK)
+    {
+        // the banks are not touched
+        matches = ret == mfrERR_NONE && !checks;
+    }
+    else if (ret == mfrERR_NONE)
+    {
+        matches = !checks && benchCheck(opt, fx, config.sparseMode) == 0;
+    }
+    if (ret == mfrERR_NONE && config.sparseMode && !stats.bytesUnmapped)
+    {
+        fprintf(stderr, "sparse mode wrote the free space of the rootfs\n");
+        matches = 0;
+    }
+
+    fprintf(out, "    {\"mode\": \"%s\", \"run\": %u, \"result\": %d, \"matches\": %s, \"wallMs\": %.1f, "
+            "\"pipelineMs\": %llu,\n", mode, run, (int)ret, matches ? "true" : "false", wallMs,
+            (unsigned long long)stats.streamMs);
+    fprintf(out, "     \"prepareMs\": %llu, \"readbackMs\": %llu, \"treeMs\": %llu, \"commitMs\": %llu,\n",
+            (unsigned long long)stats.prepareMs, (unsigned long long)stats.readbackMs,
+            (unsigned long long)stats.hashTreeMs, (unsigned long long)stats.commitMs);
+    fprintf(out, "     \"packageMBps\": %.1f, \"peakRssKB\": %ld, \"bufferBytes\": %llu,\n",
+            (double)(config.sparseMode ? fx->sparsePackageBytes : fx->packageBytes) / BENCH_MB / (wallMs / 1000.0),
+            usage.ru_maxrss,
+            (unsigned long long)stats.bufferBytes);
+    fprintf(out, "     \"bytesRead\": %llu, \"bytesDecompressed\": %llu, \"bytesWritten\": %llu, "
+            "\"bytesSkipped\": %llu, \"bytesUnmapped\": %llu, \"bytesResumed\": %llu,\n",
+            (unsigned long long)stats.bytesRead, (unsigned long long)stats.bytesDecompressed,
+            (unsigned long long)stats.bytesWritten, (unsigned long long)stats.bytesSkipped,
+            (unsigned long long)stats.bytesUnmapped, (unsigned long long)stats.bytesResumed);
+    fprintf(out, "     \"syscalls\": {\"read\": %llu, \"write\": %llu, \"writeSubmissions\": %llu}, "
+            "\"contextSwitches\": {\"voluntary\": %ld, \"involuntary\": %ld}, \"cpuMs\": %.1f,\n",
+            (unsigned long long)(syscr1 - syscr0), (unsigned long long)(syscw1 - syscw0),
+            (unsigned long long)stats.writeRequests, usage.ru_nvcsw, usage.ru_nivcsw,
+            (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+            (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0);
+    fprintf(out, "     \"stages\": [");
+    for (i = 0; i < mfrUPGRADE_STAGE_MAX; i++)
+    {
+        const mfrUpgradeStageStats_t *stage = &stats.stage[i];
+        uint64_t stalls = stage->stallInMs + stage->stallOutMs;
+        uint64_t busy = stats.streamMs > stalls ? stats.streamMs - stalls : 1;
+        fprintf(out, "%s\n       {\"name\": \"%s\", \"blocks\": %llu, \"bytes\": %llu, \"busyMs\": %llu, "
+                "\"stallInMs\": %llu, \"stallOutMs\": %llu, \"peakQueue\": %u, \"MBps\": %.1f}", i ? "," : "",
+                g_stages[i], (unsigned long long)stage->blocks, (unsigned long long)stage->bytes,
+                (unsigned long long)busy, (unsigned long long)stage->stallInMs,
+                (unsigned long long)stage->stallOutMs, stage->peakQueueDepth,
+                (double)stage->bytes / BENCH_MB / ((double)busy / 1000.0));
+    }
+    fprintf(out, "],\n     \"writer\": {\"backend\": \"%s\", \"requests\": %llu, \"maxDepth\": %u, "
+            "\"meanLatencyUs\": %llu, \"maxLatencyUs\": %llu, \"retries\": %llu, \"syncMs\": %llu}}",
+            g_writeBackends[config.writeBackend], (unsigned long long)stats.writeRequests,
+            stats.peakWriteQueueDepth, (unsigned long long)stats.writeLatencyAvgUs,
+            (unsigned long long)stats.writeLatencyMaxUs, (unsigned long long)stats.writeRetries,
+            (unsigned long long)stats.syncMs);
+    return matches ? 0 : -1;
+}
+
+/* Forks the run so its peak RSS and counters are its own, appends its JSON to out */
+static int benchFork(const bench_Options_t *opt, const bench_Fixture_t *fx, const char *mode, unsigned int run,
+                     FILE *out)
+{
+    char result[BENCH_RESULT_MAX];
+    size_t len = 0;
+    int pipeFd[2];
+    int status = 0;
+    pid_t pid;
+
+    if (pipe(pipeFd) < 0)
+    {
+        return -1;
+    }
+    fflush(NULL);
+    pid = fork();
+    if (pid == 0)
+    {
+        FILE *fp = fdopen(pipeFd[1], "w");
+        int devnull = open("/dev/null", O_WRONLY);
+        close(pipeFd[0]);
+        if (!opt->verbose && devnull >= 0)
+        {
+            // the engine logs to stdout, keep the JSON clean
+            dup2(devnull, STDOUT_FILENO);
+        }
+        // a failed run reports its JSON too
+        int ret = fp ? benchRun(opt, fx, mode, run, fp) : -1;
+        _exit(fp && fclose(fp) == 0 && ret == 0 ? 0 : 1);
+    }
+    close(pipeFd[1]);
+    while (pid > 0 && len < sizeof(result) - 1)
+    {
+        ssize_t n = read(pipeFd[0], result + len, sizeof(result) - 1 - len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(pipeFd[0]);
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !len)
+    {
+        // keep the document valid when the child died before reporting
+        fprintf(out, "    {\"mode\": \"%s\", \"run\": %u, \"result\": -1}", mode, run);
+        return -1;
+    }
+    result[len] = '\0';
+    fputs(result, out);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void benchUsage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --dir DIR        fixture directory (default ./fwupgrade-bench.d)\n"
+            "  --out FILE       JSON results (default stdout)\n"
+            "  --rootfs MB      rootfs size (default 256)\n"
+            "  --boot MB        boot partition size, 4 to 1024 (default 32)\n"
+            "  --change RATIO   share of the rootfs differing from the passive bank (default 0.1)\n"
+            "  --level N        gzip level of the package (default 6)\n"
+            "  --modes LIST     comma separated: full, delta, sparse, budget, sync, threads,\n"
+            "                   buffered, noreadback, tree, pipe, callback, mismatch, cancel,\n"
+            "                   term, resume, progress, unpack (default full,delta). sparse\n"
+            "                   needs mkfs.ext4 and e2fsck, the streaming modes pipe, callback\n"
+            "                   and mismatch need sha256sum, resume a rootfs of 96 MB or more\n"
+            "  --runs N         runs per mode (default 3)\n"
+            "  --depth N        writes in flight (default: engine default)\n"
+            "  --block KB       pipeline block size (default: engine default)\n"
+            "  --backend NAME   auto, loop or file (default auto)\n"
+            "  --latency US     device model: latency of every request (default 0)\n"
+            "  --read-bw MB     device model: read bandwidth in MB/s (default unlimited)\n"
+            "  --write-bw MB    device model: write bandwidth in MB/s (default unlimited)\n"
+            "  --sync US        device model: time a sync takes (default 0)\n"
+            "  --seed N         content seed (default 1)\n"
+            "  --verbose        keep the engine log on stdout\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    bench_Options_t opt = {
+        .dir = "fwupgrade-bench.d",
+        .modes = "full,delta",
+        .rootfsMB = 256,
+        .bootMB = 32,
+        .change = 0.1,
+        .level = 6,
+        .runs = 3,
+        .seed = 1,
+    };
+    bench_Fixture_t fx;
+    char modes[256];
+    char *mode;
+    char *save = NULL;
+    uint8_t *buf;
+    FILE *out = stdout;
+    int first = 1;
+    int failed = 0;
+    int sparse = 0;
+    int streamed = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(argv[i], "--verbose"))
+        {
+            opt.verbose = 1;
+            continue;
+        }
+        if (!value)
+        {
+            benchUsage(argv[0]);
+            return 2;
+        }
+        if (!strcmp(argv[i], "--dir"))
+            opt.dir = value;
+        else if (!strcmp(argv[i], "--out"))
+            opt.out = value;
+        else if (!strcmp(argv[i], "--rootfs"))
+            opt.rootfsMB = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--boot"))
+            opt.bootMB = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--change"))
+            opt.change = strtod(value, NULL);
+        else if (!strcmp(argv[i], "--level"))
+            opt.level = atoi(value);
+        else if (!strcmp(argv[i], "--modes"))
+            opt.modes = value;
+        else if (!strcmp(argv[i], "--runs"))
+            opt.runs = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--depth"))
+            opt.writeDepth = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--seed"))
+            opt.seed = strtoull(value, NULL, 0);
+        else if (!strcmp(argv[i], "--block"))
+            opt.blockKB = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--backend"))
+        {
+            for (opt.backend = mfrBLOCK_BACKEND_AUTO; opt.backend <= mfrBLOCK_BACKEND_FILE; opt.backend++)
+            {
+                if (!strcmp(value, g_backends[opt.backend]))
+                {
+                    break;
+                }
+            }
+        }
+        else if (!strcmp(argv[i], "--latency"))
+            opt.latencyUs = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--read-bw"))
+            opt.readMBps = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--write-bw"))
+            opt.writeMBps = (unsigned int)strtoul(value, NULL, 0);
+        else if (!strcmp(argv[i], "--sync"))
+            opt.syncUs = (unsigned int)strtoul(value, NULL, 0);
+        else
+        {
+            benchUsage(argv[0]);
+            return 2;
+        }
+        i++;
+    }
+    if (!opt.rootfsMB || opt.bootMB < 4 || opt.bootMB > 1024 || opt.change < 0 || opt.change > 1 ||
+        opt.level < 1 || opt.level > 9 || !opt.runs || opt.backend > mfrBLOCK_BACKEND_FILE ||
+        opt.backend == mfrBLOCK_BACKEND_MMC)
+    {
+        benchUsage(argv[0]);
+        return 2;
+    }
+
+    snprintf(modes, sizeof(modes), "%s", opt.modes);
+    for (mode = strtok_r(modes, ",", &save); mode; mode = strtok_r(NULL, ",", &save))
+    {
+        mfrFWUpgradeConfig_t config;
+        if (benchConfigure(&opt, &fx, mode, &config) < 0)
+        {
+            fprintf(stderr, "unknown mode %s\n", mode);
+            return 2;
+        }
+        sparse |= config.sparseMode;
+        streamed |= benchSourceOf(mode) != BENCH_SOURCE_FILE;
+        if (config.resumeMode && opt.rootfsMB < BENCH_JOURNAL_MB + 32)
+        {
+            fprintf(stderr, "the resume mode needs a rootfs of %u MB or more\n", BENCH_JOURNAL_MB + 32);
+            return 2;
+        }
+    }
+
+    memset(&fx, 0, sizeof(fx));
+    fprintf(stderr, "generating %u MB rootfs, %.0f%% changed, in %s\n", opt.rootfsMB, opt.change * 100, opt.dir);
+    if (benchSetup(&opt, &fx, sparse) < 0)
+    {
+        fprintf(stderr, "failed to generate the fixtures in %s: %s\n", opt.dir, strerror(errno));
+        return 1;
+    }
+    if (streamed && benchDigest(fx.package, fx.digest, sizeof(fx.digest)) < 0)
+    {
+        fprintf(stderr, "sha256sum of %s failed, the pipe, callback and mismatch modes need it\n", fx.package);
+        return 1;
+    }
+    if (opt.out && !(out = fopen(opt.out, "w")))
+    {
+        fprintf(stderr, "cannot write %s\n", opt.out);
+        return 1;
+    }
+    if (!(buf = (uint8_t *)malloc(BENCH_IO_SIZE)))
+    {
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"package\": {\"path\": \"%s\", \"bytes\": %llu, \"rootfsBytes\": %llu, \"bootBytes\": %llu, "
+            "\"sparseBytes\": %llu, \"changeRatio\": %.3f, \"changedBytes\": %llu, \"gzipLevel\": %d, "
+            "\"generateMs\": %.1f},\n"
+            "  \"device\": {\"backend\": \"%s\", \"latencyUs\": %u, \"readMBps\": %u, \"writeMBps\": %u, "
+            "\"syncUs\": %u},\n"
+            "  \"runs\": [\n", fx.package, (unsigned long long)fx.packageBytes,
+            (unsigned long long)fx.rootfsSize, (unsigned long long)fx.bootSize,
+            (unsigned long long)fx.sparsePackageBytes, opt.change,
+            (unsigned long long)fx.changedBytes, opt.level, fx.generateMs, g_backends[opt.backend], opt.latencyUs,
+            opt.readMBps, opt.writeMBps, opt.syncUs);
+    snprintf(modes, sizeof(modes), "%s", opt.modes);
+    for (mode = strtok_r(modes, ",", &save); mode; mode = strtok_r(NULL, ",", &save))
+    {
+        unsigned int run;
+        for (run = 0; run < opt.runs; run++)
+        {
+            fprintf(stderr, "%s run %u\n", mode, run + 1);
+            // every run starts from the same passive bank, with nothing of it cached
+            if (benchSeedPassive(&opt, &fx, buf) < 0)
+            {
+                fprintf(stderr, "failed to seed the passive bank\n");
+                failed = 1;
+                break;
+            }
+            int fd = open(fx.package, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+            fprintf(out, "%s", first ? "" : ",\n");
+            first = 0;
+            if (benchFork(&opt, &fx, mode, run + 1, out) < 0)
+            {
+                fprintf(stderr, "%s run %u failed\n", mode, run + 1);
+                failed = 1;
+            }
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    free(buf);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return failed;
+}
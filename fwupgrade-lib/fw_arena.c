@@ -0,0 +1,114 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+
+  Bump allocator over one preallocated region, see fw_arena.h.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "string.h"
+#include "fw_arena.h"
+
+#define FW_ARENA_ALIGN          4096
+#define FW_STATM_PATH           "/proc/self/statm"
+
+/********************************************************************
+   Functiona Name: fwArenaInit
+   Description   : allocates the region and touches every page of it,
+                   so it is resident from now on
+   Input:    size - bytes
+   Output:   arena
+   Returns:  mfrERR_NONE, mfrERR_MALLOC_FAILED
+
+*********************************************************************/
+
+mfrError_t fwArenaInit(fw_Arena_t *arena, size_t size)
+{
+    void *base = NULL;
+
+    memset(arena, 0, sizeof(*arena));
+    if (!size || posix_memalign(&base, FW_ARENA_ALIGN, size) != 0)
+    {
+        printf("failed to allocate %zu bytes for the memory budget %s:%d \n", size, __FUNCTION__, __LINE__);
+        return mfrERR_MALLOC_FAILED;
+    }
+    memset(base, 0, size);
+    arena->base = (uint8_t *)base;
+    arena->size = size;
+    return mfrERR_NONE;
+}
+
+void *fwArenaAlloc(fw_Arena_t *arena, size_t size, size_t align)
+{
+    size_t start = (arena->used + align - 1) & ~(align - 1);
+
+    if (start < arena->used || start > arena->size || size > arena->size - start)
+    {
+        return NULL;
+    }
+    arena->used = start + size;
+    arena->peak = arena->used > arena->peak ? arena->used : arena->peak;
+    // may have been handed out before the last rewind
+    memset(arena->base + start, 0, size);
+    return arena->base + start;
+}
+
+void fwArenaRewind(fw_Arena_t *arena, size_t mark)
+{
+    if (mark < arena->used)
+    {
+        arena->used = mark;
+    }
+}
+
+void fwArenaRelease(fw_Arena_t *arena)
+{
+    free(arena->base);
+    memset(arena, 0, sizeof(*arena));
+}
+
+uint64_t fwResidentKB(void)
+{
+    char text[128];
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    ssize_t n;
+    // no stdio, sampling must not allocate
+    int fd = open(FW_STATM_PATH, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return 0;
+    }
+    n = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    text[n] = 0;
+    if (sscanf(text, "%llu %llu", &size, &resident) != 2)
+    {
+        return 0;
+    }
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
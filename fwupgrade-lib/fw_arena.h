@@ -0,0 +1,48 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+
+  Fixed memory budget. One region is allocated and touched up front,
+  then handed out by bumping a pointer: the resident size of the
+  upgrade is reached before the first byte is flashed and does not
+  grow with the image. Nothing is freed on its own, the region is
+  rewound to a mark instead.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+
+typedef struct fw_Arena {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;                    /* most ever handed out */
+} fw_Arena_t;
+
+mfrError_t fwArenaInit(fw_Arena_t *arena, size_t size);
+/* Zeroed memory aligned to align, a power of two, NULL once the region is exhausted */
+void *fwArenaAlloc(fw_Arena_t *arena, size_t size, size_t align);
+/* Takes back everything handed out after mark, a value of arena->used */
+void fwArenaRewind(fw_Arena_t *arena, size_t mark);
+void fwArenaRelease(fw_Arena_t *arena);
+/* Resident set size of the process, 0 when it cannot be read */
+uint64_t fwResidentKB(void);
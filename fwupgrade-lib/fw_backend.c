@@ -0,0 +1,570 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  A loop device is taken from /dev/loop-control and set to clear
+  itself, so it goes away with the last descriptor of the flash, a
+  crash included. The model only delays the file operations: the
+  transfers happen at the speed of the machine and the caller then
+  waits until the model says the device would be done.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/loop.h>
+#include "string.h"
+#include "fw_backend.h"
+#include "fw_pipeline.h"
+#include "fw_target.h"
+
+#define FW_LOOP_CONTROL         "/dev/loop-control"
+#define FW_LOOP_ATTEMPTS        8               /* others may take the free loop device first */
+#define FW_SYSFS_BLOCK          "/sys/dev/block"
+#define FW_FILE_BLOCK_SIZE      512
+
+static const char *backendName(mfrBlockBackend_t type)
+{
+    switch (type)
+    {
+    case mfrBLOCK_BACKEND_MMC:
+        return "mmc";
+    case mfrBLOCK_BACKEND_LOOP:
+        return "loop";
+    case mfrBLOCK_BACKEND_FILE:
+        return "file";
+    default:
+        return "auto";
+    }
+}
+
+static mfrError_t backendRead(fw_Target_t *target, void *buf, size_t len, uint64_t offset)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (len)
+    {
+        ssize_t n = pread(target->fd, p, len, (off_t)(target->base + offset));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            printf("read of %s failed at %llu %s:%d \n", target->path,
+                   (unsigned long long)offset, __FUNCTION__, __LINE__);
+            return mfrERR_GENERAL;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t backendWrite(fw_Target_t *target, const void *buf, size_t len, uint64_t offset)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (len)
+    {
+        ssize_t n = pwrite(target->fd, p, len, (off_t)(target->base + offset));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            printf("write of %s failed at %llu: %s %s:%d \n", target->path,
+                   (unsigned long long)offset, strerror(errno), __FUNCTION__, __LINE__);
+            return mfrERR_GENERAL;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t backendFlush(fw_Target_t *target)
+{
+    if (fsync(target->fd) < 0)
+    {
+        printf("fsync of %s failed %s:%d \n", target->path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+/* A failed discard only matters when the media could have taken it */
+static mfrError_t backendDiscardResult(fw_Target_t *target, int ret, uint64_t offset)
+{
+    if (ret == 0)
+    {
+        return mfrERR_NONE;
+    }
+    if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL)
+    {
+        return mfrERR_OPERATION_NOT_SUPPORTED;
+    }
+    printf("discard of %s failed at %llu: %s %s:%d \n", target->path, (unsigned long long)offset,
+           strerror(errno), __FUNCTION__, __LINE__);
+    return mfrERR_GENERAL;
+}
+
+/* Zeroes by writing them, for the media that cannot zero a range itself */
+static mfrError_t backendWriteZeros(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    static const uint8_t zeros[65536];
+    mfrError_t ret = mfrERR_NONE;
+
+    while (len && ret == mfrERR_NONE)
+    {
+        size_t n = len < sizeof(zeros) ? (size_t)len : sizeof(zeros);
+        ret = target->ops->write(target, zeros, n, offset);
+        offset += n;
+        len -= n;
+    }
+    return ret;
+}
+
+static void backendClose(fw_Target_t *target)
+{
+    close(target->fd);
+}
+
+/*
+ * mmc: block devices. The geometry comes from the block layer, the
+ * erase size from the mmc core; a partition has neither in its own
+ * sysfs directory and takes them from its disk.
+ */
+
+static uint32_t blockSysfs(fw_Target_t *target, const char *attr)
+{
+    struct stat st;
+    char path[128];
+    unsigned long long value = 0;
+    FILE *fp;
+
+    if (fstat(target->fd, &st) < 0)
+    {
+        return 0;
+    }
+    snprintf(path, sizeof(path), FW_SYSFS_BLOCK "/%u:%u/%s", major(st.st_rdev), minor(st.st_rdev), attr);
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        snprintf(path, sizeof(path), FW_SYSFS_BLOCK "/%u:%u/../%s", major(st.st_rdev), minor(st.st_rdev), attr);
+        fp = fopen(path, "r");
+    }
+    if (!fp)
+    {
+        return 0;
+    }
+    if (fscanf(fp, "%llu", &value) != 1)
+    {
+        value = 0;
+    }
+    fclose(fp);
+    return value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+}
+
+static mfrError_t blockOpen(fw_Target_t *target, const char *path, int writable)
+{
+    target->fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (target->fd < 0)
+    {
+        printf("failed to open %s: %s %s:%d \n", path, strerror(errno), __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    target->isBlockDevice = 1;
+    if (ioctl(target->fd, BLKGETSIZE64, &target->size) < 0)
+    {
+        printf("failed to get size of %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t blockDiscard(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    uint64_t range[2] = { target->base + offset, len };
+
+    return backendDiscardResult(target, ioctl(target->fd, BLKDISCARD, range), offset);
+}
+
+/* The block layer zeroes by the cheapest means the device has, writing the zeros at worst */
+static mfrError_t blockZero(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    uint64_t range[2] = { target->base + offset, len };
+    mfrError_t ret = backendDiscardResult(target, ioctl(target->fd, BLKZEROOUT, range), offset);
+
+    return ret == mfrERR_OPERATION_NOT_SUPPORTED ? backendWriteZeros(target, offset, len) : ret;
+}
+
+static void blockGeometry(fw_Target_t *target, fw_Geometry_t *geometry)
+{
+    int logical = 0;
+    unsigned int physical = 0;
+    unsigned int optimal = 0;
+
+    geometry->logicalBlockSize = ioctl(target->fd, BLKSSZGET, &logical) == 0 && logical > 0 ?
+                                 (uint32_t)logical : FW_FILE_BLOCK_SIZE;
+    geometry->physicalBlockSize = ioctl(target->fd, BLKPBSZGET, &physical) == 0 && physical ?
+                                  physical : geometry->logicalBlockSize;
+    geometry->optimalIoSize = ioctl(target->fd, BLKIOOPT, &optimal) == 0 ? optimal : 0;
+    geometry->discardGranularity = blockSysfs(target, "queue/discard_max_bytes") ?
+                                   blockSysfs(target, "queue/discard_granularity") : 0;
+    geometry->eraseSize = blockSysfs(target, "device/preferred_erase_size");
+}
+
+static const fw_BackendOps_t g_mmcOps = {
+    "mmc", blockOpen, backendRead, backendWrite, blockDiscard, blockZero, backendFlush, blockGeometry, backendClose,
+};
+
+/*
+ * loop: a disk image attached to a free loop device. The target then
+ * is the loop device, writes to the image go through the block layer
+ * and, when the kernel can, around the page cache of the image.
+ */
+
+static int loopAttach(int fd, int file, const char *path, int writable)
+{
+    struct loop_info64 info;
+
+    memset(&info, 0, sizeof(info));
+    snprintf((char *)info.lo_file_name, sizeof(info.lo_file_name), "%s", path);
+    info.lo_flags = LO_FLAGS_AUTOCLEAR;
+#ifdef LOOP_CONFIGURE
+    struct loop_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.fd = (uint32_t)file;
+    config.info = info;
+    config.info.lo_flags |= LO_FLAGS_DIRECT_IO | (writable ? 0 : LO_FLAGS_READ_ONLY);
+    if (ioctl(fd, LOOP_CONFIGURE, &config) == 0)
+    {
+        return 0;
+    }
+    // kernels before 5.8, or an image on a filesystem without O_DIRECT
+    if (errno != EINVAL && errno != ENOTTY)
+    {
+        return -1;
+    }
+#endif
+    (void)writable;
+    if (ioctl(fd, LOOP_SET_FD, file) < 0)
+    {
+        return -1;
+    }
+    if (ioctl(fd, LOOP_SET_STATUS64, &info) < 0)
+    {
+        int saved = errno;
+        ioctl(fd, LOOP_CLR_FD, 0);
+        errno = saved;
+        return -1;
+    }
+    ioctl(fd, LOOP_SET_DIRECT_IO, 1);
+    return 0;
+}
+
+static mfrError_t loopOpen(fw_Target_t *target, const char *path, int writable)
+{
+    int flags = (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+    int file = open(path, flags);
+    int control = file < 0 ? -1 : open(FW_LOOP_CONTROL, O_RDWR | O_CLOEXEC);
+    mfrError_t ret = mfrERR_GENERAL;
+    int attempt;
+
+    if (file < 0 || control < 0)
+    {
+        printf("failed to open %s: %s %s:%d \n", file < 0 ? path : FW_LOOP_CONTROL, strerror(errno),
+               __FUNCTION__, __LINE__);
+    }
+    for (attempt = 0; control >= 0 && attempt < FW_LOOP_ATTEMPTS; attempt++)
+    {
+        int index = ioctl(control, LOOP_CTL_GET_FREE);
+        if (index < 0)
+        {
+            break;
+        }
+        snprintf(target->node, sizeof(target->node), "/dev/loop%d", index);
+        target->fd = open(target->node, flags);
+        if (target->fd < 0)
+        {
+            break;
+        }
+        if (loopAttach(target->fd, file, path, writable) == 0)
+        {
+            ret = mfrERR_NONE;
+            break;
+        }
+        close(target->fd);
+        target->fd = -1;
+        if (errno != EBUSY)
+        {
+            break;
+        }
+    }
+    if (control >= 0 && ret != mfrERR_NONE)
+    {
+        printf("failed to attach %s to a loop device: %s %s:%d \n", path, strerror(errno), __FUNCTION__, __LINE__);
+    }
+    if (control >= 0)
+    {
+        close(control);
+    }
+    if (file >= 0)
+    {
+        close(file);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    printf("%s attached to %s\n", path, target->node);
+    target->path = target->node;
+    target->isBlockDevice = 1;
+    if (ioctl(target->fd, BLKGETSIZE64, &target->size) < 0)
+    {
+        printf("failed to get size of %s %s:%d \n", target->node, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+static const fw_BackendOps_t g_loopOps = {
+    "loop", loopOpen, backendRead, backendWrite, blockDiscard, blockZero, backendFlush, blockGeometry, backendClose,
+};
+
+/*
+ * file: regular files standing in for partitions, throttled by the
+ * device model of the backend when it has one.
+ */
+
+static mfrError_t fileOpen(fw_Target_t *target, const char *path, int writable)
+{
+    struct stat st;
+
+    target->fd = open(path, (writable ? (O_RDWR | O_CREAT) : O_RDONLY) | O_CLOEXEC, 0644);
+    if (target->fd < 0)
+    {
+        printf("failed to open %s: %s %s:%d \n", path, strerror(errno), __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    if (fstat(target->fd, &st) < 0)
+    {
+        return mfrERR_GENERAL;
+    }
+    target->size = (uint64_t)st.st_size;
+    target->model = target->backend && target->backend->modeled ? &target->backend->model : NULL;
+    return mfrERR_NONE;
+}
+
+static mfrError_t fileRead(fw_Target_t *target, void *buf, size_t len, uint64_t offset)
+{
+    uint64_t deadline = target->model ? fwModelSchedule(target->model, len, 0) : 0;
+    mfrError_t ret = backendRead(target, buf, len, offset);
+
+    fwModelWait(deadline);
+    return ret;
+}
+
+static mfrError_t fileWrite(fw_Target_t *target, const void *buf, size_t len, uint64_t offset)
+{
+    uint64_t deadline = target->model ? fwModelSchedule(target->model, len, 1) : 0;
+    mfrError_t ret = backendWrite(target, buf, len, offset);
+
+    fwModelWait(deadline);
+    return ret;
+}
+
+static mfrError_t fileDiscard(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    uint64_t deadline = target->model ? fwModelSchedule(target->model, 0, 1) : 0;
+    int ret = fallocate(target->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)(target->base + offset),
+                        (off_t)len);
+
+    fwModelWait(deadline);
+    return backendDiscardResult(target, ret, offset);
+}
+
+/* A hole reads back as zeros */
+static mfrError_t fileZero(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    mfrError_t ret = fileDiscard(target, offset, len);
+
+    return ret == mfrERR_OPERATION_NOT_SUPPORTED ? backendWriteZeros(target, offset, len) : ret;
+}
+
+static mfrError_t fileFlush(fw_Target_t *target)
+{
+    mfrError_t ret = backendFlush(target);
+
+    fwModelWait(target->model ? fwModelScheduleFlush(target->model) : 0);
+    return ret;
+}
+
+/* Holes are punched by filesystem block */
+static void fileGeometry(fw_Target_t *target, fw_Geometry_t *geometry)
+{
+    struct stat st;
+    uint32_t block = fstat(target->fd, &st) == 0 && st.st_blksize > 0 ? (uint32_t)st.st_blksize : 4096;
+
+    geometry->logicalBlockSize = FW_FILE_BLOCK_SIZE;
+    geometry->physicalBlockSize = block;
+    geometry->optimalIoSize = 0;
+    geometry->discardGranularity = block;
+    geometry->eraseSize = 0;
+}
+
+static const fw_BackendOps_t g_fileOps = {
+    "file", fileOpen, fileRead, fileWrite, fileDiscard, fileZero, fileFlush, fileGeometry, backendClose,
+};
+
+/********************************************************************
+   Functiona Name: fwBackendInit
+   Description   : picks the backend of a flash and sets up its device
+                   model from the configuration
+   Input:    config
+   Output:   backend
+   Returns:  mfrERR_NONE, mfrERR_INVALID_PARAM for an unknown backend
+
+*********************************************************************/
+
+mfrError_t fwBackendInit(fw_Backend_t *backend, const mfrFWUpgradeConfig_t *config)
+{
+    fw_DeviceModel_t *model = &backend->model;
+
+    memset(backend, 0, sizeof(*backend));
+    pthread_mutex_init(&model->lock, NULL);
+    if (config->blockBackend > mfrBLOCK_BACKEND_FILE)
+    {
+        printf("unknown block backend %d %s:%d \n", (int)config->blockBackend, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    backend->type = config->blockBackend;
+    model->latencyNs = config->modelLatencyUs * 1000ull;
+    model->readBytesPerSec = config->modelReadKBps * 1024ull;
+    model->writeBytesPerSec = config->modelWriteKBps * 1024ull;
+    model->flushNs = config->modelFlushUs * 1000ull;
+    backend->modeled = model->latencyNs || model->readBytesPerSec || model->writeBytesPerSec || model->flushNs;
+    if (backend->modeled)
+    {
+        printf("device model of the files: %u us per request, read %u KB/s, write %u KB/s, sync %u us\n",
+               config->modelLatencyUs, config->modelReadKBps, config->modelWriteKBps, config->modelFlushUs);
+    }
+    return mfrERR_NONE;
+}
+
+void fwBackendRelease(fw_Backend_t *backend)
+{
+    pthread_mutex_destroy(&backend->model.lock);
+}
+
+const fw_BackendOps_t *fwBackendOps(const fw_Backend_t *backend, const char *path)
+{
+    mfrBlockBackend_t type = backend ? backend->type : mfrBLOCK_BACKEND_AUTO;
+    struct stat st;
+    int block = stat(path, &st) == 0 && S_ISBLK(st.st_mode);
+
+    switch (type)
+    {
+    case mfrBLOCK_BACKEND_MMC:
+        if (block)
+        {
+            return &g_mmcOps;
+        }
+        break;
+    case mfrBLOCK_BACKEND_LOOP:
+        return block ? &g_mmcOps : &g_loopOps;
+    case mfrBLOCK_BACKEND_FILE:
+        if (!block)
+        {
+            return &g_fileOps;
+        }
+        break;
+    default:
+        return block ? &g_mmcOps : &g_fileOps;
+    }
+    printf("%s is %sa block device, out of reach of the %s backend %s:%d \n", path, block ? "" : "not ",
+           backendName(type), __FUNCTION__, __LINE__);
+    return NULL;
+}
+
+/********************************************************************
+   Functiona Name: fwModelSchedule
+   Description   : books the channel of the device for a transfer.
+                   It starts once the transfers booked before are
+                   through and is over a request latency after its
+                   last byte, so requests in flight hide each other's
+                   latency but not their bandwidth.
+   Input:    model, len, write - which bandwidth applies
+   Output:   None
+   Returns:  deadline on the fwNowNs clock
+
+*********************************************************************/
+
+uint64_t fwModelSchedule(fw_DeviceModel_t *model, uint64_t len, int write)
+{
+    uint64_t rate = write ? model->writeBytesPerSec : model->readBytesPerSec;
+    uint64_t now = fwNowNs();
+    uint64_t end;
+
+    pthread_mutex_lock(&model->lock);
+    end = model->busyUntilNs > now ? model->busyUntilNs : now;
+    end += rate ? (uint64_t)((double)len * 1e9 / (double)rate) : 0;
+    model->busyUntilNs = end;
+    pthread_mutex_unlock(&model->lock);
+    return end + model->latencyNs;
+}
+
+/* A sync takes the channel once everything booked is through */
+uint64_t fwModelScheduleFlush(fw_DeviceModel_t *model)
+{
+    uint64_t now = fwNowNs();
+    uint64_t end;
+
+    pthread_mutex_lock(&model->lock);
+    end = (model->busyUntilNs > now ? model->busyUntilNs : now) + model->flushNs;
+    model->busyUntilNs = end;
+    pthread_mutex_unlock(&model->lock);
+    return end;
+}
+
+void fwModelWait(uint64_t deadlineNs)
+{
+    struct timespec ts;
+
+    if (deadlineNs <= fwNowNs())
+    {
+        return;
+    }
+    ts.tv_sec = (time_t)(deadlineNs / 1000000000ull);
+    ts.tv_nsec = (long)(deadlineNs % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+        continue;
+    }
+}
@@ -0,0 +1,83 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Block backends. Every target is reached through the operations of
+  one backend: mmc for the block devices of the box, loop for disk
+  images attached to loop devices, and file for plain files. The file
+  backend can be throttled by a device model, a request latency that
+  overlaps between the requests in flight and a transfer bandwidth
+  shared by all the targets of the device, so queue depth, block size
+  and direct I/O can be measured on any machine.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <mfrApi.h>
+
+struct fw_Target;
+
+typedef struct fw_Geometry {
+    uint32_t logicalBlockSize;      /* smallest unit the media addresses */
+    uint32_t physicalBlockSize;     /* smallest unit it writes without read-modify-write */
+    uint32_t optimalIoSize;         /* 0 when the media does not say */
+    uint32_t discardGranularity;    /* 0 when the media cannot discard */
+    uint32_t eraseSize;             /* mmc: preferred erase size, 0 when unknown */
+} fw_Geometry_t;
+
+/* Every backend leaves a descriptor in target->fd that pread/pwrite/fsync
+   work on, see fw_target.h: the writer uses it instead of write */
+typedef struct fw_BackendOps {
+    const char *name;
+    mfrError_t (*open)(struct fw_Target *target, const char *path, int writable);
+    mfrError_t (*read)(struct fw_Target *target, void *buf, size_t len, uint64_t offset);
+    mfrError_t (*write)(struct fw_Target *target, const void *buf, size_t len, uint64_t offset);
+    mfrError_t (*discard)(struct fw_Target *target, uint64_t offset, uint64_t len);
+    mfrError_t (*zero)(struct fw_Target *target, uint64_t offset, uint64_t len);
+    mfrError_t (*flush)(struct fw_Target *target);
+    void (*geometry)(struct fw_Target *target, fw_Geometry_t *geometry);
+    void (*close)(struct fw_Target *target);
+} fw_BackendOps_t;
+
+/* Transfers queue up on one channel, their latencies overlap */
+typedef struct fw_DeviceModel {
+    uint64_t latencyNs;
+    uint64_t readBytesPerSec;       /* 0 for unlimited */
+    uint64_t writeBytesPerSec;
+    uint64_t flushNs;
+    pthread_mutex_t lock;
+    uint64_t busyUntilNs;           /* the channel is taken until then */
+} fw_DeviceModel_t;
+
+typedef struct fw_Backend {
+    mfrBlockBackend_t type;
+    int modeled;                    /* file targets go through the model */
+    fw_DeviceModel_t model;
+} fw_Backend_t;
+
+mfrError_t fwBackendInit(fw_Backend_t *backend, const mfrFWUpgradeConfig_t *config);
+void fwBackendRelease(fw_Backend_t *backend);
+/* Operations for path, NULL backend for the defaults, NULL when the backend does not take it */
+const fw_BackendOps_t *fwBackendOps(const fw_Backend_t *backend, const char *path);
+/* When a transfer of len bytes starting now is over, according to the model */
+uint64_t fwModelSchedule(fw_DeviceModel_t *model, uint64_t len, int write);
+uint64_t fwModelScheduleFlush(fw_DeviceModel_t *model);
+void fwModelWait(uint64_t deadlineNs);
@@ -0,0 +1,293 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  The disk stamp leaves out the modification time, which every flash
+  of a disk image file moves. A partition table rewritten by
+  memory_partition.sh shows in the partition count the kernel reports
+  for a block device and in the CRC of the primary table area (MBR,
+  GPT header and entries) for both.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "string.h"
+#include "fw_device.h"
+#include "fw_hash.h"
+#include "fw_pipeline.h"
+#include "fw_target.h"
+
+#define FW_DEVICE_HEAD_SIZE     (34 * FW_PART_SECTOR_SIZE)    /* MBR, GPT header and 128 entries */
+#define FW_CMDLINE_MAX          4096
+
+/* Locates the value of the root= argument, returns its length */
+size_t fwCmdlineFindRoot(const char *cmdline, const char **value)
+{
+    const char *p = cmdline;
+
+    while ((p = strstr(p, "root=")) != NULL)
+    {
+        if (p == cmdline || p[-1] == ' ' || p[-1] == '\t')
+        {
+            *value = p + 5;
+            return strcspn(*value, " \t\r\n");
+        }
+        p += 5;
+    }
+    return 0;
+}
+
+/* Size in sectors and number of partitions of a block device, as sysfs has them */
+static int deviceSysfsStamp(const struct stat *st, fw_DeviceStamp_t *stamp)
+{
+    char path[96];
+    char value[32];
+    struct dirent *entry;
+    DIR *dir;
+    int fd;
+    ssize_t len;
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/size", major(st->st_rdev), minor(st->st_rdev));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    len = read(fd, value, sizeof(value) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return -1;
+    }
+    value[len] = '\0';
+    stamp->size = strtoull(value, NULL, 10);
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(st->st_rdev), minor(st->st_rdev));
+    dir = opendir(path);
+    if (!dir)
+    {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char partition[sizeof(path) + 2 * sizeof(entry->d_name)];
+
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(partition, sizeof(partition), "%s/%s/partition", path, entry->d_name);
+        if (access(partition, F_OK) == 0)
+        {
+            stamp->partitions++;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+/* CRC32C of the primary partition table area */
+static mfrError_t deviceHeadCrc(const char *path, fw_DeviceStamp_t *stamp)
+{
+    uint8_t head[FW_DEVICE_HEAD_SIZE];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t len;
+
+    if (fd < 0)
+    {
+        printf("failed to open %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    len = pread(fd, head, sizeof(head), 0);
+    close(fd);
+    if (len < 0)
+    {
+        printf("failed to read %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    stamp->headCrc = fwCrc32c(0, head, (size_t)len);
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: deviceStamp
+   Description   : takes the stamp of a disk or of the command line.
+                   Files are told apart by their modification time,
+                   disks by their size and partition table.
+   Input:    path, disk - path is the disk holding the banks
+   Output:   stamp
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+static mfrError_t deviceStamp(const char *path, int disk, fw_DeviceStamp_t *stamp)
+{
+    struct stat st;
+
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(path, &st) < 0)
+    {
+        printf("failed to stat %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    stamp->dev = (uint64_t)st.st_dev;
+    stamp->ino = (uint64_t)st.st_ino;
+    if (!disk)
+    {
+        stamp->size = (uint64_t)st.st_size;
+        stamp->mtimeNs = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+        return mfrERR_NONE;
+    }
+    if (S_ISBLK(st.st_mode))
+    {
+        stamp->dev = (uint64_t)st.st_rdev;
+        if (deviceSysfsStamp(&st, stamp) < 0)
+        {
+            stamp->size = 0;
+            stamp->partitions = 0;
+        }
+    }
+    else
+    {
+        stamp->size = (uint64_t)st.st_size;
+    }
+    return deviceHeadCrc(path, stamp);
+}
+
+/* Reads the active root from the command line, the other bank is the one to upgrade */
+static mfrError_t deviceReadBank(fw_Device_t *device, const mfrFWUpgradeConfig_t *config)
+{
+    char cmdline[FW_CMDLINE_MAX];
+    const char *root = NULL;
+    const char *bank1 = config->bankRootName[1];
+    FILE *fp = fopen(config->cmdlinePath, "r");
+    size_t len;
+    size_t rootLen;
+
+    if (!fp)
+    {
+        printf("failed to open %s %s:%d \n", config->cmdlinePath, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    len = fread(cmdline, 1, sizeof(cmdline) - 1, fp);
+    fclose(fp);
+    cmdline[len] = '\0';
+
+    rootLen = fwCmdlineFindRoot(cmdline, &root);
+    if (rootLen >= sizeof(device->activeRoot))
+    {
+        rootLen = sizeof(device->activeRoot) - 1;
+    }
+    memcpy(device->activeRoot, root ? root : "", rootLen);
+    device->activeRoot[rootLen] = '\0';
+    // bank 1 is written unless bank 1 is live
+    device->passive = rootLen && !strcmp(device->activeRoot, bank1) ? 0 : 1;
+    return mfrERR_NONE;
+}
+
+/* Locates the partitions in the table of the whole disk */
+static mfrError_t deviceReadLayout(fw_Device_t *device, const mfrFWUpgradeConfig_t *config)
+{
+    fw_Target_t disk = { .fd = -1 };
+    fw_PartTable_t table;
+    mfrError_t ret = fwTargetOpen(&disk, NULL, config->diskDevice, 0);
+
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwPartRead(&table, &disk);
+    }
+    fwTargetClose(&disk);
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwPartLayout(&table, config, &device->layout);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwDeviceProbe
+   Description   : finds the bank to upgrade and, when the banks are
+                   addressed through the whole disk, their layout. The
+                   result of the last probe is kept as long as the
+                   stamps of the disk and the command line match.
+   Input:    device, config - defaults filled in
+   Output:   device
+   Returns:  mfrERR_NONE on success. A disk without the expected
+             partitions is no error here, see device->layoutError.
+
+*********************************************************************/
+
+mfrError_t fwDeviceProbe(fw_Device_t *device, const mfrFWUpgradeConfig_t *config)
+{
+    fw_DeviceStamp_t disk;
+    fw_DeviceStamp_t cmdline;
+    uint64_t start = fwNowNs();
+    mfrError_t ret;
+
+    memset(&disk, 0, sizeof(disk));
+    ret = deviceStamp(config->cmdlinePath, 0, &cmdline);
+    if (ret == mfrERR_NONE && config->diskDevice[0])
+    {
+        ret = deviceStamp(config->diskDevice, 1, &disk);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        fwDeviceInvalidate(device);
+        return ret;
+    }
+    if (device->valid && !memcmp(&cmdline, &device->cmdline, sizeof(cmdline)) &&
+        !memcmp(&disk, &device->disk, sizeof(disk)))
+    {
+        return mfrERR_NONE;
+    }
+
+    device->valid = 0;
+    device->layoutError = mfrERR_NONE;
+    memset(&device->layout, 0, sizeof(device->layout));
+    ret = deviceReadBank(device, config);
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    if (config->diskDevice[0])
+    {
+        device->layoutError = deviceReadLayout(device, config);
+        if (device->layoutError != mfrERR_NONE)
+        {
+            printf("failed to locate the banks on %s %s:%d \n", config->diskDevice, __FUNCTION__, __LINE__);
+        }
+    }
+    device->disk = disk;
+    device->cmdline = cmdline;
+    device->valid = 1;
+    device->probes++;
+    printf("probed %s in %llu us, active root %s\n", config->diskDevice[0] ? config->diskDevice : config->cmdlinePath,
+           (unsigned long long)((fwNowNs() - start) / 1000), device->activeRoot[0] ? device->activeRoot : "unknown");
+    return mfrERR_NONE;
+}
+
+/* Forces the next fwDeviceProbe to read the device again */
+void fwDeviceInvalidate(fw_Device_t *device)
+{
+    device->valid = 0;
+}
@@ -0,0 +1,59 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Device probe. The active bank, taken from the kernel command line,
+  and the partition layout of the disk are probed once and kept. Later
+  upgrades only compare cheap stamps of the disk and the command line
+  (sysfs size and partition count of a block device, the partition
+  table area of a disk image file) and probe again when they changed.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_partition.h"
+
+#define FW_DEVICE_ROOT_MAX      256
+
+typedef struct fw_DeviceStamp {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtimeNs;
+    uint32_t partitions;        /* block device: partitions known to the kernel */
+    uint32_t headCrc;           /* disk image file: CRC32C of its partition table area */
+} fw_DeviceStamp_t;
+
+typedef struct fw_Device {
+    int valid;
+    fw_DeviceStamp_t disk;
+    fw_DeviceStamp_t cmdline;
+    char activeRoot[FW_DEVICE_ROOT_MAX];    /* root= the kernel was booted with */
+    int passive;                /* bank to upgrade */
+    mfrError_t layoutError;     /* locating the partitions on the disk failed */
+    fw_Layout_t layout;
+    uint64_t probes;
+} fw_Device_t;
+
+mfrError_t fwDeviceProbe(fw_Device_t *device, const mfrFWUpgradeConfig_t *config);
+void fwDeviceInvalidate(fw_Device_t *device);
+/* Locates the value of the root= argument, returns its length */
+size_t fwCmdlineFindRoot(const char *cmdline, const char **value);
@@ -0,0 +1,2316 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  The rootfs partition of the sdimg goes straight to the passive bank.
+  The boot partition is shared by both banks, so it is staged in the
+  storage area and only copied over the live one once the rootfs has
+  been written completely, with cmdline.txt pointing at the new bank.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "string.h"
+#include "fw_engine.h"
+#include "fw_arena.h"
+#include "fw_device.h"
+#include "fw_fat.h"
+#include "fw_hash.h"
+#include "fw_journal.h"
+#include "fw_manifest.h"
+#include "fw_partition.h"
+#include "fw_pipeline.h"
+#include "fw_sparse.h"
+#include "fw_tar.h"
+#include "fw_target.h"
+#include "fw_throttle.h"
+#include "fw_trace.h"
+#include "fw_verify.h"
+#include "fw_verity.h"
+#include "fw_writer.h"
+
+#define FW_ENGINE_READ_SIZE     (256 * 1024)
+#define FW_ENGINE_BLOCK_SIZE    (1024 * 1024)
+#define FW_ENGINE_QUEUE_DEPTH   4
+#define FW_ENGINE_MAX_DEPTH     256
+#define FW_ENGINE_WRITE_DEPTH   4
+#define FW_INFLATE_SIZE         (256 * 1024)
+#define FW_BUDGET_RESERVE       (512 * 1024)        /* checksums and inflate state of a flash */
+#define FW_BUDGET_MIN_BLOCK     (64 * 1024)
+#define FW_BUDGET_MIN_READ      (16 * 1024)
+#define FW_BUDGET_DROP_SIZE     (8 * 1024 * 1024)   /* package read between two page cache drops */
+#define FW_RESIDENT_SAMPLE      16                  /* blocks written between two samples of the RSS */
+#define FW_IO_ALIGN             4096
+#define FW_SDIMG_HEAD_MAX       (34 * FW_PART_SECTOR_SIZE)  /* MBR, or GPT with 128 entries */
+#define FW_CMDLINE_MAX          4096
+#define FW_BOOT_STAGING_FILE    "boot.img"
+#define FW_BOOT_MANIFEST_FILE   "boot.manifest"
+#define FW_BOOT_BACKUP_DIR      "data_bkup_linux_bank%d"
+#define FW_DELTA_CHUNK_SIZE     (64 * 1024)
+#define FW_BMAP_MAX             (16 * 1024 * 1024)
+#define FW_VERIFY_THREADS       4
+#define FW_DIGEST_SUFFIX        ".sha256"
+#define FW_STREAM_POLL_MS       100                 /* a cancelled flash stops waiting on a stream this fast */
+#define FW_JOURNAL_FILE         "upgrade.journal"
+#define FW_JOURNAL_INTERVAL     (64 * 1024 * 1024)  /* rootfs written between two syncs of the bank and the journal */
+#define FW_JOURNAL_HEAD_SIZE    (1024 * 1024)       /* stands in for the digest of a package without one */
+#define FW_TREE_FILE            "rootfs%d.verity"
+#define FW_TREE_ROOT_FILE       "rootfs%d.roothash"
+
+enum {
+    ROUTE_BOOT = 0,
+    ROUTE_ROOTFS,
+    ROUTE_COUNT,
+};
+
+/* Package members the engine reads */
+enum {
+    ENTRY_OTHER = 0,
+    ENTRY_SDIMG,
+    ENTRY_BMAP,
+};
+
+typedef struct fw_Route {
+    const char *label;
+    fw_Target_t *target;
+    uint64_t imageStart;            /* offset of the partition inside the sdimg */
+    uint64_t length;
+    uint64_t done;
+    fw_Block_t *block;              /* block being assembled */
+    int file;                       /* writer file of the target */
+} fw_Route_t;
+
+typedef struct fw_Engine {
+    const mfrFWUpgradeConfig_t *config;
+    fw_EngineStats_t *stats;
+    pthread_mutex_t errorLock;
+    mfrError_t error;
+    _Atomic int abort;
+    int fd;
+    int verifyOnly;                 /* walk the package without touching any target */
+    const mfrImageSource_t *source; /* streamed package, NULL for a package file */
+    fw_Sha256_t digest;             /* reader: digest of the package */
+    uint8_t expected[FW_SHA256_SIZE];
+    int haveExpected;
+    int passive;
+    int useLayout;                  /* partitions addressed as ranges of the disk */
+    fw_Layout_t layout;
+    fw_Backend_t backend;           /* how the partitions are reached */
+    fw_Target_t staging;
+    fw_Target_t rootfs;
+    char stagingPath[PATH_MAX];
+    int workDirMounted;
+    int sdimgSeen;
+    uint64_t sdimgSize;
+    int entry;                      /* member being read */
+    char *bmap;                     /* sparse mode: bmap of the sdimg, NUL terminated */
+    size_t bmapLen;
+    fw_Sparse_t sparse;             /* sparse mode: data of the rootfs, hasher only */
+    uint64_t *unwritten;            /* sparse mode: rootfs granules left alone */
+    int discardFailed;
+    fw_Journal_t journal;           /* resume mode: how much of the bank is on the media */
+    int buildTree;                  /* hash tree mode, unless there is a memory budget */
+    fw_Verity_t tree;               /* hash tree of the rootfs being written */
+    fw_Verity_t baseTree;           /* hash tree and delta mode: what the passive bank holds */
+    uint8_t head[FW_SDIMG_HEAD_MAX];  /* partition table of the sdimg */
+    size_t headLen;
+    int layoutReady;
+    fw_Route_t route[ROUTE_COUNT];
+    uint32_t *crc[ROUTE_COUNT];     /* hasher: CRC32C of every block, for the readback */
+    fw_EngineJob_t *job;            /* NULL when not run by the job manager */
+    fw_Throttle_t *throttle;        /* the job's background mode limits, NULL at full speed */
+    /* pipeline: reader -> decompressor -> hasher -> writer */
+    fw_EngineBuffers_t *buffers;    /* the job's, or ownBuffers */
+    fw_EngineBuffers_t ownBuffers;
+    uint32_t outCount;              /* queueDepth, plus the blocks the writer keeps in flight */
+    fw_Writer_t *writer;            /* the buffers' writer, NULL when verifying */
+} fw_Engine_t;
+
+static size_t engineInflateSize(const mfrFWUpgradeConfig_t *config)
+{
+    return config->memoryBudgetKB && config->blockSize < FW_INFLATE_SIZE ? config->blockSize : FW_INFLATE_SIZE;
+}
+
+/* Bytes a flash takes from the memory budget: the blocks, with room for alignment, rings and writer, and the reserve */
+static uint64_t engineFootprint(const mfrFWUpgradeConfig_t *config, int writes)
+{
+    uint64_t outCount = config->queueDepth + (writes ? config->writeDepth : 0);
+    uint64_t dirtyWords = (config->blockSize / FW_IO_ALIGN + 63) / 64;
+    uint64_t bytes = config->queueDepth * ((uint64_t)config->readSize + sizeof(fw_Block_t)) +
+                     outCount * ((uint64_t)config->blockSize + sizeof(fw_Block_t) + dirtyWords * sizeof(uint64_t)) +
+                     engineInflateSize(config) + (config->deltaMode ? config->blockSize : 0);
+
+    bytes += (2 * fwRingSize(config->queueDepth + 1) + 3 * fwRingSize(outCount + 1)) * sizeof(fw_Block_t *);
+    bytes += writes ? fwWriterSize(config->writeDepth) : 0;
+    return bytes + (config->queueDepth + outCount + 8) * FW_WRITER_ALIGN + FW_BUDGET_RESERVE;
+}
+
+/* Scales the pipeline down until it fits the memory budget: the blocks in flight go first, then their size */
+static void engineFitBudget(mfrFWUpgradeConfig_t *config)
+{
+    uint64_t budget = (uint64_t)config->memoryBudgetKB * 1024;
+
+    // every unpack thread holds back the output of a whole segment
+    config->unpackThreads = 1;
+    while (engineFootprint(config, 1) > budget)
+    {
+        if (config->writeDepth > 2)
+        {
+            config->writeDepth--;
+        }
+        else if (config->queueDepth > 2)
+        {
+            config->queueDepth--;
+        }
+        else if (config->blockSize > FW_BUDGET_MIN_BLOCK)
+        {
+            config->blockSize = config->blockSize / 2 / FW_IO_ALIGN * FW_IO_ALIGN;
+            config->blockSize = config->blockSize < FW_BUDGET_MIN_BLOCK ? FW_BUDGET_MIN_BLOCK : config->blockSize;
+        }
+        else if (config->readSize > FW_BUDGET_MIN_READ)
+        {
+            config->readSize = config->readSize / 2 < FW_BUDGET_MIN_READ ? FW_BUDGET_MIN_READ : config->readSize / 2;
+        }
+        else if (config->writeDepth > 1)
+        {
+            config->writeDepth--;
+        }
+        else if (config->queueDepth > 1)
+        {
+            config->queueDepth--;
+        }
+        else
+        {
+            // the flash refuses to start
+            break;
+        }
+    }
+}
+
+void fwEngineDefaults(const mfrFWUpgradeConfig_t *in, mfrFWUpgradeConfig_t *out)
+{
+    if (in)
+    {
+        *out = *in;
+    }
+    else
+    {
+        memset(out, 0, sizeof(*out));
+    }
+    out->bootDevice = out->bootDevice ? out->bootDevice : "/dev/mmcblk0p1";
+    out->bankDevice[0] = out->bankDevice[0] ? out->bankDevice[0] : "/dev/mmcblk0p2";
+    out->bankDevice[1] = out->bankDevice[1] ? out->bankDevice[1] : "/dev/mmcblk0p3";
+    out->bankRootName[0] = out->bankRootName[0] ? out->bankRootName[0] : out->bankDevice[0];
+    out->bankRootName[1] = out->bankRootName[1] ? out->bankRootName[1] : out->bankDevice[1];
+    out->storageDevice = out->storageDevice ? out->storageDevice : "/dev/mmcblk0p4";
+    out->diskDevice = out->diskDevice ? out->diskDevice : "/dev/mmcblk0";
+    out->workDir = out->workDir ? out->workDir : "/imageblk";
+    out->cmdlinePath = out->cmdlinePath ? out->cmdlinePath : "/proc/cmdline";
+    out->tracePath = out->tracePath ? out->tracePath : FW_TRACE_DEFAULT_PATH;
+    if (!out->blockSize || out->blockSize % FW_IO_ALIGN || out->blockSize > 64 * FW_ENGINE_BLOCK_SIZE)
+    {
+        out->blockSize = FW_ENGINE_BLOCK_SIZE;
+    }
+    if (out->readSize < FW_IO_ALIGN || out->readSize > 64 * FW_ENGINE_BLOCK_SIZE)
+    {
+        out->readSize = FW_ENGINE_READ_SIZE;
+    }
+    if (!out->queueDepth || out->queueDepth > FW_ENGINE_MAX_DEPTH)
+    {
+        out->queueDepth = FW_ENGINE_QUEUE_DEPTH;
+    }
+    if (!out->writeDepth || out->writeDepth > FW_WRITER_MAX_DEPTH)
+    {
+        out->writeDepth = FW_ENGINE_WRITE_DEPTH;
+    }
+    if (!out->verifyThreads)
+    {
+        out->verifyThreads = FW_VERIFY_THREADS;
+    }
+    if (!out->unpackThreads || !out->hashTreeThreads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        unsigned int online = cpus > 0 ? (unsigned int)cpus : 1;
+        out->unpackThreads = out->unpackThreads ? out->unpackThreads : online;
+        out->hashTreeThreads = out->hashTreeThreads ? out->hashTreeThreads : online;
+    }
+    if (out->memoryBudgetKB)
+    {
+        engineFitBudget(out);
+    }
+    if (!out->deltaChunkSize || out->deltaChunkSize > out->blockSize || out->blockSize % out->deltaChunkSize)
+    {
+        out->deltaChunkSize = out->blockSize % FW_DELTA_CHUNK_SIZE ? FW_IO_ALIGN : FW_DELTA_CHUNK_SIZE;
+    }
+}
+
+/* Records the first error and stops every stage of the pipeline */
+static void engineFail(fw_Engine_t *engine, mfrError_t error)
+{
+    pthread_mutex_lock(&engine->errorLock);
+    if (engine->error == mfrERR_NONE)
+    {
+        engine->error = error;
+    }
+    pthread_mutex_unlock(&engine->errorLock);
+    atomic_store(&engine->abort, 1);
+    fwRingWake(&engine->buffers->inFull);
+    fwRingWake(&engine->buffers->inFree);
+    fwRingWake(&engine->buffers->outFull);
+    fwRingWake(&engine->buffers->hashed);
+    fwRingWake(&engine->buffers->outFree);
+    fwThrottleWake(engine->throttle);
+}
+
+/********************************************************************
+   Functiona Name: engineProbeDevice
+   Description   : the bank the kernel was not booted from is the one
+                   to upgrade. The job manager keeps the probe across
+                   flashes, so only the stamps of the device are read
+                   unless it changed.
+   Input:    engine
+   Output:   engine->passive, engine->layout
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+static mfrError_t engineProbeDevice(fw_Engine_t *engine)
+{
+    const mfrFWUpgradeConfig_t *config = engine->config;
+    fw_Device_t local;
+    fw_Device_t *device = engine->job && engine->job->device ? engine->job->device : &local;
+    uint64_t probes = device->probes;
+    mfrError_t ret;
+
+    if (device == &local)
+    {
+        memset(&local, 0, sizeof(local));
+    }
+    ret = fwDeviceProbe(device, config);
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    engine->passive = device->passive;
+    printf("Active bank partition is %s, upgrading %s%s\n", device->activeRoot,
+           config->bankDevice[engine->passive], device->probes == probes ? " (cached)" : "");
+    if (!config->diskDevice[0])
+    {
+        return mfrERR_NONE;
+    }
+    if (device->layoutError != mfrERR_NONE)
+    {
+        return device->layoutError;
+    }
+    // partitions are located in the table of the whole disk, unless they are only addressed by device node
+    engine->layout = device->layout;
+    engine->useLayout = 1;
+    printf("%s: boot at %llu, bank %d at %llu, %llu bytes\n", config->diskDevice,
+           (unsigned long long)engine->layout.boot.start, engine->passive,
+           (unsigned long long)engine->layout.bank[engine->passive].start,
+           (unsigned long long)engine->layout.bank[engine->passive].size);
+    return mfrERR_NONE;
+}
+
+/* Opens a partition as a range of the whole disk when the layout is known, by its node otherwise */
+static mfrError_t engineOpenPartition(fw_Engine_t *engine, fw_Target_t *target, const char *device,
+                                      const fw_Partition_t *part)
+{
+    mfrError_t ret;
+
+    if (engine->useLayout)
+    {
+        ret = fwTargetOpenRange(target, &engine->backend, engine->config->diskDevice, 1, part->start, part->size);
+    }
+    else
+    {
+        ret = fwTargetOpen(target, &engine->backend, device, 1);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        const fw_Geometry_t *geometry = &target->geometry;
+
+        printf("%s: %s backend, %u/%u byte blocks, optimal I/O %u, discard %u, erase %u%s\n", target->path,
+               target->ops->name, geometry->logicalBlockSize, geometry->physicalBlockSize, geometry->optimalIoSize,
+               geometry->discardGranularity, geometry->eraseSize, target->model ? ", device model" : "");
+    }
+    return ret;
+}
+
+static mfrError_t enginePrepareWorkDir(fw_Engine_t *engine)
+{
+    const mfrFWUpgradeConfig_t *config = engine->config;
+    static const char *fsTypes[] = { "ext4", "ext3" };
+    size_t i;
+
+    if (mkdir(config->workDir, 0755) < 0 && errno != EEXIST)
+    {
+        printf("failed to create %s %s:%d \n", config->workDir, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    if (config->storageDevice[0])
+    {
+        for (i = 0; i < sizeof(fsTypes) / sizeof(fsTypes[0]) && !engine->workDirMounted; i++)
+        {
+            if (mount(config->storageDevice, config->workDir, fsTypes[i], MS_NOATIME, NULL) == 0)
+            {
+                engine->workDirMounted = 1;
+            }
+            else if (errno == EBUSY)
+            {
+                // already mounted by a previous upgrade
+                break;
+            }
+        }
+    }
+    snprintf(engine->stagingPath, sizeof(engine->stagingPath), "%s/%s", config->workDir, FW_BOOT_STAGING_FILE);
+    return mfrERR_NONE;
+}
+
+/* Memory of a flash, taken from what the blocks left of the budget in budget mode */
+static void *engineCalloc(fw_Engine_t *engine, size_t count, size_t size)
+{
+    fw_Arena_t *arena = &engine->buffers->arena;
+    void *data;
+
+    if (!arena->base)
+    {
+        return calloc(count, size);
+    }
+    data = count <= SIZE_MAX / size ? fwArenaAlloc(arena, count * size, sizeof(uint64_t)) : NULL;
+    if (!data)
+    {
+        printf("memory budget exhausted, %zu more bytes needed %s:%d \n", count * size, __FUNCTION__, __LINE__);
+    }
+    return data;
+}
+
+static void engineFree(fw_Engine_t *engine, void *data)
+{
+    if (!engine->buffers || !engine->buffers->arena.base)
+    {
+        free(data);
+    }
+}
+
+/* What engineCalloc takes from, for the modules allocating on their own: NULL for the heap */
+static fw_Arena_t *engineArena(fw_Engine_t *engine)
+{
+    return engine->buffers->arena.base ? &engine->buffers->arena : NULL;
+}
+
+/* Sparse mode: the map of the rootfs comes from the bmap if there is a usable one, from its bitmaps otherwise */
+static mfrError_t engineSparseInit(fw_Engine_t *engine)
+{
+    const fw_Route_t *route = &engine->route[ROUTE_ROOTFS];
+    uint64_t granules = (route->length + engine->config->deltaChunkSize - 1) / engine->config->deltaChunkSize;
+
+    if (!(engine->unwritten = (uint64_t *)engineCalloc(engine, (size_t)(granules + 63) / 64 + 1, sizeof(uint64_t))))
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    if (engine->bmap)
+    {
+        mfrError_t ret = fwSparseLoadBmap(&engine->sparse, engineArena(engine), engine->bmap, engine->bmapLen,
+                                          engine->sdimgSize, route->imageStart, route->length);
+        if (ret != mfrERR_INVALID_PARAM)
+        {
+            printf("sparse mode: rootfs blocks in use taken from the bmap\n");
+            return ret;
+        }
+    }
+    printf("sparse mode: rootfs blocks in use taken from its block bitmaps\n");
+    fwSparseInitExt(&engine->sparse, engineArena(engine));
+    return mfrERR_NONE;
+}
+
+/* The first two partitions of the sdimg are the boot partition and the rootfs.
+   Data before routeFrom has already gone by without being routed. */
+static mfrError_t engineParseLayout(fw_Engine_t *engine, uint64_t routeFrom)
+{
+    fw_PartTable_t table;
+    int i;
+
+    if (fwPartParse(&table, engine->head, engine->headLen, FW_PART_SECTOR_SIZE) != mfrERR_NONE)
+    {
+        printf("sdimg has no valid partition table %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_DECRYPTION_FAILED;
+    }
+    if (table.count < ROUTE_COUNT)
+    {
+        printf("sdimg does not hold boot and rootfs partitions %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_DECRYPTION_FAILED;
+    }
+    for (i = 0; i < ROUTE_COUNT; i++)
+    {
+        engine->route[i].imageStart = table.part[i].start;
+        engine->route[i].length = table.part[i].size;
+        if (table.part[i].start < routeFrom)
+        {
+            printf("sdimg partition %d overlaps the partition table %s:%d \n", table.part[i].number,
+                   __FUNCTION__, __LINE__);
+            return mfrERR_DECRYPTION_FAILED;
+        }
+    }
+
+    engine->route[ROUTE_BOOT].label = "boot";
+    engine->route[ROUTE_BOOT].target = &engine->staging;
+    engine->route[ROUTE_ROOTFS].label = "rootfs";
+    engine->route[ROUTE_ROOTFS].target = &engine->rootfs;
+    for (i = 0; i < ROUTE_COUNT; i++)
+    {
+        fw_Route_t *route = &engine->route[i];
+        uint64_t blocks = (route->length + engine->config->blockSize - 1) / engine->config->blockSize;
+        printf("sdimg %s partition at %llu, %llu bytes\n", route->label,
+               (unsigned long long)route->imageStart, (unsigned long long)route->length);
+        if (!(engine->crc[i] = (uint32_t *)engineCalloc(engine, blocks ? blocks : 1, sizeof(uint32_t))))
+        {
+            return mfrERR_MALLOC_FAILED;
+        }
+        if (!engine->verifyOnly && fwTargetReserve(route->target, route->length) != mfrERR_NONE)
+        {
+            return mfrERR_INVALID_PARAM;
+        }
+    }
+    engine->layoutReady = 1;
+    if (engine->journal.active)
+    {
+        const fw_Route_t *rootfs = &engine->route[ROUTE_ROOTFS];
+        uint64_t blocks = (rootfs->length + engine->config->blockSize - 1) / engine->config->blockSize;
+        uint32_t *crc = (uint32_t *)engineCalloc(engine, blocks ? blocks : 1, sizeof(uint32_t));
+        if (!crc)
+        {
+            return mfrERR_MALLOC_FAILED;
+        }
+        uint64_t resumable = fwJournalAttach(&engine->journal, rootfs->length, crc);
+        if (resumable)
+        {
+            printf("resuming: %llu bytes of the rootfs are on %s already\n", (unsigned long long)resumable,
+                   engine->rootfs.path);
+        }
+    }
+    if (engine->buildTree)
+    {
+        // leaves only compare with those of the passive bank under the same salt
+        const uint8_t *salt = engine->baseTree.tree ? engine->baseTree.salt : NULL;
+        unsigned int threads = fwThrottleThreads(engine->throttle, engine->config->hashTreeThreads);
+        if (fwVerityInit(&engine->tree, engine->route[ROUTE_ROOTFS].length, salt, engine->buffers->verityPool, threads,
+                         engineArena(engine)) != mfrERR_NONE)
+        {
+            printf("no hash tree of the rootfs\n");
+        }
+    }
+    return engine->config->sparseMode ? engineSparseInit(engine) : mfrERR_NONE;
+}
+
+/* Copies the part of [offset, offset + len) of the sdimg that belongs to the route */
+static mfrError_t engineRoute(fw_Engine_t *engine, int index, uint64_t offset, const uint8_t *data, size_t len)
+{
+    fw_Route_t *route = &engine->route[index];
+    fw_StageStats_t *stage = &engine->stats->stage[FW_STAGE_DECOMPRESS];
+    uint64_t start = offset > route->imageStart ? offset : route->imageStart;
+    uint64_t end = offset + len;
+    uint64_t routeEnd = route->imageStart + route->length;
+
+    end = end < routeEnd ? end : routeEnd;
+    while (start < end)
+    {
+        fw_Block_t *block = route->block;
+        if (!block)
+        {
+            if (fwRingPop(&engine->buffers->outFree, &block, &stage->stallOutNs) < 0)
+            {
+                return mfrERR_GENERAL;
+            }
+            block->len = 0;
+            block->offset = route->done;
+            block->route = index;
+            route->block = block;
+        }
+        size_t take = block->capacity - block->len;
+        take = (uint64_t)take < end - start ? take : (size_t)(end - start);
+        memcpy(block->data + block->len, data + (start - offset), take);
+        block->len += take;
+        route->done += take;
+        start += take;
+        if (block->len == block->capacity || route->done == route->length)
+        {
+            route->block = NULL;
+            stage->blocks++;
+            stage->bytes += block->len;
+            if (fwRingPush(&engine->buffers->outFull, block, &stage->stallOutNs) < 0)
+            {
+                return mfrERR_GENERAL;
+            }
+        }
+    }
+    return mfrERR_NONE;
+}
+
+static int engineHasSuffix(const char *name, const char *suffix)
+{
+    size_t nameLen = strlen(name);
+    size_t suffixLen = strlen(suffix);
+
+    return nameLen >= suffixLen && !strcmp(name + nameLen - suffixLen, suffix);
+}
+
+static int engineOnEntry(void *ctx, const fw_TarEntry_t *entry)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)ctx;
+
+    engine->entry = ENTRY_OTHER;
+    if (engine->sdimgSeen)
+    {
+        return 0;
+    }
+    if (engine->config->sparseMode && engineHasSuffix(entry->name, FW_BMAP_SUFFIX))
+    {
+        // only useful ahead of the sdimg, and small
+        engineFree(engine, engine->bmap);
+        engine->bmap = NULL;
+        if (entry->size > FW_BMAP_MAX)
+        {
+            printf("ignoring %s, %llu bytes\n", entry->name, (unsigned long long)entry->size);
+            return 0;
+        }
+        if (!(engine->bmap = (char *)engineCalloc(engine, (size_t)entry->size + 1, 1)))
+        {
+            engineFail(engine, mfrERR_MALLOC_FAILED);
+            return -1;
+        }
+        printf("found %s, %llu bytes\n", entry->name, (unsigned long long)entry->size);
+        engine->bmapLen = (size_t)entry->size;
+        engine->entry = ENTRY_BMAP;
+        return 1;
+    }
+    if (!engineHasSuffix(entry->name, FW_SDIMG_SUFFIX))
+    {
+        return 0;
+    }
+    printf("found %s, %llu bytes\n", entry->name, (unsigned long long)entry->size);
+    engine->sdimgSeen = 1;
+    engine->sdimgSize = entry->size;
+    engine->entry = ENTRY_SDIMG;
+    return 1;
+}
+
+static int engineOnData(void *ctx, uint64_t offset, const uint8_t *data, size_t len)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)ctx;
+    mfrError_t ret = mfrERR_NONE;
+    int i;
+
+    if (engine->entry == ENTRY_BMAP)
+    {
+        memcpy(engine->bmap + offset, data, len);
+        return 0;
+    }
+    if (!engine->layoutReady && offset < FW_SDIMG_HEAD_MAX)
+    {
+        size_t take = FW_SDIMG_HEAD_MAX - (size_t)offset;
+        take = take < len ? take : len;
+        memcpy(engine->head + offset, data, take);
+        engine->headLen += take;
+        size_t need = fwPartHeadSize(engine->head, engine->headLen, FW_PART_SECTOR_SIZE);
+        if (need > FW_SDIMG_HEAD_MAX)
+        {
+            printf("sdimg partition table is too large %s:%d \n", __FUNCTION__, __LINE__);
+            ret = mfrERR_DECRYPTION_FAILED;
+        }
+        else if (engine->headLen >= need)
+        {
+            ret = engineParseLayout(engine, offset);
+        }
+    }
+    for (i = 0; i < ROUTE_COUNT && engine->layoutReady && ret == mfrERR_NONE; i++)
+    {
+        ret = engineRoute(engine, i, offset, data, len);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        engineFail(engine, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/* Fills buf from the package, a short count only at its end. A stream fd is polled so a cancellation is seen. */
+static mfrError_t engineReadPackage(fw_Engine_t *engine, uint8_t *buf, size_t len, size_t *got)
+{
+    const mfrImageSource_t *source = engine->source;
+    int fd = source ? source->fd : engine->fd;
+
+    *got = 0;
+    while (*got < len && !atomic_load(&engine->abort))
+    {
+        size_t n = 0;
+        ssize_t ret;
+
+        if (source && source->read)
+        {
+            if (source->read(source->ctx, buf + *got, len - *got, &n) != mfrERR_NONE)
+            {
+                return mfrERR_GENERAL;
+            }
+            if (!n)
+            {
+                break;
+            }
+            *got += n;
+            continue;
+        }
+        if (source)
+        {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, FW_STREAM_POLL_MS);
+            if (ready == 0 || (ready < 0 && errno == EINTR))
+            {
+                continue;
+            }
+        }
+        ret = read(fd, buf + *got, len - *got);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            return mfrERR_GENERAL;
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        *got += (size_t)ret;
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: engineReadStage
+   Description   : pipeline stage 1, reads the compressed package
+                   from its file or from the caller's stream
+   Input:    fw_Engine_t
+   Output:   filled blocks on inFull
+   Returns:  NULL
+
+*********************************************************************/
+
+static void *engineReadStage(void *arg)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)arg;
+    fw_StageStats_t *stage = &engine->stats->stage[FW_STAGE_READ];
+    fw_Block_t *block = NULL;
+    uint64_t generation = 0;
+    uint64_t offset = 0;
+    uint64_t dropped = 0;
+
+    FW_TRACE_THREAD("read");
+    while (fwRingPop(&engine->buffers->inFree, &block, &stage->stallOutNs) == 0)
+    {
+        FW_TRACE_BEGIN(start);
+        size_t n;
+        fwThrottleApply(engine->throttle, &generation);
+        if (engineReadPackage(engine, block->data, block->capacity, &n) != mfrERR_NONE)
+        {
+            printf("failed to read package %s:%d \n", __FUNCTION__, __LINE__);
+            engineFail(engine, mfrERR_GENERAL);
+            break;
+        }
+        if (n == 0)
+        {
+            fwRingPush(&engine->buffers->inFull, NULL, &stage->stallOutNs);
+            break;
+        }
+        block->len = n;
+        offset += n;
+        if (engine->config->memoryBudgetKB && engine->fd >= 0 && offset - dropped >= FW_BUDGET_DROP_SIZE)
+        {
+            // budget mode: the package read so far leaves the page cache, unless it sits on tmpfs
+            posix_fadvise(engine->fd, (off_t)dropped, (off_t)(offset - dropped), POSIX_FADV_DONTNEED);
+            dropped = offset;
+        }
+        fwSha256Update(&engine->digest, block->data, block->len);
+        FW_TRACE_END("read", start);
+        atomic_fetch_add_explicit(&engine->stats->bytesConsumed, (uint64_t)n, memory_order_relaxed);
+        stage->blocks++;
+        stage->bytes += (uint64_t)n;
+        if (fwRingPush(&engine->buffers->inFull, block, &stage->stallOutNs) < 0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/********************************************************************
+   Functiona Name: engineDecompressStage
+   Description   : pipeline stage 2, inflates gzip members on the fly
+                   (plain tar is accepted as well), walks the tar
+                   stream and cuts the sdimg partitions into blocks
+   Input:    fw_Engine_t
+   Output:   target blocks on outFull
+   Returns:  NULL
+
+*********************************************************************/
+
+static voidpf engineZalloc(voidpf opaque, uInt items, uInt size)
+{
+    return engineCalloc((fw_Engine_t *)opaque, items, size);
+}
+
+static void engineZfree(voidpf opaque, voidpf address)
+{
+    // taken back with the rest of the flash
+    (void)opaque;
+    (void)address;
+}
+
+static void *engineDecompressStage(void *arg)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)arg;
+    fw_StageStats_t *stage = &engine->stats->stage[FW_STAGE_DECOMPRESS];
+    fw_TarParser_t parser;
+    fw_TarCallbacks_t cb = { engine, engineOnEntry, engineOnData };
+    fw_Block_t *block = NULL;
+    z_stream zs;
+    uint8_t *out = engine->buffers->inflate;
+    mfrError_t ret = mfrERR_NONE;
+    int gzip = -1;
+    int zret = Z_OK;
+    uint64_t generation = 0;
+
+    memset(&zs, 0, sizeof(zs));
+    if (engine->buffers->arena.base)
+    {
+        zs.zalloc = engineZalloc;
+        zs.zfree = engineZfree;
+        zs.opaque = engine;
+    }
+    fwTarInit(&parser, &cb);
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)
+    {
+        engineFail(engine, mfrERR_MALLOC_FAILED);
+        return NULL;
+    }
+
+    FW_TRACE_THREAD("decompress");
+    while (ret == mfrERR_NONE && fwRingPop(&engine->buffers->inFull, &block, &stage->stallInNs) == 0 && block)
+    {
+        FW_TRACE_BEGIN(start);
+        fwThrottleApply(engine->throttle, &generation);
+        if (gzip < 0)
+        {
+            gzip = block->len >= 2 && block->data[0] == 0x1f && block->data[1] == 0x8b;
+        }
+        if (!gzip && !fwTarFinished(&parser))
+        {
+            atomic_fetch_add_explicit(&engine->stats->bytesDecompressed, block->len, memory_order_relaxed);
+            ret = fwTarFeed(&parser, block->data, block->len);
+        }
+        zs.next_in = block->data;
+        zs.avail_in = gzip ? (uInt)block->len : 0;
+        // whatever follows the end of the archive is drained and dropped
+        while (zs.avail_in && ret == mfrERR_NONE && !fwTarFinished(&parser))
+        {
+            if (zret == Z_STREAM_END)
+            {
+                // concatenated gzip members
+                inflateReset(&zs);
+            }
+            zs.next_out = out;
+            zs.avail_out = (uInt)engine->buffers->inflateSize;
+            zret = inflate(&zs, Z_NO_FLUSH);
+            if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR)
+            {
+                printf("package is corrupted: %s %s:%d \n", zs.msg ? zs.msg : "", __FUNCTION__, __LINE__);
+                ret = mfrERR_DECRYPTION_FAILED;
+                break;
+            }
+            size_t produced = engine->buffers->inflateSize - zs.avail_out;
+            if (zret == Z_BUF_ERROR && !produced)
+            {
+                break;
+            }
+            atomic_fetch_add_explicit(&engine->stats->bytesDecompressed, produced, memory_order_relaxed);
+            ret = fwTarFeed(&parser, out, produced);
+        }
+        fwRingPush(&engine->buffers->inFree, block, NULL);
+        FW_TRACE_END("inflate", start);
+    }
+
+    if (ret == mfrERR_NONE && !atomic_load(&engine->abort))
+    {
+        if (!engine->sdimgSeen)
+        {
+            printf("no *%s in package %s:%d \n", FW_SDIMG_SUFFIX, __FUNCTION__, __LINE__);
+            ret = mfrERR_DECRYPTION_FAILED;
+        }
+        else if (!engine->layoutReady ||
+                 engine->route[ROUTE_BOOT].done != engine->route[ROUTE_BOOT].length ||
+                 engine->route[ROUTE_ROOTFS].done != engine->route[ROUTE_ROOTFS].length)
+        {
+            printf("package is truncated %s:%d \n", __FUNCTION__, __LINE__);
+            ret = mfrERR_DECRYPTION_FAILED;
+        }
+    }
+    if (ret != mfrERR_NONE)
+    {
+        engineFail(engine, ret);
+    }
+    else
+    {
+        fwRingPush(&engine->buffers->outFull, NULL, &stage->stallOutNs);
+    }
+    inflateEnd(&zs);
+    fwTarRelease(&parser);
+    return NULL;
+}
+
+/* Sparse mode: free space is neither written nor read back, it counts as zeroes */
+static mfrError_t engineSparseClassify(fw_Engine_t *engine, fw_Block_t *block)
+{
+    size_t granule = engine->config->deltaChunkSize;
+    size_t granules = (block->len + granule - 1) / granule;
+    size_t i;
+
+    if (fwSparseFeed(&engine->sparse, block->offset, block->data, block->len) != mfrERR_NONE)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    for (i = 0; i < granules; i++)
+    {
+        size_t pos = i * granule;
+        size_t len = block->len - pos < granule ? block->len - pos : granule;
+        uint64_t index = (block->offset + pos) / granule;
+
+        if (fwSparseUsed(&engine->sparse, block->offset + pos, len))
+        {
+            continue;
+        }
+        block->dirty[i / 64] &= ~(1ull << (i % 64));
+        engine->unwritten[index / 64] |= 1ull << (index % 64);
+        memset(block->data + pos, 0, len);
+        atomic_fetch_add_explicit(&engine->stats->bytesUnmapped, len, memory_order_relaxed);
+    }
+    return mfrERR_NONE;
+}
+
+/* Hash tree mode: the leaves of a rootfs block, free space is zeroed in the block and on the bank alike */
+static void engineTreeHash(fw_Engine_t *engine, fw_Block_t *block)
+{
+    fwVerityHash(&engine->tree, block->offset, block->data, block->len);
+}
+
+/* Hash tree and delta mode: granules whose leaves match the tree of the passive bank are there already */
+static void engineTreeCompare(fw_Engine_t *engine, fw_Block_t *block)
+{
+    size_t granule = engine->config->deltaChunkSize;
+    size_t granules = (block->len + granule - 1) / granule;
+    size_t i;
+
+    for (i = 0; i < granules; i++)
+    {
+        size_t pos = i * granule;
+        size_t len = block->len - pos < granule ? block->len - pos : granule;
+        uint64_t first = (block->offset + pos) / FW_VERITY_BLOCK_SIZE;
+        uint64_t end = first + len / FW_VERITY_BLOCK_SIZE;
+
+        // partial data blocks are not in the tree
+        if (!(block->dirty[i / 64] & (1ull << (i % 64))) || len % FW_VERITY_BLOCK_SIZE ||
+            end > engine->tree.dataBlocks || end > engine->baseTree.dataBlocks ||
+            memcmp(fwVerityLeaf(&engine->tree, first), fwVerityLeaf(&engine->baseTree, first),
+                   (size_t)(end - first) * FW_SHA256_SIZE))
+        {
+            continue;
+        }
+        block->dirty[i / 64] &= ~(1ull << (i % 64));
+        atomic_fetch_add_explicit(&engine->stats->bytesSkipped, len, memory_order_relaxed);
+    }
+}
+
+/********************************************************************
+   Functiona Name: engineHashStage
+   Description   : pipeline stage 3, takes the CRC32C of a block for
+                   the readback and classifies its content. In sparse
+                   mode granules of free space are dropped from the
+                   block's dirty map and zeroed, in delta mode those
+                   the passive bank already holds. In resume mode a
+                   block the journal has on the media is dropped whole.
+                   In hash tree mode the leaves of the rootfs are
+                   hashed here, and in delta mode compared with the
+                   tree of the passive bank rather than the bank.
+   Input:    fw_Engine_t
+   Output:   classified blocks on hashed
+   Returns:  NULL
+
+*********************************************************************/
+
+static void *engineHashStage(void *arg)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)arg;
+    fw_StageStats_t *stage = &engine->stats->stage[FW_STAGE_HASH];
+    size_t granule = engine->config->deltaChunkSize;
+    fw_Block_t *block = NULL;
+    uint64_t generation = 0;
+
+    FW_TRACE_THREAD("hash");
+    while (fwRingPop(&engine->buffers->outFull, &block, &stage->stallInNs) == 0)
+    {
+        FW_TRACE_BEGIN(start);
+        fwThrottleApply(engine->throttle, &generation);
+        if (block && block->dirty)
+        {
+            memset(block->dirty, 0xff, ((block->len + granule - 1) / granule + 63) / 64 * sizeof(uint64_t));
+            if (block->route == ROUTE_ROOTFS && engine->config->sparseMode &&
+                engineSparseClassify(engine, block) != mfrERR_NONE)
+            {
+                engineFail(engine, mfrERR_MALLOC_FAILED);
+                break;
+            }
+        }
+        int resumed = 0;
+        if (block)
+        {
+            uint32_t crc = fwCrc32c(0, block->data, block->len);
+            engine->crc[block->route][block->offset / engine->config->blockSize] = crc;
+            resumed = block->route == ROUTE_ROOTFS && fwJournalHas(&engine->journal, block->offset, block->len, crc);
+        }
+        if (block && block->route == ROUTE_ROOTFS && engine->tree.tree)
+        {
+            engineTreeHash(engine, block);
+        }
+        if (resumed)
+        {
+            // an interrupted upgrade of the package got it to the media
+            memset(block->dirty, 0, engine->buffers->dirtyWords * sizeof(uint64_t));
+            atomic_fetch_add_explicit(&engine->stats->bytesResumed, block->len, memory_order_relaxed);
+        }
+        else if (block && block->dirty && engine->config->deltaMode && block->route == ROUTE_ROOTFS &&
+                 engine->tree.tree && engine->baseTree.tree)
+        {
+            engineTreeCompare(engine, block);
+        }
+        else if (block && block->dirty && engine->config->deltaMode)
+        {
+            size_t granules = (block->len + granule - 1) / granule;
+            size_t i;
+
+            if (block->route == ROUTE_ROOTFS)
+            {
+                if (fwTargetRead(&engine->rootfs, engine->buffers->current, block->len, block->offset) != mfrERR_NONE)
+                {
+                    engineFail(engine, mfrERR_GENERAL);
+                    break;
+                }
+                for (i = 0; i < granules; i++)
+                {
+                    size_t pos = i * granule;
+                    size_t len = block->len - pos < granule ? block->len - pos : granule;
+                    if ((block->dirty[i / 64] & (1ull << (i % 64))) &&
+                        !memcmp(block->data + pos, engine->buffers->current + pos, len))
+                    {
+                        block->dirty[i / 64] &= ~(1ull << (i % 64));
+                        atomic_fetch_add_explicit(&engine->stats->bytesSkipped, len, memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        FW_TRACE_END(resumed ? "resume" : block && block->dirty ? "compare" : "hash", start);
+        stage->blocks += block ? 1 : 0;
+        stage->bytes += block ? block->len : 0;
+        if (fwRingPush(&engine->buffers->hashed, block, &stage->stallOutNs) < 0 || !block)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Writer completion: the block goes back to the decompressor with its last write */
+static void engineWriteDone(void *ctx, void *cookie)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)ctx;
+    fw_Block_t *block = (fw_Block_t *)cookie;
+
+    if (--block->pending == 0)
+    {
+        engine->stats->stage[FW_STAGE_WRITE].blocks++;
+        fwRingPush(&engine->buffers->outFree, block, NULL);
+    }
+}
+
+static void engineSampleMemory(fw_Engine_t *engine)
+{
+    uint64_t kb = fwResidentKB();
+
+    if (kb > engine->stats->peakResidentKB)
+    {
+        engine->stats->peakResidentKB = kb;
+    }
+}
+
+/* Sparse mode: hands free space back to the device, only a hint, so the first failure ends it.
+   In hash tree mode free space has to read back as the zeros its leaves were hashed from. */
+static mfrError_t engineDiscard(fw_Engine_t *engine, uint64_t offset, uint64_t len)
+{
+    mfrError_t ret;
+
+    if (!len)
+    {
+        return mfrERR_NONE;
+    }
+    if (engine->buildTree)
+    {
+        // the tree vouches for zeros there, whatever a discard leaves behind would not verify
+        ret = fwTargetZero(&engine->rootfs, offset, len);
+        if (ret != mfrERR_NONE)
+        {
+            printf("failed to zero free space of %s at %llu %s:%d \n", engine->rootfs.path,
+                   (unsigned long long)offset, __FUNCTION__, __LINE__);
+            return ret;
+        }
+        engine->stats->bytesDiscarded += len;
+        return mfrERR_NONE;
+    }
+    if (engine->discardFailed)
+    {
+        return mfrERR_NONE;
+    }
+    ret = fwTargetDiscard(&engine->rootfs, offset, len);
+    if (ret != mfrERR_NONE)
+    {
+        printf("%s does not take discards, free space is left as it is\n", engine->rootfs.path);
+        engine->discardFailed = 1;
+        return mfrERR_NONE;
+    }
+    engine->stats->bytesDiscarded += len;
+    return mfrERR_NONE;
+}
+
+/* Resume mode: the journal vouches for the bank up to end, once the bank is synced that far */
+static void engineCheckpoint(fw_Engine_t *engine, uint64_t end)
+{
+    if (fwJournalRecord(&engine->journal, end, engine->crc[ROUTE_ROOTFS]) != mfrERR_NONE)
+    {
+        // a stale journal would vouch for blocks written since
+        fwJournalRemove(&engine->journal);
+        printf("no journal of %s, an interrupted upgrade starts over\n", engine->rootfs.path);
+    }
+}
+
+/********************************************************************
+   Functiona Name: engineWriteStage
+   Description   : pipeline stage 4, submits the dirty runs of a block
+                   to the writer, which hands the block back to the
+                   decompressor once they are on the target. A target
+                   is synced as soon as its last block is written.
+                   In sparse mode runs of free space are discarded.
+                   In resume mode the bank is synced and journaled
+                   every FW_JOURNAL_INTERVAL bytes.
+   Input:    fw_Engine_t
+   Output:   None
+   Returns:  NULL
+
+*********************************************************************/
+
+static void *engineWriteStage(void *arg)
+{
+    fw_Engine_t *engine = (fw_Engine_t *)arg;
+    fw_StageStats_t *stage = &engine->stats->stage[FW_STAGE_WRITE];
+    size_t granule = engine->config->deltaChunkSize;
+    fw_Block_t *block = NULL;
+    mfrError_t ret = mfrERR_NONE;
+    uint64_t generation = 0;
+    uint64_t discardStart = 0;
+    uint64_t discardLen = 0;
+    uint64_t written = 0;
+    uint64_t checkpoint = engine->journal.durable + FW_JOURNAL_INTERVAL;
+
+    FW_TRACE_THREAD("write");
+    while (ret == mfrERR_NONE && fwRingPop(&engine->buffers->hashed, &block, &stage->stallInNs) == 0 && block)
+    {
+        FW_TRACE_BEGIN(start);
+        fw_Route_t *route = &engine->route[block->route];
+        size_t granules = (block->len + granule - 1) / granule;
+        int resumed = block->route == ROUTE_ROOTFS &&
+                      fwJournalHas(&engine->journal, block->offset, block->len,
+                                   engine->crc[ROUTE_ROOTFS][block->offset / engine->config->blockSize]);
+        size_t i = engine->verifyOnly || resumed ? granules : 0;
+
+        fwThrottleApply(engine->throttle, &generation);
+        if (block->route == ROUTE_ROOTFS && !resumed && block->offset < engine->journal.durable)
+        {
+            // the journal vouches for what is about to be overwritten
+            engineCheckpoint(engine, block->offset);
+        }
+        // held until every run is submitted, so an early completion cannot release the block
+        block->pending = 1;
+        while (i < granules && ret == mfrERR_NONE)
+        {
+            size_t first = i;
+            if (block->dirty && !(block->dirty[i / 64] & (1ull << (i % 64))))
+            {
+                uint64_t index = (block->offset + i * granule) / granule;
+                if (block->route == ROUTE_ROOTFS && engine->unwritten &&
+                    (engine->unwritten[index / 64] & (1ull << (index % 64))))
+                {
+                    // free space, joins the run of free space to discard
+                    uint64_t offset = block->offset + i * granule;
+                    uint64_t len = block->len - i * granule < granule ? block->len - i * granule : granule;
+                    if (discardStart + discardLen != offset)
+                    {
+                        ret = engineDiscard(engine, discardStart, discardLen);
+                        discardStart = offset;
+                        discardLen = 0;
+                    }
+                    discardLen += len;
+                }
+                i++;
+                continue;
+            }
+            // coalesce adjacent dirty granules into a single write
+            while (i < granules && (!block->dirty || (block->dirty[i / 64] & (1ull << (i % 64)))))
+            {
+                i++;
+            }
+            size_t pos = first * granule;
+            size_t len = (i * granule < block->len ? i * granule : block->len) - pos;
+            ret = fwThrottleTake(engine->throttle, len, &engine->abort, &engine->stats->throttleNs);
+            if (ret != mfrERR_NONE)
+            {
+                break;
+            }
+            block->pending++;
+            stage->bytes += len;
+            ret = fwWriterSubmit(engine->writer, route->file, block->data + pos, len, block->offset + pos, block);
+            atomic_fetch_add_explicit(&engine->stats->bytesWritten, len, memory_order_relaxed);
+        }
+        int last = block->offset + block->len >= route->length;
+        if (++written % FW_RESIDENT_SAMPLE == 0)
+        {
+            engineSampleMemory(engine);
+        }
+        if (ret == mfrERR_NONE && last && block->route == ROUTE_ROOTFS)
+        {
+            ret = engineDiscard(engine, discardStart, discardLen);
+            discardLen = 0;
+        }
+        engineWriteDone(engine, block);
+        if (ret == mfrERR_NONE && engine->writer)
+        {
+            ret = fwWriterReap(engine->writer, 0);
+        }
+        FW_TRACE_END("submit", start);
+        // the bank is synced once complete, while the rest of the package goes by, and at every checkpoint
+        int sync = last || (engine->journal.active && block->offset + block->len >= checkpoint);
+        if (ret == mfrERR_NONE && sync && route->target == &engine->rootfs && engine->writer)
+        {
+            FW_TRACE_BEGIN(flushStart);
+            ret = fwWriterFlush(engine->writer, route->file);
+            FW_TRACE_END("sync", flushStart);
+            if (ret == mfrERR_NONE && engine->journal.active)
+            {
+                engineCheckpoint(engine, block->offset + block->len);
+                checkpoint = block->offset + block->len + FW_JOURNAL_INTERVAL;
+            }
+        }
+    }
+    if (engine->writer && fwWriterDrain(engine->writer) != mfrERR_NONE && ret == mfrERR_NONE)
+    {
+        ret = mfrERR_GENERAL;
+    }
+    if (ret != mfrERR_NONE)
+    {
+        engineFail(engine, ret);
+    }
+    return NULL;
+}
+
+/* Carves the blocks out of the arena in budget mode, allocates them otherwise. align 0 for zeroed memory. */
+static void *engineBufferAlloc(fw_EngineBuffers_t *buffers, size_t size, size_t align)
+{
+    void *data = NULL;
+
+    if (buffers->arena.base)
+    {
+        return fwArenaAlloc(&buffers->arena, size, align ? align : sizeof(uint64_t));
+    }
+    if (!align)
+    {
+        return calloc(1, size);
+    }
+    return posix_memalign(&data, align, size) == 0 ? data : NULL;
+}
+
+/* Hash tree mode: the helpers are kept as long as their number does not change */
+static void engineBuffersPool(fw_EngineBuffers_t *buffers, const mfrFWUpgradeConfig_t *config)
+{
+    unsigned int threads = config->hashTree && !config->memoryBudgetKB ? config->hashTreeThreads : 0;
+
+    if (buffers->verityThreads == threads)
+    {
+        return;
+    }
+    fwVerityPoolDestroy(buffers->verityPool);
+    buffers->verityPool = fwVerityPoolCreate(threads);
+    buffers->verityThreads = threads;
+}
+
+static mfrError_t engineRingInit(fw_EngineBuffers_t *buffers, fw_Ring_t *ring, uint32_t depth)
+{
+    uint32_t size = fwRingSize(depth);
+    fw_Block_t **slots = (fw_Block_t **)engineBufferAlloc(buffers, size * sizeof(fw_Block_t *), 0);
+
+    if (!slots)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    fwRingInit(ring, slots, size);
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwEngineBuffersAlloc
+   Description   : sizes the pipeline blocks for the configuration and
+                   sets up the rings and the writer moving them.
+                   Whatever already fits is kept, so a flash only
+                   allocates after the configuration changed. With a
+                   memory budget the blocks are all carved out of one
+                   arena of that size, the rest of which serves the
+                   flash.
+   Input:    config, writes - blocks are needed for writes in flight
+   Output:   buffers - zeroed before the first call
+   Returns:  mfrERR_NONE when the blocks are there
+
+*********************************************************************/
+
+mfrError_t fwEngineBuffersAlloc(fw_EngineBuffers_t *buffers, const mfrFWUpgradeConfig_t *config, int writes)
+{
+    uint32_t inCount = config->queueDepth;
+    uint32_t outCount = config->queueDepth + (writes ? config->writeDepth : 0);
+    size_t granules = config->blockSize / config->deltaChunkSize;
+    size_t dirtyWords = config->deltaMode || config->sparseMode || config->resumeMode ? (granules + 63) / 64 : 0;
+    size_t inflateSize = engineInflateSize(config);
+    uint32_t i;
+
+    if (config->memoryBudgetKB && engineFootprint(config, writes) > (uint64_t)config->memoryBudgetKB * 1024)
+    {
+        printf("memory budget of %u KB is below the %llu KB the smallest pipeline needs %s:%d \n",
+               config->memoryBudgetKB, (unsigned long long)(engineFootprint(config, writes) + 1023) / 1024,
+               __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    if (buffers->inCount >= inCount && buffers->readSize == config->readSize &&
+        buffers->outCount >= outCount && buffers->blockSize == config->blockSize &&
+        buffers->dirtyWords >= dirtyWords && (!config->deltaMode || buffers->current) &&
+        buffers->budgetKB == config->memoryBudgetKB && buffers->inflateSize == inflateSize &&
+        (!writes || (buffers->writer && buffers->writeBackend == config->writeBackend &&
+                     buffers->writeDepth == config->writeDepth)))
+    {
+        engineBuffersPool(buffers, config);
+        return mfrERR_NONE;
+    }
+    fwEngineBuffersFree(buffers);
+    if (config->memoryBudgetKB && fwArenaInit(&buffers->arena, (size_t)config->memoryBudgetKB * 1024) != mfrERR_NONE)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    buffers->budgetKB = config->memoryBudgetKB;
+    buffers->in = (fw_Block_t *)engineBufferAlloc(buffers, inCount * sizeof(fw_Block_t), 0);
+    buffers->out = (fw_Block_t *)engineBufferAlloc(buffers, outCount * sizeof(fw_Block_t), 0);
+    buffers->inflate = (uint8_t *)engineBufferAlloc(buffers, inflateSize, FW_WRITER_ALIGN);
+    if (!buffers->in || !buffers->out || !buffers->inflate)
+    {
+        fwEngineBuffersFree(buffers);
+        return mfrERR_MALLOC_FAILED;
+    }
+    buffers->inCount = inCount;
+    buffers->outCount = outCount;
+    buffers->readSize = config->readSize;
+    buffers->blockSize = config->blockSize;
+    buffers->inflateSize = inflateSize;
+    buffers->bytes = (uint64_t)inCount * config->readSize + (uint64_t)outCount * config->blockSize + inflateSize;
+    for (i = 0; i < inCount; i++)
+    {
+        buffers->in[i].capacity = config->readSize;
+        if (!(buffers->in[i].data = (uint8_t *)engineBufferAlloc(buffers, config->readSize, FW_WRITER_ALIGN)))
+        {
+            fwEngineBuffersFree(buffers);
+            return mfrERR_MALLOC_FAILED;
+        }
+    }
+    for (i = 0; i < outCount; i++)
+    {
+        // aligned, so the writer can send the blocks around the page cache
+        buffers->out[i].capacity = config->blockSize;
+        if (!(buffers->out[i].data = (uint8_t *)engineBufferAlloc(buffers, config->blockSize, FW_WRITER_ALIGN)))
+        {
+            fwEngineBuffersFree(buffers);
+            return mfrERR_MALLOC_FAILED;
+        }
+    }
+    if (dirtyWords)
+    {
+        buffers->dirtyWords = dirtyWords;
+        if (!(buffers->dirty = (uint64_t *)engineBufferAlloc(buffers, outCount * dirtyWords * sizeof(uint64_t), 0)))
+        {
+            fwEngineBuffersFree(buffers);
+            return mfrERR_MALLOC_FAILED;
+        }
+    }
+    if (config->deltaMode)
+    {
+        if (!(buffers->current = (uint8_t *)engineBufferAlloc(buffers, config->blockSize, FW_WRITER_ALIGN)))
+        {
+            fwEngineBuffersFree(buffers);
+            return mfrERR_MALLOC_FAILED;
+        }
+        buffers->bytes += config->blockSize;
+    }
+    if (engineRingInit(buffers, &buffers->inFull, inCount + 1) != mfrERR_NONE ||
+        engineRingInit(buffers, &buffers->inFree, inCount + 1) != mfrERR_NONE ||
+        engineRingInit(buffers, &buffers->outFull, outCount + 1) != mfrERR_NONE ||
+        engineRingInit(buffers, &buffers->hashed, outCount + 1) != mfrERR_NONE ||
+        engineRingInit(buffers, &buffers->outFree, outCount + 1) != mfrERR_NONE)
+    {
+        fwEngineBuffersFree(buffers);
+        return mfrERR_MALLOC_FAILED;
+    }
+    if (writes)
+    {
+        mfrError_t ret = fwWriterCreate(&buffers->writer, config->writeBackend, config->writeDepth,
+                                        buffers->arena.base ? &buffers->arena : NULL);
+        if (ret != mfrERR_NONE)
+        {
+            fwEngineBuffersFree(buffers);
+            return ret;
+        }
+        buffers->writeBackend = config->writeBackend;
+        buffers->writeDepth = config->writeDepth;
+    }
+    if (buffers->arena.base)
+    {
+        buffers->arenaMark = buffers->arena.used;
+        buffers->bytes = buffers->arena.size;
+        printf("memory budget %u KB: %u + %u blocks of %u KB, %u KB reads, %llu KB left for the flash\n",
+               config->memoryBudgetKB, inCount, outCount, config->blockSize / 1024, config->readSize / 1024,
+               (unsigned long long)(buffers->arena.size - buffers->arenaMark) / 1024);
+    }
+    engineBuffersPool(buffers, config);
+    return mfrERR_NONE;
+}
+
+void fwEngineBuffersFree(fw_EngineBuffers_t *buffers)
+{
+    uint32_t i;
+
+    fwWriterDestroy(buffers->writer);
+    fwVerityPoolDestroy(buffers->verityPool);
+    if (buffers->arena.base)
+    {
+        // the blocks, rings and writer live in the arena
+        fwArenaRelease(&buffers->arena);
+        memset(buffers, 0, sizeof(*buffers));
+        return;
+    }
+    for (i = 0; buffers->in && i < buffers->inCount; i++)
+    {
+        free(buffers->in[i].data);
+    }
+    for (i = 0; buffers->out && i < buffers->outCount; i++)
+    {
+        free(buffers->out[i].data);
+    }
+    free(buffers->in);
+    free(buffers->out);
+    free(buffers->inFull.slots);
+    free(buffers->inFree.slots);
+    free(buffers->outFull.slots);
+    free(buffers->hashed.slots);
+    free(buffers->outFree.slots);
+    free(buffers->dirty);
+    free(buffers->current);
+    free(buffers->inflate);
+    memset(buffers, 0, sizeof(*buffers));
+}
+
+static mfrError_t engineAllocPipeline(fw_Engine_t *engine)
+{
+    const mfrFWUpgradeConfig_t *config = engine->config;
+    uint32_t depth = config->queueDepth;
+    mfrError_t ret;
+    uint32_t i;
+
+    ret = fwEngineBuffersAlloc(engine->buffers, config, !engine->verifyOnly);
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    // what the last flash took from the budget
+    fwArenaRewind(&engine->buffers->arena, engine->buffers->arenaMark);
+    engine->outCount = depth + (engine->verifyOnly ? 0 : config->writeDepth);
+    engine->stats->bufferBytes = engine->buffers->bytes;
+    fwRingReset(&engine->buffers->inFull, &engine->abort);
+    fwRingReset(&engine->buffers->inFree, &engine->abort);
+    fwRingReset(&engine->buffers->outFull, &engine->abort);
+    fwRingReset(&engine->buffers->hashed, &engine->abort);
+    fwRingReset(&engine->buffers->outFree, &engine->abort);
+    if (!engine->verifyOnly)
+    {
+        engine->writer = engine->buffers->writer;
+        fwWriterBind(engine->writer, engineWriteDone, engine, &engine->stats->write, engine->throttle);
+        ret = fwWriterAttach(engine->writer, &engine->staging, 0, &engine->route[ROUTE_BOOT].file);
+        if (ret == mfrERR_NONE)
+        {
+            ret = fwWriterAttach(engine->writer, &engine->rootfs, !config->bufferedWrites,
+                                 &engine->route[ROUTE_ROOTFS].file);
+        }
+        if (ret != mfrERR_NONE)
+        {
+            return ret;
+        }
+    }
+    for (i = 0; i < depth; i++)
+    {
+        fwRingPush(&engine->buffers->inFree, &engine->buffers->in[i], NULL);
+    }
+    for (i = 0; i < engine->outCount; i++)
+    {
+        fw_Block_t *out = &engine->buffers->out[i];
+
+        out->dirty = config->deltaMode || config->sparseMode || config->resumeMode
+                         ? engine->buffers->dirty + i * engine->buffers->dirtyWords : NULL;
+        fwRingPush(&engine->buffers->outFree, out, NULL);
+    }
+    return mfrERR_NONE;
+}
+
+static void engineFreePipeline(fw_Engine_t *engine)
+{
+    if (engine->writer && fwWriterDetach(engine->writer) != mfrERR_NONE)
+    {
+        // io_uring broke down, the next flash gets a new writer
+        fwWriterDestroy(engine->writer);
+        engine->buffers->writer = NULL;
+    }
+    engine->writer = NULL;
+    engineFree(engine, engine->crc[ROUTE_BOOT]);
+    engineFree(engine, engine->crc[ROUTE_ROOTFS]);
+    engineFree(engine, engine->unwritten);
+    engineFree(engine, engine->journal.crc);
+    fwVerityRelease(&engine->tree);
+    fwVerityRelease(&engine->baseTree);
+    fwSparseRelease(&engine->sparse);
+    engineFree(engine, engine->bmap);
+    fwEngineBuffersFree(&engine->ownBuffers);
+}
+
+/* Runs the four stages to completion, returns the first error any of them hit */
+static mfrError_t engineRunPipeline(fw_Engine_t *engine)
+{
+    void *(*stages[FW_STAGE_COUNT])(void *) = {
+        engineReadStage, engineDecompressStage, engineHashStage, engineWriteStage,
+    };
+    static const char *names[FW_STAGE_COUNT] = { "read", "decompress", "hash", "write" };
+    pthread_t tids[FW_STAGE_COUNT];
+    uint64_t start = fwNowNs();
+    int started = 0;
+    int i;
+
+    for (i = 0; i < FW_STAGE_COUNT; i++)
+    {
+        engine->stats->stage[i].name = names[i];
+    }
+    for (i = 0; i < FW_STAGE_COUNT; i++, started++)
+    {
+        if (pthread_create(&tids[i], NULL, stages[i], engine) != 0)
+        {
+            engineFail(engine, mfrERR_GENERAL);
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    engine->stats->pipelineNs = fwNowNs() - start;
+    engineSampleMemory(engine);
+    engine->stats->stage[FW_STAGE_DECOMPRESS].peakQueue = engine->buffers->inFull.peak;
+    engine->stats->stage[FW_STAGE_HASH].peakQueue = engine->buffers->outFull.peak;
+    engine->stats->stage[FW_STAGE_WRITE].peakQueue = engine->buffers->hashed.peak;
+    for (i = 0; i < FW_STAGE_COUNT; i++)
+    {
+        const fw_StageStats_t *stage = &engine->stats->stage[i];
+        printf("stage %-10s %8llu blocks, stalled %llu ms on input, %llu ms on output, peak queue %u\n", stage->name,
+               (unsigned long long)stage->blocks, (unsigned long long)(stage->stallInNs / 1000000),
+               (unsigned long long)(stage->stallOutNs / 1000000), stage->peakQueue);
+    }
+    if (engine->writer)
+    {
+        const fw_WriterStats_t *write = &engine->stats->write;
+        uint64_t requests = write->requests ? write->requests : 1;
+        printf("writer %s: %llu writes, %llu%% direct, queue depth %u, mean %.1f, max %u, "
+               "latency mean %llu us, max %llu us, %llu retries, %llu syncs in %llu ms\n", write->backend,
+               (unsigned long long)write->requests,
+               (unsigned long long)(write->bytes ? write->directBytes * 100 / write->bytes : 0), write->depth,
+               (double)write->inFlightSum / requests, write->maxInFlight,
+               (unsigned long long)(write->latencyNs / requests / 1000),
+               (unsigned long long)(write->maxLatencyNs / 1000), (unsigned long long)write->retries,
+               (unsigned long long)write->flushes,
+               (unsigned long long)(write->flushNs / 1000000));
+    }
+    if (engine->stats->throttleNs)
+    {
+        printf("writes held back %llu ms by the background mode\n",
+               (unsigned long long)(engine->stats->throttleNs / 1000000));
+    }
+    return engine->error;
+}
+
+/* Points root= of the staged cmdline.txt at the freshly written bank */
+static mfrError_t engineSwitchCmdline(fw_Engine_t *engine)
+{
+    const char *rootName = engine->config->bankRootName[engine->passive];
+    char cmdline[FW_CMDLINE_MAX];
+    char updated[FW_CMDLINE_MAX];
+    const char *root = NULL;
+    size_t len = 0;
+    fw_FatVolume_t vol;
+    mfrError_t ret = fwFatOpen(&vol, &engine->staging, 0);
+
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatReadFile(&vol, FW_CMDLINE_FILE, cmdline, sizeof(cmdline) - 1, &len);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    cmdline[len] = '\0';
+
+    size_t rootLen = fwCmdlineFindRoot(cmdline, &root);
+    if (!root)
+    {
+        printf("no root= in %s %s:%d \n", FW_CMDLINE_FILE, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    int n = snprintf(updated, sizeof(updated), "%.*s%s%s", (int)(root - cmdline), cmdline, rootName, root + rootLen);
+    if (n < 0 || (size_t)n >= sizeof(updated))
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    return fwFatRewriteFile(&vol, FW_CMDLINE_FILE, updated, (size_t)n);
+}
+
+/* The pipeline is over by the readback, its blocks from first on serve as readback buffers */
+static unsigned int engineReadbackBuffers(fw_Engine_t *engine, uint32_t first, uint8_t **buffers)
+{
+    unsigned int threads = fwThrottleThreads(engine->throttle, engine->config->verifyThreads);
+    unsigned int i;
+
+    threads = threads > FW_VERIFY_MAX_THREADS ? FW_VERIFY_MAX_THREADS : threads < 1 ? 1 : threads;
+    threads = threads > engine->outCount - first ? engine->outCount - first : threads;
+    for (i = 0; i < threads; i++)
+    {
+        buffers[i] = engine->buffers->out[first + i].data;
+    }
+    return threads;
+}
+
+/* Brings the boot partition to the staged image, file by file when possible */
+/* The copies of the boot partition write_kernel_rootfs.sh keeps for each bank in workDir: the files the
+   active bank boots with, read before they are replaced, and the staged ones for the passive bank */
+static void engineBackupBoot(fw_Engine_t *engine, fw_Target_t *boot)
+{
+    char dir[PATH_MAX];
+    int bank;
+
+    for (bank = 0; bank < 2; bank++)
+    {
+        snprintf(dir, sizeof(dir), "%s/" FW_BOOT_BACKUP_DIR, engine->config->workDir, bank);
+        if (fwManifestExport(bank == engine->passive ? &engine->staging : boot, dir) != mfrERR_NONE)
+        {
+            printf("no backup of the kernel information of bank %d in %s\n", bank, dir);
+        }
+    }
+}
+
+static mfrError_t engineCommitBoot(fw_Engine_t *engine)
+{
+    const fw_Route_t *route = &engine->route[ROUTE_BOOT];
+    fw_Target_t boot = { .fd = -1 };
+    size_t chunk = engine->config->blockSize;
+    char manifest[PATH_MAX];
+    fw_ManifestStats_t sync;
+    uint8_t *buf = NULL;
+    uint64_t offset = 0;
+    mfrError_t ret = engineSwitchCmdline(engine);
+
+    snprintf(manifest, sizeof(manifest), "%s/%s", engine->config->workDir, FW_BOOT_MANIFEST_FILE);
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineOpenPartition(engine, &boot, engine->config->bootDevice, &engine->layout.boot);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        engineBackupBoot(engine, &boot);
+        ret = fwManifestSync(&engine->staging, &boot, manifest, FW_CMDLINE_FILE, !engine->config->skipReadback, &sync);
+        atomic_fetch_add_explicit(&engine->stats->bytesWritten, sync.bytesWritten, memory_order_relaxed);
+        if (ret == mfrERR_NONE)
+        {
+            printf("synced kernel information: %u files, %u changed, %u added, %u removed, %llu bytes written%s\n",
+                   sync.files, sync.changed, sync.added, sync.removed, (unsigned long long)sync.bytesWritten,
+                   sync.fromManifest ? "" : ", manifest rebuilt");
+            fwTargetClose(&boot);
+            return mfrERR_NONE;
+        }
+        printf("file sync of %s failed, copying the whole image %s:%d \n", boot.path, __FUNCTION__, __LINE__);
+        ret = mfrERR_NONE;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetReserve(&boot, route->length);
+    }
+    // the pipeline is over, its first block carries the copy
+    buf = engine->buffers->out[0].data;
+    printf("copy new kernel information\n");
+    while (ret == mfrERR_NONE && offset < route->length)
+    {
+        size_t take = route->length - offset < chunk ? (size_t)(route->length - offset) : chunk;
+        ret = fwTargetRead(&engine->staging, buf, take, offset);
+        if (ret == mfrERR_NONE)
+        {
+            // cmdline.txt changed since the hasher saw the blocks
+            engine->crc[ROUTE_BOOT][offset / chunk] = fwCrc32c(0, buf, take);
+            ret = fwTargetWrite(&boot, buf, take, offset);
+        }
+        atomic_fetch_add_explicit(&engine->stats->bytesWritten, take, memory_order_relaxed);
+        offset += take;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetFlush(&boot);
+    }
+    if (ret == mfrERR_NONE && !engine->config->skipReadback)
+    {
+        uint8_t *buffers[FW_VERIFY_MAX_THREADS];
+        unsigned int threads = engineReadbackBuffers(engine, 1, buffers);
+        ret = fwVerifyTarget(&boot, engine->crc[ROUTE_BOOT], route->length, chunk, buffers, threads, NULL, 0);
+    }
+    if (ret == mfrERR_NONE && fwManifestRecord(&engine->staging, manifest) != mfrERR_NONE)
+    {
+        printf("no manifest of %s, the next upgrade reads it whole\n", boot.path);
+    }
+    fwTargetClose(&boot);
+    return ret;
+}
+
+/* Expected digest from the first 64 hex digits of hex, sha256sum format */
+static mfrError_t engineParseDigest(fw_Engine_t *engine, const char *hex)
+{
+    int i;
+
+    for (i = 0; i < FW_SHA256_SIZE; i++)
+    {
+        unsigned int byte;
+        if (!isxdigit((unsigned char)hex[i * 2]) || !isxdigit((unsigned char)hex[i * 2 + 1]) ||
+            sscanf(hex + i * 2, "%2x", &byte) != 1)
+        {
+            return mfrERR_INVALID_PARAM;
+        }
+        engine->expected[i] = (uint8_t)byte;
+    }
+    engine->haveExpected = 1;
+    return mfrERR_NONE;
+}
+
+/* Opens the package and loads the digest of the <package>.sha256 sidecar if there is one */
+static mfrError_t engineOpenPackage(fw_Engine_t *engine, const char *package)
+{
+    char path[PATH_MAX];
+    char hex[2 * FW_SHA256_SIZE + 1];
+    FILE *fp;
+
+    engine->fd = open(package, O_RDONLY | O_CLOEXEC);
+    if (engine->fd < 0)
+    {
+        printf("failed to open %s %s:%d \n", package, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    posix_fadvise(engine->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    fwSha256Init(&engine->digest);
+
+    snprintf(path, sizeof(path), "%s%s", package, FW_DIGEST_SUFFIX);
+    if (!(fp = fopen(path, "r")))
+    {
+        printf("no %s, package digest is not checked\n", path);
+        return mfrERR_NONE;
+    }
+    size_t len = fread(hex, 1, sizeof(hex) - 1, fp);
+    fclose(fp);
+    hex[len] = 0;
+    if (engineParseDigest(engine, hex) != mfrERR_NONE)
+    {
+        printf("%s is not a sha256 digest %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_DECRYPTION_FAILED;
+    }
+    return mfrERR_NONE;
+}
+
+/* A streamed package comes with its digest, if any */
+static mfrError_t engineOpenStream(fw_Engine_t *engine, const mfrImageSource_t *source)
+{
+    engine->source = source;
+    fwSha256Init(&engine->digest);
+    if (!source->sha256)
+    {
+        printf("no digest of the stream, package digest is not checked\n");
+        return mfrERR_NONE;
+    }
+    if (strlen(source->sha256) != 2 * FW_SHA256_SIZE || engineParseDigest(engine, source->sha256) != mfrERR_NONE)
+    {
+        printf("%s is not a sha256 digest %s:%d \n", source->sha256, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t engineCheckDigest(fw_Engine_t *engine)
+{
+    uint8_t digest[FW_SHA256_SIZE];
+    char hex[2 * FW_SHA256_SIZE + 1];
+
+    fwSha256Final(&engine->digest, digest);
+    fwSha256Hex(digest, hex);
+    printf("package sha256 %s (%s)\n", hex, fwHashBackend());
+    if (engine->haveExpected && memcmp(digest, engine->expected, sizeof(digest)))
+    {
+        printf("package digest does not match %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_DECRYPTION_FAILED;
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: engineOpenJournal
+   Description   : resume mode, picks up the journal of the passive
+                   bank in the work directory. It belongs to the
+                   package digest or, for a package file without one,
+                   to its size and first megabyte. A stream without a
+                   digest is flashed from scratch.
+   Input:    engine - package, bank and pipeline ready
+   Output:   engine->journal
+   Returns:  None
+
+*********************************************************************/
+
+static void engineOpenJournal(fw_Engine_t *engine)
+{
+    const mfrFWUpgradeConfig_t *config = engine->config;
+    uint8_t *buf = engine->buffers->out[0].data;
+    fw_JournalKey_t key;
+    char path[PATH_MAX];
+    struct stat st;
+
+    memset(&key, 0, sizeof(key));
+    if (engine->haveExpected)
+    {
+        memcpy(key.package, engine->expected, sizeof(key.package));
+    }
+    else if (engine->fd >= 0 && fstat(engine->fd, &st) == 0)
+    {
+        fw_Sha256_t head;
+        uint64_t size = (uint64_t)st.st_size;
+        size_t offset = 0;
+        ssize_t n = 1;
+
+        fwSha256Init(&head);
+        fwSha256Update(&head, &size, sizeof(size));
+        while (offset < FW_JOURNAL_HEAD_SIZE && n > 0)
+        {
+            size_t take = FW_JOURNAL_HEAD_SIZE - offset < config->blockSize ? FW_JOURNAL_HEAD_SIZE - offset
+                                                                            : config->blockSize;
+            n = pread(engine->fd, buf, take, (off_t)offset);
+            if (n > 0)
+            {
+                fwSha256Update(&head, buf, (size_t)n);
+                offset += (size_t)n;
+            }
+        }
+        fwSha256Final(&head, key.package);
+    }
+    else
+    {
+        printf("no digest of the stream, an interrupted upgrade starts over\n");
+        return;
+    }
+    key.bank = (uint32_t)engine->passive;
+    key.bankPath = fwCrc32c(0, engine->rootfs.path, strlen(engine->rootfs.path));
+    key.bankBase = engine->rootfs.base;
+    key.blockSize = config->blockSize;
+    key.sparse = config->sparseMode ? 1 : 0;
+    snprintf(path, sizeof(path), "%s/%s", config->workDir, FW_JOURNAL_FILE);
+    fwJournalOpen(&engine->journal, path, &key);
+}
+
+/* Hash tree of a bank in the work directory, and its root hash */
+static void engineTreePaths(fw_Engine_t *engine, char *tree, char *root)
+{
+    snprintf(tree, PATH_MAX, "%s/" FW_TREE_FILE, engine->config->workDir, engine->passive);
+    snprintf(root, PATH_MAX, "%s/" FW_TREE_ROOT_FILE, engine->config->workDir, engine->passive);
+}
+
+/********************************************************************
+   Functiona Name: engineOpenTree
+   Description   : hash tree mode. In delta mode the saved tree of the
+                   passive bank stands in for reading the bank, as long
+                   as the first block of the bank is still the one in
+                   the tree: mounting the filesystem read-write rewrites
+                   its superblock. The saved tree goes away on every
+                   flash, with or without hash tree mode, the bank is
+                   about to change.
+   Input:    engine - bank and pipeline ready
+   Output:   engine->buildTree, engine->baseTree
+   Returns:  None
+
+*********************************************************************/
+
+static void engineOpenTree(fw_Engine_t *engine)
+{
+    const mfrFWUpgradeConfig_t *config = engine->config;
+    uint8_t *buf = engine->buffers->out[0].data;
+    uint8_t digest[FW_SHA256_SIZE];
+    char tree[PATH_MAX];
+    char root[PATH_MAX];
+
+    engineTreePaths(engine, tree, root);
+    if (config->hashTree && config->memoryBudgetKB)
+    {
+        printf("no hash tree of the rootfs with a memory budget\n");
+    }
+    else if (config->hashTree && config->deltaMode &&
+             fwVerityLoad(&engine->baseTree, tree, root, engine->buffers->verityPool,
+                          fwThrottleThreads(engine->throttle, config->hashTreeThreads),
+                          engineArena(engine)) == mfrERR_NONE)
+    {
+        fw_Sha256_t ctx = engine->baseTree.salted;
+        int same = fwTargetRead(&engine->rootfs, buf, FW_VERITY_BLOCK_SIZE, 0) == mfrERR_NONE;
+
+        fwSha256Update(&ctx, buf, FW_VERITY_BLOCK_SIZE);
+        fwSha256Final(&ctx, digest);
+        if (same && !memcmp(digest, fwVerityLeaf(&engine->baseTree, 0), sizeof(digest)))
+        {
+            printf("delta mode: comparing with the hash tree of %s\n", engine->rootfs.path);
+        }
+        else
+        {
+            printf("%s changed since %s was saved, delta mode reads it\n", engine->rootfs.path, tree);
+            fwVerityRelease(&engine->baseTree);
+        }
+    }
+    engine->buildTree = config->hashTree && !config->memoryBudgetKB;
+    unlink(root);
+    unlink(tree);
+}
+
+/* Hash tree mode: the upper levels, then the tree goes next to the root hash of the bank */
+static void engineSaveTree(fw_Engine_t *engine)
+{
+    char hex[2 * FW_SHA256_SIZE + 1];
+    char tree[PATH_MAX];
+    char root[PATH_MAX];
+
+    fwVerityFinish(&engine->tree);
+    fwSha256Hex(engine->tree.root, hex);
+    engineTreePaths(engine, tree, root);
+    if (fwVeritySave(&engine->tree, tree, root) == mfrERR_NONE)
+    {
+        printf("rootfs hash tree saved to %s, root hash %s\n", tree, hex);
+    }
+}
+
+void fwEngineJobInit(fw_EngineJob_t *job, fw_EngineBuffers_t *buffers, fw_Device_t *device,
+                     fw_Throttle_t *throttle)
+{
+    memset(job, 0, sizeof(*job));
+    job->buffers = buffers;
+    job->device = device;
+    job->throttle = throttle;
+    pthread_mutex_init(&job->lock, NULL);
+}
+
+void fwEngineJobRelease(fw_EngineJob_t *job)
+{
+    pthread_mutex_destroy(&job->lock);
+}
+
+/* Clears a cancellation before the next flash of the job */
+void fwEngineJobReset(fw_EngineJob_t *job)
+{
+    pthread_mutex_lock(&job->lock);
+    job->cancelled = 0;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/********************************************************************
+   Functiona Name: fwEngineCancel
+   Description   : stops the flash of the job. The stages leave at
+                   their next block boundary and the writes in flight
+                   are drained; once the boot partition is being
+                   switched the flash is left to complete.
+   Input:    job
+   Output:   None
+   Returns:  None
+
+*********************************************************************/
+
+void fwEngineCancel(fw_EngineJob_t *job)
+{
+    pthread_mutex_lock(&job->lock);
+    job->cancelled = 1;
+    if (job->engine)
+    {
+        engineFail(job->engine, mfrERR_INVALID_STATE);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/* Lets fwEngineCancel reach the flash, fails when it has been cancelled already */
+static mfrError_t engineAttachJob(fw_Engine_t *engine, fw_EngineJob_t *job)
+{
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!job)
+    {
+        return mfrERR_NONE;
+    }
+    pthread_mutex_lock(&job->lock);
+    if (job->cancelled)
+    {
+        ret = mfrERR_INVALID_STATE;
+    }
+    else
+    {
+        job->engine = engine;
+        engine->job = job;
+        engine->throttle = job->throttle;
+    }
+    pthread_mutex_unlock(&job->lock);
+    return ret;
+}
+
+static void engineDetachJob(fw_Engine_t *engine)
+{
+    if (engine->job)
+    {
+        pthread_mutex_lock(&engine->job->lock);
+        engine->job->engine = NULL;
+        pthread_mutex_unlock(&engine->job->lock);
+    }
+}
+
+/* The error the flash has been stopped with, if any */
+static mfrError_t engineStopped(fw_Engine_t *engine)
+{
+    mfrError_t ret = mfrERR_NONE;
+
+    if (atomic_load(&engine->abort))
+    {
+        pthread_mutex_lock(&engine->errorLock);
+        ret = engine->error;
+        pthread_mutex_unlock(&engine->errorLock);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwEngineFlash
+   Description   : flashes the package to the passive bank and switches
+                   the boot partition over to it
+   Input:    config, package - full path of the downloaded package,
+             or its name in the log when streamed, source - stream,
+             NULL to read the package file, job - preallocated
+             blocks and cancellation, may be NULL
+   Output:   stats - zeroed by the caller, updated while flashing
+   Returns:  mfrERR_NONE on success, mfrERR_INVALID_STATE when the
+             job has been cancelled
+
+*********************************************************************/
+
+mfrError_t fwEngineFlash(const mfrFWUpgradeConfig_t *config, const char *package, const mfrImageSource_t *source,
+                         fw_EngineJob_t *job, fw_EngineStats_t *stats)
+{
+    fw_Engine_t engine;
+    uint64_t start = fwNowNs();
+    uint64_t mark = start;
+    uint64_t generation = 0;
+    mfrError_t ret;
+
+    memset(&engine, 0, sizeof(engine));
+    engine.config = config;
+    engine.stats = stats;
+    engine.fd = -1;
+    engine.staging.fd = -1;
+    engine.rootfs.fd = -1;
+    // before the job is attached, a cancel wakes the rings
+    engine.buffers = job && job->buffers ? job->buffers : &engine.ownBuffers;
+    pthread_mutex_init(&engine.errorLock, NULL);
+    FW_TRACE_RESET();
+
+    ret = fwBackendInit(&engine.backend, config);
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineAttachJob(&engine, job);
+    }
+    fwThrottleApply(engine.throttle, &generation);
+    if (ret == mfrERR_NONE)
+    {
+        ret = source ? engineOpenStream(&engine, source) : engineOpenPackage(&engine, package);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineProbeDevice(&engine);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = enginePrepareWorkDir(&engine);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        unlink(engine.stagingPath);
+        ret = fwTargetOpen(&engine.staging, NULL, engine.stagingPath, 1);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineOpenPartition(&engine, &engine.rootfs, config->bankDevice[engine.passive],
+                                  &engine.layout.bank[engine.passive]);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineAllocPipeline(&engine);
+    }
+    if (ret == mfrERR_NONE && config->resumeMode)
+    {
+        engineOpenJournal(&engine);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        engineOpenTree(&engine);
+    }
+    stats->prepareNs = fwNowNs() - mark;
+    FW_TRACE_SPAN("prepare", 0, mark, mark + stats->prepareNs);
+    engineSampleMemory(&engine);
+    if (ret == mfrERR_NONE)
+    {
+        printf("streaming %s to %s\n", package, config->bankDevice[engine.passive]);
+        mark = fwNowNs();
+        ret = engineRunPipeline(&engine);
+        FW_TRACE_SPAN("pipeline", 0, mark, mark + stats->pipelineNs);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineCheckDigest(&engine);
+    }
+    if (ret == mfrERR_NONE && !config->skipReadback)
+    {
+        // the bank is only switched over once it reads back as written
+        mark = fwNowNs();
+        // the readback threads inherit the I/O class and CPUs of this thread
+        fwThrottleApply(engine.throttle, &generation);
+        uint8_t *buffers[FW_VERIFY_MAX_THREADS];
+        unsigned int threads = engineReadbackBuffers(&engine, 0, buffers);
+        ret = fwVerifyTarget(&engine.rootfs, engine.crc[ROUTE_ROOTFS], engine.route[ROUTE_ROOTFS].length,
+                             config->blockSize, buffers, threads, engine.unwritten, config->deltaChunkSize);
+        if (ret != mfrERR_NONE)
+        {
+            // what the journal vouches for did not read back
+            fwJournalRemove(&engine.journal);
+        }
+        stats->readbackNs = fwNowNs() - mark;
+        engineSampleMemory(&engine);
+        FW_TRACE_SPAN("readback", 0, mark, mark + stats->readbackNs);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineStopped(&engine);
+    }
+    if (ret == mfrERR_NONE && engine.tree.tree)
+    {
+        mark = fwNowNs();
+        engineSaveTree(&engine);
+        stats->treeNs = fwNowNs() - mark;
+        FW_TRACE_SPAN("tree", 0, mark, mark + stats->treeNs);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        // past this point the flash is not cancelled anymore
+        engineDetachJob(&engine);
+        mark = fwNowNs();
+        ret = engineCommitBoot(&engine);
+        if (ret == mfrERR_NONE)
+        {
+            fwJournalRemove(&engine.journal);
+        }
+        stats->commitNs = fwNowNs() - mark;
+        engineSampleMemory(&engine);
+        FW_TRACE_SPAN("commit", 0, mark, mark + stats->commitNs);
+    }
+
+    engineDetachJob(&engine);
+    if (engine.fd >= 0)
+    {
+        close(engine.fd);
+    }
+    engineFreePipeline(&engine);
+    fwTargetClose(&engine.rootfs);
+    fwTargetClose(&engine.staging);
+    fwBackendRelease(&engine.backend);
+    if (engine.stagingPath[0])
+    {
+        unlink(engine.stagingPath);
+    }
+    if (engine.workDirMounted)
+    {
+        umount(config->workDir);
+    }
+    pthread_mutex_destroy(&engine.errorLock);
+    stats->totalNs = fwNowNs() - start;
+    printf("flashing %s: %llu bytes read, %llu bytes written, %llu bytes skipped\n",
+           ret == mfrERR_NONE ? "completed" : "failed", (unsigned long long)atomic_load(&stats->bytesConsumed),
+           (unsigned long long)atomic_load(&stats->bytesWritten), (unsigned long long)atomic_load(&stats->bytesSkipped));
+    if (config->resumeMode)
+    {
+        printf("resume mode: %llu bytes already on the bank\n", (unsigned long long)atomic_load(&stats->bytesResumed));
+    }
+    if (config->sparseMode)
+    {
+        printf("sparse mode: %llu bytes of free space not written, %llu discarded\n",
+               (unsigned long long)atomic_load(&stats->bytesUnmapped), (unsigned long long)stats->bytesDiscarded);
+    }
+    printf("flashing took %llu ms: prepare %llu, pipeline %llu, readback %llu, tree %llu, commit %llu\n",
+           (unsigned long long)(stats->totalNs / 1000000), (unsigned long long)(stats->prepareNs / 1000000),
+           (unsigned long long)(stats->pipelineNs / 1000000), (unsigned long long)(stats->readbackNs / 1000000),
+           (unsigned long long)(stats->treeNs / 1000000), (unsigned long long)(stats->commitNs / 1000000));
+    printf("memory: %llu KB for the blocks%s, peak resident %llu KB\n", (unsigned long long)stats->bufferBytes / 1024,
+           config->memoryBudgetKB ? " (budget)" : "", (unsigned long long)stats->peakResidentKB);
+    if (config->tracePath[0])
+    {
+        FW_TRACE_DUMP(config->tracePath);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwEngineVerify
+   Description   : runs the package through the pipeline without any
+                   target, checking the archive, the sdimg layout and
+                   the package digest
+   Input:    config, package - full path of the package
+   Output:   stats - zeroed by the caller
+   Returns:  mfrERR_NONE when the package can be flashed
+
+*********************************************************************/
+
+mfrError_t fwEngineVerify(const mfrFWUpgradeConfig_t *config, const char *package, fw_EngineStats_t *stats)
+{
+    mfrFWUpgradeConfig_t verifyConfig = *config;
+    fw_Engine_t engine;
+    mfrError_t ret;
+
+    verifyConfig.deltaMode = 0;
+    verifyConfig.sparseMode = 0;
+    verifyConfig.resumeMode = 0;
+    verifyConfig.hashTree = 0;
+    memset(&engine, 0, sizeof(engine));
+    engine.config = &verifyConfig;
+    engine.stats = stats;
+    engine.fd = -1;
+    engine.verifyOnly = 1;
+    engine.staging.fd = -1;
+    engine.rootfs.fd = -1;
+    engine.buffers = &engine.ownBuffers;
+    pthread_mutex_init(&engine.errorLock, NULL);
+
+    ret = engineOpenPackage(&engine, package);
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineAllocPipeline(&engine);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineRunPipeline(&engine);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = engineCheckDigest(&engine);
+    }
+
+    if (engine.fd >= 0)
+    {
+        close(engine.fd);
+    }
+    engineFreePipeline(&engine);
+    pthread_mutex_destroy(&engine.errorLock);
+    printf("verification of %s %s\n", package, ret == mfrERR_NONE ? "passed" : "failed");
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwEngineCheckLayout
+   Description   : checks the partition table of the disk holds the boot
+                   partition, both banks and the storage partition
+   Input:    config, device - probe kept across calls
+   Output:   device
+   Returns:  mfrERR_NONE when the disk is ready to be flashed or is
+             only addressed by partition devices, mfrERR_INVALID_STATE
+             when partitions still have to be created
+
+*********************************************************************/
+
+mfrError_t fwEngineCheckLayout(const mfrFWUpgradeConfig_t *config, fw_Device_t *device)
+{
+    mfrError_t ret;
+
+    if (!config->diskDevice[0])
+    {
+        return mfrERR_NONE;
+    }
+    ret = fwDeviceProbe(device, config);
+    if (ret == mfrERR_NONE)
+    {
+        ret = device->layoutError;
+    }
+    if (ret == mfrERR_NONE && config->storageDevice[0] && !device->layout.hasStorage)
+    {
+        printf("no partition for %s %s:%d \n", config->storageDevice, __FUNCTION__, __LINE__);
+        ret = mfrERR_INVALID_STATE;
+    }
+    return ret;
+}
@@ -0,0 +1,123 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Streaming flasher. The package (*.tar.gz holding *rootfs.rpi-sdimg)
+  is decompressed on the fly and the partitions of the sdimg are routed
+  straight to the target devices, so the rootfs is written exactly once.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <mfrApi.h>
+#include "fw_arena.h"
+#include "fw_pipeline.h"
+#include "fw_writer.h"
+
+#define FW_SDIMG_SUFFIX         "rootfs.rpi-sdimg"
+#define FW_BMAP_SUFFIX          ".bmap"
+#define FW_CMDLINE_FILE         "cmdline.txt"
+
+enum {
+    FW_STAGE_READ = 0,
+    FW_STAGE_DECOMPRESS,
+    FW_STAGE_HASH,
+    FW_STAGE_WRITE,
+    FW_STAGE_COUNT,
+};
+
+/* The atomic counters are sampled by the progress reporter while flashing,
+   the rest is only read once the engine returned */
+typedef struct fw_EngineStats {
+    _Atomic uint64_t bytesTotal;    /* size of the package */
+    _Atomic uint64_t bytesConsumed; /* compressed package bytes read */
+    _Atomic uint64_t bytesDecompressed;
+    _Atomic uint64_t bytesWritten;
+    _Atomic uint64_t bytesSkipped;  /* delta mode: already up to date on the target */
+    _Atomic uint64_t bytesUnmapped; /* sparse mode: free space, not written */
+    _Atomic uint64_t bytesResumed;  /* resume mode: on the target since an interrupted flash */
+    uint64_t bytesDiscarded;        /* sparse mode: free space discarded, or zeroed for the hash tree */
+    uint64_t bufferBytes;           /* allocated for the pipeline blocks, the whole arena in budget mode */
+    uint64_t peakResidentKB;        /* sampled while flashing */
+    uint64_t prepareNs;             /* package, bank selection, partition layout */
+    uint64_t pipelineNs;            /* the stages ran for this long */
+    uint64_t readbackNs;            /* reading the rootfs back */
+    uint64_t treeNs;                /* upper levels of the hash tree and saving it */
+    uint64_t commitNs;              /* boot partition switch, including its readback */
+    uint64_t totalNs;
+    uint64_t throttleNs;            /* writes held back by the background mode */
+    fw_StageStats_t stage[FW_STAGE_COUNT];
+    fw_WriterStats_t write;         /* queue depth and latency of the target writes */
+} fw_EngineStats_t;
+
+/* Pipeline blocks, the rings between the stages, the writer and the hash
+   tree helpers. The job manager keeps them across flashes, so nothing is
+   allocated for the data path of a flash. */
+typedef struct fw_EngineBuffers {
+    fw_Block_t *in;                 /* compressed package */
+    uint32_t inCount;
+    fw_Block_t *out;                /* target blocks */
+    uint32_t outCount;
+    size_t readSize;
+    size_t blockSize;
+    uint64_t *dirty;                /* delta and sparse mode: dirtyWords per out block */
+    size_t dirtyWords;
+    uint8_t *current;               /* delta mode: passive bank content under a block */
+    uint8_t *inflate;
+    size_t inflateSize;
+    uint64_t bytes;
+    unsigned int budgetKB;          /* memory budget the blocks were sized for, 0 for none */
+    fw_Arena_t arena;               /* budget mode: holds the blocks */
+    size_t arenaMark;               /* budget mode: end of the blocks, a flash gets the rest */
+    fw_Ring_t inFull;               /* read -> decompress */
+    fw_Ring_t inFree;               /* decompress -> read */
+    fw_Ring_t outFull;              /* decompress -> hash */
+    fw_Ring_t hashed;               /* hash -> write */
+    fw_Ring_t outFree;              /* write -> decompress */
+    fw_Writer_t *writer;            /* NULL when the blocks are only read */
+    mfrWriteBackend_t writeBackend; /* the writer was created for */
+    unsigned int writeDepth;
+    struct fw_VerityPool *verityPool;   /* hash tree mode: threads hashing the leaves with the hasher */
+    unsigned int verityThreads;     /* the pool was created for */
+} fw_EngineBuffers_t;
+
+/* A flash on behalf of the job manager */
+typedef struct fw_EngineJob {
+    fw_EngineBuffers_t *buffers;    /* NULL to allocate the blocks for the flash */
+    struct fw_Device *device;       /* probe kept across flashes, NULL to probe every time */
+    struct fw_Throttle *throttle;   /* background mode limits, NULL for full speed */
+    pthread_mutex_t lock;
+    int cancelled;
+    struct fw_Engine *engine;       /* flash in progress, until the boot switch starts */
+} fw_EngineJob_t;
+
+void fwEngineDefaults(const mfrFWUpgradeConfig_t *in, mfrFWUpgradeConfig_t *out);
+mfrError_t fwEngineBuffersAlloc(fw_EngineBuffers_t *buffers, const mfrFWUpgradeConfig_t *config, int writes);
+void fwEngineBuffersFree(fw_EngineBuffers_t *buffers);
+void fwEngineJobInit(fw_EngineJob_t *job, fw_EngineBuffers_t *buffers, struct fw_Device *device,
+                     struct fw_Throttle *throttle);
+void fwEngineJobRelease(fw_EngineJob_t *job);
+void fwEngineJobReset(fw_EngineJob_t *job);
+void fwEngineCancel(fw_EngineJob_t *job);
+mfrError_t fwEngineFlash(const mfrFWUpgradeConfig_t *config, const char *package, const mfrImageSource_t *source,
+                         fw_EngineJob_t *job, fw_EngineStats_t *stats);
+mfrError_t fwEngineVerify(const mfrFWUpgradeConfig_t *config, const char *package, fw_EngineStats_t *stats);
+mfrError_t fwEngineCheckLayout(const mfrFWUpgradeConfig_t *config, struct fw_Device *device);
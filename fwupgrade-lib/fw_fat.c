@@ -0,0 +1,946 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "string.h"
+#include "fw_fat.h"
+#include "fw_hash.h"
+
+#define FAT_DIRENT_SIZE     FW_FAT_DIRENT_SIZE
+#define FAT_DIR_DEPTH       16
+#define FAT_LFN_LAST        0x40
+#define FAT_DELETED         0xe5
+#define FAT_ATTR_LFN        0x0f
+#define FAT_ATTR_VOLUME     0x08
+#define FAT_ATTR_DIRECTORY  0x10
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+mfrError_t fwFatOpen(fw_FatVolume_t *vol, fw_Target_t *target, uint64_t base)
+{
+    uint8_t bs[512];
+
+    memset(vol, 0, sizeof(*vol));
+    vol->target = target;
+    vol->base = base;
+    if (fwTargetRead(target, bs, sizeof(bs), base) != mfrERR_NONE)
+    {
+        return mfrERR_GENERAL;
+    }
+
+    uint32_t bps = rd16(bs + 11);
+    uint32_t spc = bs[13];
+    uint32_t reserved = rd16(bs + 14);
+    uint32_t numFats = bs[16];
+    uint32_t rootEntries = rd16(bs + 17);
+    uint32_t totalSectors = rd16(bs + 19) ? rd16(bs + 19) : rd32(bs + 32);
+    uint32_t fatSectors = rd16(bs + 22) ? rd16(bs + 22) : rd32(bs + 36);
+
+    if (bs[510] != 0x55 || bs[511] != 0xaa || bps < 512 || bps > 4096 || (bps & (bps - 1)) ||
+        !spc || (spc & (spc - 1)) || !numFats || !fatSectors)
+    {
+        printf("not a FAT boot sector %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+
+    uint32_t rootDirSectors = (rootEntries * FAT_DIRENT_SIZE + bps - 1) / bps;
+    uint32_t firstData = reserved + numFats * fatSectors + rootDirSectors;
+    if (firstData >= totalSectors)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    vol->bytesPerSector = bps;
+    vol->clusterSize = bps * spc;
+    vol->clusterCount = (totalSectors - firstData) / spc;
+    vol->fatBits = vol->clusterCount < 4085 ? 12 : (vol->clusterCount < 65525 ? 16 : 32);
+    vol->fatOffset = base + (uint64_t)reserved * bps;
+    vol->rootDirOffset = base + (uint64_t)(reserved + numFats * fatSectors) * bps;
+    vol->rootDirEntries = rootEntries;
+    vol->rootCluster = vol->fatBits == 32 ? rd32(bs + 44) : 0;
+    vol->dataOffset = base + (uint64_t)firstData * bps;
+    vol->numFats = numFats;
+    vol->fatSize = (uint64_t)fatSectors * bps;
+    if (vol->fatBits == 32 && rd16(bs + 48) && rd16(bs + 48) != 0xffff)
+    {
+        vol->fsInfoOffset = base + (uint64_t)rd16(bs + 48) * bps;
+    }
+    vol->allocHint = 2;
+    return mfrERR_NONE;
+}
+
+void fwFatClose(fw_FatVolume_t *vol)
+{
+    free(vol->table);
+    free(vol->dirty);
+    vol->table = NULL;
+    vol->dirty = NULL;
+}
+
+uint64_t fwFatClusterOffset(const fw_FatVolume_t *vol, uint32_t cluster)
+{
+    return vol->dataOffset + (uint64_t)(cluster - 2) * vol->clusterSize;
+}
+
+static int fatValidCluster(const fw_FatVolume_t *vol, uint32_t cluster)
+{
+    return cluster >= 2 && cluster < vol->clusterCount + 2;
+}
+
+/* Value of a FAT entry, from the table in memory */
+static uint32_t fatGet(const fw_FatVolume_t *vol, uint32_t cluster)
+{
+    uint32_t value;
+
+    if (vol->fatBits == 12)
+    {
+        value = rd16(vol->table + cluster + cluster / 2);
+        return (cluster & 1) ? (value >> 4) : (value & 0xfff);
+    }
+    if (vol->fatBits == 16)
+    {
+        return rd16(vol->table + (uint64_t)cluster * 2);
+    }
+    return rd32(vol->table + (uint64_t)cluster * 4) & 0x0fffffff;
+}
+
+static void fatSet(fw_FatVolume_t *vol, uint32_t cluster, uint32_t value)
+{
+    uint64_t offset;
+    size_t len;
+
+    if (vol->fatBits == 12)
+    {
+        uint16_t old;
+
+        offset = cluster + cluster / 2;
+        len = 2;
+        old = rd16(vol->table + offset);
+        wr16(vol->table + offset, (uint16_t)((cluster & 1) ? ((old & 0x000f) | (value << 4))
+                                                            : ((old & 0xf000) | (value & 0xfff))));
+    }
+    else if (vol->fatBits == 16)
+    {
+        offset = (uint64_t)cluster * 2;
+        len = 2;
+        wr16(vol->table + offset, (uint16_t)value);
+    }
+    else
+    {
+        offset = (uint64_t)cluster * 4;
+        len = 4;
+        // the top four bits are reserved
+        wr32(vol->table + offset, (rd32(vol->table + offset) & 0xf0000000) | (value & 0x0fffffff));
+    }
+    vol->dirty[offset / vol->bytesPerSector] = 1;
+    vol->dirty[(offset + len - 1) / vol->bytesPerSector] = 1;
+}
+
+static uint32_t fatEndOfChain(const fw_FatVolume_t *vol)
+{
+    return vol->fatBits == 12 ? 0xfff : (vol->fatBits == 16 ? 0xffff : 0x0fffffff);
+}
+
+/* Returns the next cluster of the chain, 0 at the end of the chain or on error */
+static uint32_t fatNext(fw_FatVolume_t *vol, uint32_t cluster)
+{
+    uint8_t entry[4] = {0};
+    uint32_t next;
+
+    if (vol->table)
+    {
+        next = fatValidCluster(vol, cluster) ? fatGet(vol, cluster) : 0;
+        next = next >= (fatEndOfChain(vol) & ~7u) ? 0 : next;
+    }
+    else if (vol->fatBits == 12)
+    {
+        if (fwTargetRead(vol->target, entry, 2, vol->fatOffset + cluster + cluster / 2) != mfrERR_NONE)
+        {
+            return 0;
+        }
+        next = rd16(entry);
+        next = (cluster & 1) ? (next >> 4) : (next & 0xfff);
+        next = next >= 0xff8 ? 0 : next;
+    }
+    else if (vol->fatBits == 16)
+    {
+        if (fwTargetRead(vol->target, entry, 2, vol->fatOffset + (uint64_t)cluster * 2) != mfrERR_NONE)
+        {
+            return 0;
+        }
+        next = rd16(entry);
+        next = next >= 0xfff8 ? 0 : next;
+    }
+    else
+    {
+        if (fwTargetRead(vol->target, entry, 4, vol->fatOffset + (uint64_t)cluster * 4) != mfrERR_NONE)
+        {
+            return 0;
+        }
+        next = rd32(entry) & 0x0fffffff;
+        next = next >= 0x0ffffff8 ? 0 : next;
+    }
+    return fatValidCluster(vol, next) ? next : 0;
+}
+
+static void fatShortName(const char *name, char shortName[11])
+{
+    const char *dot = strrchr(name, '.');
+    size_t baseLen = dot ? (size_t)(dot - name) : strlen(name);
+    size_t i;
+
+    memset(shortName, ' ', 11);
+    for (i = 0; i < baseLen && i < 8; i++)
+    {
+        shortName[i] = (char)toupper((unsigned char)name[i]);
+    }
+    for (i = 0; dot && dot[i + 1] && i < 3; i++)
+    {
+        shortName[8 + i] = (char)toupper((unsigned char)dot[i + 1]);
+    }
+}
+
+static int fatMatchEntry(const uint8_t *dirent, const char shortName[11])
+{
+    if (dirent[0] == 0xe5 || dirent[11] == FAT_ATTR_LFN ||
+        (dirent[11] & (FAT_ATTR_VOLUME | FAT_ATTR_DIRECTORY)))
+    {
+        return 0;
+    }
+    return !memcmp(dirent, shortName, 11);
+}
+
+/* Looks up a file of the root directory, returns the offset of its entry */
+static mfrError_t fatFindRootEntry(fw_FatVolume_t *vol, const char *name, uint8_t dirent[FAT_DIRENT_SIZE],
+                                   uint64_t *entryOffset)
+{
+    char shortName[11];
+    uint32_t cluster = vol->rootCluster;
+    uint64_t offset = vol->rootDirOffset;
+    uint64_t entries = vol->fatBits == 32 ? vol->clusterSize / FAT_DIRENT_SIZE : vol->rootDirEntries;
+
+    fatShortName(name, shortName);
+    while (1)
+    {
+        uint64_t i;
+        if (vol->fatBits == 32)
+        {
+            offset = fwFatClusterOffset(vol, cluster);
+        }
+        for (i = 0; i < entries; i++, offset += FAT_DIRENT_SIZE)
+        {
+            if (fwTargetRead(vol->target, dirent, FAT_DIRENT_SIZE, offset) != mfrERR_NONE)
+            {
+                return mfrERR_GENERAL;
+            }
+            if (!dirent[0])
+            {
+                return mfrERR_INVALID_PARAM;
+            }
+            if (fatMatchEntry(dirent, shortName))
+            {
+                *entryOffset = offset;
+                return mfrERR_NONE;
+            }
+        }
+        if (vol->fatBits != 32 || !(cluster = fatNext(vol, cluster)))
+        {
+            return mfrERR_INVALID_PARAM;
+        }
+    }
+}
+
+static uint32_t fatFirstCluster(const fw_FatVolume_t *vol, const uint8_t *dirent)
+{
+    uint32_t cluster = rd16(dirent + 26);
+    if (vol->fatBits == 32)
+    {
+        cluster |= (uint32_t)rd16(dirent + 20) << 16;
+    }
+    return cluster;
+}
+
+/********************************************************************
+   Functiona Name: fwFatReadFile
+   Description   : reads a file of the root directory into buf
+   Input:    vol, name, buf, bufLen
+   Output:   len - size of the file
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwFatReadFile(fw_FatVolume_t *vol, const char *name, char *buf, size_t bufLen, size_t *len)
+{
+    uint8_t dirent[FAT_DIRENT_SIZE];
+    uint64_t entryOffset = 0;
+    mfrError_t ret = fatFindRootEntry(vol, name, dirent, &entryOffset);
+
+    if (ret != mfrERR_NONE)
+    {
+        printf("%s not found in boot partition %s:%d \n", name, __FUNCTION__, __LINE__);
+        return ret;
+    }
+
+    uint32_t size = rd32(dirent + 28);
+    uint32_t cluster = fatFirstCluster(vol, dirent);
+    size_t done = 0;
+    if (size > bufLen)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    while (done < size)
+    {
+        size_t take = size - done < vol->clusterSize ? size - done : vol->clusterSize;
+        if (!fatValidCluster(vol, cluster) ||
+            fwTargetRead(vol->target, buf + done, take, fwFatClusterOffset(vol, cluster)) != mfrERR_NONE)
+        {
+            return mfrERR_GENERAL;
+        }
+        done += take;
+        if (done < size)
+        {
+            cluster = fatNext(vol, cluster);
+        }
+    }
+    *len = size;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwFatRewriteFile
+   Description   : replaces the content of a root directory file in
+                   place. The new content has to fit the clusters
+                   already allocated to the file.
+   Input:    vol, name, data, len
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwFatRewriteFile(fw_FatVolume_t *vol, const char *name, const char *data, size_t len)
+{
+    uint8_t dirent[FAT_DIRENT_SIZE];
+    uint64_t entryOffset = 0;
+    mfrError_t ret = fatFindRootEntry(vol, name, dirent, &entryOffset);
+
+    if (ret != mfrERR_NONE)
+    {
+        printf("%s not found in boot partition %s:%d \n", name, __FUNCTION__, __LINE__);
+        return ret;
+    }
+
+    uint32_t cluster = fatFirstCluster(vol, dirent);
+    size_t done = 0;
+    while (done < len)
+    {
+        size_t take = len - done < vol->clusterSize ? len - done : vol->clusterSize;
+        if (!fatValidCluster(vol, cluster))
+        {
+            printf("%s does not fit its clusters %s:%d \n", name, __FUNCTION__, __LINE__);
+            return mfrERR_INVALID_PARAM;
+        }
+        if (fwTargetWrite(vol->target, data + done, take, fwFatClusterOffset(vol, cluster)) != mfrERR_NONE)
+        {
+            return mfrERR_GENERAL;
+        }
+        done += take;
+        if (done < len)
+        {
+            cluster = fatNext(vol, cluster);
+        }
+    }
+    wr32(dirent + 28, (uint32_t)len);
+    return fwTargetWrite(vol->target, dirent + 28, 4, entryOffset + 28);
+}
+
+/* Reads the first FAT, chains are then walked and allocated in memory */
+static mfrError_t fatLoadTable(fw_FatVolume_t *vol)
+{
+    uint64_t needed = ((uint64_t)vol->clusterCount + 2) * (uint64_t)vol->fatBits / 8 + 1;
+
+    if (vol->table)
+    {
+        return mfrERR_NONE;
+    }
+    if (needed > vol->fatSize)
+    {
+        printf("FAT is too small for %u clusters %s:%d \n", vol->clusterCount, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    vol->table = (uint8_t *)malloc(vol->fatSize);
+    vol->dirty = (uint8_t *)calloc(vol->fatSize / vol->bytesPerSector, 1);
+    if (!vol->table || !vol->dirty)
+    {
+        fwFatClose(vol);
+        return mfrERR_MALLOC_FAILED;
+    }
+    if (fwTargetRead(vol->target, vol->table, vol->fatSize, vol->fatOffset) != mfrERR_NONE)
+    {
+        fwFatClose(vol);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+uint32_t fwFatNextCluster(fw_FatVolume_t *vol, uint32_t cluster)
+{
+    return fatNext(vol, cluster);
+}
+
+static uint8_t fatNameChecksum(const uint8_t *shortName)
+{
+    uint8_t sum = 0;
+    int i;
+
+    for (i = 0; i < 11; i++)
+    {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + shortName[i]);
+    }
+    return sum;
+}
+
+/* Appends a UCS-2 character as UTF-8 */
+static size_t fatPutChar(char *name, size_t pos, size_t size, uint16_t c)
+{
+    if (c < 0x80 && pos + 1 < size)
+    {
+        name[pos++] = (char)c;
+    }
+    else if (c < 0x800 && pos + 2 < size)
+    {
+        name[pos++] = (char)(0xc0 | (c >> 6));
+        name[pos++] = (char)(0x80 | (c & 0x3f));
+    }
+    else if (c >= 0x800 && pos + 3 < size)
+    {
+        name[pos++] = (char)(0xe0 | (c >> 12));
+        name[pos++] = (char)(0x80 | ((c >> 6) & 0x3f));
+        name[pos++] = (char)(0x80 | (c & 0x3f));
+    }
+    return pos;
+}
+
+/* Name of an entry, from its long name entries when they belong to the short one */
+static void fatEntryName(const fw_FatEntry_t *entry, char *name, size_t size)
+{
+    static const int lfnChars[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    const uint8_t *dirent = entry->raw[entry->slots - 1];
+    size_t pos = 0;
+    int slot;
+    int i;
+
+    // the long name entries come last part first
+    for (slot = entry->slots - 2; slot >= 0; slot--)
+    {
+        for (i = 0; i < 13; i++)
+        {
+            uint16_t c = rd16(entry->raw[slot] + lfnChars[i]);
+            if (!c || c == 0xffff)
+            {
+                break;
+            }
+            pos = fatPutChar(name, pos, size, c);
+        }
+    }
+    if (entry->slots > 1)
+    {
+        name[pos] = '\0';
+        return;
+    }
+    for (i = 0; i < 11; i++)
+    {
+        char c = (char)(i == 0 && dirent[0] == 0x05 ? FAT_DELETED : dirent[i]);
+        // NT stores all lower case names in the short entry only
+        int lower = i < 8 ? (dirent[12] & 0x08) : (dirent[12] & 0x10);
+
+        if (c == ' ')
+        {
+            continue;
+        }
+        if (i >= 8 && (i == 8 || dirent[8] == ' ') && pos + 1 < size)
+        {
+            name[pos++] = '.';
+        }
+        if (pos + 1 < size)
+        {
+            name[pos++] = lower ? (char)tolower((unsigned char)c) : c;
+        }
+    }
+    name[pos] = '\0';
+}
+
+typedef struct fw_FatWalk {
+    fw_FatVolume_t *vol;
+    fw_FatListing_t *listing;
+    uint32_t crc;
+} fw_FatWalk_t;
+
+/* Adds the short entry at offset, with the long name entries gathered before it */
+static mfrError_t fatAddEntry(fw_FatWalk_t *walk, fw_FatEntry_t *pending, int slots, const uint8_t *dirent,
+                              uint64_t offset, int parent)
+{
+    fw_FatListing_t *listing = walk->listing;
+    fw_FatEntry_t *entry;
+    char name[FW_FAT_PATH_MAX];
+    int n;
+
+    if (listing->count == listing->capacity)
+    {
+        int capacity = listing->capacity ? listing->capacity * 2 : 64;
+        fw_FatEntry_t *entries = (fw_FatEntry_t *)realloc(listing->entries, (size_t)capacity * sizeof(*entries));
+        if (!entries)
+        {
+            return mfrERR_MALLOC_FAILED;
+        }
+        listing->entries = entries;
+        listing->capacity = capacity;
+    }
+    entry = &listing->entries[listing->count];
+    // long name entries left over from a deleted or foreign name are ignored
+    if (slots && pending->raw[0][13] != fatNameChecksum(dirent))
+    {
+        slots = 0;
+    }
+    memcpy(entry->raw, pending->raw, (size_t)slots * FAT_DIRENT_SIZE);
+    memcpy(entry->slotOffset, pending->slotOffset, (size_t)slots * sizeof(uint64_t));
+    memcpy(entry->raw[slots], dirent, FAT_DIRENT_SIZE);
+    entry->slotOffset[slots] = offset;
+    entry->slots = slots + 1;
+    entry->parent = parent;
+    entry->isDirectory = (dirent[11] & FAT_ATTR_DIRECTORY) != 0;
+    entry->cluster = fatFirstCluster(walk->vol, dirent);
+    entry->size = entry->isDirectory ? 0 : rd32(dirent + 28);
+
+    fatEntryName(entry, name, sizeof(name));
+    n = parent < 0 ? snprintf(entry->path, sizeof(entry->path), "%s", name)
+                   : snprintf(entry->path, sizeof(entry->path), "%s/%s", listing->entries[parent].path, name);
+    if (n < 0 || (size_t)n >= sizeof(entry->path))
+    {
+        printf("path too long in boot partition %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    listing->count++;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fatWalkDir
+   Description   : lists a directory and, depth first, the directories
+                   it holds. Cluster 0 is the fixed root directory of
+                   FAT12/16.
+   Input:    walk, cluster, parent - index of the directory, depth
+   Output:   walk->listing, walk->crc
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+static mfrError_t fatWalkDir(fw_FatWalk_t *walk, uint32_t cluster, int parent, int depth)
+{
+    fw_FatVolume_t *vol = walk->vol;
+    int fixedRoot = vol->fatBits != 32 && !cluster;
+    size_t len = fixedRoot ? (size_t)vol->rootDirEntries * FAT_DIRENT_SIZE : vol->clusterSize;
+    uint8_t *buf = (uint8_t *)malloc(len ? len : 1);
+    fw_FatEntry_t pending;
+    uint32_t visited = 0;
+    int slots = 0;
+    int end = 0;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!buf)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    if (depth > FAT_DIR_DEPTH || (!fixedRoot && !fatValidCluster(vol, cluster)))
+    {
+        printf("bad directory in boot partition %s:%d \n", __FUNCTION__, __LINE__);
+        ret = mfrERR_INVALID_PARAM;
+    }
+    while (ret == mfrERR_NONE && !end)
+    {
+        uint64_t base = fixedRoot ? vol->rootDirOffset : fwFatClusterOffset(vol, cluster);
+        size_t i;
+
+        ret = fwTargetRead(vol->target, buf, len, base);
+        walk->crc = fwCrc32c(walk->crc, buf, len);
+        for (i = 0; i < len && ret == mfrERR_NONE && !end; i += FAT_DIRENT_SIZE)
+        {
+            const uint8_t *dirent = buf + i;
+
+            if (!dirent[0])
+            {
+                end = 1;
+            }
+            else if (dirent[0] == FAT_DELETED)
+            {
+                slots = 0;
+            }
+            else if (dirent[11] == FAT_ATTR_LFN)
+            {
+                slots = (dirent[0] & FAT_LFN_LAST) ? 0 : slots;
+                if (slots < FW_FAT_NAME_SLOTS - 1)
+                {
+                    memcpy(pending.raw[slots], dirent, FAT_DIRENT_SIZE);
+                    pending.slotOffset[slots] = base + i;
+                    slots++;
+                }
+            }
+            else if ((dirent[11] & FAT_ATTR_VOLUME) || dirent[0] == '.')
+            {
+                // volume label, "." and ".."
+                slots = 0;
+            }
+            else
+            {
+                int index = walk->listing->count;
+
+                ret = fatAddEntry(walk, &pending, slots, dirent, base + i, parent);
+                slots = 0;
+                if (ret == mfrERR_NONE && walk->listing->entries[index].isDirectory)
+                {
+                    ret = fatWalkDir(walk, walk->listing->entries[index].cluster, index, depth + 1);
+                }
+            }
+        }
+        if (fixedRoot || !(cluster = fatNext(vol, cluster)))
+        {
+            break;
+        }
+        if (++visited > vol->clusterCount)
+        {
+            ret = mfrERR_INVALID_PARAM;
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwFatList
+   Description   : lists every file and directory of the volume. The
+                   FAT is loaded and kept for the chains.
+   Input:    vol
+   Output:   listing - to be freed with fwFatListingFree
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwFatList(fw_FatVolume_t *vol, fw_FatListing_t *listing)
+{
+    fw_FatWalk_t walk;
+    mfrError_t ret = fatLoadTable(vol);
+
+    memset(listing, 0, sizeof(*listing));
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    walk.vol = vol;
+    walk.listing = listing;
+    walk.crc = fwCrc32c(0, vol->table, vol->fatSize);
+    ret = fatWalkDir(&walk, vol->fatBits == 32 ? vol->rootCluster : 0, -1, 0);
+    listing->metaCrc = walk.crc;
+    if (ret != mfrERR_NONE)
+    {
+        fwFatListingFree(listing);
+    }
+    return ret;
+}
+
+void fwFatListingFree(fw_FatListing_t *listing)
+{
+    free(listing->entries);
+    memset(listing, 0, sizeof(*listing));
+}
+
+/********************************************************************
+   Functiona Name: fwFatReadData
+   Description   : reads the content of a file, contiguous clusters in
+                   a single read of up to bufLen bytes
+   Input:    vol, cluster - first of the file, size, buf, bufLen - at
+             least one cluster, cb, ctx
+   Output:   None
+   Returns:  mfrERR_NONE on success, what cb returned otherwise
+
+*********************************************************************/
+
+mfrError_t fwFatReadData(fw_FatVolume_t *vol, uint32_t cluster, uint32_t size, uint8_t *buf, size_t bufLen,
+                         fw_FatData_t cb, void *ctx)
+{
+    uint64_t done = 0;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (bufLen < vol->clusterSize)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    while (ret == mfrERR_NONE && done < size)
+    {
+        uint32_t first = cluster;
+        uint64_t run = vol->clusterSize;
+        uint32_t next;
+
+        if (!fatValidCluster(vol, cluster))
+        {
+            printf("file is shorter than its size %s:%d \n", __FUNCTION__, __LINE__);
+            return mfrERR_GENERAL;
+        }
+        next = fatNext(vol, cluster);
+        while (next == cluster + 1 && run + vol->clusterSize <= bufLen && done + run < size)
+        {
+            cluster = next;
+            next = fatNext(vol, cluster);
+            run += vol->clusterSize;
+        }
+        size_t take = (size_t)(size - done < run ? size - done : run);
+        ret = fwTargetRead(vol->target, buf, take, fwFatClusterOffset(vol, first));
+        if (ret == mfrERR_NONE)
+        {
+            ret = cb(ctx, buf, take);
+        }
+        done += take;
+        cluster = next;
+    }
+    return ret;
+}
+
+/* Allocates a chain of count clusters in the table in memory */
+mfrError_t fwFatAlloc(fw_FatVolume_t *vol, uint32_t count, uint32_t *first)
+{
+    uint32_t cluster = vol->allocHint;
+    uint32_t prev = 0;
+    uint32_t found = 0;
+    uint32_t scanned;
+
+    *first = 0;
+    if (!vol->table)
+    {
+        return mfrERR_INVALID_STATE;
+    }
+    for (scanned = 0; found < count && scanned < vol->clusterCount; scanned++)
+    {
+        if (!fatValidCluster(vol, cluster))
+        {
+            cluster = 2;
+        }
+        if (!fatGet(vol, cluster))
+        {
+            fatSet(vol, cluster, fatEndOfChain(vol));
+            if (prev)
+            {
+                fatSet(vol, prev, cluster);
+            }
+            else
+            {
+                *first = cluster;
+            }
+            prev = cluster;
+            found++;
+        }
+        cluster++;
+    }
+    if (found < count)
+    {
+        printf("boot partition is full: %u of %u clusters %s:%d \n", found, count, __FUNCTION__, __LINE__);
+        fwFatFree(vol, *first);
+        *first = 0;
+        return mfrERR_GENERAL;
+    }
+    vol->allocHint = cluster;
+    return mfrERR_NONE;
+}
+
+/* Releases a chain in the table in memory */
+void fwFatFree(fw_FatVolume_t *vol, uint32_t first)
+{
+    uint32_t cluster = first;
+    uint32_t freed = 0;
+
+    while (vol->table && fatValidCluster(vol, cluster) && freed++ <= vol->clusterCount)
+    {
+        uint32_t next = fatNext(vol, cluster);
+        fatSet(vol, cluster, 0);
+        cluster = next;
+    }
+}
+
+/********************************************************************
+   Functiona Name: fwFatSyncTable
+   Description   : writes the sectors of the table changed since the
+                   last call to every copy of the FAT. The FAT32 free
+                   cluster hints are marked unknown.
+   Input:    vol
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwFatSyncTable(fw_FatVolume_t *vol)
+{
+    static const uint8_t unknown[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    uint64_t sectors = vol->fatSize / vol->bytesPerSector;
+    uint64_t start = 0;
+    int changed = 0;
+    mfrError_t ret = mfrERR_NONE;
+
+    while (vol->table && ret == mfrERR_NONE && start < sectors)
+    {
+        uint64_t end = start;
+        uint32_t i;
+
+        if (!vol->dirty[start])
+        {
+            start++;
+            continue;
+        }
+        while (end < sectors && vol->dirty[end])
+        {
+            end++;
+        }
+        for (i = 0; i < vol->numFats && ret == mfrERR_NONE; i++)
+        {
+            ret = fwTargetWrite(vol->target, vol->table + start * vol->bytesPerSector,
+                                (size_t)((end - start) * vol->bytesPerSector),
+                                vol->fatOffset + i * vol->fatSize + start * vol->bytesPerSector);
+        }
+        memset(vol->dirty + start, 0, (size_t)(end - start));
+        changed = 1;
+        start = end;
+    }
+    if (ret == mfrERR_NONE && changed && vol->fsInfoOffset)
+    {
+        // free count and next free cluster
+        ret = fwTargetWrite(vol->target, unknown, sizeof(unknown), vol->fsInfoOffset + 488);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwFatFindFree
+   Description   : finds slots free directory entries in a row. A
+                   directory with no room gets a zeroed cluster more,
+                   linked in the table in memory.
+   Input:    vol, dirCluster - 0 for the FAT12/16 root, slots
+   Output:   offset - of the first entry
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwFatFindFree(fw_FatVolume_t *vol, uint32_t dirCluster, int slots, uint64_t *offset)
+{
+    int fixedRoot = vol->fatBits != 32 && !dirCluster;
+    size_t len = fixedRoot ? (size_t)vol->rootDirEntries * FAT_DIRENT_SIZE : vol->clusterSize;
+    uint8_t *buf = (uint8_t *)calloc(len ? len : 1, 1);
+    uint32_t cluster = dirCluster;
+    uint32_t tail = dirCluster;
+    uint32_t visited = 0;
+    uint32_t added = 0;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!buf)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    while (ret == mfrERR_NONE && (fixedRoot || fatValidCluster(vol, cluster)))
+    {
+        uint64_t base = fixedRoot ? vol->rootDirOffset : fwFatClusterOffset(vol, cluster);
+        size_t i;
+        int run = 0;
+
+        ret = fwTargetRead(vol->target, buf, len, base);
+        for (i = 0; i < len && ret == mfrERR_NONE; i += FAT_DIRENT_SIZE)
+        {
+            run = !buf[i] || buf[i] == FAT_DELETED ? run + 1 : 0;
+            if (run == slots)
+            {
+                *offset = base + i - (size_t)(slots - 1) * FAT_DIRENT_SIZE;
+                free(buf);
+                return mfrERR_NONE;
+            }
+        }
+        tail = cluster;
+        if (fixedRoot || !(cluster = fatNext(vol, cluster)) || ++visited > vol->clusterCount)
+        {
+            break;
+        }
+    }
+    if (ret == mfrERR_NONE && (fixedRoot || (size_t)slots * FAT_DIRENT_SIZE > len))
+    {
+        printf("no room for %d entries in the directory %s:%d \n", slots, __FUNCTION__, __LINE__);
+        ret = mfrERR_GENERAL;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatAlloc(vol, 1, &added);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        // zeroes on the media before the table links them to the directory
+        memset(buf, 0, len);
+        ret = fwTargetWrite(vol->target, buf, len, fwFatClusterOffset(vol, added));
+        if (ret == mfrERR_NONE)
+        {
+            ret = fwTargetFlush(vol->target);
+        }
+        if (ret == mfrERR_NONE)
+        {
+            fatSet(vol, tail, added);
+            *offset = fwFatClusterOffset(vol, added);
+        }
+        else
+        {
+            fwFatFree(vol, added);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+/* Points a short directory entry at a chain */
+void fwFatSetEntry(const fw_FatVolume_t *vol, uint8_t *dirent, uint32_t cluster, uint32_t size)
+{
+    wr16(dirent + 26, (uint16_t)cluster);
+    if (vol->fatBits == 32)
+    {
+        wr16(dirent + 20, (uint16_t)(cluster >> 16));
+    }
+    wr32(dirent + 28, size);
+}
@@ -0,0 +1,89 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Minimal FAT12/16/32 access to an unmounted boot partition image, enough
+  to read and rewrite small files such as cmdline.txt in place, to list
+  the files of a volume and to allocate clusters for new file contents.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include "fw_target.h"
+
+#define FW_FAT_DIRENT_SIZE      32
+#define FW_FAT_NAME_SLOTS       21      /* long name entries of a 255 character name, and the short entry */
+#define FW_FAT_PATH_MAX         256
+
+typedef struct fw_FatVolume {
+    fw_Target_t *target;
+    uint64_t base;
+    int fatBits;
+    uint32_t bytesPerSector;
+    uint32_t clusterSize;
+    uint64_t fatOffset;
+    uint64_t rootDirOffset;     /* FAT12/16 fixed root directory */
+    uint32_t rootDirEntries;
+    uint32_t rootCluster;       /* FAT32 root directory chain */
+    uint64_t dataOffset;
+    uint32_t clusterCount;
+    uint32_t numFats;
+    uint64_t fatSize;           /* bytes per copy of the FAT */
+    uint64_t fsInfoOffset;      /* FAT32 free cluster hints, 0 if none */
+    uint8_t *table;             /* first FAT, once loaded */
+    uint8_t *dirty;             /* per sector of the table: to be written to every copy */
+    uint32_t allocHint;
+} fw_FatVolume_t;
+
+/* A file or directory found walking a volume */
+typedef struct fw_FatEntry {
+    char path[FW_FAT_PATH_MAX];     /* long names, '/' separated */
+    int parent;                     /* directory holding it, -1 for the root */
+    int isDirectory;
+    uint32_t cluster;               /* first cluster, 0 for an empty file */
+    uint32_t size;
+    int slots;                      /* directory entries of the name, the short entry last */
+    uint64_t slotOffset[FW_FAT_NAME_SLOTS];
+    uint8_t raw[FW_FAT_NAME_SLOTS][FW_FAT_DIRENT_SIZE];
+} fw_FatEntry_t;
+
+typedef struct fw_FatListing {
+    fw_FatEntry_t *entries;         /* a directory comes before what it holds */
+    int count;
+    int capacity;
+    uint32_t metaCrc;               /* CRC32C of the FAT and of every directory */
+} fw_FatListing_t;
+
+/* Receives the content of a file, run by run */
+typedef mfrError_t (*fw_FatData_t)(void *ctx, const uint8_t *data, size_t len);
+
+mfrError_t fwFatOpen(fw_FatVolume_t *vol, fw_Target_t *target, uint64_t base);
+mfrError_t fwFatReadFile(fw_FatVolume_t *vol, const char *name, char *buf, size_t bufLen, size_t *len);
+mfrError_t fwFatRewriteFile(fw_FatVolume_t *vol, const char *name, const char *data, size_t len);
+void fwFatClose(fw_FatVolume_t *vol);
+mfrError_t fwFatList(fw_FatVolume_t *vol, fw_FatListing_t *listing);
+void fwFatListingFree(fw_FatListing_t *listing);
+mfrError_t fwFatReadData(fw_FatVolume_t *vol, uint32_t cluster, uint32_t size, uint8_t *buf, size_t bufLen,
+                         fw_FatData_t cb, void *ctx);
+uint64_t fwFatClusterOffset(const fw_FatVolume_t *vol, uint32_t cluster);
+uint32_t fwFatNextCluster(fw_FatVolume_t *vol, uint32_t cluster);
+mfrError_t fwFatAlloc(fw_FatVolume_t *vol, uint32_t count, uint32_t *first);
+void fwFatFree(fw_FatVolume_t *vol, uint32_t first);
+mfrError_t fwFatSyncTable(fw_FatVolume_t *vol);
+mfrError_t fwFatFindFree(fw_FatVolume_t *vol, uint32_t dirCluster, int slots, uint64_t *offset);
+void fwFatSetEntry(const fw_FatVolume_t *vol, uint8_t *dirent, uint32_t cluster, uint32_t size);
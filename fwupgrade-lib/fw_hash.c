@@ -0,0 +1,504 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <pthread.h>
+#include "string.h"
+#include "fw_hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FW_HASH_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+/* built for the baseline, the kernels enable their extension themselves
+   and hashProbeCpu picks them when the cpu has it */
+#define FW_HASH_ARM 1
+#define FW_HASH_ARM_SHA 1
+#define FW_HASH_ARM_CRC 1
+#define FW_TARGET_ARM_SHA   __attribute__((target("+crypto")))
+#define FW_TARGET_ARM_CRC   __attribute__((target("+crc")))
+#include <arm_neon.h>
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__arm__) && defined(__ARM_NEON) && \
+    (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRC32))
+/* 32-bit compilers only take the extensions from the command line */
+#define FW_HASH_ARM 1
+#if defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2)
+#define FW_HASH_ARM_SHA 1
+#endif
+#ifdef __ARM_FEATURE_CRC32
+#define FW_HASH_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+#define FW_TARGET_ARM_SHA
+#define FW_TARGET_ARM_CRC
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#define CRC32C_POLY     0x82f63b78u     /* Castagnoli, reflected */
+
+typedef void (*fw_Sha256Blocks_t)(uint32_t state[8], const uint8_t *data, size_t blocks);
+typedef uint32_t (*fw_Crc32c_t)(uint32_t crc, const uint8_t *data, size_t len);
+
+static const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static pthread_once_t g_hashOnce = PTHREAD_ONCE_INIT;
+static fw_Sha256Blocks_t g_sha256Blocks;
+static fw_Crc32c_t g_crc32c;
+static const char *g_shaName = "portable";
+static const char *g_crcName = "portable";
+static char g_backendName[64];
+static uint32_t g_crcTable[8][256];
+
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256BlocksPortable(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    uint32_t w[64];
+    int i;
+
+    while (blocks--)
+    {
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (i = 0; i < 16; i++)
+        {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | data[i * 4 + 3];
+        }
+        for (i = 16; i < 64; i++)
+        {
+            uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        for (i = 0; i < 64; i++)
+        {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += FW_SHA256_BLOCK_SIZE;
+    }
+}
+
+/* slice-by-8, eight bytes per table round */
+static uint32_t crc32cPortable(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while (len && ((uintptr_t)data & 7))
+    {
+        crc = g_crcTable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = g_crcTable[7][lo & 0xff] ^ g_crcTable[6][(lo >> 8) & 0xff] ^
+              g_crcTable[5][(lo >> 16) & 0xff] ^ g_crcTable[4][lo >> 24] ^
+              g_crcTable[3][hi & 0xff] ^ g_crcTable[2][(hi >> 8) & 0xff] ^
+              g_crcTable[1][(hi >> 16) & 0xff] ^ g_crcTable[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while (len--)
+    {
+        crc = g_crcTable[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef FW_HASH_X86
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256BlocksShaNi(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    __m128i state0;
+    __m128i m[4];
+    int i;
+
+    // the instructions want the state as ABEF/CDGH
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    while (blocks--)
+    {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+
+        for (i = 0; i < 4; i++)
+        {
+            m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+        }
+        for (i = 0; i < 16; i++)
+        {
+            __m128i msg;
+            if (i >= 4)
+            {
+                msg = _mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]),
+                                    _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+                m[i & 3] = _mm_sha256msg2_epu32(msg, m[(i + 3) & 3]);
+            }
+            msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&K256[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += FW_SHA256_BLOCK_SIZE;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+        data += 4;
+        len -= 4;
+    }
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+static void hashProbeCpu(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int ecx1 = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx1, &edx) && (ecx1 & bit_SSE4_2))
+    {
+        g_crc32c = crc32cSse42;
+        g_crcName = "sse4.2";
+    }
+    if ((ecx1 & bit_SSSE3) && (ecx1 & bit_SSE4_1) &&
+        __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29)))
+    {
+        g_sha256Blocks = sha256BlocksShaNi;
+        g_shaName = "sha-ni";
+    }
+}
+
+#elif defined(FW_HASH_ARM)
+
+#ifdef FW_HASH_ARM_SHA
+FW_TARGET_ARM_SHA
+static void sha256BlocksArmCe(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+    uint32x4_t m[4];
+    int i;
+
+    while (blocks--)
+    {
+        uint32x4_t abcd = state0;
+        uint32x4_t efgh = state1;
+
+        for (i = 0; i < 4; i++)
+        {
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+        }
+        for (i = 0; i < 16; i++)
+        {
+            uint32x4_t msg, prev;
+            if (i >= 4)
+            {
+                m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]);
+            }
+            msg = vaddq_u32(m[i & 3], vld1q_u32(&K256[i * 4]));
+            prev = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, prev, msg);
+        }
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+        data += FW_SHA256_BLOCK_SIZE;
+    }
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+#endif
+
+#ifdef FW_HASH_ARM_CRC
+FW_TARGET_ARM_CRC
+static uint32_t crc32cArm(uint32_t crc, const uint8_t *data, size_t len)
+{
+#ifdef __aarch64__
+    while (len >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        len -= 8;
+    }
+#endif
+    while (len >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, data, 4);
+        crc = __crc32cw(crc, word);
+        data += 4;
+        len -= 4;
+    }
+    while (len--)
+    {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#endif
+
+static void hashProbeCpu(void)
+{
+#ifdef __aarch64__
+    unsigned long caps = getauxval(AT_HWCAP);
+    unsigned long shaCap = HWCAP_SHA2;
+    unsigned long crcCap = HWCAP_CRC32;
+#else
+    unsigned long caps = getauxval(AT_HWCAP2);
+    unsigned long shaCap = HWCAP2_SHA2;
+    unsigned long crcCap = HWCAP2_CRC32;
+#endif
+
+#ifdef FW_HASH_ARM_SHA
+    if (caps & shaCap)
+    {
+        g_sha256Blocks = sha256BlocksArmCe;
+        g_shaName = "armv8-ce";
+    }
+#endif
+#ifdef FW_HASH_ARM_CRC
+    if (caps & crcCap)
+    {
+        g_crc32c = crc32cArm;
+        g_crcName = "armv8-crc";
+    }
+#endif
+    (void)shaCap;
+    (void)crcCap;
+}
+
+#else
+
+static void hashProbeCpu(void)
+{
+}
+
+#endif
+
+static void hashInit(void)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (j = 0; j < 8; j++)
+        {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        }
+        g_crcTable[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+        {
+            g_crcTable[j][i] = g_crcTable[0][g_crcTable[j - 1][i] & 0xff] ^ (g_crcTable[j - 1][i] >> 8);
+        }
+    }
+    g_sha256Blocks = sha256BlocksPortable;
+    g_crc32c = crc32cPortable;
+    hashProbeCpu();
+    snprintf(g_backendName, sizeof(g_backendName), "sha256 %s, crc32c %s", g_shaName, g_crcName);
+}
+
+const char *fwHashBackend(void)
+{
+    pthread_once(&g_hashOnce, hashInit);
+    return g_backendName;
+}
+
+void fwSha256Init(fw_Sha256_t *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    pthread_once(&g_hashOnce, hashInit);
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->bufLen = 0;
+    ctx->total = 0;
+}
+
+void fwSha256Update(fw_Sha256_t *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    ctx->total += len;
+    if (ctx->bufLen)
+    {
+        size_t take = FW_SHA256_BLOCK_SIZE - ctx->bufLen;
+        take = take < len ? take : len;
+        memcpy(ctx->buf + ctx->bufLen, p, take);
+        ctx->bufLen += take;
+        p += take;
+        len -= take;
+        if (ctx->bufLen < FW_SHA256_BLOCK_SIZE)
+        {
+            return;
+        }
+        g_sha256Blocks(ctx->state, ctx->buf, 1);
+        ctx->bufLen = 0;
+    }
+    if (len >= FW_SHA256_BLOCK_SIZE)
+    {
+        // whole blocks straight from the caller's buffer
+        g_sha256Blocks(ctx->state, p, len / FW_SHA256_BLOCK_SIZE);
+        p += len & ~(size_t)(FW_SHA256_BLOCK_SIZE - 1);
+        len &= FW_SHA256_BLOCK_SIZE - 1;
+    }
+    memcpy(ctx->buf, p, len);
+    ctx->bufLen = len;
+}
+
+void fwSha256Final(fw_Sha256_t *ctx, uint8_t digest[FW_SHA256_SIZE])
+{
+    uint64_t bits = ctx->total * 8;
+    int i;
+
+    ctx->buf[ctx->bufLen++] = 0x80;
+    if (ctx->bufLen > FW_SHA256_BLOCK_SIZE - 8)
+    {
+        memset(ctx->buf + ctx->bufLen, 0, FW_SHA256_BLOCK_SIZE - ctx->bufLen);
+        g_sha256Blocks(ctx->state, ctx->buf, 1);
+        ctx->bufLen = 0;
+    }
+    memset(ctx->buf + ctx->bufLen, 0, FW_SHA256_BLOCK_SIZE - 8 - ctx->bufLen);
+    for (i = 0; i < 8; i++)
+    {
+        ctx->buf[FW_SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bits >> (i * 8));
+    }
+    g_sha256Blocks(ctx->state, ctx->buf, 1);
+    for (i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void fwSha256(const void *data, size_t len, uint8_t digest[FW_SHA256_SIZE])
+{
+    fw_Sha256_t ctx;
+
+    fwSha256Init(&ctx);
+    fwSha256Update(&ctx, data, len);
+    fwSha256Final(&ctx, digest);
+}
+
+void fwSha256Hex(const uint8_t digest[FW_SHA256_SIZE], char hex[2 * FW_SHA256_SIZE + 1])
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < FW_SHA256_SIZE; i++)
+    {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 0xf];
+    }
+    hex[2 * FW_SHA256_SIZE] = '\0';
+}
+
+uint32_t fwCrc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&g_hashOnce, hashInit);
+    return ~g_crc32c(~crc, (const uint8_t *)data, len);
+}
@@ -0,0 +1,50 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Streaming SHA-256 and CRC32C. The CPU is probed once and the SHA and
+  CRC instructions are used when present (x86 SHA-NI/SSE4.2, ARMv8
+  crypto/CRC extensions), portable code is used otherwise.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FW_SHA256_SIZE          32
+#define FW_SHA256_BLOCK_SIZE    64
+
+typedef struct fw_Sha256 {
+    uint32_t state[8];
+    uint8_t buf[FW_SHA256_BLOCK_SIZE];
+    size_t bufLen;
+    uint64_t total;
+} fw_Sha256_t;
+
+void fwSha256Init(fw_Sha256_t *ctx);
+void fwSha256Update(fw_Sha256_t *ctx, const void *data, size_t len);
+void fwSha256Final(fw_Sha256_t *ctx, uint8_t digest[FW_SHA256_SIZE]);
+void fwSha256(const void *data, size_t len, uint8_t digest[FW_SHA256_SIZE]);
+void fwSha256Hex(const uint8_t digest[FW_SHA256_SIZE], char hex[2 * FW_SHA256_SIZE + 1]);
+
+/* Start with crc 0; the result can be fed back in to continue a stream */
+uint32_t fwCrc32c(uint32_t crc, const void *data, size_t len);
+
+/* Names of the implementations picked for this CPU, for the logs */
+const char *fwHashBackend(void);
@@ -0,0 +1,284 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+  Resume journal of the rootfs bank, see fw_journal.h.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "string.h"
+#include "fw_journal.h"
+
+#define FW_JOURNAL_MAGIC        "FWJRNL1"
+
+/* The journal file: this header, then the CRC32C of the blocks below durable */
+typedef struct fw_JournalHeader {
+    char magic[8];
+    fw_JournalKey_t key;
+    uint64_t length;
+    uint64_t durable;
+    uint32_t blocks;
+    uint32_t crc;                   /* CRC32C of the header, with this field zeroed, then of the block CRCs */
+} fw_JournalHeader_t;
+
+static uint32_t journalBlocks(const fw_Journal_t *journal, uint64_t bytes)
+{
+    return (uint32_t)((bytes + journal->key.blockSize - 1) / journal->key.blockSize);
+}
+
+static int journalReadAll(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = read(fd, (uint8_t *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int journalWriteAll(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = write(fd, (const uint8_t *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* A rename or unlink is only on the media once its directory is synced */
+static void journalSyncDir(const char *path)
+{
+    char dir[PATH_MAX];
+    char *slash;
+    int fd;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (!slash)
+    {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    else
+    {
+        slash[slash == dir ? 1 : 0] = '\0';
+    }
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static void journalDrop(fw_Journal_t *journal)
+{
+    if (unlink(journal->path) == 0)
+    {
+        journalSyncDir(journal->path);
+    }
+    journal->durable = 0;
+    journal->resumable = 0;
+}
+
+/********************************************************************
+   Functiona Name: fwJournalOpen
+   Description   : starts journaling the flash described by key. A
+                   journal file left by another package or another
+                   bank is removed before the bank is touched, it
+                   would vouch for blocks about to be overwritten.
+   Input:    path - journal file, key
+   Output:   journal
+   Returns:  None
+
+*********************************************************************/
+
+void fwJournalOpen(fw_Journal_t *journal, const char *path, const fw_JournalKey_t *key)
+{
+    fw_JournalHeader_t head;
+    int fd;
+
+    memset(journal, 0, sizeof(*journal));
+    journal->active = 1;
+    journal->key = *key;
+    snprintf(journal->path, sizeof(journal->path), "%s", path);
+    fd = open(journal->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    if (journalReadAll(fd, &head, sizeof(head)) == 0 && !memcmp(head.magic, FW_JOURNAL_MAGIC, sizeof(head.magic)) &&
+        !memcmp(&head.key, key, sizeof(*key)))
+    {
+        journal->length = head.length;
+        journal->durable = head.durable;
+        close(fd);
+        return;
+    }
+    close(fd);
+    printf("%s was left by another upgrade, starting over\n", journal->path);
+    journalDrop(journal);
+}
+
+/********************************************************************
+   Functiona Name: fwJournalAttach
+   Description   : loads the block CRCs of a journal left by the same
+                   upgrade, once the length of the rootfs is known.
+                   A damaged journal is dropped.
+   Input:    journal, length - of the rootfs, crc - room for the CRC
+             of every block of length
+   Output:   journal->crc, owned by the caller, journal->resumable
+   Returns:  bytes of the rootfs already on the media
+
+*********************************************************************/
+
+uint64_t fwJournalAttach(fw_Journal_t *journal, uint64_t length, uint32_t *crc)
+{
+    fw_JournalHeader_t head;
+    uint32_t check;
+    int ok = 0;
+    int fd;
+
+    if (!journal->active)
+    {
+        return 0;
+    }
+    journal->length = length;
+    journal->crc = crc;
+    if (!journal->durable)
+    {
+        return 0;
+    }
+    fd = open(journal->path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && journalReadAll(fd, &head, sizeof(head)) == 0 && head.length == length &&
+        head.durable == journal->durable && head.durable <= length && head.blocks == journalBlocks(journal, head.durable) &&
+        journalReadAll(fd, crc, (size_t)head.blocks * sizeof(uint32_t)) == 0)
+    {
+        check = head.crc;
+        head.crc = 0;
+        ok = fwCrc32c(fwCrc32c(0, &head, sizeof(head)), crc, (size_t)head.blocks * sizeof(uint32_t)) == check;
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (!ok)
+    {
+        printf("%s is damaged or was left by another image, starting over\n", journal->path);
+        journalDrop(journal);
+        return 0;
+    }
+    journal->resumable = journal->durable;
+    return journal->resumable;
+}
+
+int fwJournalHas(const fw_Journal_t *journal, uint64_t offset, size_t len, uint32_t crc)
+{
+    return journal->active && offset + len <= journal->resumable &&
+           journal->crc[offset / journal->key.blockSize] == crc;
+}
+
+/********************************************************************
+   Functiona Name: fwJournalRecord
+   Description   : replaces the journal file with one vouching for the
+                   bank up to durable. The caller has synced the bank
+                   first. Moving durable back is how a block the
+                   journal vouches for gets rewritten safely.
+   Input:    journal, durable - bytes of the rootfs on the media,
+             crc - CRC32C of its blocks
+   Output:   None
+   Returns:  mfrERR_NONE once the journal is on the media
+
+*********************************************************************/
+
+mfrError_t fwJournalRecord(fw_Journal_t *journal, uint64_t durable, const uint32_t *crc)
+{
+    fw_JournalHeader_t head;
+    char tmp[PATH_MAX];
+    int failed;
+    int fd;
+
+    if (!journal->active)
+    {
+        return mfrERR_NONE;
+    }
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, FW_JOURNAL_MAGIC, sizeof(head.magic));
+    head.key = journal->key;
+    head.length = journal->length;
+    head.durable = durable;
+    head.blocks = journalBlocks(journal, durable);
+    head.crc = fwCrc32c(fwCrc32c(0, &head, sizeof(head)), crc, (size_t)head.blocks * sizeof(uint32_t));
+
+    // a cut name would rename some other file over the journal
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", journal->path) >= (int)sizeof(tmp))
+    {
+        printf("journal path %s is too long %s:%d \n", journal->path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("failed to create %s %s:%d \n", tmp, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    failed = journalWriteAll(fd, &head, sizeof(head)) != 0 ||
+             journalWriteAll(fd, crc, (size_t)head.blocks * sizeof(uint32_t)) != 0 || fdatasync(fd) != 0;
+    failed |= close(fd) != 0;
+    if (failed || rename(tmp, journal->path) < 0)
+    {
+        printf("failed to write %s %s:%d \n", journal->path, __FUNCTION__, __LINE__);
+        unlink(tmp);
+        return mfrERR_GENERAL;
+    }
+    journalSyncDir(journal->path);
+    journal->durable = durable;
+    return mfrERR_NONE;
+}
+
+/* The bank is complete or cannot be trusted, nothing is left to resume */
+void fwJournalRemove(fw_Journal_t *journal)
+{
+    if (journal->active)
+    {
+        journalDrop(journal);
+    }
+}
@@ -0,0 +1,66 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Resume journal of the rootfs bank. While a bank is written, a small
+  file in the work directory on the storage partition records which
+  package goes to which bank, how much of the bank is known to be on
+  the media and the CRC32C of every block below that point. It is only
+  ever replaced whole, through a temporary file. When an interrupted
+  upgrade of the same package to the same bank runs again, it leaves
+  the blocks the journal vouches for alone. A block whose CRC differs
+  is written again.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <mfrApi.h>
+#include "fw_hash.h"
+
+/* What the journal is valid for, all of it has to match */
+typedef struct fw_JournalKey {
+    uint8_t package[FW_SHA256_SIZE];    /* digest of the package */
+    uint32_t bank;
+    uint32_t bankPath;                  /* CRC32C of the bank device */
+    uint64_t bankBase;                  /* start of the bank on the disk, 0 for a partition device */
+    uint32_t blockSize;
+    uint32_t sparse;                    /* free space was left unwritten */
+} fw_JournalKey_t;
+
+typedef struct fw_Journal {
+    int active;
+    char path[PATH_MAX];
+    fw_JournalKey_t key;
+    uint64_t length;                /* of the rootfs */
+    uint64_t resumable;             /* on the media when the flash started */
+    uint32_t *crc;                  /* CRC32C of the blocks below resumable */
+    uint64_t durable;               /* what the journal file says, moves as the flash goes */
+} fw_Journal_t;
+
+/* Drops the journal file unless it was written for key */
+void fwJournalOpen(fw_Journal_t *journal, const char *path, const fw_JournalKey_t *key);
+/* Loads the block CRCs into crc, room for the blocks of length, returns the bytes to resume from */
+uint64_t fwJournalAttach(fw_Journal_t *journal, uint64_t length, uint32_t *crc);
+/* The block is on the media already */
+int fwJournalHas(const fw_Journal_t *journal, uint64_t offset, size_t len, uint32_t crc);
+/* Everything below durable is on the media, crc holds the CRC32C of its blocks */
+mfrError_t fwJournalRecord(fw_Journal_t *journal, uint64_t durable, const uint32_t *crc);
+void fwJournalRemove(fw_Journal_t *journal);
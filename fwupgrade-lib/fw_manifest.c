@@ -0,0 +1,878 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  The sync only handles the usual case of a release changing some
+  files: the directories of both volumes must match and a new file
+  must not take a short name the live directory already uses. Anything
+  else returns mfrERR_OPERATION_NOT_SUPPORTED and the caller copies
+  the whole image as before. The old clusters of a file are freed once its entry
+  points at the new ones, so a crash leaks clusters at worst.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <strings.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "string.h"
+#include "fw_manifest.h"
+#include "fw_fat.h"
+#include "fw_hash.h"
+
+#define FW_MANIFEST_HEADER      "fwupgrade boot manifest 1"
+#define FW_MANIFEST_BUF_SIZE    (1024 * 1024)
+#define FW_MANIFEST_LINE_MAX    (2 * FW_SHA256_SIZE + FW_FAT_PATH_MAX + 32)
+
+typedef struct fw_ManifestFile {
+    char path[FW_FAT_PATH_MAX];
+    uint32_t size;
+    uint8_t digest[FW_SHA256_SIZE];
+} fw_ManifestFile_t;
+
+typedef struct fw_Manifest {
+    uint32_t metaCrc;
+    fw_ManifestFile_t *files;
+    int count;
+} fw_Manifest_t;
+
+/* Writes a file into a chain of the live volume, run by run */
+typedef struct fw_ManifestCopy {
+    fw_FatVolume_t *vol;
+    uint32_t cluster;
+    uint32_t used;              /* bytes of the current cluster already written */
+} fw_ManifestCopy_t;
+
+static mfrError_t manifestExportRun(void *ctx, const uint8_t *data, size_t len)
+{
+    int fd = *(int *)ctx;
+
+    while (len)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return mfrERR_GENERAL;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t manifestHashRun(void *ctx, const uint8_t *data, size_t len)
+{
+    fwSha256Update((fw_Sha256_t *)ctx, data, len);
+    return mfrERR_NONE;
+}
+
+static mfrError_t manifestCopyRun(void *ctx, const uint8_t *data, size_t len)
+{
+    fw_ManifestCopy_t *copy = (fw_ManifestCopy_t *)ctx;
+    fw_FatVolume_t *vol = copy->vol;
+    uint32_t clusterSize = vol->clusterSize;
+
+    while (len)
+    {
+        uint32_t last = copy->cluster;
+        uint64_t room = clusterSize - copy->used;
+        uint64_t pos;
+        size_t take;
+        mfrError_t ret;
+
+        if (!copy->cluster)
+        {
+            return mfrERR_GENERAL;
+        }
+        // one write for clusters allocated in a row
+        while (room < len && fwFatNextCluster(vol, last) == last + 1)
+        {
+            last++;
+            room += clusterSize;
+        }
+        take = room < len ? (size_t)room : len;
+        ret = fwTargetWrite(vol->target, data, take, fwFatClusterOffset(vol, copy->cluster) + copy->used);
+        if (ret != mfrERR_NONE)
+        {
+            return ret;
+        }
+        pos = copy->used + take;
+        copy->cluster += (uint32_t)((pos - 1) / clusterSize);
+        copy->used = (uint32_t)((pos - 1) % clusterSize + 1);
+        if (copy->used == clusterSize)
+        {
+            copy->cluster = fwFatNextCluster(vol, copy->cluster);
+            copy->used = 0;
+        }
+        data += take;
+        len -= take;
+    }
+    return mfrERR_NONE;
+}
+
+static mfrError_t manifestHashFile(fw_FatVolume_t *vol, const fw_FatEntry_t *entry, uint8_t *buf,
+                                   uint8_t digest[FW_SHA256_SIZE])
+{
+    fw_Sha256_t sha;
+    mfrError_t ret;
+
+    fwSha256Init(&sha);
+    ret = fwFatReadData(vol, entry->cluster, entry->size, buf, FW_MANIFEST_BUF_SIZE, manifestHashRun, &sha);
+    fwSha256Final(&sha, digest);
+    return ret;
+}
+
+/* Index of path in the listing, -1 if it is not there */
+static int manifestFind(const fw_FatListing_t *listing, const char *path)
+{
+    int i;
+
+    for (i = 0; i < listing->count; i++)
+    {
+        if (!strcasecmp(listing->entries[i].path, path))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void manifestFree(fw_Manifest_t *manifest)
+{
+    free(manifest->files);
+    memset(manifest, 0, sizeof(*manifest));
+}
+
+/* Loads a manifest, a missing or damaged one loads empty */
+static void manifestLoad(const char *path, fw_Manifest_t *manifest)
+{
+    char line[FW_MANIFEST_LINE_MAX];
+    FILE *fp = fopen(path, "r");
+    int capacity = 0;
+    int ok = 0;
+
+    memset(manifest, 0, sizeof(*manifest));
+    if (!fp)
+    {
+        return;
+    }
+    if (fgets(line, sizeof(line), fp) && !strncmp(line, FW_MANIFEST_HEADER "\n", sizeof(line)) &&
+        fgets(line, sizeof(line), fp) && sscanf(line, "meta %8x", &manifest->metaCrc) == 1)
+    {
+        ok = 1;
+    }
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        fw_ManifestFile_t *file;
+        char hex[2 * FW_SHA256_SIZE + 1];
+        int pathStart = 0;
+        size_t len;
+        int i;
+
+        if (manifest->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            file = (fw_ManifestFile_t *)realloc(manifest->files, (size_t)capacity * sizeof(*file));
+            if (!file)
+            {
+                ok = 0;
+                break;
+            }
+            manifest->files = file;
+        }
+        file = &manifest->files[manifest->count];
+        len = strlen(line);
+        if (len && line[len - 1] == '\n')
+        {
+            line[--len] = '\0';
+        }
+        if (sscanf(line, "%64s %u %n", hex, &file->size, &pathStart) != 2 || !pathStart ||
+            strlen(hex) != sizeof(hex) - 1 || len - (size_t)pathStart >= sizeof(file->path))
+        {
+            ok = 0;
+            break;
+        }
+        for (i = 0; i < FW_SHA256_SIZE && ok; i++)
+        {
+            unsigned int byte;
+            ok = sscanf(hex + i * 2, "%2x", &byte) == 1;
+            file->digest[i] = (uint8_t)byte;
+        }
+        strcpy(file->path, line + pathStart);
+        manifest->count += ok;
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        printf("ignoring damaged %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        manifestFree(manifest);
+    }
+}
+
+/* Writes the digests of the files of a volume, through a temporary file */
+static mfrError_t manifestSave(const char *path, const fw_FatListing_t *listing, const uint8_t *digests)
+{
+    char tmp[PATH_MAX];
+    char hex[2 * FW_SHA256_SIZE + 1];
+    FILE *fp;
+    int failed;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(fp = fopen(tmp, "w")))
+    {
+        printf("failed to create %s %s:%d \n", tmp, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    fprintf(fp, "%s\nmeta %08x\n", FW_MANIFEST_HEADER, listing->metaCrc);
+    for (i = 0; i < listing->count; i++)
+    {
+        if (!listing->entries[i].isDirectory)
+        {
+            fwSha256Hex(digests + (size_t)i * FW_SHA256_SIZE, hex);
+            fprintf(fp, "%s %u %s\n", hex, listing->entries[i].size, listing->entries[i].path);
+        }
+    }
+    failed = fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    failed |= fclose(fp) != 0;
+    if (failed || rename(tmp, path) < 0)
+    {
+        printf("failed to write %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        unlink(tmp);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+/* Hashes every file of a volume, digests indexed like the listing */
+static mfrError_t manifestHashAll(fw_FatVolume_t *vol, const fw_FatListing_t *listing, uint8_t *buf,
+                                  uint8_t *digests)
+{
+    mfrError_t ret = mfrERR_NONE;
+    int i;
+
+    for (i = 0; i < listing->count && ret == mfrERR_NONE; i++)
+    {
+        if (!listing->entries[i].isDirectory)
+        {
+            ret = manifestHashFile(vol, &listing->entries[i], buf, digests + (size_t)i * FW_SHA256_SIZE);
+        }
+    }
+    return ret;
+}
+
+/* Takes the live digests from the manifest when it describes the volume as it is */
+static int manifestLiveDigests(const char *path, const fw_FatListing_t *live, uint8_t *digests)
+{
+    fw_Manifest_t manifest;
+    int found = 1;
+    int i;
+    int j;
+
+    manifestLoad(path, &manifest);
+    if (!manifest.files || manifest.metaCrc != live->metaCrc)
+    {
+        manifestFree(&manifest);
+        return 0;
+    }
+    for (i = 0; i < live->count && found; i++)
+    {
+        if (live->entries[i].isDirectory)
+        {
+            continue;
+        }
+        found = 0;
+        for (j = 0; j < manifest.count && !found; j++)
+        {
+            if (!strcmp(manifest.files[j].path, live->entries[i].path) && manifest.files[j].size == live->entries[i].size)
+            {
+                memcpy(digests + (size_t)i * FW_SHA256_SIZE, manifest.files[j].digest, FW_SHA256_SIZE);
+                found = 1;
+            }
+        }
+    }
+    manifestFree(&manifest);
+    return found;
+}
+
+/* First cluster of the live directory holding an entry, 0 for the FAT12/16 root */
+static uint32_t manifestDirCluster(const fw_FatVolume_t *vol, const fw_FatListing_t *listing, int parent)
+{
+    if (parent >= 0)
+    {
+        return listing->entries[parent].cluster;
+    }
+    return vol->fatBits == 32 ? vol->rootCluster : 0;
+}
+
+/********************************************************************
+   Functiona Name: manifestPlan
+   Description   : pairs the staged files with the live ones. match[i]
+                   is the live entry of staged entry i, -1 for a new
+                   file. Live files left unpaired are to be removed.
+   Input:    staged, live, vol - the live volume
+   Output:   match, liveMatched
+   Returns:  mfrERR_NONE, mfrERR_OPERATION_NOT_SUPPORTED when the
+             directories differ or a new short name is taken
+
+*********************************************************************/
+
+static mfrError_t manifestPlan(const fw_FatListing_t *staged, const fw_FatListing_t *live, int *match,
+                               int *liveMatched)
+{
+    int i;
+    int j;
+
+    memset(liveMatched, 0, (size_t)live->count * sizeof(*liveMatched));
+    for (i = 0; i < staged->count; i++)
+    {
+        const fw_FatEntry_t *entry = &staged->entries[i];
+
+        match[i] = manifestFind(live, entry->path);
+        if (match[i] >= 0 && live->entries[match[i]].isDirectory != entry->isDirectory)
+        {
+            printf("%s changed type %s:%d \n", entry->path, __FUNCTION__, __LINE__);
+            return mfrERR_OPERATION_NOT_SUPPORTED;
+        }
+        if (match[i] < 0 && entry->isDirectory)
+        {
+            printf("new directory %s %s:%d \n", entry->path, __FUNCTION__, __LINE__);
+            return mfrERR_OPERATION_NOT_SUPPORTED;
+        }
+        if (match[i] >= 0)
+        {
+            liveMatched[match[i]] = 1;
+            continue;
+        }
+        int parent = entry->parent >= 0 ? match[entry->parent] : -1;
+        for (j = 0; j < live->count; j++)
+        {
+            const fw_FatEntry_t *other = &live->entries[j];
+            if (other->parent == parent &&
+                !memcmp(other->raw[other->slots - 1], entry->raw[entry->slots - 1], 11))
+            {
+                printf("short name of %s is taken %s:%d \n", entry->path, __FUNCTION__, __LINE__);
+                return mfrERR_OPERATION_NOT_SUPPORTED;
+            }
+        }
+    }
+    for (j = 0; j < live->count; j++)
+    {
+        if (!liveMatched[j] && live->entries[j].isDirectory)
+        {
+            printf("directory %s is gone %s:%d \n", live->entries[j].path, __FUNCTION__, __LINE__);
+            return mfrERR_OPERATION_NOT_SUPPORTED;
+        }
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: manifestWriteFile
+   Description   : writes a staged file to free clusters of the live
+                   volume and switches its directory entry over: the
+                   data and the chain are flushed before the entry is
+                   written, the old chain is released afterwards
+   Input:    stagedVol, entry, liveVol, liveEntry - NULL for a new
+             file, liveDir - directory to add a new file to, buf
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+static mfrError_t manifestWriteFile(fw_FatVolume_t *stagedVol, const fw_FatEntry_t *entry, fw_FatVolume_t *liveVol,
+                                    const fw_FatEntry_t *liveEntry, uint32_t liveDir, uint8_t *buf)
+{
+    uint32_t count = (uint32_t)(((uint64_t)entry->size + liveVol->clusterSize - 1) / liveVol->clusterSize);
+    uint8_t dirent[FW_FAT_NAME_SLOTS * FW_FAT_DIRENT_SIZE];
+    uint32_t first = 0;
+    uint64_t offset;
+    int slots;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (count)
+    {
+        ret = fwFatAlloc(liveVol, count, &first);
+    }
+    if (ret == mfrERR_NONE && count)
+    {
+        fw_ManifestCopy_t copy = { liveVol, first, 0 };
+        ret = fwFatReadData(stagedVol, entry->cluster, entry->size, buf, FW_MANIFEST_BUF_SIZE, manifestCopyRun, &copy);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatSyncTable(liveVol);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetFlush(liveVol->target);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        fwFatFree(liveVol, first);
+        return ret;
+    }
+
+    if (liveEntry)
+    {
+        // the live name and attributes stay, the times come with the new content
+        slots = 1;
+        offset = liveEntry->slotOffset[liveEntry->slots - 1];
+        memcpy(dirent, liveEntry->raw[liveEntry->slots - 1], FW_FAT_DIRENT_SIZE);
+        memcpy(dirent + 13, entry->raw[entry->slots - 1] + 13, 7);
+        memcpy(dirent + 22, entry->raw[entry->slots - 1] + 22, 4);
+    }
+    else
+    {
+        slots = entry->slots;
+        memcpy(dirent, entry->raw, (size_t)slots * FW_FAT_DIRENT_SIZE);
+        ret = fwFatFindFree(liveVol, liveDir, slots, &offset);
+        if (ret != mfrERR_NONE)
+        {
+            fwFatFree(liveVol, first);
+            return ret;
+        }
+    }
+    fwFatSetEntry(liveVol, dirent + (slots - 1) * FW_FAT_DIRENT_SIZE, first, entry->size);
+    if (slots > 1)
+    {
+        // a long name without its short entry is ignored by every reader
+        ret = fwTargetWrite(liveVol->target, dirent, (size_t)(slots - 1) * FW_FAT_DIRENT_SIZE, offset);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetWrite(liveVol->target, dirent + (slots - 1) * FW_FAT_DIRENT_SIZE, FW_FAT_DIRENT_SIZE,
+                            offset + (uint64_t)(slots - 1) * FW_FAT_DIRENT_SIZE);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatSyncTable(liveVol);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetFlush(liveVol->target);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        printf("failed to write %s %s:%d \n", entry->path, __FUNCTION__, __LINE__);
+        return ret;
+    }
+    if (liveEntry)
+    {
+        fwFatFree(liveVol, liveEntry->cluster);
+    }
+    return mfrERR_NONE;
+}
+
+/* Deletes a live file, its entries first and then its chain */
+static mfrError_t manifestRemoveFile(fw_FatVolume_t *vol, const fw_FatEntry_t *entry)
+{
+    static const uint8_t deleted = 0xe5;
+    mfrError_t ret = mfrERR_NONE;
+    int i;
+
+    for (i = entry->slots - 1; i >= 0 && ret == mfrERR_NONE; i--)
+    {
+        ret = fwTargetWrite(vol->target, &deleted, 1, entry->slotOffset[i]);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        fwFatFree(vol, entry->cluster);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwManifestSync
+   Description   : brings the live boot partition to the content of
+                   the staged image file by file and records the new
+                   manifest. lastFile, cmdline.txt, is switched last so
+                   the new root= only shows once everything else is in
+                   place.
+   Input:    staging, boot, manifestPath, lastFile, readback - read
+             the written files back and compare their digests
+   Output:   stats
+   Returns:  mfrERR_NONE on success, mfrERR_OPERATION_NOT_SUPPORTED
+             when the whole image is to be copied instead
+
+*********************************************************************/
+
+mfrError_t fwManifestSync(fw_Target_t *staging, fw_Target_t *boot, const char *manifestPath, const char *lastFile,
+                          int readback, fw_ManifestStats_t *stats)
+{
+    fw_FatVolume_t stagedVol;
+    fw_FatVolume_t liveVol;
+    fw_FatListing_t staged;
+    fw_FatListing_t live;
+    uint8_t *stagedDigests = NULL;
+    uint8_t *liveDigests = NULL;
+    uint8_t *buf = NULL;
+    int *match = NULL;
+    int *liveMatched = NULL;
+    int *written = NULL;
+    int pass;
+    int i;
+    mfrError_t ret;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&staged, 0, sizeof(staged));
+    memset(&live, 0, sizeof(live));
+    memset(&liveVol, 0, sizeof(liveVol));
+    ret = fwFatOpen(&stagedVol, staging, 0);
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatList(&stagedVol, &staged);
+    }
+    if (ret == mfrERR_NONE && (fwFatOpen(&liveVol, boot, 0) != mfrERR_NONE || fwFatList(&liveVol, &live) != mfrERR_NONE))
+    {
+        printf("no FAT volume on %s %s:%d \n", boot->path, __FUNCTION__, __LINE__);
+        ret = mfrERR_OPERATION_NOT_SUPPORTED;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        stagedDigests = (uint8_t *)calloc((size_t)staged.count + 1, FW_SHA256_SIZE);
+        liveDigests = (uint8_t *)calloc((size_t)live.count + 1, FW_SHA256_SIZE);
+        match = (int *)calloc((size_t)staged.count + 1, sizeof(int));
+        written = (int *)calloc((size_t)staged.count + 1, sizeof(int));
+        liveMatched = (int *)calloc((size_t)live.count + 1, sizeof(int));
+        buf = (uint8_t *)malloc(FW_MANIFEST_BUF_SIZE);
+        if (!stagedDigests || !liveDigests || !match || !written || !liveMatched || !buf)
+        {
+            ret = mfrERR_MALLOC_FAILED;
+        }
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = manifestPlan(&staged, &live, match, liveMatched);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = manifestHashAll(&stagedVol, &staged, buf, stagedDigests);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        stats->fromManifest = manifestLiveDigests(manifestPath, &live, liveDigests);
+        if (!stats->fromManifest)
+        {
+            ret = manifestHashAll(&liveVol, &live, buf, liveDigests);
+        }
+    }
+
+    // everything else first, then lastFile
+    for (pass = 0; pass < 2 && ret == mfrERR_NONE; pass++)
+    {
+        for (i = 0; i < staged.count && ret == mfrERR_NONE; i++)
+        {
+            const fw_FatEntry_t *entry = &staged.entries[i];
+            const fw_FatEntry_t *liveEntry = match[i] >= 0 ? &live.entries[match[i]] : NULL;
+            int isLast = lastFile && !strcasecmp(entry->path, lastFile);
+
+            if (entry->isDirectory || isLast != pass)
+            {
+                continue;
+            }
+            stats->files++;
+            if (liveEntry && liveEntry->size == entry->size &&
+                !memcmp(liveDigests + (size_t)match[i] * FW_SHA256_SIZE, stagedDigests + (size_t)i * FW_SHA256_SIZE,
+                        FW_SHA256_SIZE))
+            {
+                continue;
+            }
+            ret = manifestWriteFile(&stagedVol, entry, &liveVol, liveEntry,
+                                    manifestDirCluster(&liveVol, &live, entry->parent >= 0 ? match[entry->parent] : -1),
+                                    buf);
+            written[i] = 1;
+            stats->changed += liveEntry != NULL;
+            stats->added += liveEntry == NULL;
+            stats->bytesWritten += entry->size;
+        }
+    }
+    for (i = 0; i < live.count && ret == mfrERR_NONE; i++)
+    {
+        if (!liveMatched[i])
+        {
+            ret = manifestRemoveFile(&liveVol, &live.entries[i]);
+            stats->removed++;
+        }
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatSyncTable(&liveVol);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwTargetFlush(boot);
+    }
+
+    // the chains are read from the table in memory, the data from the media
+    fwFatListingFree(&live);
+    if (ret == mfrERR_NONE && readback)
+    {
+        fwTargetDropCache(boot);
+        ret = fwFatList(&liveVol, &live);
+        for (i = 0; i < staged.count && ret == mfrERR_NONE; i++)
+        {
+            uint8_t digest[FW_SHA256_SIZE];
+            int index = written[i] ? manifestFind(&live, staged.entries[i].path) : -1;
+
+            if (index >= 0)
+            {
+                ret = manifestHashFile(&liveVol, &live.entries[index], buf, digest);
+            }
+            if (ret == mfrERR_NONE && written[i] &&
+                (index < 0 || memcmp(digest, stagedDigests + (size_t)i * FW_SHA256_SIZE, FW_SHA256_SIZE)))
+            {
+                printf("%s does not read back as written %s:%d \n", staged.entries[i].path, __FUNCTION__, __LINE__);
+                ret = mfrERR_GENERAL;
+            }
+        }
+        fwFatListingFree(&live);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatList(&liveVol, &live);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        // the live paths keep their case, the digests are those of the staged files
+        uint8_t *digests = (uint8_t *)calloc((size_t)live.count + 1, FW_SHA256_SIZE);
+        for (i = 0; digests && i < live.count; i++)
+        {
+            int index = manifestFind(&staged, live.entries[i].path);
+            if (index >= 0)
+            {
+                memcpy(digests + (size_t)i * FW_SHA256_SIZE, stagedDigests + (size_t)index * FW_SHA256_SIZE,
+                       FW_SHA256_SIZE);
+            }
+        }
+        // the boot partition is up to date, a manifest that fails to save is only rebuilt next time
+        if (!digests || manifestSave(manifestPath, &live, digests) != mfrERR_NONE)
+        {
+            unlink(manifestPath);
+        }
+        free(digests);
+    }
+
+    fwFatListingFree(&live);
+    fwFatListingFree(&staged);
+    fwFatClose(&liveVol);
+    fwFatClose(&stagedVol);
+    free(stagedDigests);
+    free(liveDigests);
+    free(match);
+    free(written);
+    free(liveMatched);
+    free(buf);
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwManifestRecord
+   Description   : records the manifest of the staged image once it
+                   was copied whole to the boot partition
+   Input:    staging, manifestPath
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwManifestRecord(fw_Target_t *staging, const char *manifestPath)
+{
+    fw_FatVolume_t vol;
+    fw_FatListing_t listing;
+    uint8_t *digests = NULL;
+    uint8_t *buf = NULL;
+    mfrError_t ret;
+
+    memset(&listing, 0, sizeof(listing));
+    ret = fwFatOpen(&vol, staging, 0);
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatList(&vol, &listing);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        digests = (uint8_t *)calloc((size_t)listing.count + 1, FW_SHA256_SIZE);
+        buf = (uint8_t *)malloc(FW_MANIFEST_BUF_SIZE);
+        ret = digests && buf ? manifestHashAll(&vol, &listing, buf, digests) : mfrERR_MALLOC_FAILED;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = manifestSave(manifestPath, &listing, digests);
+    }
+    if (ret != mfrERR_NONE)
+    {
+        unlink(manifestPath);
+    }
+    fwFatListingFree(&listing);
+    fwFatClose(&vol);
+    free(digests);
+    free(buf);
+    return ret;
+}
+
+static int manifestRemoveEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Removes a directory tree, nothing there is fine */
+static void manifestRemoveTree(const char *path)
+{
+    nftw(path, manifestRemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* The files and renames under path are only on the media once its file system is synced */
+static mfrError_t manifestSyncFs(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int failed = fd < 0 || syncfs(fd) != 0;
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return failed ? mfrERR_GENERAL : mfrERR_NONE;
+}
+
+/* Writes the files of a volume under root, the listing has directories ahead of what they hold */
+static mfrError_t manifestExportAll(fw_FatVolume_t *vol, const fw_FatListing_t *listing, uint8_t *buf,
+                                    const char *root)
+{
+    char path[PATH_MAX];
+    mfrError_t ret = mfrERR_NONE;
+    int i;
+
+    for (i = 0; ret == mfrERR_NONE && i < listing->count; i++)
+    {
+        const fw_FatEntry_t *entry = &listing->entries[i];
+        int fd;
+
+        if (snprintf(path, sizeof(path), "%s/%s", root, entry->path) >= (int)sizeof(path))
+        {
+            ret = mfrERR_GENERAL;
+        }
+        else if (entry->isDirectory)
+        {
+            ret = mkdir(path, 0755) < 0 && errno != EEXIST ? mfrERR_GENERAL : mfrERR_NONE;
+        }
+        else if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+        {
+            ret = mfrERR_GENERAL;
+        }
+        else
+        {
+            if (entry->size)
+            {
+                ret = fwFatReadData(vol, entry->cluster, entry->size, buf, FW_MANIFEST_BUF_SIZE,
+                                    manifestExportRun, &fd);
+            }
+            if (close(fd) != 0)
+            {
+                ret = mfrERR_GENERAL;
+            }
+        }
+    }
+    if (ret != mfrERR_NONE)
+    {
+        printf("failed to write %s %s:%d \n", path, __FUNCTION__, __LINE__);
+    }
+    return ret;
+}
+
+/********************************************************************
+   Functiona Name: fwManifestExport
+   Description   : copies the files of a FAT image to a directory, the
+                   cp -R of write_kernel_rootfs.sh. They are written to
+                   <dir>.new and swapped in by renames once synced, so
+                   dir, or <dir>.old after a crash, holds one complete
+                   copy or the other.
+   Input:    image - the volume, staged or live, dir
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwManifestExport(fw_Target_t *image, const char *dir)
+{
+    fw_FatVolume_t vol;
+    fw_FatListing_t listing;
+    char tmp[PATH_MAX];
+    char old[PATH_MAX];
+    uint8_t *buf = NULL;
+    mfrError_t ret;
+
+    memset(&listing, 0, sizeof(listing));
+    snprintf(tmp, sizeof(tmp), "%s.new", dir);
+    snprintf(old, sizeof(old), "%s.old", dir);
+    // left behind by an interrupted export, one stopped between its renames leaves the previous copy as old
+    manifestRemoveTree(tmp);
+    if (rename(old, dir) < 0)
+    {
+        manifestRemoveTree(old);
+    }
+
+    ret = fwFatOpen(&vol, image, 0);
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwFatList(&vol, &listing);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        buf = (uint8_t *)malloc(FW_MANIFEST_BUF_SIZE);
+        ret = buf ? mfrERR_NONE : mfrERR_MALLOC_FAILED;
+    }
+    if (ret == mfrERR_NONE && mkdir(tmp, 0755) < 0)
+    {
+        printf("failed to create %s %s:%d \n", tmp, __FUNCTION__, __LINE__);
+        ret = mfrERR_GENERAL;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = manifestExportAll(&vol, &listing, buf, tmp);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = manifestSyncFs(tmp);
+    }
+    if (ret == mfrERR_NONE && ((rename(dir, old) < 0 && errno != ENOENT) || rename(tmp, dir) < 0))
+    {
+        printf("failed to replace %s %s:%d \n", dir, __FUNCTION__, __LINE__);
+        ret = mfrERR_GENERAL;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        manifestSyncFs(dir);
+    }
+    manifestRemoveTree(ret == mfrERR_NONE ? old : tmp);
+    fwFatListingFree(&listing);
+    fwFatClose(&vol);
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,50 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Boot partition sync. The files of the staged boot image are hashed
+  and compared with those of the live boot partition, whose digests
+  come from a manifest kept in the work directory as long as the FAT
+  and the directories are the ones it was written for. Only changed
+  and new files are written, each to free clusters first and then
+  switched over by rewriting its single short directory entry, so the
+  partition holds either the old or the new version of every file.
+  The files of a volume can also be exported to a directory, the
+  backups of the boot partition kept for each bank in the work
+  directory.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <mfrApi.h>
+#include "fw_target.h"
+
+typedef struct fw_ManifestStats {
+    uint32_t files;
+    uint32_t changed;
+    uint32_t added;
+    uint32_t removed;
+    uint64_t bytesWritten;
+    int fromManifest;           /* live digests taken from the manifest, not read */
+} fw_ManifestStats_t;
+
+mfrError_t fwManifestSync(fw_Target_t *staging, fw_Target_t *boot, const char *manifestPath, const char *lastFile,
+                          int readback, fw_ManifestStats_t *stats);
+mfrError_t fwManifestRecord(fw_Target_t *staging, const char *manifestPath);
+mfrError_t fwManifestExport(fw_Target_t *image, const char *dir);
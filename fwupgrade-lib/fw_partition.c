@@ -0,0 +1,368 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include "string.h"
+#include "fw_partition.h"
+
+#define MBR_SIGNATURE_OFFSET    510
+#define MBR_ENTRY_OFFSET        446
+#define MBR_ENTRY_SIZE          16
+#define MBR_TYPE_GPT            0xee
+#define GPT_HEADER_MIN          92
+#define GPT_ENTRY_MIN           128
+#define GPT_MAX_ENTRIES         4096
+#define FW_PART_HEAD_MAX        (1024 * 1024)
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t le64(const uint8_t *p)
+{
+    return (uint64_t)le32(p) | ((uint64_t)le32(p + 4) << 32);
+}
+
+static int mbrIsExtended(uint8_t type)
+{
+    return type == 0x05 || type == 0x0f || type == 0x85;
+}
+
+static int mbrIsProtective(const uint8_t *head)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        if (head[MBR_ENTRY_OFFSET + i * MBR_ENTRY_SIZE + 4] == MBR_TYPE_GPT)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static mfrError_t partAdd(fw_PartTable_t *table, int number, uint64_t start, uint64_t size)
+{
+    fw_Partition_t *part;
+
+    if (table->count == FW_PART_MAX)
+    {
+        printf("too many partitions %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    part = &table->part[table->count++];
+    memset(part, 0, sizeof(*part));
+    part->number = number;
+    part->start = start;
+    part->size = size;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwPartHeadSize
+   Description   : how much of the head of a disk holds its partition
+                   table: the MBR, or up to the end of the GPT entries
+   Input:    head, len - first bytes of the disk, sectorSize
+   Output:   None
+   Returns:  bytes to read before calling fwPartParse
+
+*********************************************************************/
+
+size_t fwPartHeadSize(const uint8_t *head, size_t len, uint32_t sectorSize)
+{
+    if (len < FW_PART_SECTOR_SIZE || !mbrIsProtective(head))
+    {
+        return FW_PART_SECTOR_SIZE;
+    }
+    if (len < (size_t)sectorSize + GPT_HEADER_MIN)
+    {
+        return (size_t)sectorSize * 2;
+    }
+    const uint8_t *hdr = head + sectorSize;
+    uint64_t end = le64(hdr + 72) * sectorSize + (uint64_t)le32(hdr + 80) * le32(hdr + 84);
+    end = end > (uint64_t)sectorSize * 2 ? end : (uint64_t)sectorSize * 2;
+    return end < FW_PART_HEAD_MAX ? (size_t)end : FW_PART_HEAD_MAX;
+}
+
+static mfrError_t partParseGpt(fw_PartTable_t *table, const uint8_t *head, size_t len)
+{
+    uint32_t ss = table->sectorSize;
+    const uint8_t *hdr = head + ss;
+    uint8_t copy[GPT_ENTRY_MIN * 4];
+    uint32_t i;
+
+    if (len < (size_t)ss + GPT_HEADER_MIN || memcmp(hdr, "EFI PART", 8))
+    {
+        printf("protective MBR without GPT header %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    uint32_t hdrSize = le32(hdr + 12);
+    if (hdrSize < GPT_HEADER_MIN || hdrSize > sizeof(copy) || hdrSize > ss)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    memcpy(copy, hdr, hdrSize);
+    memset(copy + 16, 0, 4);
+    if (crc32(0, copy, hdrSize) != le32(hdr + 16))
+    {
+        printf("GPT header checksum mismatch %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+
+    uint64_t entriesLba = le64(hdr + 72);
+    uint32_t entries = le32(hdr + 80);
+    uint32_t entrySize = le32(hdr + 84);
+    if (entrySize < GPT_ENTRY_MIN || entries > GPT_MAX_ENTRIES || entriesLba > len / ss ||
+        entriesLba * ss + (uint64_t)entries * entrySize > len)
+    {
+        printf("GPT entries out of reach %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    const uint8_t *array = head + entriesLba * ss;
+    if (crc32(0, array, entries * entrySize) != le32(hdr + 88))
+    {
+        printf("GPT entries checksum mismatch %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+
+    table->scheme = FW_PART_GPT;
+    for (i = 0; i < entries; i++)
+    {
+        static const uint8_t unused[16];
+        const uint8_t *entry = array + (size_t)i * entrySize;
+        uint64_t first = le64(entry + 32);
+        uint64_t last = le64(entry + 40);
+
+        if (!memcmp(entry, unused, sizeof(unused)))
+        {
+            continue;
+        }
+        if (last < first || partAdd(table, (int)i + 1, first * ss, (last - first + 1) * ss) != mfrERR_NONE)
+        {
+            return mfrERR_INVALID_PARAM;
+        }
+        memcpy(table->part[table->count - 1].typeGuid, entry, 16);
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwPartParse
+   Description   : parses the primary partitions of an MBR or the GPT
+                   from the head of a disk. Logical partitions need
+                   more reads, see fwPartRead.
+   Input:    head, len, sectorSize
+   Output:   table
+   Returns:  mfrERR_NONE, mfrERR_INVALID_PARAM if there is no valid table
+
+*********************************************************************/
+
+mfrError_t fwPartParse(fw_PartTable_t *table, const uint8_t *head, size_t len, uint32_t sectorSize)
+{
+    mfrError_t ret = mfrERR_NONE;
+    int i;
+
+    memset(table, 0, sizeof(*table));
+    table->sectorSize = sectorSize;
+    if (len < FW_PART_SECTOR_SIZE || head[MBR_SIGNATURE_OFFSET] != 0x55 || head[MBR_SIGNATURE_OFFSET + 1] != 0xaa)
+    {
+        printf("no partition table %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    if (mbrIsProtective(head))
+    {
+        return partParseGpt(table, head, len);
+    }
+
+    table->scheme = FW_PART_MBR;
+    for (i = 0; i < 4 && ret == mfrERR_NONE; i++)
+    {
+        const uint8_t *entry = head + MBR_ENTRY_OFFSET + i * MBR_ENTRY_SIZE;
+        uint64_t start = (uint64_t)le32(entry + 8) * sectorSize;
+        uint64_t size = (uint64_t)le32(entry + 12) * sectorSize;
+
+        if (!entry[4] || !size)
+        {
+            continue;
+        }
+        if (mbrIsExtended(entry[4]))
+        {
+            table->extendedStart = start;
+            table->extendedSize = size;
+            continue;
+        }
+        ret = partAdd(table, i + 1, start, size);
+        if (ret == mfrERR_NONE)
+        {
+            table->part[table->count - 1].type = entry[4];
+        }
+    }
+    return ret;
+}
+
+/* Follows the chain of extended boot records, logical partitions are numbered from 5 */
+static mfrError_t partReadLogical(fw_PartTable_t *table, fw_Target_t *disk)
+{
+    uint8_t ebr[FW_PART_SECTOR_SIZE];
+    uint64_t offset = table->extendedStart;
+    int number = 5;
+
+    while (number < 5 + FW_PART_MAX)
+    {
+        if (fwTargetRead(disk, ebr, sizeof(ebr), offset) != mfrERR_NONE ||
+            ebr[MBR_SIGNATURE_OFFSET] != 0x55 || ebr[MBR_SIGNATURE_OFFSET + 1] != 0xaa)
+        {
+            printf("broken extended partition chain at %llu %s:%d \n", (unsigned long long)offset,
+                   __FUNCTION__, __LINE__);
+            return mfrERR_INVALID_PARAM;
+        }
+        const uint8_t *logical = ebr + MBR_ENTRY_OFFSET;
+        const uint8_t *next = logical + MBR_ENTRY_SIZE;
+        if (logical[4] && le32(logical + 12))
+        {
+            if (partAdd(table, number, offset + (uint64_t)le32(logical + 8) * table->sectorSize,
+                        (uint64_t)le32(logical + 12) * table->sectorSize) != mfrERR_NONE)
+            {
+                return mfrERR_INVALID_PARAM;
+            }
+            table->part[table->count - 1].type = logical[4];
+        }
+        number++;
+        if (!mbrIsExtended(next[4]) || !le32(next + 12))
+        {
+            break;
+        }
+        offset = table->extendedStart + (uint64_t)le32(next + 8) * table->sectorSize;
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwPartRead
+   Description   : reads the partition table of a disk, or of a file
+                   holding a disk image
+   Input:    disk
+   Output:   table
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwPartRead(fw_PartTable_t *table, fw_Target_t *disk)
+{
+    uint32_t sectorSize = FW_PART_SECTOR_SIZE;
+    uint8_t *head = NULL;
+    size_t have = 0;
+    size_t need = FW_PART_SECTOR_SIZE;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (disk->isBlockDevice && disk->geometry.logicalBlockSize)
+    {
+        sectorSize = disk->geometry.logicalBlockSize;
+    }
+    while (need > have && ret == mfrERR_NONE)
+    {
+        uint8_t *grown = (uint8_t *)realloc(head, need);
+        if (!grown)
+        {
+            ret = mfrERR_MALLOC_FAILED;
+            break;
+        }
+        head = grown;
+        ret = fwTargetRead(disk, head + have, need - have, have);
+        have = need;
+        need = fwPartHeadSize(head, have, sectorSize);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        ret = fwPartParse(table, head, have, sectorSize);
+    }
+    if (ret == mfrERR_NONE && table->extendedStart)
+    {
+        ret = partReadLogical(table, disk);
+    }
+    free(head);
+    return ret;
+}
+
+const fw_Partition_t *fwPartFind(const fw_PartTable_t *table, int number)
+{
+    int i;
+
+    for (i = 0; i < table->count; i++)
+    {
+        if (table->part[i].number == number)
+        {
+            return &table->part[i];
+        }
+    }
+    return NULL;
+}
+
+/* Partition number a device node stands for, e.g. 3 for /dev/mmcblk0p3, -1 if none */
+int fwPartNumber(const char *device)
+{
+    size_t len = device ? strlen(device) : 0;
+    size_t end = len;
+
+    while (len && device[len - 1] >= '0' && device[len - 1] <= '9')
+    {
+        len--;
+    }
+    return len == end ? -1 : atoi(device + len);
+}
+
+/********************************************************************
+   Functiona Name: fwPartLayout
+   Description   : finds the boot partition, the banks and the storage
+                   partition the configuration names in the live table
+   Input:    table, config
+   Output:   layout
+   Returns:  mfrERR_NONE, mfrERR_INVALID_STATE when a bank is missing
+
+*********************************************************************/
+
+mfrError_t fwPartLayout(const fw_PartTable_t *table, const mfrFWUpgradeConfig_t *config, fw_Layout_t *layout)
+{
+    const char *devices[3] = { config->bootDevice, config->bankDevice[0], config->bankDevice[1] };
+    fw_Partition_t *parts[3] = { &layout->boot, &layout->bank[0], &layout->bank[1] };
+    const fw_Partition_t *part;
+    int i;
+
+    memset(layout, 0, sizeof(*layout));
+    for (i = 0; i < 3; i++)
+    {
+        part = fwPartFind(table, fwPartNumber(devices[i]));
+        if (!part)
+        {
+            printf("no partition for %s %s:%d \n", devices[i], __FUNCTION__, __LINE__);
+            return mfrERR_INVALID_STATE;
+        }
+        *parts[i] = *part;
+    }
+    if (config->storageDevice[0] && (part = fwPartFind(table, fwPartNumber(config->storageDevice))) != NULL)
+    {
+        layout->storage = *part;
+        layout->hasStorage = 1;
+    }
+    return mfrERR_NONE;
+}
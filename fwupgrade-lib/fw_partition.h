@@ -0,0 +1,72 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  MBR and GPT partition tables, of the sdimg in the package as well as
+  of the live device. Partitions are numbered the way the kernel names
+  them: primary MBR entries 1-4, logical partitions from 5, GPT entries
+  from 1.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_target.h"
+
+#define FW_PART_MAX             128
+#define FW_PART_SECTOR_SIZE     512
+
+enum {
+    FW_PART_MBR = 1,
+    FW_PART_GPT,
+};
+
+typedef struct fw_Partition {
+    int number;
+    uint64_t start;             /* bytes from the start of the disk */
+    uint64_t size;              /* bytes */
+    uint8_t type;               /* MBR partition type, 0 on GPT */
+    uint8_t typeGuid[16];       /* GPT partition type, zero on MBR */
+} fw_Partition_t;
+
+typedef struct fw_PartTable {
+    int scheme;
+    uint32_t sectorSize;
+    uint64_t extendedStart;     /* MBR extended partition holding the logical ones, 0 if none */
+    uint64_t extendedSize;
+    int count;
+    fw_Partition_t part[FW_PART_MAX];
+} fw_PartTable_t;
+
+/* Banks as the upgrade sees them, located on the live device */
+typedef struct fw_Layout {
+    fw_Partition_t boot;
+    fw_Partition_t bank[2];
+    fw_Partition_t storage;
+    int hasStorage;
+} fw_Layout_t;
+
+/* Length of the head of a disk fwPartParse needs to see, given its first bytes */
+size_t fwPartHeadSize(const uint8_t *head, size_t len, uint32_t sectorSize);
+mfrError_t fwPartParse(fw_PartTable_t *table, const uint8_t *head, size_t len, uint32_t sectorSize);
+mfrError_t fwPartRead(fw_PartTable_t *table, fw_Target_t *disk);
+const fw_Partition_t *fwPartFind(const fw_PartTable_t *table, int number);
+int fwPartNumber(const char *device);
+mfrError_t fwPartLayout(const fw_PartTable_t *table, const mfrFWUpgradeConfig_t *config, fw_Layout_t *layout);
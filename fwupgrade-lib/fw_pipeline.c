@@ -0,0 +1,145 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "string.h"
+#include "fw_pipeline.h"
+
+#define RING_SPIN_COUNT     64
+/* sleepers re-check the abort flag at least this often */
+#define RING_WAIT_NS        (50 * 1000 * 1000)
+
+uint64_t fwNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint32_t fwRingSize(uint32_t depth)
+{
+    uint32_t size = 1;
+
+    while (size < depth)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+void fwRingInit(fw_Ring_t *ring, fw_Block_t **slots, uint32_t size)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = slots;
+    ring->size = size;
+}
+
+void fwRingReset(fw_Ring_t *ring, _Atomic int *abort)
+{
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    ring->peak = 0;
+    ring->abort = abort;
+}
+
+void fwRingWake(fw_Ring_t *ring)
+{
+    atomic_fetch_add(&ring->seq, 1);
+    if (atomic_load(&ring->sleepers))
+    {
+        syscall(SYS_futex, &ring->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Blocks until ready() holds, returns -1 when the pipeline got aborted */
+static int ringWait(fw_Ring_t *ring, int (*ready)(fw_Ring_t *), uint64_t *stallNs)
+{
+    uint64_t start = 0;
+    int spin = 0;
+
+    while (!ready(ring))
+    {
+        if (atomic_load(ring->abort))
+        {
+            return -1;
+        }
+        if (!start)
+        {
+            start = fwNowNs();
+        }
+        if (spin++ < RING_SPIN_COUNT)
+        {
+            continue;
+        }
+        uint32_t seq = atomic_load(&ring->seq);
+        atomic_fetch_add(&ring->sleepers, 1);
+        if (!ready(ring) && !atomic_load(ring->abort))
+        {
+            struct timespec timeout = { 0, RING_WAIT_NS };
+            syscall(SYS_futex, &ring->seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+        }
+        atomic_fetch_sub(&ring->sleepers, 1);
+    }
+    if (start && stallNs)
+    {
+        *stallNs += fwNowNs() - start;
+    }
+    return 0;
+}
+
+static int ringHasRoom(fw_Ring_t *ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail) < ring->size;
+}
+
+static int ringHasData(fw_Ring_t *ring)
+{
+    return atomic_load(&ring->head) != atomic_load(&ring->tail);
+}
+
+int fwRingPush(fw_Ring_t *ring, fw_Block_t *block, uint64_t *stallNs)
+{
+    if (ringWait(ring, ringHasRoom, stallNs) < 0)
+    {
+        return -1;
+    }
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->slots[head & (ring->size - 1)] = block;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    fwRingWake(ring);
+    return 0;
+}
+
+int fwRingPop(fw_Ring_t *ring, fw_Block_t **block, uint64_t *stallNs)
+{
+    if (ringWait(ring, ringHasData, stallNs) < 0)
+    {
+        return -1;
+    }
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t queued = atomic_load_explicit(&ring->head, memory_order_relaxed) - tail;
+    ring->peak = queued > ring->peak ? queued : ring->peak;
+    *block = ring->slots[tail & (ring->size - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    fwRingWake(ring);
+    return 0;
+}
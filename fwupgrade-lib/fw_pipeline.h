@@ -0,0 +1,74 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Building blocks of the flashing pipeline: preallocated data blocks and
+  bounded single-producer/single-consumer rings handing them from one
+  stage thread to the next. Rings are lock free; a stage only sleeps in
+  the kernel (futex) when its ring is empty or full.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <mfrApi.h>
+
+typedef struct fw_Block {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    uint64_t offset;            /* offset on the target */
+    int route;
+    uint64_t *dirty;            /* granules left to write, NULL for the whole block */
+    unsigned int pending;       /* writes of the block still in flight */
+} fw_Block_t;
+
+typedef struct fw_Ring {
+    fw_Block_t **slots;
+    uint32_t size;
+    _Atomic uint32_t head;      /* advanced by the producer only */
+    _Atomic uint32_t tail;      /* advanced by the consumer only */
+    _Atomic uint32_t seq;       /* futex word, bumped on every push and pop */
+    _Atomic int sleepers;
+    _Atomic int *abort;
+    uint32_t peak;              /* most blocks queued, seen by the consumer */
+} fw_Ring_t;
+
+typedef struct fw_StageStats {
+    const char *name;
+    uint64_t blocks;
+    uint64_t bytes;             /* handed to the next stage, submitted to the target by the writer */
+    uint64_t stallInNs;         /* waiting for work from the previous stage */
+    uint64_t stallOutNs;        /* waiting for room in the next stage */
+    uint32_t peakQueue;         /* most blocks waiting for the stage */
+} fw_StageStats_t;
+
+uint64_t fwNowNs(void);
+
+/* Slots of a ring holding up to depth blocks, a power of two */
+uint32_t fwRingSize(uint32_t depth);
+/* slots - size entries, kept by the caller */
+void fwRingInit(fw_Ring_t *ring, fw_Block_t **slots, uint32_t size);
+/* Empties the ring before a run of the pipeline, abort stops the run */
+void fwRingReset(fw_Ring_t *ring, _Atomic int *abort);
+/* Both return -1 once the pipeline is aborted. A NULL block marks the end of the stream. */
+int fwRingPush(fw_Ring_t *ring, fw_Block_t *block, uint64_t *stallNs);
+int fwRingPop(fw_Ring_t *ring, fw_Block_t **block, uint64_t *stallNs);
+void fwRingWake(fw_Ring_t *ring);
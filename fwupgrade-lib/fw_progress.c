@@ -0,0 +1,165 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <time.h>
+#include "string.h"
+#include "fw_progress.h"
+
+/* the last percent is only reported once the upgrade has completed */
+#define PROGRESS_MAX_RUNNING    99
+
+/********************************************************************
+   Functiona Name: fwProgressNotify
+   Description   : samples the engine counters and calls the client
+   Input:    progress, state, error
+   Output:   callback invocation
+   Returns:  None
+
+*********************************************************************/
+
+void fwProgressNotify(fw_Progress_t *progress, mfrUpgradeProgress_t state, mfrError_t error)
+{
+    const fw_EngineStats_t *stats = progress->stats;
+    mfrUpgradeStatusEx_t status;
+    uint64_t now = fwNowNs();
+    uint64_t consumed = atomic_load_explicit(&stats->bytesConsumed, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&stats->bytesTotal, memory_order_relaxed);
+    uint64_t elapsed = now - progress->startNs;
+    uint64_t sinceLast = now - progress->lastNs;
+
+    memset(&status, 0, sizeof(status));
+    status.status.progress = state;
+    status.status.error = error;
+    status.bytesConsumed = consumed;
+    status.bytesTotal = total;
+    status.bytesWritten = atomic_load_explicit(&stats->bytesWritten, memory_order_relaxed);
+    status.throughput = sinceLast ? (consumed - progress->lastConsumed) * 1000000000ull / sinceLast : 0;
+    status.avgThroughput = elapsed ? consumed * 1000000000ull / elapsed : 0;
+    status.etaSeconds = -1;
+
+    if (state == mfrUPGRADE_PROGRESS_COMPLETED)
+    {
+        status.status.percentage = 100;
+        status.etaSeconds = 0;
+    }
+    else if (state == mfrUPGRADE_PROGRESS_STARTED && total)
+    {
+        uint64_t percentage = consumed * 100 / total;
+        status.status.percentage = percentage < PROGRESS_MAX_RUNNING ? (int)percentage : PROGRESS_MAX_RUNNING;
+        if (status.avgThroughput && consumed <= total)
+        {
+            status.etaSeconds = (int)((total - consumed) / status.avgThroughput);
+        }
+    }
+    progress->lastNs = now;
+    progress->lastConsumed = consumed;
+
+    if (progress->notify.cbEx)
+    {
+        progress->notify.cbEx(status, progress->notify.cbData);
+    }
+    else if (progress->notify.cb)
+    {
+        progress->notify.cb(status.status, progress->notify.cbData);
+    }
+}
+
+static void *progressThread(void *arg)
+{
+    fw_Progress_t *progress = (fw_Progress_t *)arg;
+    uint64_t deadline = progress->startNs;
+
+    pthread_mutex_lock(&progress->lock);
+    while (!progress->stop)
+    {
+        struct timespec ts;
+        deadline += (uint64_t)progress->notify.interval * 1000000000ull;
+        ts.tv_sec = (time_t)(deadline / 1000000000ull);
+        ts.tv_nsec = (long)(deadline % 1000000000ull);
+        while (!progress->stop && pthread_cond_timedwait(&progress->cond, &progress->lock, &ts) == 0);
+        if (!progress->stop)
+        {
+            pthread_mutex_unlock(&progress->lock);
+            fwProgressNotify(progress, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE);
+            pthread_mutex_lock(&progress->lock);
+        }
+    }
+    pthread_mutex_unlock(&progress->lock);
+    return NULL;
+}
+
+/********************************************************************
+   Functiona Name: fwProgressStart
+   Description   : reports the start of the upgrade and arms the
+                   interval timer. An interval of 0 means the client
+                   only wants the final result.
+   Input:    progress, notify, stats
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwProgressStart(fw_Progress_t *progress, const fw_Notify_t *notify, fw_EngineStats_t *stats)
+{
+    pthread_condattr_t attr;
+
+    memset(progress, 0, sizeof(*progress));
+    progress->notify = *notify;
+    progress->stats = stats;
+    progress->startNs = fwNowNs();
+    progress->lastNs = progress->startNs;
+    if (notify->interval <= 0)
+    {
+        return mfrERR_NONE;
+    }
+
+    pthread_mutex_init(&progress->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&progress->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    fwProgressNotify(progress, mfrUPGRADE_PROGRESS_STARTED, mfrERR_NONE);
+    if (pthread_create(&progress->tid, NULL, progressThread, progress) != 0)
+    {
+        printf("failed to start progress timer %s:%d \n", __FUNCTION__, __LINE__);
+        pthread_cond_destroy(&progress->cond);
+        pthread_mutex_destroy(&progress->lock);
+        return mfrERR_GENERAL;
+    }
+    progress->running = 1;
+    return mfrERR_NONE;
+}
+
+void fwProgressStop(fw_Progress_t *progress)
+{
+    if (!progress->running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&progress->lock);
+    progress->stop = 1;
+    pthread_cond_signal(&progress->cond);
+    pthread_mutex_unlock(&progress->lock);
+    pthread_join(progress->tid, NULL);
+    pthread_cond_destroy(&progress->cond);
+    pthread_mutex_destroy(&progress->lock);
+    progress->running = 0;
+}
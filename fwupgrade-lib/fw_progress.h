@@ -0,0 +1,53 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Progress reporter. A timer thread samples the engine byte counters
+  every notify interval and calls the client back, so a slow callback
+  never holds up the flashing pipeline.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <pthread.h>
+#include <mfrApi.h>
+#include "fw_engine.h"
+
+typedef struct fw_Notify {
+    void (*cb)(mfrUpgradeStatus_t status, void *cbData);
+    void (*cbEx)(mfrUpgradeStatusEx_t status, void *cbData);
+    void *cbData;
+    int interval;
+} fw_Notify_t;
+
+typedef struct fw_Progress {
+    fw_Notify_t notify;
+    fw_EngineStats_t *stats;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int running;
+    int stop;
+    uint64_t startNs;
+    uint64_t lastNs;
+    uint64_t lastConsumed;
+} fw_Progress_t;
+
+mfrError_t fwProgressStart(fw_Progress_t *progress, const fw_Notify_t *notify, fw_EngineStats_t *stats);
+void fwProgressStop(fw_Progress_t *progress);
+void fwProgressNotify(fw_Progress_t *progress, mfrUpgradeProgress_t state, mfrError_t error);
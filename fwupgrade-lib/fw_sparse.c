@@ -0,0 +1,513 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  mke2fs puts the block bitmaps of a group, or of a flex group, ahead
+  of the data they describe, so they are known by the time the data
+  streams by. Groups flagged BLOCK_UNINIT have no bitmap: they only
+  hold their superblock and descriptor backups and the bitmaps and
+  inode tables placed in them. Layouts with descriptors spread over
+  the disk (meta_bg, sparse_super2) or clusters (bigalloc) are written
+  whole.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "string.h"
+#include "fw_sparse.h"
+
+#define EXT_SUPER_OFFSET            1024
+#define EXT_SUPER_SIZE              1024
+#define EXT_MAGIC                   0xef53
+#define EXT_COMPAT_SPARSE_SUPER2    0x0200
+#define EXT_INCOMPAT_META_BG        0x0010
+#define EXT_INCOMPAT_64BIT          0x0080
+#define EXT_RO_COMPAT_SPARSE_SUPER  0x0001
+#define EXT_RO_COMPAT_GDT_CSUM      0x0010
+#define EXT_RO_COMPAT_BIGALLOC      0x0200
+#define EXT_RO_COMPAT_METADATA_CSUM 0x0400
+#define EXT_BG_BLOCK_UNINIT         0x0002
+#define EXT_MAX_BLOCKS              (1ull << 32)
+
+enum {
+    SPARSE_EXT_SUPER = 0,
+    SPARSE_EXT_GDT,
+    SPARSE_EXT_BITMAPS,
+    SPARSE_EXT_DONE,
+};
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Sets or clears count units from first, within the map */
+static void sparseMark(fw_Sparse_t *sparse, uint64_t first, uint64_t count, int used)
+{
+    uint64_t end = first + count < sparse->units ? first + count : sparse->units;
+    uint64_t unit;
+
+    for (unit = first; unit < end; unit++)
+    {
+        if (used)
+        {
+            sparse->used[unit / 64] |= 1ull << (unit % 64);
+        }
+        else
+        {
+            sparse->used[unit / 64] &= ~(1ull << (unit % 64));
+        }
+    }
+}
+
+/* From the arena in budget mode, NULL once it is exhausted */
+static void *sparseAlloc(fw_Sparse_t *sparse, size_t size)
+{
+    return sparse->arena ? fwArenaAlloc(sparse->arena, size, sizeof(uint64_t)) : malloc(size);
+}
+
+static void sparseFree(fw_Sparse_t *sparse, void *data)
+{
+    if (!sparse->arena)
+    {
+        free(data);
+    }
+}
+
+static mfrError_t sparseAllocMap(fw_Sparse_t *sparse, uint32_t unit, uint64_t units, int used)
+{
+    sparse->unit = unit;
+    sparse->units = units;
+    sparse->used = (uint64_t *)sparseAlloc(sparse, (size_t)((units + 63) / 64 + 1) * sizeof(uint64_t));
+    if (!sparse->used)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    memset(sparse->used, used ? 0xff : 0, (size_t)((units + 63) / 64 + 1) * sizeof(uint64_t));
+    return mfrERR_NONE;
+}
+
+/* Drops the map, everything is written */
+static void sparseDisable(fw_Sparse_t *sparse)
+{
+    sparseFree(sparse, sparse->used);
+    sparse->used = NULL;
+    sparse->source = FW_SPARSE_NONE;
+}
+
+void fwSparseInitExt(fw_Sparse_t *sparse, fw_Arena_t *arena)
+{
+    memset(sparse, 0, sizeof(*sparse));
+    sparse->arena = arena;
+    sparse->source = FW_SPARSE_EXT;
+    sparse->state = SPARSE_EXT_SUPER;
+}
+
+/********************************************************************
+   Functiona Name: sparseCollect
+   Description   : copies [start, start + size) of the partition into
+                   buf as it streams by, sparse->have bytes of it are
+                   already there
+   Input:    sparse, buf, start, size, offset, data, len - the data fed
+   Output:   buf
+   Returns:  1 once buf is complete, 0 for more, -1 when part of the
+             range went by before it was asked for
+
+*********************************************************************/
+
+static int sparseCollect(fw_Sparse_t *sparse, uint8_t *buf, uint64_t start, size_t size, uint64_t offset,
+                         const uint8_t *data, size_t len)
+{
+    uint64_t want = start + sparse->have;
+    size_t take;
+
+    if (want < offset)
+    {
+        return -1;
+    }
+    if (want >= offset + len)
+    {
+        return 0;
+    }
+    take = size - sparse->have;
+    take = (uint64_t)take < offset + len - want ? take : (size_t)(offset + len - want);
+    memcpy(buf + sparse->have, data + (want - offset), take);
+    sparse->have += take;
+    return sparse->have == size;
+}
+
+static int sparseCompareGroups(const void *a, const void *b)
+{
+    const fw_SparseGroup_t *x = (const fw_SparseGroup_t *)a;
+    const fw_SparseGroup_t *y = (const fw_SparseGroup_t *)b;
+
+    return x->block < y->block ? -1 : x->block > y->block;
+}
+
+/* Checks the superblock, returns 1 when the bitmaps can be followed */
+static int sparseParseSuper(fw_Sparse_t *sparse)
+{
+    const uint8_t *sb = sparse->super;
+    uint32_t compat = rd32(sb + 0x5c);
+    uint32_t incompat = rd32(sb + 0x60);
+    uint32_t roCompat = rd32(sb + 0x64);
+    uint32_t logBlockSize = rd32(sb + 0x18);
+    uint64_t blocks;
+
+    if (rd16(sb + 0x38) != EXT_MAGIC)
+    {
+        printf("rootfs is not ext2/3/4, it is written whole\n");
+        return -1;
+    }
+    if ((compat & EXT_COMPAT_SPARSE_SUPER2) || (incompat & EXT_INCOMPAT_META_BG) ||
+        (roCompat & EXT_RO_COMPAT_BIGALLOC) || logBlockSize > 6)
+    {
+        printf("rootfs layout is not supported, it is written whole\n");
+        return -1;
+    }
+    sparse->blockSize = 1024u << logBlockSize;
+    sparse->firstDataBlock = rd32(sb + 0x14);
+    sparse->blocksPerGroup = rd32(sb + 0x20);
+    sparse->descSize = (incompat & EXT_INCOMPAT_64BIT) ? rd16(sb + 0xfe) : 32;
+    sparse->blockUninit = (roCompat & (EXT_RO_COMPAT_GDT_CSUM | EXT_RO_COMPAT_METADATA_CSUM)) != 0;
+    blocks = rd32(sb + 0x04) | ((incompat & EXT_INCOMPAT_64BIT) ? (uint64_t)rd32(sb + 0x150) << 32 : 0);
+    if (!sparse->blocksPerGroup || sparse->blocksPerGroup > 8 * sparse->blockSize || blocks <= sparse->firstDataBlock ||
+        blocks > EXT_MAX_BLOCKS || sparse->descSize < 32 || sparse->descSize > 1024 ||
+        (sparse->descSize & (sparse->descSize - 1)))
+    {
+        printf("rootfs superblock is damaged, it is written whole\n");
+        return -1;
+    }
+    sparse->groups = (uint32_t)((blocks - sparse->firstDataBlock + sparse->blocksPerGroup - 1) / sparse->blocksPerGroup);
+    sparse->gdt = (uint8_t *)sparseAlloc(sparse, (size_t)sparse->groups * sparse->descSize);
+    sparse->bitmap = (uint8_t *)sparseAlloc(sparse, sparse->blockSize);
+    sparse->pending = (fw_SparseGroup_t *)sparseAlloc(sparse, (size_t)sparse->groups * sizeof(fw_SparseGroup_t));
+    if (!sparse->gdt || !sparse->bitmap || !sparse->pending ||
+        sparseAllocMap(sparse, sparse->blockSize, blocks, 1) != mfrERR_NONE)
+    {
+        printf("no memory for the bitmaps of %u groups %s:%d \n", sparse->groups, __FUNCTION__, __LINE__);
+        sparse->error = mfrERR_MALLOC_FAILED;
+        return -1;
+    }
+    return 1;
+}
+
+/* Groups holding a backup of the superblock and the descriptors */
+static int sparseHasSuper(const fw_Sparse_t *sparse, uint32_t group)
+{
+    static const uint32_t bases[] = { 3, 5, 7 };
+    unsigned int i;
+
+    if (group <= 1 || !(rd32(sparse->super + 0x64) & EXT_RO_COMPAT_SPARSE_SUPER))
+    {
+        return 1;
+    }
+    for (i = 0; i < sizeof(bases) / sizeof(bases[0]); i++)
+    {
+        uint64_t power = bases[i];
+        while (power < group)
+        {
+            power *= bases[i];
+        }
+        if (power == group)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t sparseDescBlock(const fw_Sparse_t *sparse, const uint8_t *desc, int field)
+{
+    uint64_t block = rd32(desc + field);
+
+    if (sparse->descSize >= 64)
+    {
+        block |= (uint64_t)rd32(desc + 0x20 + field) << 32;
+    }
+    return block;
+}
+
+/********************************************************************
+   Functiona Name: sparseApplyGdt
+   Description   : frees the groups without a bitmap but for their
+                   metadata and lists the bitmaps to wait for
+   Input:    sparse - descriptors collected
+   Output:   sparse
+   Returns:  None
+
+*********************************************************************/
+
+static void sparseApplyGdt(fw_Sparse_t *sparse)
+{
+    const uint8_t *sb = sparse->super;
+    uint32_t bs = sparse->blockSize;
+    uint64_t gdtBlocks = ((uint64_t)sparse->groups * sparse->descSize + bs - 1) / bs;
+    uint32_t inodeSize = rd32(sb + 0x4c) ? rd16(sb + 0x58) : 128;
+    uint64_t tableBlocks = ((uint64_t)rd32(sb + 0x28) * inodeSize + bs - 1) / bs;
+    uint32_t group;
+
+    sparse->pendingCount = 0;
+    for (group = 0; group < sparse->groups; group++)
+    {
+        const uint8_t *desc = sparse->gdt + (size_t)group * sparse->descSize;
+        uint64_t start = sparse->firstDataBlock + (uint64_t)group * sparse->blocksPerGroup;
+
+        if (sparse->blockUninit && (rd16(desc + 0x12) & EXT_BG_BLOCK_UNINIT))
+        {
+            sparseMark(sparse, start, sparse->blocksPerGroup, 0);
+            if (sparseHasSuper(sparse, group))
+            {
+                sparseMark(sparse, start, 1 + gdtBlocks + rd16(sb + 0xce), 1);
+            }
+        }
+        else
+        {
+            sparse->pending[sparse->pendingCount].block = sparseDescBlock(sparse, desc, 0x00);
+            sparse->pending[sparse->pendingCount].group = group;
+            sparse->pendingCount++;
+        }
+    }
+    for (group = 0; group < sparse->groups; group++)
+    {
+        const uint8_t *desc = sparse->gdt + (size_t)group * sparse->descSize;
+
+        sparseMark(sparse, sparseDescBlock(sparse, desc, 0x00), 1, 1);
+        sparseMark(sparse, sparseDescBlock(sparse, desc, 0x04), 1, 1);
+        sparseMark(sparse, sparseDescBlock(sparse, desc, 0x08), tableBlocks, 1);
+    }
+    qsort(sparse->pending, sparse->pendingCount, sizeof(fw_SparseGroup_t), sparseCompareGroups);
+}
+
+static void sparseApplyBitmap(fw_Sparse_t *sparse, uint32_t group)
+{
+    uint64_t start = sparse->firstDataBlock + (uint64_t)group * sparse->blocksPerGroup;
+    uint32_t i;
+
+    for (i = 0; i < sparse->blocksPerGroup && start + i < sparse->units; i++)
+    {
+        sparseMark(sparse, start + i, 1, (sparse->bitmap[i / 8] >> (i % 8)) & 1);
+    }
+}
+
+/********************************************************************
+   Functiona Name: fwSparseFeed
+   Description   : follows the ext2/3/4 superblock, descriptors and
+                   block bitmaps through the data of the partition
+   Input:    sparse, offset, data, len - the partition, fed in order
+   Output:   sparse
+   Returns:  mfrERR_NONE, mfrERR_MALLOC_FAILED when the bitmaps did
+             not fit in memory
+
+*********************************************************************/
+
+mfrError_t fwSparseFeed(fw_Sparse_t *sparse, uint64_t offset, const uint8_t *data, size_t len)
+{
+    int done = 1;
+
+    while (sparse->source == FW_SPARSE_EXT && done > 0)
+    {
+        if (sparse->state == SPARSE_EXT_SUPER)
+        {
+            done = sparseCollect(sparse, sparse->super, EXT_SUPER_OFFSET, EXT_SUPER_SIZE, offset, data, len);
+            done = done > 0 ? sparseParseSuper(sparse) : done;
+        }
+        else if (sparse->state == SPARSE_EXT_GDT)
+        {
+            done = sparseCollect(sparse, sparse->gdt, (uint64_t)(sparse->firstDataBlock + 1) * sparse->blockSize,
+                                 (size_t)sparse->groups * sparse->descSize, offset, data, len);
+            if (done > 0)
+            {
+                sparseApplyGdt(sparse);
+            }
+        }
+        else if (sparse->state == SPARSE_EXT_BITMAPS && sparse->nextPending < sparse->pendingCount)
+        {
+            const fw_SparseGroup_t *next = &sparse->pending[sparse->nextPending];
+
+            done = sparseCollect(sparse, sparse->bitmap, next->block * sparse->blockSize, sparse->blockSize,
+                                 offset, data, len);
+            if (done > 0)
+            {
+                sparseApplyBitmap(sparse, next->group);
+            }
+            if (done != 0)
+            {
+                // a bitmap that went by unseen leaves its group written whole
+                sparse->nextPending++;
+                sparse->have = 0;
+                done = 1;
+            }
+            continue;
+        }
+        else
+        {
+            sparse->state = SPARSE_EXT_DONE;
+            break;
+        }
+        if (done < 0)
+        {
+            sparseDisable(sparse);
+        }
+        else if (done > 0)
+        {
+            sparse->state++;
+            sparse->have = 0;
+        }
+    }
+    return sparse->error;
+}
+
+/* Value of a <Tag> number </Tag> of the bmap, 0 if missing */
+static uint64_t sparseBmapNumber(const char *bmap, const char *tag)
+{
+    const char *p = strstr(bmap, tag);
+
+    return p ? strtoull(p + strlen(tag), NULL, 10) : 0;
+}
+
+/********************************************************************
+   Functiona Name: fwSparseLoadBmap
+   Description   : loads the mapped ranges of a bmap file (bmaptool
+                   format 1.x or 2.x) describing the whole sdimg, and
+                   keeps those of the partition
+   Input:    arena - budget mode, NULL for the heap,
+             bmap - NUL terminated, len, imageSize - of the sdimg,
+             partStart, partLength - of the partition in the sdimg
+   Output:   sparse
+   Returns:  mfrERR_NONE on success, mfrERR_INVALID_PARAM when the
+             bmap is damaged or describes another image,
+             mfrERR_MALLOC_FAILED when the map does not fit
+
+*********************************************************************/
+
+mfrError_t fwSparseLoadBmap(fw_Sparse_t *sparse, fw_Arena_t *arena, const char *bmap, size_t len, uint64_t imageSize,
+                            uint64_t partStart, uint64_t partLength)
+{
+    uint64_t blockSize = sparseBmapNumber(bmap, "<BlockSize>");
+    uint32_t unit;
+    const char *p;
+    int damaged = 0;
+
+    memset(sparse, 0, sizeof(*sparse));
+    sparse->arena = arena;
+    if (!strstr(bmap, "<bmap") || !blockSize || blockSize % 512 || blockSize > (1u << 20) ||
+        sparseBmapNumber(bmap, "<ImageSize>") != imageSize || strlen(bmap) != len)
+    {
+        printf("bmap does not describe the sdimg %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    // ranges of the sdimg have to line up with the partition
+    unit = partStart % blockSize ? 512 : (uint32_t)blockSize;
+    if (sparseAllocMap(sparse, unit, (partLength + unit - 1) / unit, 0) != mfrERR_NONE)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    p = strstr(bmap, "<BlockMap>");
+    while (p && (p = strstr(p, "<Range")) != NULL)
+    {
+        char *end;
+        uint64_t first;
+        uint64_t last;
+
+        p = strchr(p, '>');
+        if (!p)
+        {
+            damaged = 1;
+            break;
+        }
+        first = strtoull(p + 1, &end, 10);
+        last = first;
+        while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')
+        {
+            end++;
+        }
+        if (*end == '-')
+        {
+            last = strtoull(end + 1, &end, 10);
+        }
+        while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r')
+        {
+            end++;
+        }
+        if (strncmp(end, "</Range>", 8) || last < first ||
+            last >= (imageSize + blockSize - 1) / blockSize)
+        {
+            damaged = 1;
+            break;
+        }
+        uint64_t start = first * blockSize;
+        uint64_t stop = (last + 1) * blockSize;
+        start = start > partStart ? start - partStart : 0;
+        stop = stop > partStart ? stop - partStart : 0;
+        stop = stop < partLength ? stop : partLength;
+        if (start < stop)
+        {
+            sparseMark(sparse, start / unit, (stop + unit - 1) / unit - start / unit, 1);
+        }
+        p = end;
+    }
+    if (damaged)
+    {
+        printf("bmap is damaged %s:%d \n", __FUNCTION__, __LINE__);
+        fwSparseRelease(sparse);
+        return mfrERR_INVALID_PARAM;
+    }
+    sparse->source = FW_SPARSE_BMAP;
+    return mfrERR_NONE;
+}
+
+/* Whether any of [offset, offset + len) of the partition holds data */
+int fwSparseUsed(const fw_Sparse_t *sparse, uint64_t offset, uint64_t len)
+{
+    uint64_t unit;
+    uint64_t last;
+
+    if (!sparse->used || !len)
+    {
+        return 1;
+    }
+    last = (offset + len - 1) / sparse->unit;
+    if (last >= sparse->units)
+    {
+        // past the end of the filesystem
+        return 1;
+    }
+    for (unit = offset / sparse->unit; unit <= last; unit++)
+    {
+        if ((sparse->used[unit / 64] >> (unit % 64)) & 1)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void fwSparseRelease(fw_Sparse_t *sparse)
+{
+    sparseFree(sparse, sparse->used);
+    sparseFree(sparse, sparse->gdt);
+    sparseFree(sparse, sparse->bitmap);
+    sparseFree(sparse, sparse->pending);
+    memset(sparse, 0, sizeof(*sparse));
+}
@@ -0,0 +1,76 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Sparse imaging. Tells which parts of the rootfs partition hold data,
+  from a bmap file shipped in the package or from the block bitmaps of
+  the ext2/3/4 filesystem as they stream by. Until a bitmap has been
+  seen, and for anything the map does not describe, the data counts as
+  used and is written.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_arena.h"
+
+enum {
+    FW_SPARSE_NONE = 0,
+    FW_SPARSE_BMAP,
+    FW_SPARSE_EXT,
+};
+
+/* A block bitmap still to stream by */
+typedef struct fw_SparseGroup {
+    uint64_t block;
+    uint32_t group;
+} fw_SparseGroup_t;
+
+typedef struct fw_Sparse {
+    int source;
+    fw_Arena_t *arena;              /* budget mode: holds the maps, NULL for the heap */
+    mfrError_t error;               /* the maps did not fit */
+    uint32_t unit;                  /* bytes covered by a bit of used */
+    uint64_t units;
+    uint64_t *used;                 /* set for units holding data, or not known to be free */
+    /* ext2/3/4 bitmaps, collected from the stream */
+    int state;
+    uint8_t super[1024];
+    uint8_t *gdt;
+    uint8_t *bitmap;
+    size_t have;                    /* bytes of the structure being collected */
+    uint32_t blockSize;
+    uint32_t blocksPerGroup;
+    uint32_t firstDataBlock;
+    uint32_t groups;
+    uint32_t descSize;
+    int blockUninit;                /* group descriptors carry the BLOCK_UNINIT flag */
+    fw_SparseGroup_t *pending;      /* in the order they stream by */
+    uint32_t pendingCount;
+    uint32_t nextPending;
+} fw_Sparse_t;
+
+void fwSparseInitExt(fw_Sparse_t *sparse, fw_Arena_t *arena);
+mfrError_t fwSparseLoadBmap(fw_Sparse_t *sparse, fw_Arena_t *arena, const char *bmap, size_t len, uint64_t imageSize,
+                            uint64_t partStart, uint64_t partLength);
+/* Data of the partition, fed in order. Fails once the bitmaps do not fit in memory. */
+mfrError_t fwSparseFeed(fw_Sparse_t *sparse, uint64_t offset, const uint8_t *data, size_t len);
+int fwSparseUsed(const fw_Sparse_t *sparse, uint64_t offset, uint64_t len);
+void fwSparseRelease(fw_Sparse_t *sparse);
@@ -0,0 +1,299 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Understands ustar, GNU long names ('L') and pax extended headers ('x')
+  which is what busybox and GNU tar produce for our packages.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "string.h"
+#include "fw_tar.h"
+
+enum {
+    TAR_STATE_HEADER = 0,
+    TAR_STATE_DATA,
+    TAR_STATE_PAD,
+    TAR_STATE_END,
+};
+
+/* pax and long name records bigger than this are not something we ship */
+#define TAR_MAX_META   (64 * 1024)
+
+void fwTarInit(fw_TarParser_t *parser, const fw_TarCallbacks_t *cb)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->cb = *cb;
+    parser->state = TAR_STATE_HEADER;
+}
+
+void fwTarRelease(fw_TarParser_t *parser)
+{
+    free(parser->meta);
+    parser->meta = NULL;
+}
+
+int fwTarFinished(const fw_TarParser_t *parser)
+{
+    return parser->state == TAR_STATE_END;
+}
+
+static uint64_t tarNumber(const uint8_t *field, size_t len)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+
+    // GNU base-256 encoding for members of 8GB and more
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x3f;
+        for (i = 1; i < len; i++)
+        {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    while (i < len && (field[i] == ' ' || field[i] == '\0'))
+    {
+        i++;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    {
+        value = (value << 3) | (uint64_t)(field[i] - '0');
+    }
+    return value;
+}
+
+static int tarChecksumValid(const uint8_t *header)
+{
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i < FW_TAR_BLOCK_SIZE; i++)
+    {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == (unsigned int)tarNumber(header + 148, 8);
+}
+
+static void tarParsePax(fw_TarParser_t *parser)
+{
+    size_t pos = 0;
+
+    while (pos < parser->metaLen)
+    {
+        char *record = parser->meta + pos;
+        char *end = NULL;
+        unsigned long recLen = strtoul(record, &end, 10);
+        if (!recLen || pos + recLen > parser->metaLen || *end != ' ')
+        {
+            break;
+        }
+        char *key = end + 1;
+        char *value = strchr(key, '=');
+        if (value && value < record + recLen)
+        {
+            size_t valueLen = (size_t)(record + recLen - (value + 1)) - 1;
+            if (!strncmp(key, "path=", 5) && valueLen < FW_TAR_MAX_NAME)
+            {
+                memcpy(parser->longName, value + 1, valueLen);
+                parser->longName[valueLen] = '\0';
+            }
+            else if (!strncmp(key, "size=", 5))
+            {
+                parser->paxSize = strtoull(value + 1, NULL, 10);
+            }
+        }
+        pos += recLen;
+    }
+}
+
+static mfrError_t tarHeader(fw_TarParser_t *parser)
+{
+    const uint8_t *h = parser->header;
+    fw_TarEntry_t *entry = &parser->entry;
+    int i;
+
+    for (i = 0; i < FW_TAR_BLOCK_SIZE && !h[i]; i++);
+    if (i == FW_TAR_BLOCK_SIZE)
+    {
+        // two zero blocks terminate the archive
+        if (++parser->zeroBlocks == 2)
+        {
+            parser->state = TAR_STATE_END;
+        }
+        return mfrERR_NONE;
+    }
+    parser->zeroBlocks = 0;
+    if (!tarChecksumValid(h))
+    {
+        printf("tar header checksum mismatch %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_DECRYPTION_FAILED;
+    }
+
+    entry->type = (char)h[156];
+    entry->size = tarNumber(h + 124, 12);
+    if (parser->longName[0])
+    {
+        strcpy(entry->name, parser->longName);
+        parser->longName[0] = '\0';
+    }
+    else
+    {
+        // ustar splits long paths into prefix and name
+        size_t len = 0;
+        if (!memcmp(h + 257, "ustar", 5) && h[345])
+        {
+            len = strnlen((const char *)h + 345, 155);
+            memcpy(entry->name, h + 345, len);
+            entry->name[len++] = '/';
+        }
+        size_t nameLen = strnlen((const char *)h, 100);
+        memcpy(entry->name + len, h, nameLen);
+        entry->name[len + nameLen] = '\0';
+    }
+    if (parser->paxSize && entry->type != 'x' && entry->type != 'g')
+    {
+        entry->size = parser->paxSize;
+        parser->paxSize = 0;
+    }
+
+    parser->remaining = entry->size;
+    parser->offset = 0;
+    parser->padding = (FW_TAR_BLOCK_SIZE - (entry->size % FW_TAR_BLOCK_SIZE)) % FW_TAR_BLOCK_SIZE;
+    parser->capture = 0;
+    parser->metaLen = 0;
+
+    if (entry->type == 'L' || entry->type == 'x')
+    {
+        if (entry->size >= TAR_MAX_META)
+        {
+            printf("tar meta header too large %s:%d \n", __FUNCTION__, __LINE__);
+            return mfrERR_DECRYPTION_FAILED;
+        }
+        if (!parser->meta)
+        {
+            parser->meta = (char *)malloc(TAR_MAX_META);
+            if (!parser->meta)
+            {
+                return mfrERR_MALLOC_FAILED;
+            }
+        }
+    }
+    else if (entry->type == '0' || entry->type == '\0' || entry->type == '7')
+    {
+        int ret = parser->cb.onEntry ? parser->cb.onEntry(parser->cb.ctx, entry) : 0;
+        if (ret < 0)
+        {
+            return mfrERR_GENERAL;
+        }
+        parser->capture = ret;
+    }
+    parser->state = parser->remaining ? TAR_STATE_DATA :
+                    (parser->padding ? TAR_STATE_PAD : TAR_STATE_HEADER);
+    return mfrERR_NONE;
+}
+
+static void tarMetaDone(fw_TarParser_t *parser)
+{
+    parser->meta[parser->metaLen] = '\0';
+    if (parser->entry.type == 'L')
+    {
+        strncpy(parser->longName, parser->meta, FW_TAR_MAX_NAME - 1);
+        parser->longName[FW_TAR_MAX_NAME - 1] = '\0';
+    }
+    else
+    {
+        tarParsePax(parser);
+    }
+}
+
+/********************************************************************
+   Functiona Name: fwTarFeed
+   Description   : consumes the next piece of the uncompressed archive
+   Input:    parser, data, len
+   Output:   member data through the parser callbacks
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwTarFeed(fw_TarParser_t *parser, const uint8_t *data, size_t len)
+{
+    mfrError_t ret = mfrERR_NONE;
+
+    while (len && ret == mfrERR_NONE)
+    {
+        size_t take = 0;
+        switch (parser->state)
+        {
+        case TAR_STATE_HEADER:
+            take = FW_TAR_BLOCK_SIZE - parser->headerLen;
+            take = take < len ? take : len;
+            memcpy(parser->header + parser->headerLen, data, take);
+            parser->headerLen += take;
+            if (parser->headerLen == FW_TAR_BLOCK_SIZE)
+            {
+                parser->headerLen = 0;
+                ret = tarHeader(parser);
+            }
+            break;
+        case TAR_STATE_DATA:
+            take = parser->remaining < len ? (size_t)parser->remaining : len;
+            if (parser->entry.type == 'L' || parser->entry.type == 'x')
+            {
+                memcpy(parser->meta + parser->metaLen, data, take);
+                parser->metaLen += take;
+            }
+            else if (parser->capture && parser->cb.onData)
+            {
+                if (parser->cb.onData(parser->cb.ctx, parser->offset, data, take) < 0)
+                {
+                    ret = mfrERR_GENERAL;
+                    break;
+                }
+            }
+            parser->offset += take;
+            parser->remaining -= take;
+            if (!parser->remaining)
+            {
+                if (parser->entry.type == 'L' || parser->entry.type == 'x')
+                {
+                    tarMetaDone(parser);
+                }
+                parser->state = parser->padding ? TAR_STATE_PAD : TAR_STATE_HEADER;
+            }
+            break;
+        case TAR_STATE_PAD:
+            take = parser->padding < len ? (size_t)parser->padding : len;
+            parser->padding -= take;
+            if (!parser->padding)
+            {
+                parser->state = TAR_STATE_HEADER;
+            }
+            break;
+        default:
+            // trailing blocks after the end of archive marker
+            take = len;
+            break;
+        }
+        data += take;
+        len -= take;
+    }
+    return ret;
+}
@@ -0,0 +1,69 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Push based tar parser. Decompressed package bytes are fed in as they
+  become available and member data is handed to the caller without the
+  archive ever being extracted to disk.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+
+#define FW_TAR_BLOCK_SIZE    512
+#define FW_TAR_MAX_NAME      4096
+
+typedef struct fw_TarEntry {
+    char name[FW_TAR_MAX_NAME];
+    uint64_t size;
+    char type;
+} fw_TarEntry_t;
+
+typedef struct fw_TarCallbacks {
+    void *ctx;
+    /* Returns 1 to receive the member data, 0 to skip it, <0 to abort */
+    int (*onEntry)(void *ctx, const fw_TarEntry_t *entry);
+    /* Returns 0 to continue, <0 to abort */
+    int (*onData)(void *ctx, uint64_t offset, const uint8_t *data, size_t len);
+} fw_TarCallbacks_t;
+
+typedef struct fw_TarParser {
+    fw_TarCallbacks_t cb;
+    int state;
+    uint8_t header[FW_TAR_BLOCK_SIZE];
+    size_t headerLen;
+    fw_TarEntry_t entry;
+    uint64_t remaining;
+    uint64_t offset;
+    uint64_t padding;
+    int capture;
+    /* GNU long name / pax header contents */
+    char *meta;
+    size_t metaLen;
+    char longName[FW_TAR_MAX_NAME];
+    uint64_t paxSize;
+    int zeroBlocks;
+} fw_TarParser_t;
+
+void fwTarInit(fw_TarParser_t *parser, const fw_TarCallbacks_t *cb);
+mfrError_t fwTarFeed(fw_TarParser_t *parser, const uint8_t *data, size_t len);
+int fwTarFinished(const fw_TarParser_t *parser);
+void fwTarRelease(fw_TarParser_t *parser);
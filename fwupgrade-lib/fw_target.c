@@ -0,0 +1,173 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "string.h"
+#include "fw_target.h"
+
+mfrError_t fwTargetOpen(fw_Target_t *target, fw_Backend_t *backend, const char *path, int writable)
+{
+    mfrError_t ret;
+
+    memset(target, 0, sizeof(*target));
+    target->path = path;
+    target->fd = -1;
+    target->backend = backend;
+    target->ops = fwBackendOps(backend, path);
+    if (!target->ops)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    ret = target->ops->open(target, path, writable);
+    if (ret != mfrERR_NONE)
+    {
+        fwTargetClose(target);
+        return ret;
+    }
+    target->ops->geometry(target, &target->geometry);
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwTargetOpenRange
+   Description   : opens one partition of a disk, or of a disk image,
+                   by its byte range instead of its device node
+   Input:    backend, path - the whole disk, writable, base, size
+   Output:   target
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwTargetOpenRange(fw_Target_t *target, fw_Backend_t *backend, const char *path, int writable,
+                             uint64_t base, uint64_t size)
+{
+    mfrError_t ret = fwTargetOpen(target, backend, path, writable);
+
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    if (target->isBlockDevice && base + size > target->size)
+    {
+        printf("range %llu+%llu is beyond the end of %s %s:%d \n", (unsigned long long)base,
+               (unsigned long long)size, path, __FUNCTION__, __LINE__);
+        fwTargetClose(target);
+        return mfrERR_INVALID_PARAM;
+    }
+    // a partition cannot grow, whatever backs the disk
+    target->isBlockDevice = 1;
+    target->base = base;
+    target->size = size;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwTargetReserve
+   Description   : makes sure the target can hold len bytes. Files
+                   standing in for partitions grow, devices cannot.
+   Input:    target, len
+   Output:   None
+   Returns:  mfrERR_NONE when len bytes fit
+
+*********************************************************************/
+
+mfrError_t fwTargetReserve(fw_Target_t *target, uint64_t len)
+{
+    if (len <= target->size)
+    {
+        return mfrERR_NONE;
+    }
+    if (target->isBlockDevice)
+    {
+        printf("%s is too small: %llu < %llu %s:%d \n", target->path,
+               (unsigned long long)target->size, (unsigned long long)len, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    if (ftruncate(target->fd, (off_t)len) < 0)
+    {
+        return mfrERR_GENERAL;
+    }
+    target->size = len;
+    return mfrERR_NONE;
+}
+
+mfrError_t fwTargetRead(fw_Target_t *target, void *buf, size_t len, uint64_t offset)
+{
+    return target->ops->read(target, buf, len, offset);
+}
+
+mfrError_t fwTargetWrite(fw_Target_t *target, const void *buf, size_t len, uint64_t offset)
+{
+    return target->ops->write(target, buf, len, offset);
+}
+
+mfrError_t fwTargetFlush(fw_Target_t *target)
+{
+    return target->ops->flush(target);
+}
+
+/********************************************************************
+   Functiona Name: fwTargetDiscard
+   Description   : tells the media a range holds nothing worth keeping,
+                   a discard for a block device and a hole for a file.
+                   What the range reads back afterwards is undefined.
+   Input:    target, offset, len
+   Output:   None
+   Returns:  mfrERR_NONE on success, mfrERR_OPERATION_NOT_SUPPORTED
+             when the media cannot discard
+
+*********************************************************************/
+
+mfrError_t fwTargetDiscard(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    return target->ops->discard(target, offset, len);
+}
+
+/********************************************************************
+   Functiona Name: fwTargetZero
+   Description   : makes a range read back as zeros, by a discard the
+                   media guarantees to zero, a hole for a file, or by
+                   writing the zeros when it has neither.
+   Input:    target, offset, len
+   Output:   None
+   Returns:  mfrERR_NONE on success, mfrERR_GENERAL on an I/O error
+
+*********************************************************************/
+
+mfrError_t fwTargetZero(fw_Target_t *target, uint64_t offset, uint64_t len)
+{
+    return target->ops->zero(target, offset, len);
+}
+
+/* Drops the cached pages of the target so the next reads come from the media */
+void fwTargetDropCache(fw_Target_t *target)
+{
+    posix_fadvise(target->fd, (off_t)target->base, target->base ? (off_t)target->size : 0, POSIX_FADV_DONTNEED);
+}
+
+void fwTargetClose(fw_Target_t *target)
+{
+    if (target->fd >= 0)
+    {
+        target->ops->close(target);
+    }
+    target->fd = -1;
+}
@@ -0,0 +1,65 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Flash target abstraction. A target is a block device partition on the
+  box, or a regular file standing in for one, reached through one of
+  the block backends of fw_backend.h.
+
+  Backends must be descriptor backed. The calls below go through the
+  operations of the backend, but the writer (fw_writer.h) submits the
+  bulk writes of a flash straight to fd, through io_uring or pwrite,
+  and opens path a second time for O_DIRECT; it applies the device
+  model itself. A backend whose write does more than pwrite on fd
+  would be bypassed on that path.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_backend.h"
+
+#define FW_TARGET_NODE_MAX      32
+
+typedef struct fw_Target {
+    const char *path;
+    int fd;
+    int isBlockDevice;
+    uint64_t size;          /* capacity of a block device, current size of a file */
+    uint64_t base;          /* start of the partition when the target is a range of a whole disk */
+    const fw_BackendOps_t *ops;
+    fw_Backend_t *backend;  /* NULL for the defaults */
+    fw_DeviceModel_t *model;        /* file backend: delays of the device, NULL for none */
+    fw_Geometry_t geometry;
+    char node[FW_TARGET_NODE_MAX];  /* loop backend: the loop device path points to */
+} fw_Target_t;
+
+/* backend NULL picks mmc for block devices and file for the rest, without a device model */
+mfrError_t fwTargetOpen(fw_Target_t *target, fw_Backend_t *backend, const char *path, int writable);
+mfrError_t fwTargetOpenRange(fw_Target_t *target, fw_Backend_t *backend, const char *path, int writable,
+                             uint64_t base, uint64_t size);
+mfrError_t fwTargetRead(fw_Target_t *target, void *buf, size_t len, uint64_t offset);
+mfrError_t fwTargetWrite(fw_Target_t *target, const void *buf, size_t len, uint64_t offset);
+mfrError_t fwTargetReserve(fw_Target_t *target, uint64_t len);
+mfrError_t fwTargetFlush(fw_Target_t *target);
+mfrError_t fwTargetDiscard(fw_Target_t *target, uint64_t offset, uint64_t len);
+mfrError_t fwTargetZero(fw_Target_t *target, uint64_t offset, uint64_t len);
+void fwTargetDropCache(fw_Target_t *target);
+void fwTargetClose(fw_Target_t *target);
@@ -0,0 +1,265 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  The I/O class and the CPU set are per thread. Threads created later,
+  such as the readback threads, inherit them from the thread creating
+  them. The pwrite threads of the writer's thread pool outlive the
+  flashes and apply the settings before every write, like the stages.
+  io_uring writes carry the I/O class in their request, the CPU set
+  does not apply to the kernel's workers.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "string.h"
+#include "fw_throttle.h"
+#include "fw_pipeline.h"
+
+#define FW_IOPRIO_WHO_PROCESS   1           /* the calling thread with who 0 */
+#define FW_IOPRIO_CLASS_SHIFT   13
+#define FW_IOPRIO_CLASS_IDLE    3
+#define FW_THROTTLE_BURST_DIV   4           /* default burst, a quarter second of bandwidth */
+#define FW_THROTTLE_WAIT_MAX_NS 100000000ull
+
+/* Adds the tokens earned since the last refill, with throttle->lock held */
+static void throttleRefill(fw_Throttle_t *throttle, uint64_t now)
+{
+    const mfrUpgradeThrottle_t *limits = &throttle->limits;
+    double burst = (double)(limits->writeBurstBytes ? limits->writeBurstBytes
+                                                    : limits->writeBytesPerSec / FW_THROTTLE_BURST_DIV);
+
+    if (now > throttle->lastNs)
+    {
+        throttle->tokens += (double)(now - throttle->lastNs) * (double)limits->writeBytesPerSec / 1e9;
+    }
+    throttle->lastNs = now;
+    if (throttle->tokens > burst)
+    {
+        throttle->tokens = burst;
+    }
+}
+
+static int throttleLimited(const mfrUpgradeThrottle_t *limits)
+{
+    return limits->background && limits->writeBytesPerSec;
+}
+
+/********************************************************************
+   Functiona Name: fwThrottleSet
+   Description   : replaces the limits, the upgrade in progress follows
+                   them from its next block on
+   Input:    throttle, limits - NULL for full speed
+   Output:   None
+   Returns:  None
+
+*********************************************************************/
+
+void fwThrottleSet(fw_Throttle_t *throttle, const mfrUpgradeThrottle_t *limits)
+{
+    uint64_t now = fwNowNs();
+
+    pthread_mutex_lock(&throttle->lock);
+    if (throttleLimited(&throttle->limits))
+    {
+        // what was earned at the old rate is kept
+        throttleRefill(throttle, now);
+    }
+    else
+    {
+        throttle->tokens = 0;
+    }
+    throttle->lastNs = now;
+    if (limits)
+    {
+        throttle->limits = *limits;
+    }
+    else
+    {
+        memset(&throttle->limits, 0, sizeof(throttle->limits));
+    }
+    atomic_fetch_add(&throttle->generation, 1);
+    pthread_cond_broadcast(&throttle->changed);
+    pthread_mutex_unlock(&throttle->lock);
+}
+
+void fwThrottleGet(fw_Throttle_t *throttle, mfrUpgradeThrottle_t *limits)
+{
+    pthread_mutex_lock(&throttle->lock);
+    *limits = throttle->limits;
+    pthread_mutex_unlock(&throttle->lock);
+}
+
+/********************************************************************
+   Functiona Name: fwThrottleApply
+   Description   : moves the calling thread to the I/O class and CPUs
+                   of the limits, unless it already follows the
+                   current ones. Cheap enough to be called per block.
+   Input:    throttle, generation - of the limits the thread follows,
+             zero for a new thread
+   Output:   generation
+   Returns:  None
+
+*********************************************************************/
+
+void fwThrottleApply(fw_Throttle_t *throttle, uint64_t *generation)
+{
+    uint64_t current;
+    int idle;
+    int haveCpus;
+    uint64_t mask;
+    cpu_set_t cpus;
+    int cpu;
+
+    if (!throttle || (current = atomic_load_explicit(&throttle->generation, memory_order_acquire)) == *generation)
+    {
+        return;
+    }
+    *generation = current;
+    pthread_mutex_lock(&throttle->lock);
+    idle = throttle->limits.background && throttle->limits.idleIoPriority;
+    mask = throttle->limits.background ? throttle->limits.cpuMask : 0;
+    if (mask && !throttle->haveCpus)
+    {
+        // threads running the upgrade inherit the process' affinity
+        throttle->haveCpus = pthread_getaffinity_np(pthread_self(), sizeof(throttle->cpus), &throttle->cpus) == 0;
+    }
+    haveCpus = throttle->haveCpus;
+    cpus = throttle->cpus;
+    pthread_mutex_unlock(&throttle->lock);
+
+    // class none is the default, derived from the nice value
+    if (syscall(SYS_ioprio_set, FW_IOPRIO_WHO_PROCESS, 0, idle ? FW_IOPRIO_CLASS_IDLE << FW_IOPRIO_CLASS_SHIFT : 0) < 0)
+    {
+        printf("failed to set the I/O priority: %s %s:%d \n", strerror(errno), __FUNCTION__, __LINE__);
+    }
+    if (mask)
+    {
+        CPU_ZERO(&cpus);
+        for (cpu = 0; cpu < 64; cpu++)
+        {
+            if (mask & (1ull << cpu))
+            {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+    }
+    if ((mask || haveCpus) && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        printf("failed to set the CPU affinity %s:%d \n", __FUNCTION__, __LINE__);
+    }
+}
+
+uint16_t fwThrottleIoPriority(fw_Throttle_t *throttle)
+{
+    int idle = 0;
+
+    if (throttle)
+    {
+        pthread_mutex_lock(&throttle->lock);
+        idle = throttle->limits.background && throttle->limits.idleIoPriority;
+        pthread_mutex_unlock(&throttle->lock);
+    }
+    return idle ? FW_IOPRIO_CLASS_IDLE << FW_IOPRIO_CLASS_SHIFT : 0;
+}
+
+/* Caps a number of worker threads */
+unsigned int fwThrottleThreads(fw_Throttle_t *throttle, unsigned int threads)
+{
+    unsigned int cap = 0;
+
+    if (throttle)
+    {
+        pthread_mutex_lock(&throttle->lock);
+        cap = throttle->limits.background ? throttle->limits.maxThreads : 0;
+        pthread_mutex_unlock(&throttle->lock);
+    }
+    return cap && cap < threads ? cap : threads;
+}
+
+/********************************************************************
+   Functiona Name: fwThrottleTake
+   Description   : takes bytes from the write bandwidth bucket, waiting
+                   for the bucket to be out of debt. A write larger than
+                   the bucket is let through and paid for afterwards.
+   Input:    throttle, bytes, abort - stops the wait when set
+   Output:   waitNs - time spent waiting is added
+   Returns:  mfrERR_NONE, mfrERR_INVALID_STATE when aborted
+
+*********************************************************************/
+
+mfrError_t fwThrottleTake(fw_Throttle_t *throttle, uint64_t bytes, _Atomic int *abort, uint64_t *waitNs)
+{
+    uint64_t start;
+    uint64_t now;
+    mfrError_t ret = mfrERR_NONE;
+
+    if (!throttle)
+    {
+        return mfrERR_NONE;
+    }
+    start = fwNowNs();
+    now = start;
+    pthread_mutex_lock(&throttle->lock);
+    while (throttleLimited(&throttle->limits))
+    {
+        if (atomic_load(abort))
+        {
+            ret = mfrERR_INVALID_STATE;
+            break;
+        }
+        throttleRefill(throttle, now);
+        if (throttle->tokens >= 0)
+        {
+            throttle->tokens -= (double)bytes;
+            break;
+        }
+        uint64_t delay = (uint64_t)(-throttle->tokens * 1e9 / (double)throttle->limits.writeBytesPerSec) + 1;
+        struct timespec deadline;
+        uint64_t nsec;
+
+        // bounded sleeps, the condition variable runs on the wall clock
+        delay = delay < FW_THROTTLE_WAIT_MAX_NS ? delay : FW_THROTTLE_WAIT_MAX_NS;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        nsec = (uint64_t)deadline.tv_nsec + delay;
+        deadline.tv_sec += (time_t)(nsec / 1000000000);
+        deadline.tv_nsec = (long)(nsec % 1000000000);
+        pthread_cond_timedwait(&throttle->changed, &throttle->lock, &deadline);
+        now = fwNowNs();
+    }
+    pthread_mutex_unlock(&throttle->lock);
+    if (waitNs)
+    {
+        *waitNs += now - start;
+    }
+    return ret;
+}
+
+/* Wakes the writers waiting on the bucket, to see an abort */
+void fwThrottleWake(fw_Throttle_t *throttle)
+{
+    if (throttle)
+    {
+        pthread_mutex_lock(&throttle->lock);
+        pthread_cond_broadcast(&throttle->changed);
+        pthread_mutex_unlock(&throttle->lock);
+    }
+}
@@ -0,0 +1,57 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Background mode. A token bucket holds the writes to the targets to a
+  bandwidth, the decompression and readback threads are capped, and
+  the upgrade threads can be moved to the idle I/O class and to a set
+  of CPUs. The limits change while an upgrade runs: writers waiting on
+  the bucket see a new rate at once, threads pick up the I/O class and
+  CPU set at their next block.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <mfrApi.h>
+
+typedef struct fw_Throttle {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    mfrUpgradeThrottle_t limits;
+    _Atomic uint64_t generation;    /* bumped by every change of the limits */
+    double tokens;                  /* bytes that may be written, negative once in debt */
+    uint64_t lastNs;                /* last refill of the bucket */
+    int haveCpus;
+    cpu_set_t cpus;                 /* affinity to go back to when cpuMask is cleared */
+} fw_Throttle_t;
+
+#define FW_THROTTLE_INITIALIZER { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER }
+
+void fwThrottleSet(fw_Throttle_t *throttle, const mfrUpgradeThrottle_t *limits);
+void fwThrottleGet(fw_Throttle_t *throttle, mfrUpgradeThrottle_t *limits);
+/* The calls below accept a NULL throttle and then do nothing */
+void fwThrottleApply(fw_Throttle_t *throttle, uint64_t *generation);
+/* ioprio of the requests the upgrade hands to the kernel, 0 for the default class */
+uint16_t fwThrottleIoPriority(fw_Throttle_t *throttle);
+unsigned int fwThrottleThreads(fw_Throttle_t *throttle, unsigned int threads);
+mfrError_t fwThrottleTake(fw_Throttle_t *throttle, uint64_t bytes, _Atomic int *abort, uint64_t *waitNs);
+void fwThrottleWake(fw_Throttle_t *throttle);
@@ -0,0 +1,164 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Events go to a fixed array claimed with an atomic index, so a trace
+  point costs a clock read and a few stores and never blocks a stage.
+  Events past the end of the array are counted and dropped.
+----------------------------------------------------------------------*/
+
+#include "fw_trace.h"
+
+#ifdef FW_HAVE_TRACE
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "string.h"
+
+#define FW_TRACE_MAX_EVENTS     65536
+#define FW_TRACE_TRACK_BASE     100000      /* tids of the extra tracks */
+
+typedef struct fw_TraceEvent {
+    const char *name;
+    uint64_t ts;
+    uint64_t value;             /* duration of a span, value of a counter */
+    uint32_t tid;
+    char phase;
+} fw_TraceEvent_t;
+
+static fw_TraceEvent_t g_events[FW_TRACE_MAX_EVENTS];
+static _Atomic uint32_t g_count;
+static _Atomic uint32_t g_dropped;
+static uint64_t g_origin;
+
+static uint32_t traceTid(void)
+{
+    static __thread uint32_t tid;
+
+    if (!tid)
+    {
+        tid = (uint32_t)syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+static void traceAdd(char phase, const char *name, uint32_t tid, uint64_t ts, uint64_t value)
+{
+    uint32_t index = atomic_fetch_add_explicit(&g_count, 1, memory_order_relaxed);
+    fw_TraceEvent_t *event;
+
+    if (index >= FW_TRACE_MAX_EVENTS)
+    {
+        atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    event = &g_events[index];
+    event->name = name;
+    event->ts = ts;
+    event->value = value;
+    event->tid = tid;
+    event->phase = phase;
+}
+
+/* Starts a new trace, no trace point may be running */
+void fwTraceReset(void)
+{
+    atomic_store(&g_count, 0);
+    atomic_store(&g_dropped, 0);
+    g_origin = fwNowNs();
+    traceAdd('M', "engine", traceTid(), g_origin, 0);
+}
+
+/* Names the calling thread in the timeline */
+void fwTraceThread(const char *name)
+{
+    traceAdd('M', name, traceTid(), fwNowNs(), 0);
+}
+
+void fwTraceSpan(const char *name, int track, uint64_t startNs, uint64_t endNs)
+{
+    uint32_t tid = track ? FW_TRACE_TRACK_BASE + (uint32_t)track : traceTid();
+
+    traceAdd('X', name, tid, startNs, endNs > startNs ? endNs - startNs : 0);
+}
+
+void fwTraceCounter(const char *name, uint64_t value)
+{
+    traceAdd('C', name, traceTid(), fwNowNs(), value);
+}
+
+/********************************************************************
+   Functiona Name: fwTraceDump
+   Description   : writes the events recorded since fwTraceReset as
+                   Chrome trace JSON. Called once the pipeline threads
+                   are gone.
+   Input:    path
+   Output:   None
+   Returns:  mfrERR_NONE when the trace has been written
+
+*********************************************************************/
+
+mfrError_t fwTraceDump(const char *path)
+{
+    uint32_t count = atomic_load(&g_count);
+    int pid = (int)getpid();
+    FILE *fp = fopen(path, "w");
+    uint32_t i;
+
+    if (!fp)
+    {
+        printf("cannot write trace %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    count = count < FW_TRACE_MAX_EVENTS ? count : FW_TRACE_MAX_EVENTS;
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (i = 0; i < count; i++)
+    {
+        const fw_TraceEvent_t *event = &g_events[i];
+        double ts = (double)(event->ts - g_origin) / 1000.0;
+
+        fprintf(fp, "%s", i ? ",\n" : "");
+        switch (event->phase)
+        {
+        case 'M':
+            fprintf(fp, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, "
+                    "\"args\": {\"name\": \"%s\"}}", pid, event->tid, event->name);
+            break;
+        case 'C':
+            fprintf(fp, "{\"name\": \"%s\", \"ph\": \"C\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, "
+                    "\"args\": {\"value\": %llu}}", event->name, pid, event->tid, ts,
+                    (unsigned long long)event->value);
+            break;
+        default:
+            fprintf(fp, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    event->name, pid, event->tid, ts, (double)event->value / 1000.0);
+            break;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0)
+    {
+        return mfrERR_GENERAL;
+    }
+    printf("trace of %u events written to %s, %u dropped\n", count, path, atomic_load(&g_dropped));
+    return mfrERR_NONE;
+}
+
+#endif
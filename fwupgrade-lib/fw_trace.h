@@ -0,0 +1,63 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Compile-time trace points. When the library is built with
+  FWUPGRADE_TRACE (FW_HAVE_TRACE), the engine records its phases, the
+  pipeline blocks and the writes in flight into a preallocated buffer
+  and dumps them after every upgrade as Chrome trace JSON, which
+  chrome://tracing and ui.perfetto.dev open. Otherwise the trace
+  points compile to nothing.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <mfrApi.h>
+#include "fw_pipeline.h"
+
+#define FW_TRACE_DEFAULT_PATH   "/tmp/fwupgrade-trace.json"
+
+#ifdef FW_HAVE_TRACE
+
+void fwTraceReset(void);
+void fwTraceThread(const char *name);
+/* track 0 is the calling thread, others are extra timelines such as write slots */
+void fwTraceSpan(const char *name, int track, uint64_t startNs, uint64_t endNs);
+void fwTraceCounter(const char *name, uint64_t value);
+mfrError_t fwTraceDump(const char *path);
+
+#define FW_TRACE_BEGIN(start)                   uint64_t start = fwNowNs()
+#define FW_TRACE_END(name, start)               fwTraceSpan(name, 0, start, fwNowNs())
+#define FW_TRACE_SPAN(name, track, start, end)  fwTraceSpan(name, track, start, end)
+#define FW_TRACE_THREAD(name)                   fwTraceThread(name)
+#define FW_TRACE_COUNTER(name, value)           fwTraceCounter(name, value)
+#define FW_TRACE_RESET()                        fwTraceReset()
+#define FW_TRACE_DUMP(path)                     fwTraceDump(path)
+
+#else
+
+#define FW_TRACE_BEGIN(start)                   do { } while (0)
+#define FW_TRACE_END(name, start)               do { } while (0)
+#define FW_TRACE_SPAN(name, track, start, end)  do { } while (0)
+#define FW_TRACE_THREAD(name)                   do { } while (0)
+#define FW_TRACE_COUNTER(name, value)           do { } while (0)
+#define FW_TRACE_RESET()                        do { } while (0)
+#define FW_TRACE_DUMP(path)                     do { } while (0)
+
+#endif
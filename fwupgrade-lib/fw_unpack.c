@@ -0,0 +1,719 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  gzip members can only be told apart by decoding them, so every gzip
+  header pattern in the package is a candidate segment. Candidates are
+  decoded speculatively; the next segment in line is the candidate that
+  starts exactly where the previous member ended, the candidates in
+  between were false matches inside compressed data and are dropped.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "string.h"
+#include "fw_pipeline.h"
+#include "fw_unpack.h"
+#ifdef FW_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef FW_HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#define FW_UNPACK_OUT_SIZE      (256 * 1024)
+#define FW_UNPACK_MAX_THREADS   16
+#define FW_UNPACK_MIN_SEGMENT   (4 * 1024 * 1024)   /* small zstd frames are grouped up to this */
+#define FW_UNPACK_MAX_BUFFERED  (32 * 1024 * 1024)  /* output held back per waiting segment */
+
+enum {
+    SEG_PENDING = 0,
+    SEG_RUNNING,
+    SEG_DONE,
+    SEG_FAILED,
+};
+
+typedef struct fw_Chunk {
+    struct fw_Chunk *next;
+    size_t len;
+    uint8_t data[];
+} fw_Chunk_t;
+
+typedef struct fw_Segment {
+    uint64_t start;             /* offset in the package */
+    uint64_t end;               /* end in the package, 0 until decoded for gzip */
+    int state;
+    int cancelled;              /* false gzip candidate */
+    int check;                  /* xz: check type of the stream */
+    mfrError_t error;
+    fw_Chunk_t *chunks;         /* output held back until the segment is next in line */
+    fw_Chunk_t *tail;
+    size_t buffered;
+} fw_Segment_t;
+
+typedef struct fw_Unpack {
+    const uint8_t *data;
+    uint64_t size;
+    int format;
+    fw_UnpackWrite_t write;
+    void *ctx;
+    fw_Segment_t *seg;
+    size_t count;
+    size_t capacity;
+    size_t window;              /* segments decoded ahead of the one in line */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t next;                /* next segment to claim */
+    size_t head;                /* segment in line for the sink */
+    int finished;
+    _Atomic int abort;
+    mfrError_t error;
+    uint64_t written;
+} fw_Unpack_t;
+
+typedef mfrError_t (*fw_Decode_t)(fw_Unpack_t *unpack, fw_Segment_t *seg, uint8_t *out);
+
+int fwUnpackFormat(const uint8_t *data, size_t len)
+{
+    static const uint8_t xzMagic[6] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+    static const uint8_t zstdMagic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+    if (len >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+    {
+        return FW_FORMAT_GZIP;
+    }
+    if (len >= sizeof(zstdMagic) && !memcmp(data, zstdMagic, sizeof(zstdMagic)))
+    {
+        return FW_FORMAT_ZSTD;
+    }
+    if (len >= sizeof(xzMagic) && !memcmp(data, xzMagic, sizeof(xzMagic)))
+    {
+        return FW_FORMAT_XZ;
+    }
+    return FW_FORMAT_PLAIN;
+}
+
+static mfrError_t unpackAddSegment(fw_Unpack_t *unpack, uint64_t start, uint64_t end, int check)
+{
+    if (unpack->count == unpack->capacity)
+    {
+        size_t capacity = unpack->capacity ? unpack->capacity * 2 : 16;
+        fw_Segment_t *seg = (fw_Segment_t *)realloc(unpack->seg, capacity * sizeof(fw_Segment_t));
+        if (!seg)
+        {
+            return mfrERR_MALLOC_FAILED;
+        }
+        unpack->seg = seg;
+        unpack->capacity = capacity;
+    }
+    memset(&unpack->seg[unpack->count], 0, sizeof(fw_Segment_t));
+    unpack->seg[unpack->count].start = start;
+    unpack->seg[unpack->count].end = end;
+    unpack->seg[unpack->count].check = check;
+    unpack->count++;
+    return mfrERR_NONE;
+}
+
+/* Hands output to the sink when the segment is in line, holds it back otherwise */
+static mfrError_t unpackEmit(fw_Unpack_t *unpack, fw_Segment_t *seg, const uint8_t *data, size_t len)
+{
+    mfrError_t ret = mfrERR_NONE;
+
+    pthread_mutex_lock(&unpack->lock);
+    while (&unpack->seg[unpack->head] != seg && seg->buffered >= FW_UNPACK_MAX_BUFFERED &&
+           !seg->cancelled && !unpack->finished)
+    {
+        pthread_cond_wait(&unpack->cond, &unpack->lock);
+    }
+    if (seg->cancelled || (unpack->finished && &unpack->seg[unpack->head] != seg))
+    {
+        pthread_mutex_unlock(&unpack->lock);
+        return mfrERR_GENERAL;
+    }
+    if (&unpack->seg[unpack->head] != seg)
+    {
+        fw_Chunk_t *chunk = (fw_Chunk_t *)malloc(sizeof(fw_Chunk_t) + len);
+        if (!chunk)
+        {
+            pthread_mutex_unlock(&unpack->lock);
+            return mfrERR_MALLOC_FAILED;
+        }
+        chunk->next = NULL;
+        chunk->len = len;
+        memcpy(chunk->data, data, len);
+        if (seg->tail)
+        {
+            seg->tail->next = chunk;
+        }
+        else
+        {
+            seg->chunks = chunk;
+        }
+        seg->tail = chunk;
+        seg->buffered += len;
+        pthread_mutex_unlock(&unpack->lock);
+        return mfrERR_NONE;
+    }
+    pthread_mutex_unlock(&unpack->lock);
+
+    // in line: nobody else writes to the sink until this segment is done
+    while (seg->chunks && ret == mfrERR_NONE)
+    {
+        fw_Chunk_t *chunk = seg->chunks;
+        seg->chunks = chunk->next;
+        ret = unpack->write(unpack->ctx, chunk->data, chunk->len);
+        unpack->written += chunk->len;
+        free(chunk);
+    }
+    seg->tail = NULL;
+    seg->buffered = 0;
+    if (ret == mfrERR_NONE && len)
+    {
+        ret = unpack->write(unpack->ctx, data, len);
+        unpack->written += len;
+    }
+    return ret;
+}
+
+/* Output of a false gzip candidate, or left over after an error */
+static void unpackDropChunks(fw_Segment_t *seg)
+{
+    while (seg->chunks)
+    {
+        fw_Chunk_t *chunk = seg->chunks;
+        seg->chunks = chunk->next;
+        free(chunk);
+    }
+    seg->tail = NULL;
+    seg->buffered = 0;
+}
+
+/* Moves the line on to the segment after seg, returns 0 when the output is complete */
+static int unpackAdvance(fw_Unpack_t *unpack, const fw_Segment_t *seg)
+{
+    size_t i;
+
+    if (unpack->format != FW_FORMAT_GZIP)
+    {
+        unpack->head++;
+        return unpack->head < unpack->count;
+    }
+    for (i = unpack->head + 1; i < unpack->count && unpack->seg[i].start < seg->end; i++)
+    {
+        unpack->seg[i].cancelled = 1;
+        if (unpack->seg[i].state == SEG_DONE || unpack->seg[i].state == SEG_FAILED)
+        {
+            unpackDropChunks(&unpack->seg[i]);
+        }
+    }
+    unpack->head = i;
+    if (i < unpack->count && unpack->seg[i].start == seg->end)
+    {
+        return 1;
+    }
+    if (seg->end < unpack->size)
+    {
+        printf("ignoring %llu bytes after the last gzip member\n", (unsigned long long)(unpack->size - seg->end));
+    }
+    unpack->head = unpack->count;
+    return 0;
+}
+
+/********************************************************************
+   Functiona Name: unpackFinish
+   Description   : records the result of a segment. When the segment is
+                   in line, it and the finished segments after it are
+                   flushed to the sink and the line moves on.
+   Input:    unpack, seg, ret
+   Output:   None
+   Returns:  None
+
+*********************************************************************/
+
+static void unpackFinish(fw_Unpack_t *unpack, fw_Segment_t *seg, mfrError_t ret)
+{
+    pthread_mutex_lock(&unpack->lock);
+    seg->state = ret == mfrERR_NONE ? SEG_DONE : SEG_FAILED;
+    seg->error = ret;
+    if (seg->cancelled)
+    {
+        unpackDropChunks(seg);
+    }
+    while (!unpack->finished && &unpack->seg[unpack->head] == seg)
+    {
+        if (seg->state == SEG_FAILED)
+        {
+            unpack->error = seg->error;
+            unpack->finished = 1;
+            atomic_store(&unpack->abort, 1);
+            break;
+        }
+        if (seg->state != SEG_DONE)
+        {
+            // its worker flushes it
+            break;
+        }
+        pthread_mutex_unlock(&unpack->lock);
+        ret = unpackEmit(unpack, seg, NULL, 0);
+        pthread_mutex_lock(&unpack->lock);
+        if (ret != mfrERR_NONE)
+        {
+            unpack->error = ret;
+            unpack->finished = 1;
+            atomic_store(&unpack->abort, 1);
+            break;
+        }
+        if (!unpackAdvance(unpack, seg))
+        {
+            unpack->finished = 1;
+            break;
+        }
+        seg = &unpack->seg[unpack->head];
+    }
+    pthread_cond_broadcast(&unpack->cond);
+    pthread_mutex_unlock(&unpack->lock);
+}
+
+static mfrError_t unpackDecodePlain(fw_Unpack_t *unpack, fw_Segment_t *seg, uint8_t *out)
+{
+    uint64_t pos = seg->start;
+    mfrError_t ret = mfrERR_NONE;
+
+    (void)out;
+    while (pos < seg->end && ret == mfrERR_NONE)
+    {
+        size_t len = seg->end - pos < FW_UNPACK_OUT_SIZE ? (size_t)(seg->end - pos) : FW_UNPACK_OUT_SIZE;
+        ret = unpackEmit(unpack, seg, unpack->data + pos, len);
+        pos += len;
+    }
+    return ret;
+}
+
+/* One gzip member from seg->start, seg->end is set to where it ended */
+static mfrError_t unpackDecodeGzip(fw_Unpack_t *unpack, fw_Segment_t *seg, uint8_t *out)
+{
+    uint64_t pos = seg->start;
+    mfrError_t ret = mfrERR_NONE;
+    z_stream zs;
+    int zret = Z_OK;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    while (zret != Z_STREAM_END && ret == mfrERR_NONE)
+    {
+        if (!zs.avail_in && pos < unpack->size)
+        {
+            uint64_t left = unpack->size - pos;
+            zs.next_in = (Bytef *)(unpack->data + pos);
+            zs.avail_in = left < (1u << 30) ? (uInt)left : (1u << 30);
+            pos += zs.avail_in;
+        }
+        zs.next_out = out;
+        zs.avail_out = FW_UNPACK_OUT_SIZE;
+        zret = inflate(&zs, Z_NO_FLUSH);
+        if (zret != Z_OK && zret != Z_STREAM_END)
+        {
+            // Z_BUF_ERROR: the member is cut short
+            ret = mfrERR_DECRYPTION_FAILED;
+            break;
+        }
+        ret = unpackEmit(unpack, seg, out, FW_UNPACK_OUT_SIZE - zs.avail_out);
+    }
+    seg->end = pos - zs.avail_in;
+    inflateEnd(&zs);
+    return ret;
+}
+
+#ifdef FW_HAVE_ZSTD
+static mfrError_t unpackDecodeZstd(fw_Unpack_t *unpack, fw_Segment_t *seg, uint8_t *out)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_inBuffer in = { unpack->data + seg->start, (size_t)(seg->end - seg->start), 0 };
+    mfrError_t ret = mfrERR_NONE;
+    size_t zret = 1;
+
+    if (!dctx)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    while ((in.pos < in.size || zret) && ret == mfrERR_NONE)
+    {
+        ZSTD_outBuffer outBuf = { out, FW_UNPACK_OUT_SIZE, 0 };
+        zret = ZSTD_decompressStream(dctx, &outBuf, &in);
+        if (ZSTD_isError(zret) || (in.pos == in.size && zret && !outBuf.pos))
+        {
+            // corrupted, or a frame cut short
+            ret = mfrERR_DECRYPTION_FAILED;
+            break;
+        }
+        ret = unpackEmit(unpack, seg, out, outBuf.pos);
+    }
+    ZSTD_freeDCtx(dctx);
+    return ret;
+}
+
+static mfrError_t unpackSplitZstd(fw_Unpack_t *unpack)
+{
+    uint64_t pos = 0;
+    mfrError_t ret = mfrERR_NONE;
+
+    while (pos < unpack->size && ret == mfrERR_NONE)
+    {
+        size_t len = ZSTD_findFrameCompressedSize(unpack->data + pos, (size_t)(unpack->size - pos));
+        if (ZSTD_isError(len))
+        {
+            printf("package is corrupted: %s %s:%d \n", ZSTD_getErrorName(len), __FUNCTION__, __LINE__);
+            return mfrERR_DECRYPTION_FAILED;
+        }
+        fw_Segment_t *last = unpack->count ? &unpack->seg[unpack->count - 1] : NULL;
+        if (last && last->end - last->start < FW_UNPACK_MIN_SEGMENT)
+        {
+            last->end = pos + len;
+        }
+        else
+        {
+            ret = unpackAddSegment(unpack, pos, pos + len, 0);
+        }
+        pos += len;
+    }
+    return ret;
+}
+#endif
+
+#ifdef FW_HAVE_LZMA
+static mfrError_t unpackDecodeXz(fw_Unpack_t *unpack, fw_Segment_t *seg, uint8_t *out)
+{
+    const uint8_t *in = unpack->data + seg->start;
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_block block;
+    lzma_ret lret = LZMA_OK;
+    mfrError_t ret = mfrERR_NONE;
+    size_t i;
+
+    memset(&block, 0, sizeof(block));
+    block.version = 0;
+    block.check = (lzma_check)seg->check;
+    block.filters = filters;
+    block.header_size = lzma_block_header_size_decode(in[0]);
+    if (block.header_size > seg->end - seg->start || lzma_block_header_decode(&block, NULL, in) != LZMA_OK)
+    {
+        return mfrERR_DECRYPTION_FAILED;
+    }
+    if (lzma_block_decoder(&strm, &block) != LZMA_OK)
+    {
+        ret = mfrERR_DECRYPTION_FAILED;
+    }
+    strm.next_in = in + block.header_size;
+    strm.avail_in = (size_t)(seg->end - seg->start) - block.header_size;
+    while (ret == mfrERR_NONE && lret != LZMA_STREAM_END)
+    {
+        strm.next_out = out;
+        strm.avail_out = FW_UNPACK_OUT_SIZE;
+        lret = lzma_code(&strm, LZMA_RUN);
+        if (lret != LZMA_OK && lret != LZMA_STREAM_END)
+        {
+            ret = mfrERR_DECRYPTION_FAILED;
+            break;
+        }
+        ret = unpackEmit(unpack, seg, out, FW_UNPACK_OUT_SIZE - strm.avail_out);
+    }
+    lzma_end(&strm);
+    for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+    {
+        free(filters[i].options);
+    }
+    return ret;
+}
+
+static int unpackSegmentCompare(const void *a, const void *b)
+{
+    const fw_Segment_t *x = (const fw_Segment_t *)a;
+    const fw_Segment_t *y = (const fw_Segment_t *)b;
+
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Walks the streams back to front through their indexes, one segment per block */
+static mfrError_t unpackSplitXz(fw_Unpack_t *unpack)
+{
+    uint64_t pos = unpack->size;
+    mfrError_t ret = mfrERR_NONE;
+
+    while (pos && ret == mfrERR_NONE)
+    {
+        lzma_stream_flags header, footer;
+        lzma_index *index = NULL;
+        lzma_index_iter iter;
+        uint64_t memlimit = UINT64_MAX;
+        size_t inPos = 0;
+
+        while (pos >= 4 && !memcmp(unpack->data + pos - 4, "\0\0\0\0", 4))
+        {
+            // stream padding
+            pos -= 4;
+        }
+        if (pos < 2 * LZMA_STREAM_HEADER_SIZE ||
+            lzma_stream_footer_decode(&footer, unpack->data + pos - LZMA_STREAM_HEADER_SIZE) != LZMA_OK ||
+            footer.backward_size > pos - 2 * LZMA_STREAM_HEADER_SIZE)
+        {
+            return mfrERR_DECRYPTION_FAILED;
+        }
+        if (lzma_index_buffer_decode(&index, &memlimit, NULL,
+                                     unpack->data + pos - LZMA_STREAM_HEADER_SIZE - footer.backward_size,
+                                     &inPos, (size_t)footer.backward_size) != LZMA_OK)
+        {
+            return mfrERR_DECRYPTION_FAILED;
+        }
+        uint64_t streamSize = lzma_index_stream_size(index);
+        if (streamSize > pos ||
+            lzma_stream_header_decode(&header, unpack->data + pos - streamSize) != LZMA_OK ||
+            lzma_stream_flags_compare(&header, &footer) != LZMA_OK)
+        {
+            lzma_index_end(index, NULL);
+            return mfrERR_DECRYPTION_FAILED;
+        }
+        pos -= streamSize;
+        lzma_index_iter_init(&iter, index);
+        while (ret == mfrERR_NONE && !lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK))
+        {
+            uint64_t start = pos + iter.block.compressed_stream_offset;
+            ret = unpackAddSegment(unpack, start, start + iter.block.total_size, (int)header.check);
+        }
+        lzma_index_end(index, NULL);
+    }
+    // streams were walked back to front
+    qsort(unpack->seg, unpack->count, sizeof(fw_Segment_t), unpackSegmentCompare);
+    return ret;
+}
+#endif
+
+static mfrError_t unpackSplitGzip(fw_Unpack_t *unpack)
+{
+    static const uint8_t magic[3] = { 0x1f, 0x8b, 0x08 };
+    const uint8_t *p = unpack->data;
+    const uint8_t *end = unpack->data + unpack->size;
+    mfrError_t ret = mfrERR_NONE;
+
+    while (ret == mfrERR_NONE && (p = (const uint8_t *)memmem(p, (size_t)(end - p), magic, sizeof(magic))) != NULL)
+    {
+        // reserved flag bits must be clear in a real header
+        if (end - p >= 10 && !(p[3] & 0xe0))
+        {
+            ret = unpackAddSegment(unpack, (uint64_t)(p - unpack->data), 0, 0);
+        }
+        p++;
+    }
+    if (ret == mfrERR_NONE && (!unpack->count || unpack->seg[0].start))
+    {
+        printf("package is not gzip compressed %s:%d \n", __FUNCTION__, __LINE__);
+        ret = mfrERR_DECRYPTION_FAILED;
+    }
+    return ret;
+}
+
+static fw_Decode_t unpackDecoder(int format)
+{
+    switch (format)
+    {
+    case FW_FORMAT_GZIP:
+        return unpackDecodeGzip;
+#ifdef FW_HAVE_ZSTD
+    case FW_FORMAT_ZSTD:
+        return unpackDecodeZstd;
+#endif
+#ifdef FW_HAVE_LZMA
+    case FW_FORMAT_XZ:
+        return unpackDecodeXz;
+#endif
+    case FW_FORMAT_PLAIN:
+        return unpackDecodePlain;
+    default:
+        return NULL;
+    }
+}
+
+static mfrError_t unpackSplit(fw_Unpack_t *unpack)
+{
+    switch (unpack->format)
+    {
+    case FW_FORMAT_GZIP:
+        return unpackSplitGzip(unpack);
+#ifdef FW_HAVE_ZSTD
+    case FW_FORMAT_ZSTD:
+        return unpackSplitZstd(unpack);
+#endif
+#ifdef FW_HAVE_LZMA
+    case FW_FORMAT_XZ:
+        return unpackSplitXz(unpack);
+#endif
+    case FW_FORMAT_PLAIN:
+        return unpackAddSegment(unpack, 0, unpack->size, 0);
+    default:
+        printf("package compression is not supported by this build %s:%d \n", __FUNCTION__, __LINE__);
+        return mfrERR_OPERATION_NOT_SUPPORTED;
+    }
+}
+
+static void *unpackWorker(void *arg)
+{
+    fw_Unpack_t *unpack = (fw_Unpack_t *)arg;
+    fw_Decode_t decode = unpackDecoder(unpack->format);
+    uint8_t *out = (uint8_t *)malloc(FW_UNPACK_OUT_SIZE);
+
+    pthread_mutex_lock(&unpack->lock);
+    while (out && !unpack->finished)
+    {
+        if (unpack->next < unpack->count && unpack->seg[unpack->next].cancelled)
+        {
+            unpack->next++;
+            continue;
+        }
+        if (unpack->next >= unpack->count || unpack->next >= unpack->head + unpack->window)
+        {
+            pthread_cond_wait(&unpack->cond, &unpack->lock);
+            continue;
+        }
+        fw_Segment_t *seg = &unpack->seg[unpack->next++];
+        seg->state = SEG_RUNNING;
+        pthread_mutex_unlock(&unpack->lock);
+        unpackFinish(unpack, seg, decode(unpack, seg, out));
+        pthread_mutex_lock(&unpack->lock);
+    }
+    if (!out && !unpack->finished)
+    {
+        unpack->error = mfrERR_MALLOC_FAILED;
+        unpack->finished = 1;
+        atomic_store(&unpack->abort, 1);
+        pthread_cond_broadcast(&unpack->cond);
+    }
+    pthread_mutex_unlock(&unpack->lock);
+    free(out);
+    return NULL;
+}
+
+/********************************************************************
+   Functiona Name: fwUnpack
+   Description   : maps the package, cuts it into independent segments
+                   and decompresses them on up to threads threads
+   Input:    package, threads, write, ctx
+   Output:   outBytes - size of the unpacked data
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwUnpack(const char *package, unsigned int threads, fw_UnpackWrite_t write, void *ctx,
+                    uint64_t *outBytes)
+{
+    static const char *formats[] = { "plain", "gzip", "zstd", "xz" };
+    pthread_t tids[FW_UNPACK_MAX_THREADS];
+    fw_Unpack_t unpack;
+    struct stat st;
+    uint64_t startNs = fwNowNs();
+    unsigned int started = 0;
+    unsigned int i;
+    mfrError_t ret;
+    int fd = open(package, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        printf("failed to open %s %s:%d \n", package, __FUNCTION__, __LINE__);
+        return mfrERR_INVALID_PARAM;
+    }
+    if (fstat(fd, &st) < 0 || !st.st_size)
+    {
+        close(fd);
+        return mfrERR_INVALID_PARAM;
+    }
+    memset(&unpack, 0, sizeof(unpack));
+    unpack.size = (uint64_t)st.st_size;
+    unpack.data = (const uint8_t *)mmap(NULL, (size_t)unpack.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (unpack.data == MAP_FAILED)
+    {
+        printf("failed to map %s: %s %s:%d \n", package, strerror(errno), __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    madvise((void *)unpack.data, (size_t)unpack.size, MADV_WILLNEED);
+    unpack.format = fwUnpackFormat(unpack.data, (size_t)unpack.size);
+    unpack.write = write;
+    unpack.ctx = ctx;
+    unpack.error = mfrERR_NONE;
+    pthread_mutex_init(&unpack.lock, NULL);
+    pthread_cond_init(&unpack.cond, NULL);
+
+    ret = unpackSplit(&unpack);
+    if (ret == mfrERR_NONE && !unpack.count)
+    {
+        ret = mfrERR_DECRYPTION_FAILED;
+    }
+    if (ret == mfrERR_NONE)
+    {
+        threads = threads < 1 ? 1 : threads > FW_UNPACK_MAX_THREADS ? FW_UNPACK_MAX_THREADS : threads;
+        threads = unpack.format != FW_FORMAT_GZIP && threads > unpack.count ? (unsigned int)unpack.count : threads;
+        unpack.window = 2 * threads;
+        printf("unpacking %s: %s, %zu segments, %u threads\n", package, formats[unpack.format], unpack.count, threads);
+        for (i = 0; i < threads; i++, started++)
+        {
+            if (pthread_create(&tids[i], NULL, unpackWorker, &unpack) != 0)
+            {
+                break;
+            }
+        }
+        if (!started)
+        {
+            unpackWorker(&unpack);
+        }
+        for (i = 0; i < started; i++)
+        {
+            pthread_join(tids[i], NULL);
+        }
+        ret = unpack.error;
+    }
+
+    for (i = 0; i < unpack.count; i++)
+    {
+        unpackDropChunks(&unpack.seg[i]);
+    }
+    free(unpack.seg);
+    pthread_cond_destroy(&unpack.cond);
+    pthread_mutex_destroy(&unpack.lock);
+    munmap((void *)unpack.data, (size_t)unpack.size);
+    if (ret == mfrERR_NONE)
+    {
+        uint64_t ms = (fwNowNs() - startNs) / 1000000;
+        printf("unpacked %llu bytes to %llu bytes in %llu ms\n", (unsigned long long)unpack.size,
+               (unsigned long long)unpack.written, (unsigned long long)ms);
+    }
+    if (outBytes)
+    {
+        *outBytes = unpack.written;
+    }
+    return ret;
+}
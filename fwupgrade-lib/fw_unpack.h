@@ -0,0 +1,47 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Parallel unpacker. The package is memory mapped and cut into segments
+  that decompress independently: the members of a multi-member gzip,
+  zstd frames, xz blocks. Worker threads decompress the segments and the
+  output is handed to the sink in package order. A segment that is next
+  in line streams straight to the sink, the others are buffered.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+
+enum {
+    FW_FORMAT_PLAIN = 0,
+    FW_FORMAT_GZIP,
+    FW_FORMAT_ZSTD,
+    FW_FORMAT_XZ,
+};
+
+typedef mfrError_t (*fw_UnpackWrite_t)(void *ctx, const void *data, size_t len);
+
+/* Compression format of a package, from its first bytes */
+int fwUnpackFormat(const uint8_t *data, size_t len);
+
+/* Decompresses package to write(), in order, using up to threads threads */
+mfrError_t fwUnpack(const char *package, unsigned int threads, fw_UnpackWrite_t write, void *ctx,
+                    uint64_t *outBytes);
@@ -0,0 +1,187 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "string.h"
+#include "fw_hash.h"
+#include "fw_pipeline.h"
+#include "fw_trace.h"
+#include "fw_verify.h"
+
+typedef struct fw_Verify {
+    fw_Target_t *target;
+    const uint32_t *crcs;
+    uint64_t length;
+    size_t blockSize;
+    const uint64_t *unwritten;
+    size_t granule;
+    uint64_t blocks;
+    _Atomic uint64_t next;          /* next block to claim */
+    _Atomic uint64_t bytesRead;
+    _Atomic int failed;
+    mfrError_t error;
+} fw_Verify_t;
+
+typedef struct fw_VerifyThread {
+    fw_Verify_t *verify;
+    uint8_t *buf;
+} fw_VerifyThread_t;
+
+static void verifyFail(fw_Verify_t *verify, mfrError_t error)
+{
+    if (!atomic_exchange(&verify->failed, 1))
+    {
+        verify->error = error;
+    }
+}
+
+static int verifyUnwritten(const fw_Verify_t *verify, uint64_t offset)
+{
+    uint64_t index = offset / verify->granule;
+
+    return verify->unwritten && ((verify->unwritten[index / 64] >> (index % 64)) & 1);
+}
+
+/* Reads a block, the granules left alone as zeroes */
+static mfrError_t verifyRead(fw_Verify_t *verify, uint8_t *buf, size_t len, uint64_t offset)
+{
+    size_t pos = 0;
+
+    while (pos < len)
+    {
+        size_t end = pos;
+
+        if (verifyUnwritten(verify, offset + pos))
+        {
+            size_t take = len - pos < verify->granule ? len - pos : verify->granule;
+            memset(buf + pos, 0, take);
+            pos += take;
+            continue;
+        }
+        while (end < len && !verifyUnwritten(verify, offset + end))
+        {
+            end += verify->unwritten ? verify->granule : len;
+        }
+        end = end < len ? end : len;
+        if (fwTargetRead(verify->target, buf + pos, end - pos, offset + pos) != mfrERR_NONE)
+        {
+            return mfrERR_GENERAL;
+        }
+        atomic_fetch_add_explicit(&verify->bytesRead, end - pos, memory_order_relaxed);
+        pos = end;
+    }
+    return mfrERR_NONE;
+}
+
+static void *verifyThread(void *arg)
+{
+    fw_Verify_t *verify = ((fw_VerifyThread_t *)arg)->verify;
+    uint8_t *buf = ((fw_VerifyThread_t *)arg)->buf;
+    uint64_t i;
+
+    FW_TRACE_THREAD("verify");
+    while (!atomic_load_explicit(&verify->failed, memory_order_relaxed) &&
+           (i = atomic_fetch_add(&verify->next, 1)) < verify->blocks)
+    {
+        uint64_t offset = i * verify->blockSize;
+        size_t len = verify->length - offset < verify->blockSize ? (size_t)(verify->length - offset)
+                                                                  : verify->blockSize;
+        FW_TRACE_BEGIN(start);
+        if (verifyRead(verify, buf, len, offset) != mfrERR_NONE)
+        {
+            verifyFail(verify, mfrERR_GENERAL);
+            break;
+        }
+        uint32_t crc = fwCrc32c(0, buf, len);
+        FW_TRACE_END("readback", start);
+        if (crc != verify->crcs[i])
+        {
+            printf("%s does not read back at %llu: crc %08x, expected %08x %s:%d \n", verify->target->path,
+                   (unsigned long long)offset, crc, verify->crcs[i], __FUNCTION__, __LINE__);
+            verifyFail(verify, mfrERR_GENERAL);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/********************************************************************
+   Functiona Name: fwVerifyTarget
+   Description   : reads a synced target back from the media and checks
+                   every block against the CRC32C taken while writing
+   Input:    target, crcs, length, blockSize, buffers - one per
+             thread, threads, unwritten - NULL when everything was
+             written, granule
+   Output:   None
+   Returns:  mfrERR_NONE when the target holds what was written
+
+*********************************************************************/
+
+mfrError_t fwVerifyTarget(fw_Target_t *target, const uint32_t *crcs, uint64_t length, size_t blockSize,
+                          uint8_t *const *buffers, unsigned int threads, const uint64_t *unwritten, size_t granule)
+{
+    pthread_t tids[FW_VERIFY_MAX_THREADS];
+    fw_VerifyThread_t args[FW_VERIFY_MAX_THREADS];
+    fw_Verify_t verify;
+    uint64_t start = fwNowNs();
+    unsigned int started = 0;
+    unsigned int i;
+
+    memset(&verify, 0, sizeof(verify));
+    verify.target = target;
+    verify.crcs = crcs;
+    verify.length = length;
+    verify.blockSize = blockSize;
+    verify.unwritten = granule ? unwritten : NULL;
+    verify.granule = granule;
+    verify.blocks = (length + blockSize - 1) / blockSize;
+    verify.error = mfrERR_NONE;
+    threads = threads < 1 ? 1 : threads > FW_VERIFY_MAX_THREADS ? FW_VERIFY_MAX_THREADS : threads;
+    threads = (uint64_t)threads > verify.blocks ? (unsigned int)verify.blocks : threads;
+
+    fwTargetDropCache(target);
+    for (i = 0; i < threads; i++, started++)
+    {
+        args[i].verify = &verify;
+        args[i].buf = buffers[i];
+        if (pthread_create(&tids[i], NULL, verifyThread, &args[i]) != 0)
+        {
+            break;
+        }
+    }
+    if (!started && verify.blocks)
+    {
+        // no thread to spare, check it from here
+        verifyThread(&args[0]);
+    }
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    if (verify.error == mfrERR_NONE)
+    {
+        uint64_t ms = (fwNowNs() - start) / 1000000;
+        printf("%s verified, %llu bytes read back in %llu ms by %u threads\n", target->path,
+               (unsigned long long)atomic_load(&verify.bytesRead), (unsigned long long)ms, started ? started : 1);
+    }
+    return verify.error;
+}
@@ -0,0 +1,39 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Post-flash readback. The CRC32C of every block is taken while the
+  block is on its way to the target; once the target is synced its
+  cache is dropped and the blocks are read back from the media by a
+  few threads in parallel and checked against those CRCs.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_target.h"
+
+#define FW_VERIFY_MAX_THREADS   16
+
+/* crcs[i] covers [i * blockSize, (i + 1) * blockSize) of the first length bytes. The granules set in
+   unwritten, if any, were left alone: they are not read and count as zeroes. Every thread reads into
+   one of buffers, blockSize bytes each. */
+mfrError_t fwVerifyTarget(fw_Target_t *target, const uint32_t *crcs, uint64_t length, size_t blockSize,
+                          uint8_t *const *buffers, unsigned int threads, const uint64_t *unwritten, size_t granule);
@@ -0,0 +1,576 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+  dm-verity hash tree of the rootfs, see fw_verity.h.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "string.h"
+#include "fw_verity.h"
+
+#define FW_VERITY_DIGESTS       (FW_VERITY_BLOCK_SIZE / FW_SHA256_SIZE)
+#define FW_VERITY_SIGNATURE     "verity\0\0"
+#define FW_VERITY_ALGORITHM     "sha256"
+#define FW_VERITY_VERSION       1
+#define FW_VERITY_HASH_TYPE     1                   /* salt ahead of the data */
+#define FW_VERITY_RANDOM        "/dev/urandom"
+#define FW_VERITY_MIN_SHARE     16                  /* blocks below which hashing is not handed out */
+
+/* Hashes items [first, end) of a job */
+typedef void (*fw_VerityTask_t)(fw_Verity_t *verity, const void *arg, uint64_t first, uint64_t end);
+
+typedef struct fw_VerityHelper {
+    fw_VerityPool_t *pool;
+    unsigned int index;             /* share of the job, the caller takes share 0 */
+} fw_VerityHelper_t;
+
+struct fw_VerityPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    pthread_t threads[FW_VERITY_MAX_THREADS];
+    fw_VerityHelper_t helper[FW_VERITY_MAX_THREADS];
+    unsigned int count;             /* helper threads */
+    unsigned int shares;            /* the job is split this many ways, helpers past it sit out */
+    unsigned int busy;              /* helpers still on the job */
+    uint64_t generation;            /* bumped for every job */
+    int stop;
+    fw_Verity_t *verity;
+    fw_VerityTask_t task;
+    const void *arg;
+    uint64_t items;
+};
+
+/* Data blocks to hash into the leaves from first on */
+typedef struct fw_VeritySpan {
+    uint64_t first;
+    const uint8_t *data;
+} fw_VeritySpan_t;
+
+static void wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+    wr16(p, (uint16_t)v);
+    wr16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return (uint32_t)rd16(p) | ((uint32_t)rd16(p + 2) << 16);
+}
+
+static void wr64(uint8_t *p, uint64_t v)
+{
+    wr32(p, (uint32_t)v);
+    wr32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t rd64(const uint8_t *p)
+{
+    return (uint64_t)rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+static int verityReadAll(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = read(fd, (uint8_t *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int verityWriteAll(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = write(fd, (const uint8_t *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static void verityDigest(const fw_Verity_t *verity, const uint8_t *block, uint8_t *digest)
+{
+    fw_Sha256_t ctx = verity->salted;
+
+    fwSha256Update(&ctx, block, FW_VERITY_BLOCK_SIZE);
+    fwSha256Final(&ctx, digest);
+}
+
+static uint8_t *verityLevel(const fw_Verity_t *verity, uint32_t level)
+{
+    return verity->tree + verity->levelStart[level] * FW_VERITY_BLOCK_SIZE;
+}
+
+static void verityHashLeaves(fw_Verity_t *verity, const void *arg, uint64_t first, uint64_t end)
+{
+    const fw_VeritySpan_t *span = (const fw_VeritySpan_t *)arg;
+    uint8_t *leaves = verityLevel(verity, 0);
+    uint64_t i;
+
+    for (i = first; i < end; i++)
+    {
+        verityDigest(verity, span->data + i * FW_VERITY_BLOCK_SIZE, leaves + (span->first + i) * FW_SHA256_SIZE);
+    }
+}
+
+/* A level holds the digests of the hash blocks of the level below */
+static void verityHashLevel(fw_Verity_t *verity, const void *arg, uint64_t first, uint64_t end)
+{
+    uint32_t level = *(const uint32_t *)arg;
+    const uint8_t *below = verityLevel(verity, level - 1);
+    uint8_t *digests = verityLevel(verity, level);
+    uint64_t i;
+
+    for (i = first; i < end; i++)
+    {
+        verityDigest(verity, below + i * FW_VERITY_BLOCK_SIZE, digests + i * FW_SHA256_SIZE);
+    }
+}
+
+static void *verityHelper(void *arg)
+{
+    fw_VerityHelper_t *helper = (fw_VerityHelper_t *)arg;
+    fw_VerityPool_t *pool = helper->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (!pool->stop && pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+        seen = pool->generation;
+        if (helper->index >= pool->shares)
+        {
+            continue;
+        }
+        fw_VerityTask_t task = pool->task;
+        const void *taskArg = pool->arg;
+        uint64_t items = pool->items;
+        uint64_t shares = pool->shares;
+        pthread_mutex_unlock(&pool->lock);
+        task(pool->verity, taskArg, items * helper->index / shares, items * (helper->index + 1) / shares);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+void fwVerityPoolDestroy(fw_VerityPool_t *pool)
+{
+    unsigned int i;
+
+    if (!pool)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->count; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+
+/* Hashing goes on without the helpers when they cannot be started */
+fw_VerityPool_t *fwVerityPoolCreate(unsigned int threads)
+{
+    unsigned int count = (threads > FW_VERITY_MAX_THREADS ? FW_VERITY_MAX_THREADS : threads) - 1;
+    fw_VerityPool_t *pool;
+    unsigned int i;
+
+    if (threads < 2 || !(pool = (fw_VerityPool_t *)calloc(1, sizeof(*pool))))
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i = 0; i < count; i++)
+    {
+        pool->helper[i].pool = pool;
+        pool->helper[i].index = i + 1;
+        if (pthread_create(&pool->threads[i], NULL, verityHelper, &pool->helper[i]) != 0)
+        {
+            break;
+        }
+        pool->count++;
+    }
+    if (!pool->count)
+    {
+        fwVerityPoolDestroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/* Splits the items of a job between the caller and the helpers, returns once they are all hashed */
+static void verityRun(fw_Verity_t *verity, fw_VerityTask_t task, const void *arg, uint64_t items)
+{
+    fw_VerityPool_t *pool = verity->pool;
+    unsigned int shares = pool && verity->threads > pool->count + 1 ? pool->count + 1 : verity->threads;
+
+    if (!pool || shares < 2 || items < 2 * FW_VERITY_MIN_SHARE)
+    {
+        task(verity, arg, 0, items);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->verity = verity;
+    pool->task = task;
+    pool->arg = arg;
+    pool->items = items;
+    pool->shares = shares;
+    pool->busy = shares - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    task(verity, arg, 0, items / shares);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void verityRandom(uint8_t *buf, size_t len)
+{
+    int fd = open(FW_VERITY_RANDOM, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || verityReadAll(fd, buf, len) != 0)
+    {
+        // only makes the tree of a bank differ from that of another device
+        uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+        size_t i;
+        for (i = 0; i < len; i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            buf[i] = (uint8_t)(seed >> 56);
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+/********************************************************************
+   Functiona Name: fwVerityInit
+   Description   : lays the tree out for dataSize bytes of data
+   Input:    dataSize, salt - FW_VERITY_SALT_SIZE bytes, NULL for a
+             random one, pool - helpers, may be NULL, threads -
+             hashing the leaves, the caller included, arena - budget
+             mode, NULL for the heap
+   Output:   verity, released with fwVerityRelease
+   Returns:  mfrERR_NONE, mfrERR_INVALID_PARAM when there is not a
+             whole data block, mfrERR_MALLOC_FAILED
+
+*********************************************************************/
+
+mfrError_t fwVerityInit(fw_Verity_t *verity, uint64_t dataSize, const uint8_t *salt, fw_VerityPool_t *pool,
+                        unsigned int threads, fw_Arena_t *arena)
+{
+    size_t treeSize;
+    uint64_t blocks;
+    uint32_t i;
+
+    memset(verity, 0, sizeof(*verity));
+    verity->dataBlocks = dataSize / FW_VERITY_BLOCK_SIZE;
+    if (!verity->dataBlocks)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    blocks = verity->dataBlocks;
+    do
+    {
+        if (verity->levels == FW_VERITY_MAX_LEVELS)
+        {
+            return mfrERR_INVALID_PARAM;
+        }
+        blocks = (blocks + FW_VERITY_DIGESTS - 1) / FW_VERITY_DIGESTS;
+        verity->levelBlocks[verity->levels++] = blocks;
+    } while (blocks > 1);
+    // the top level comes first on the hash device
+    for (i = verity->levels; i-- > 0;)
+    {
+        verity->levelStart[i] = verity->treeBlocks;
+        verity->treeBlocks += verity->levelBlocks[i];
+    }
+    treeSize = (size_t)verity->treeBlocks * FW_VERITY_BLOCK_SIZE;
+    verity->arena = arena;
+    if (verity->treeBlocks <= SIZE_MAX / FW_VERITY_BLOCK_SIZE)
+    {
+        verity->tree = (uint8_t *)(arena ? fwArenaAlloc(arena, treeSize, FW_VERITY_BLOCK_SIZE) : calloc(1, treeSize));
+    }
+    if (!verity->tree)
+    {
+        printf("failed to allocate a hash tree of %llu blocks %s:%d \n", (unsigned long long)verity->treeBlocks,
+               __FUNCTION__, __LINE__);
+        return mfrERR_MALLOC_FAILED;
+    }
+    if (salt)
+    {
+        memcpy(verity->salt, salt, sizeof(verity->salt));
+    }
+    else
+    {
+        verityRandom(verity->salt, sizeof(verity->salt));
+    }
+    verityRandom(verity->uuid, sizeof(verity->uuid));
+    fwSha256Init(&verity->salted);
+    fwSha256Update(&verity->salted, verity->salt, sizeof(verity->salt));
+    verity->pool = pool;
+    verity->threads = threads;
+    return mfrERR_NONE;
+}
+
+void fwVerityHash(fw_Verity_t *verity, uint64_t offset, const uint8_t *data, size_t len)
+{
+    fw_VeritySpan_t span = { offset / FW_VERITY_BLOCK_SIZE, data };
+    uint64_t count = len / FW_VERITY_BLOCK_SIZE;
+
+    if (span.first >= verity->dataBlocks)
+    {
+        return;
+    }
+    count = count < verity->dataBlocks - span.first ? count : verity->dataBlocks - span.first;
+    verityRun(verity, verityHashLeaves, &span, count);
+}
+
+const uint8_t *fwVerityLeaf(const fw_Verity_t *verity, uint64_t block)
+{
+    return verityLevel(verity, 0) + block * FW_SHA256_SIZE;
+}
+
+void fwVerityFinish(fw_Verity_t *verity)
+{
+    uint32_t level;
+
+    for (level = 1; level < verity->levels; level++)
+    {
+        verityRun(verity, verityHashLevel, &level, verity->levelBlocks[level - 1]);
+    }
+    verityDigest(verity, verityLevel(verity, verity->levels - 1), verity->root);
+}
+
+/********************************************************************
+   Functiona Name: fwVeritySave
+   Description   : writes the tree as a veritysetup hash device and
+                   its root hash in hex. The root hash goes first, so
+                   a tree cut short by a crash never loads back.
+   Input:    verity - finished, path, rootPath
+   Output:   None
+   Returns:  mfrERR_NONE once both are on the media
+
+*********************************************************************/
+
+mfrError_t fwVeritySave(const fw_Verity_t *verity, const char *path, const char *rootPath)
+{
+    uint8_t sb[FW_VERITY_BLOCK_SIZE];
+    char hex[2 * FW_SHA256_SIZE + 2];
+    int failed;
+    int fd;
+
+    unlink(rootPath);
+    memset(sb, 0, sizeof(sb));
+    memcpy(sb, FW_VERITY_SIGNATURE, 8);
+    wr32(sb + 8, FW_VERITY_VERSION);
+    wr32(sb + 12, FW_VERITY_HASH_TYPE);
+    memcpy(sb + 16, verity->uuid, sizeof(verity->uuid));
+    memcpy(sb + 32, FW_VERITY_ALGORITHM, sizeof(FW_VERITY_ALGORITHM) - 1);
+    wr32(sb + 64, FW_VERITY_BLOCK_SIZE);
+    wr32(sb + 68, FW_VERITY_BLOCK_SIZE);
+    wr64(sb + 72, verity->dataBlocks);
+    wr16(sb + 80, FW_VERITY_SALT_SIZE);
+    memcpy(sb + 88, verity->salt, sizeof(verity->salt));
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("failed to create %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        return mfrERR_GENERAL;
+    }
+    failed = verityWriteAll(fd, sb, sizeof(sb)) != 0 ||
+             verityWriteAll(fd, verity->tree, (size_t)verity->treeBlocks * FW_VERITY_BLOCK_SIZE) != 0 ||
+             fdatasync(fd) != 0;
+    failed |= close(fd) != 0;
+    if (!failed)
+    {
+        fwSha256Hex(verity->root, hex);
+        strcat(hex, "\n");
+        fd = open(rootPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        failed = fd < 0 || verityWriteAll(fd, hex, strlen(hex)) != 0 || fdatasync(fd) != 0;
+        failed |= fd >= 0 && close(fd) != 0;
+    }
+    if (failed)
+    {
+        printf("failed to write %s %s:%d \n", path, __FUNCTION__, __LINE__);
+        unlink(rootPath);
+        unlink(path);
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+static int verityReadRoot(const char *rootPath, uint8_t root[FW_SHA256_SIZE])
+{
+    char hex[2 * FW_SHA256_SIZE + 1];
+    int fd = open(rootPath, O_RDONLY | O_CLOEXEC);
+    int ok;
+    int i;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ok = verityReadAll(fd, hex, sizeof(hex) - 1) == 0;
+    close(fd);
+    hex[sizeof(hex) - 1] = '\0';
+    for (i = 0; i < FW_SHA256_SIZE && ok; i++)
+    {
+        unsigned int byte;
+        ok = sscanf(hex + i * 2, "%2x", &byte) == 1;
+        root[i] = (uint8_t)byte;
+    }
+    return ok ? 0 : -1;
+}
+
+/********************************************************************
+   Functiona Name: fwVerityLoad
+   Description   : loads a tree saved by fwVeritySave. The upper
+                   levels are hashed again from the leaves, so a tree
+                   that does not lead to its root hash is refused.
+   Input:    path, rootPath, pool, threads, arena - as for
+             fwVerityInit
+   Output:   verity, released with fwVerityRelease
+   Returns:  mfrERR_NONE, mfrERR_GENERAL when there is no usable tree
+
+*********************************************************************/
+
+mfrError_t fwVerityLoad(fw_Verity_t *verity, const char *path, const char *rootPath, fw_VerityPool_t *pool,
+                        unsigned int threads, fw_Arena_t *arena)
+{
+    uint8_t sb[FW_VERITY_BLOCK_SIZE];
+    uint8_t root[FW_SHA256_SIZE];
+    mfrError_t ret = mfrERR_GENERAL;
+    int fd;
+
+    memset(verity, 0, sizeof(*verity));
+    if (verityReadRoot(rootPath, root) != 0)
+    {
+        return mfrERR_GENERAL;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return mfrERR_GENERAL;
+    }
+    if (verityReadAll(fd, sb, sizeof(sb)) == 0 && !memcmp(sb, FW_VERITY_SIGNATURE, 8) &&
+        rd32(sb + 8) == FW_VERITY_VERSION && rd32(sb + 12) == FW_VERITY_HASH_TYPE &&
+        !strncmp((const char *)sb + 32, FW_VERITY_ALGORITHM, 32) && rd32(sb + 64) == FW_VERITY_BLOCK_SIZE &&
+        rd32(sb + 68) == FW_VERITY_BLOCK_SIZE && rd16(sb + 80) == FW_VERITY_SALT_SIZE &&
+        rd64(sb + 72) < UINT64_MAX / FW_VERITY_BLOCK_SIZE)
+    {
+        ret = fwVerityInit(verity, rd64(sb + 72) * FW_VERITY_BLOCK_SIZE, sb + 88, pool, threads, arena);
+    }
+    if (ret == mfrERR_NONE)
+    {
+        memcpy(verity->uuid, sb + 16, sizeof(verity->uuid));
+        if (verityReadAll(fd, verity->tree, (size_t)verity->treeBlocks * FW_VERITY_BLOCK_SIZE) != 0)
+        {
+            ret = mfrERR_GENERAL;
+        }
+    }
+    close(fd);
+    if (ret == mfrERR_NONE)
+    {
+        fwVerityFinish(verity);
+        ret = memcmp(verity->root, root, sizeof(root)) ? mfrERR_GENERAL : mfrERR_NONE;
+        // only looked up from now on
+        verity->pool = NULL;
+    }
+    if (ret != mfrERR_NONE)
+    {
+        printf("ignoring %s, it does not match its root hash\n", path);
+        fwVerityRelease(verity);
+    }
+    return ret;
+}
+
+void fwVerityRelease(fw_Verity_t *verity)
+{
+    if (!verity->arena)
+    {
+        free(verity->tree);
+    }
+    memset(verity, 0, sizeof(*verity));
+}
@@ -0,0 +1,78 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  dm-verity hash tree of the rootfs: format 1, SHA-256, 4KB data and
+  hash blocks, 128 digests to a hash block. The leaves are hashed by a
+  pool of threads while the rootfs streams by, and the upper levels
+  once it is complete. The pool outlives the trees, it serves one of
+  them at a time. The tree is saved as a veritysetup hash device,
+  a superblock in the first 4KB and then the levels from the top down,
+  with its root hash in hex next to it. A saved tree can be loaded
+  back to compare an image with what a bank holds without reading the
+  bank.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_arena.h"
+#include "fw_hash.h"
+
+#define FW_VERITY_BLOCK_SIZE    4096
+#define FW_VERITY_SALT_SIZE     32
+#define FW_VERITY_MAX_LEVELS    10
+#define FW_VERITY_MAX_THREADS   16
+
+typedef struct fw_VerityPool fw_VerityPool_t;
+
+typedef struct fw_Verity {
+    uint64_t dataBlocks;            /* whole 4KB blocks covered, a partial tail is not */
+    uint32_t levels;
+    uint64_t levelStart[FW_VERITY_MAX_LEVELS];  /* first hash block of each level in the tree, 0 the leaves */
+    uint64_t levelBlocks[FW_VERITY_MAX_LEVELS];
+    uint64_t treeBlocks;
+    uint8_t *tree;
+    uint8_t salt[FW_VERITY_SALT_SIZE];
+    uint8_t uuid[16];
+    uint8_t root[FW_SHA256_SIZE];
+    fw_Sha256_t salted;             /* state once the salt went in */
+    fw_VerityPool_t *pool;          /* borrowed, NULL to hash on the calling thread only */
+    unsigned int threads;           /* hashing, the caller included */
+    fw_Arena_t *arena;              /* budget mode: holds the tree, NULL for the heap */
+} fw_Verity_t;
+
+/* Helper threads for threads hashing in all, the caller included. NULL when there is no need or no way. */
+fw_VerityPool_t *fwVerityPoolCreate(unsigned int threads);
+void fwVerityPoolDestroy(fw_VerityPool_t *pool);
+/* salt NULL for a random one, pool and threads hashing with the caller, arena NULL for the heap */
+mfrError_t fwVerityInit(fw_Verity_t *verity, uint64_t dataSize, const uint8_t *salt, fw_VerityPool_t *pool,
+                        unsigned int threads, fw_Arena_t *arena);
+/* Hashes the data blocks of [offset, offset + len), offset 4KB aligned */
+void fwVerityHash(fw_Verity_t *verity, uint64_t offset, const uint8_t *data, size_t len);
+/* Digest of a data block, zero until it has been hashed */
+const uint8_t *fwVerityLeaf(const fw_Verity_t *verity, uint64_t block);
+/* Hashes the upper levels and the root, once every leaf is in */
+void fwVerityFinish(fw_Verity_t *verity);
+mfrError_t fwVeritySave(const fw_Verity_t *verity, const char *path, const char *rootPath);
+/* Loads a saved tree, only when it hashes to its root hash */
+mfrError_t fwVerityLoad(fw_Verity_t *verity, const char *path, const char *rootPath, fw_VerityPool_t *pool,
+                        unsigned int threads, fw_Arena_t *arena);
+void fwVerityRelease(fw_Verity_t *verity);
@@ -0,0 +1,829 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  io_uring is driven through the raw system calls, the library does
+  not depend on liburing. Every write takes one of depth request
+  slots; a slot is only handed back once its write completed, so the
+  submitter is throttled to depth writes in flight. Writes to a target
+  with a device model are held back once the media is done with them,
+  until the model says the device would be.
+----------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "string.h"
+#include "fw_pipeline.h"
+#include "fw_trace.h"
+#include "fw_writer.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define FW_HAVE_IO_URING
+#endif
+
+#define FW_WRITER_FILES         2
+
+typedef struct fw_WriterFile {
+    fw_Target_t *target;
+    int directFd;               /* O_DIRECT descriptor, -1 when writes go through the page cache */
+} fw_WriterFile_t;
+
+typedef struct fw_WriteRequest {
+    int fd;
+    const uint8_t *buf;
+    size_t len;
+    uint64_t offset;            /* on the descriptor */
+    size_t done;                /* written so far, io_uring resubmits short writes */
+    unsigned int retries;       /* short writes and interrupted calls */
+    int direct;
+    void *cookie;
+    uint64_t submitNs;
+    uint64_t readyNs;           /* device model: completed no earlier than this */
+    ssize_t result;             /* bytes written or -errno, from the pool threads and held writes */
+    struct iovec iov;
+} fw_WriteRequest_t;
+
+struct fw_Writer {
+    mfrWriteBackend_t backend;
+    fw_Arena_t *arena;          /* budget mode: holds the writer, NULL for the heap */
+    uint32_t depth;
+    uint32_t inFlight;
+    fw_WriteDone_t done;
+    void *ctx;
+    mfrError_t error;
+    int broken;                 /* io_uring failed, what is in flight cannot be reaped anymore */
+    fw_WriterStats_t *stats;
+    fw_Throttle_t *throttle;    /* of the bound flash, the pool threads read it with lock held */
+    fw_WriterFile_t file[FW_WRITER_FILES];
+    int files;
+    fw_WriteRequest_t *req;
+    uint32_t *freeSlots;
+    uint32_t freeCount;
+    uint32_t *held;             /* device model: done on the media, not yet on the device */
+    uint32_t heldCount;
+#ifdef FW_HAVE_IO_URING
+    int ringFd;
+    uint64_t ioprioGeneration;  /* of the throttle limits ioprio follows */
+    uint16_t ioprio;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_cqe *cqes;
+#endif
+    /* thread pool: slots queued for the threads, slots they completed */
+    pthread_t threads[FW_WRITER_MAX_DEPTH];
+    uint32_t threadCount;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t completed;
+    uint32_t *queue;
+    uint32_t queueHead;
+    uint32_t queueCount;
+    uint32_t *finished;
+    uint32_t finishedCount;
+    int stop;
+};
+
+static ssize_t writerWriteAll(int fd, const uint8_t *buf, size_t len, uint64_t offset, unsigned int *retries)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = pwrite(fd, buf + done, len - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR)
+        {
+            (*retries)++;
+            continue;
+        }
+        if (n <= 0)
+        {
+            return n < 0 ? -errno : -EIO;
+        }
+        done += (size_t)n;
+        *retries += done < len;
+    }
+    return (ssize_t)done;
+}
+
+/* Accounts a finished write, frees its slot and hands the buffer back */
+static void writerComplete(fw_Writer_t *writer, uint32_t slot, ssize_t result)
+{
+    fw_WriteRequest_t *req = &writer->req[slot];
+    fw_WriterStats_t *stats = writer->stats;
+    uint64_t latency = fwNowNs() - req->submitNs;
+
+    if (result < 0 || (size_t)result != req->len)
+    {
+        printf("write failed at %llu: %s %s:%d \n", (unsigned long long)req->offset,
+               strerror(result < 0 ? (int)-result : EIO), __FUNCTION__, __LINE__);
+        writer->error = mfrERR_GENERAL;
+    }
+    FW_TRACE_SPAN(req->direct ? "write direct" : "write", (int)slot + 1, req->submitNs, req->submitNs + latency);
+    stats->latencyNs += latency;
+    stats->retries += req->retries;
+    stats->maxLatencyNs = latency > stats->maxLatencyNs ? latency : stats->maxLatencyNs;
+    stats->bytes += req->len;
+    stats->directBytes += req->direct ? req->len : 0;
+    writer->inFlight--;
+    writer->freeSlots[writer->freeCount++] = slot;
+    writer->done(writer->ctx, req->cookie);
+}
+
+/* A write the device model still has in progress waits among the held ones */
+static void writerFinish(fw_Writer_t *writer, uint32_t slot, ssize_t result)
+{
+    fw_WriteRequest_t *req = &writer->req[slot];
+
+    if (req->readyNs > fwNowNs())
+    {
+        req->result = result;
+        writer->held[writer->heldCount++] = slot;
+        return;
+    }
+    writerComplete(writer, slot, result);
+}
+
+/* Completes the held writes that are due, after waiting for the first one when wait is set */
+static void writerReleaseHeld(fw_Writer_t *writer, int wait)
+{
+    uint64_t first = UINT64_MAX;
+    uint64_t now;
+    uint32_t i;
+
+    for (i = 0; wait && i < writer->heldCount; i++)
+    {
+        uint64_t ready = writer->req[writer->held[i]].readyNs;
+        first = ready < first ? ready : first;
+    }
+    if (first != UINT64_MAX)
+    {
+        fwModelWait(first);
+    }
+    now = fwNowNs();
+    for (i = 0; i < writer->heldCount;)
+    {
+        uint32_t slot = writer->held[i];
+        if (writer->req[slot].readyNs > now)
+        {
+            i++;
+            continue;
+        }
+        writer->held[i] = writer->held[--writer->heldCount];
+        writerComplete(writer, slot, writer->req[slot].result);
+    }
+}
+
+#ifdef FW_HAVE_IO_URING
+
+static int writerUringEnter(fw_Writer_t *writer, unsigned int submit, unsigned int wait)
+{
+    int ret;
+
+    do
+    {
+        ret = (int)syscall(__NR_io_uring_enter, writer->ringFd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                           NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static int writerUringSetup(fw_Writer_t *writer)
+{
+    struct io_uring_params params;
+    uint8_t *sq;
+    uint8_t *cq;
+
+    memset(&params, 0, sizeof(params));
+    writer->ringFd = (int)syscall(__NR_io_uring_setup, writer->depth, &params);
+    if (writer->ringFd < 0)
+    {
+        return -1;
+    }
+    writer->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    writer->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        writer->sqMapSize = writer->cqMapSize > writer->sqMapSize ? writer->cqMapSize : writer->sqMapSize;
+    }
+    writer->sqMap = mmap(NULL, writer->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         writer->ringFd, IORING_OFF_SQ_RING);
+    if (writer->sqMap == MAP_FAILED)
+    {
+        writer->sqMap = NULL;
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        writer->cqMap = writer->sqMap;
+    }
+    else
+    {
+        writer->cqMap = mmap(NULL, writer->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             writer->ringFd, IORING_OFF_CQ_RING);
+        if (writer->cqMap == MAP_FAILED)
+        {
+            writer->cqMap = NULL;
+            return -1;
+        }
+    }
+    writer->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    writer->sqes = (struct io_uring_sqe *)mmap(NULL, writer->sqesSize, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, writer->ringFd, IORING_OFF_SQES);
+    if (writer->sqes == MAP_FAILED)
+    {
+        writer->sqes = NULL;
+        return -1;
+    }
+    sq = (uint8_t *)writer->sqMap;
+    cq = (uint8_t *)writer->cqMap;
+    writer->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+    writer->sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    writer->sqArray = (unsigned int *)(sq + params.sq_off.array);
+    writer->cqHead = (unsigned int *)(cq + params.cq_off.head);
+    writer->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+    writer->cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    writer->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void writerUringRelease(fw_Writer_t *writer)
+{
+    if (writer->sqes)
+    {
+        munmap(writer->sqes, writer->sqesSize);
+    }
+    if (writer->cqMap && writer->cqMap != writer->sqMap)
+    {
+        munmap(writer->cqMap, writer->cqMapSize);
+    }
+    if (writer->sqMap)
+    {
+        munmap(writer->sqMap, writer->sqMapSize);
+    }
+    if (writer->ringFd >= 0)
+    {
+        close(writer->ringFd);
+    }
+    writer->sqes = NULL;
+    writer->cqMap = NULL;
+    writer->sqMap = NULL;
+    writer->ringFd = -1;
+}
+
+/* I/O class of the background mode, looked up again when the limits changed */
+static uint16_t writerUringPriority(fw_Writer_t *writer)
+{
+    uint64_t generation;
+
+    if (!writer->throttle)
+    {
+        return 0;
+    }
+    generation = atomic_load_explicit(&writer->throttle->generation, memory_order_acquire);
+    if (generation != writer->ioprioGeneration)
+    {
+        writer->ioprioGeneration = generation;
+        writer->ioprio = fwThrottleIoPriority(writer->throttle);
+    }
+    return writer->ioprio;
+}
+
+/* Queues the rest of the slot's write; the ring never holds more than depth entries */
+static int writerUringQueue(fw_Writer_t *writer, uint32_t slot)
+{
+    fw_WriteRequest_t *req = &writer->req[slot];
+    unsigned int tail = *writer->sqTail;
+    unsigned int index = tail & *writer->sqMask;
+    struct io_uring_sqe *sqe = &writer->sqes[index];
+
+    req->iov.iov_base = (void *)(req->buf + req->done);
+    req->iov.iov_len = req->len - req->done;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = req->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->off = req->offset + req->done;
+    sqe->user_data = slot;
+    sqe->ioprio = writerUringPriority(writer);
+    writer->sqArray[index] = index;
+    __atomic_store_n(writer->sqTail, tail + 1, __ATOMIC_RELEASE);
+    if (writerUringEnter(writer, 1, 0) != 1)
+    {
+        printf("io_uring submission failed: %s %s:%d \n", strerror(errno), __FUNCTION__, __LINE__);
+        writer->broken = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void writerUringReap(fw_Writer_t *writer, int wait)
+{
+    unsigned int head = *writer->cqHead;
+    unsigned int tail = __atomic_load_n(writer->cqTail, __ATOMIC_ACQUIRE);
+
+    if (head == tail && wait)
+    {
+        if (writerUringEnter(writer, 0, 1) < 0)
+        {
+            printf("io_uring wait failed: %s %s:%d \n", strerror(errno), __FUNCTION__, __LINE__);
+            writer->error = mfrERR_GENERAL;
+            writer->broken = 1;
+            return;
+        }
+        tail = __atomic_load_n(writer->cqTail, __ATOMIC_ACQUIRE);
+    }
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &writer->cqes[head & *writer->cqMask];
+        uint32_t slot = (uint32_t)cqe->user_data;
+        fw_WriteRequest_t *req = &writer->req[slot];
+        int res = cqe->res;
+
+        head++;
+        __atomic_store_n(writer->cqHead, head, __ATOMIC_RELEASE);
+        if (res > 0 && req->done + (size_t)res < req->len)
+        {
+            // short write, send the rest
+            req->done += (size_t)res;
+            req->retries++;
+            if (writerUringQueue(writer, slot) == 0)
+            {
+                continue;
+            }
+            res = -EIO;
+        }
+        writerFinish(writer, slot, res < 0 ? res : res == 0 ? -EIO : (ssize_t)req->len);
+    }
+}
+
+#endif
+
+static void *writerThread(void *arg)
+{
+    fw_Writer_t *writer = (fw_Writer_t *)arg;
+    fw_Throttle_t *applied = NULL;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (!writer->queueCount && !writer->stop)
+        {
+            pthread_cond_wait(&writer->work, &writer->lock);
+        }
+        if (!writer->queueCount)
+        {
+            break;
+        }
+        uint32_t slot = writer->queue[writer->queueHead];
+        writer->queueHead = (writer->queueHead + 1) % writer->depth;
+        writer->queueCount--;
+        fw_Throttle_t *throttle = writer->throttle;
+        pthread_mutex_unlock(&writer->lock);
+
+        // the pool was started at init, it follows the background mode of the flash it writes for
+        if (throttle != applied)
+        {
+            applied = throttle;
+            generation = 0;
+        }
+        fwThrottleApply(throttle, &generation);
+        fw_WriteRequest_t *req = &writer->req[slot];
+        req->result = writerWriteAll(req->fd, req->buf, req->len, req->offset, &req->retries);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->finished[writer->finishedCount++] = slot;
+        pthread_cond_signal(&writer->completed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+static void writerThreadsReap(fw_Writer_t *writer, int wait)
+{
+    uint32_t slots[FW_WRITER_MAX_DEPTH];
+    uint32_t count;
+    uint32_t i;
+
+    pthread_mutex_lock(&writer->lock);
+    while (wait && !writer->finishedCount)
+    {
+        pthread_cond_wait(&writer->completed, &writer->lock);
+    }
+    count = writer->finishedCount;
+    memcpy(slots, writer->finished, count * sizeof(uint32_t));
+    writer->finishedCount = 0;
+    pthread_mutex_unlock(&writer->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        writerFinish(writer, slots[i], writer->req[slots[i]].result);
+    }
+}
+
+static void *writerCalloc(fw_Arena_t *arena, size_t count, size_t size)
+{
+    return arena ? fwArenaAlloc(arena, count * size, sizeof(uint64_t)) : calloc(count, size);
+}
+
+static mfrError_t writerStartThreads(fw_Writer_t *writer)
+{
+    uint32_t i;
+
+    writer->queue = (uint32_t *)writerCalloc(writer->arena, writer->depth, sizeof(uint32_t));
+    writer->finished = (uint32_t *)writerCalloc(writer->arena, writer->depth, sizeof(uint32_t));
+    if (!writer->queue || !writer->finished)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    for (i = 0; i < writer->depth; i++, writer->threadCount++)
+    {
+        if (pthread_create(&writer->threads[i], NULL, writerThread, writer) != 0)
+        {
+            break;
+        }
+    }
+    if (!writer->threadCount)
+    {
+        return mfrERR_GENERAL;
+    }
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwWriterCreate
+   Description   : sets up a writer keeping up to depth writes in
+                   flight. mfrWRITE_BACKEND_AUTO takes io_uring and
+                   falls back to the thread pool when the kernel does
+                   not provide it. The writer serves one flash after
+                   the other, see fwWriterBind.
+   Input:    backend, depth, arena - budget mode, takes
+             fwWriterSize(depth) bytes of it, NULL for the heap
+   Output:   writer
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwWriterCreate(fw_Writer_t **writer, mfrWriteBackend_t backend, unsigned int depth, fw_Arena_t *arena)
+{
+    fw_Writer_t *w = (fw_Writer_t *)writerCalloc(arena, 1, sizeof(fw_Writer_t));
+    mfrError_t ret = mfrERR_NONE;
+    uint32_t i;
+
+    *writer = NULL;
+    if (!w)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    w->arena = arena;
+    w->depth = depth < 1 ? 1 : depth > FW_WRITER_MAX_DEPTH ? FW_WRITER_MAX_DEPTH : depth;
+    w->depth = backend == mfrWRITE_BACKEND_SYNC ? 1 : w->depth;
+    w->error = mfrERR_NONE;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->completed, NULL);
+#ifdef FW_HAVE_IO_URING
+    w->ringFd = -1;
+#endif
+    w->req = (fw_WriteRequest_t *)writerCalloc(arena, w->depth, sizeof(fw_WriteRequest_t));
+    w->freeSlots = (uint32_t *)writerCalloc(arena, w->depth, sizeof(uint32_t));
+    w->held = (uint32_t *)writerCalloc(arena, w->depth, sizeof(uint32_t));
+    if (!w->req || !w->freeSlots || !w->held)
+    {
+        fwWriterDestroy(w);
+        return mfrERR_MALLOC_FAILED;
+    }
+    for (i = 0; i < w->depth; i++)
+    {
+        w->freeSlots[w->freeCount++] = w->depth - 1 - i;
+    }
+
+    if (backend == mfrWRITE_BACKEND_AUTO || backend == mfrWRITE_BACKEND_IO_URING)
+    {
+#ifdef FW_HAVE_IO_URING
+        if (writerUringSetup(w) == 0)
+        {
+            w->backend = mfrWRITE_BACKEND_IO_URING;
+        }
+        else
+        {
+            printf("io_uring is not available (%s), using pwrite threads\n", strerror(errno));
+            writerUringRelease(w);
+        }
+#endif
+        backend = w->backend == mfrWRITE_BACKEND_IO_URING ? backend : mfrWRITE_BACKEND_THREADS;
+    }
+    if (backend == mfrWRITE_BACKEND_THREADS)
+    {
+        ret = writerStartThreads(w);
+        w->backend = mfrWRITE_BACKEND_THREADS;
+    }
+    else if (backend == mfrWRITE_BACKEND_SYNC)
+    {
+        w->backend = mfrWRITE_BACKEND_SYNC;
+    }
+    if (ret != mfrERR_NONE)
+    {
+        fwWriterDestroy(w);
+        return ret;
+    }
+    *writer = w;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwWriterBind
+   Description   : hands the writer to a flash, before its targets are
+                   attached. The error of the previous flash is
+                   cleared.
+   Input:    writer, done - completion callback and its ctx,
+             stats - zeroed by the caller, updated while writing
+   Output:   None
+   Returns:  None
+
+*********************************************************************/
+
+void fwWriterBind(fw_Writer_t *writer, fw_WriteDone_t done, void *ctx, fw_WriterStats_t *stats,
+                  fw_Throttle_t *throttle)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->throttle = throttle;
+    pthread_mutex_unlock(&writer->lock);
+#ifdef FW_HAVE_IO_URING
+    writer->ioprioGeneration = throttle ? atomic_load(&throttle->generation) : 0;
+    writer->ioprio = fwThrottleIoPriority(throttle);
+#endif
+    writer->done = done;
+    writer->ctx = ctx;
+    writer->stats = stats;
+    writer->error = mfrERR_NONE;
+    stats->backend = writer->backend == mfrWRITE_BACKEND_IO_URING ? "io_uring" :
+                     writer->backend == mfrWRITE_BACKEND_THREADS ? "threads" : "sync";
+    stats->depth = writer->depth;
+}
+
+/* Drains the writes of the flash and forgets its targets, fails when the writer cannot serve another one */
+mfrError_t fwWriterDetach(fw_Writer_t *writer)
+{
+    int f;
+
+    fwWriterDrain(writer);
+    for (f = 0; f < writer->files; f++)
+    {
+        if (writer->file[f].directFd >= 0)
+        {
+            close(writer->file[f].directFd);
+        }
+    }
+    writer->files = 0;
+    return writer->broken ? mfrERR_GENERAL : mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwWriterAttach
+   Description   : registers a target with the writer. A direct target
+                   gets a second, O_DIRECT descriptor; the page cache
+                   still serves the unaligned writes and filesystems
+                   without O_DIRECT support.
+   Input:    writer, target, direct
+   Output:   file - index to submit writes to the target with
+   Returns:  mfrERR_NONE on success
+
+*********************************************************************/
+
+mfrError_t fwWriterAttach(fw_Writer_t *writer, fw_Target_t *target, int direct, int *file)
+{
+    fw_WriterFile_t *f;
+
+    if (writer->files == FW_WRITER_FILES)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    f = &writer->file[writer->files];
+    f->target = target;
+    f->directFd = -1;
+    if (direct && target->base % FW_WRITER_ALIGN)
+    {
+        printf("%s at %llu is not aligned for direct writes\n", target->path, (unsigned long long)target->base);
+    }
+    else if (direct)
+    {
+        f->directFd = open(target->path, O_WRONLY | O_DIRECT | O_CLOEXEC);
+        if (f->directFd < 0)
+        {
+            printf("no direct writes to %s (%s), going through the page cache\n", target->path, strerror(errno));
+        }
+    }
+    *file = writer->files++;
+    return mfrERR_NONE;
+}
+
+/********************************************************************
+   Functiona Name: fwWriterSubmit
+   Description   : queues a write, after waiting for a free slot when
+                   depth writes are in flight. buf must stay untouched
+                   until done() is called with cookie.
+   Input:    writer, file, buf, len, offset - on the target, cookie
+   Output:   None
+   Returns:  mfrERR_NONE, or the error of a failed earlier write
+
+*********************************************************************/
+
+mfrError_t fwWriterSubmit(fw_Writer_t *writer, int file, const void *buf, size_t len, uint64_t offset, void *cookie)
+{
+    const fw_WriterFile_t *f = &writer->file[file];
+    fw_WriterStats_t *stats = writer->stats;
+    fw_WriteRequest_t *req;
+    uint32_t slot;
+
+    while (!writer->freeCount && writer->error == mfrERR_NONE)
+    {
+        fwWriterReap(writer, 1);
+    }
+    if (writer->error != mfrERR_NONE || writer->broken)
+    {
+        return writer->error != mfrERR_NONE ? writer->error : mfrERR_GENERAL;
+    }
+    slot = writer->freeSlots[--writer->freeCount];
+    req = &writer->req[slot];
+    req->buf = (const uint8_t *)buf;
+    req->len = len;
+    req->offset = f->target->base + offset;
+    req->done = 0;
+    req->retries = 0;
+    req->direct = f->directFd >= 0 && !((uintptr_t)buf % FW_WRITER_ALIGN) && !(req->offset % FW_WRITER_ALIGN) &&
+                  !(len % FW_WRITER_ALIGN);
+    req->fd = req->direct ? f->directFd : f->target->fd;
+    req->cookie = cookie;
+    req->submitNs = fwNowNs();
+    req->readyNs = f->target->model ? fwModelSchedule(f->target->model, len, 1) : 0;
+    writer->inFlight++;
+    stats->requests++;
+    stats->inFlightSum += writer->inFlight;
+    stats->maxInFlight = writer->inFlight > stats->maxInFlight ? writer->inFlight : stats->maxInFlight;
+    FW_TRACE_COUNTER("writes in flight", writer->inFlight);
+
+    switch (writer->backend)
+    {
+#ifdef FW_HAVE_IO_URING
+    case mfrWRITE_BACKEND_IO_URING:
+        if (writerUringQueue(writer, slot) < 0)
+        {
+            writerComplete(writer, slot, -EIO);
+        }
+        break;
+#endif
+    case mfrWRITE_BACKEND_THREADS:
+        pthread_mutex_lock(&writer->lock);
+        writer->queue[(writer->queueHead + writer->queueCount) % writer->depth] = slot;
+        writer->queueCount++;
+        pthread_cond_signal(&writer->work);
+        pthread_mutex_unlock(&writer->lock);
+        break;
+    default:
+        writerFinish(writer, slot, writerWriteAll(req->fd, req->buf, req->len, req->offset, &req->retries));
+        break;
+    }
+    return writer->error;
+}
+
+mfrError_t fwWriterReap(fw_Writer_t *writer, int wait)
+{
+    uint32_t held = writer->heldCount;
+
+    wait = wait && writer->inFlight;
+    if (held)
+    {
+        // only wait on the model when the media has nothing left in flight
+        writerReleaseHeld(writer, wait && held == writer->inFlight);
+        wait = wait && writer->heldCount == held && held < writer->inFlight;
+    }
+    switch (writer->backend)
+    {
+#ifdef FW_HAVE_IO_URING
+    case mfrWRITE_BACKEND_IO_URING:
+        writerUringReap(writer, wait);
+        break;
+#endif
+    case mfrWRITE_BACKEND_THREADS:
+        writerThreadsReap(writer, wait);
+        break;
+    default:
+        break;
+    }
+    return writer->error;
+}
+
+/* Waits for every write in flight, whatever the outcome, so no buffer is still in use */
+mfrError_t fwWriterDrain(fw_Writer_t *writer)
+{
+    while (writer->inFlight && !writer->broken)
+    {
+        fwWriterReap(writer, 1);
+    }
+    return writer->broken ? mfrERR_GENERAL : writer->error;
+}
+
+/********************************************************************
+   Functiona Name: fwWriterFlush
+   Description   : drains the writes in flight and syncs the target.
+                   Called once per partition, when its last block has
+                   been submitted.
+   Input:    writer, file
+   Output:   None
+   Returns:  mfrERR_NONE when everything written is on the media
+
+*********************************************************************/
+
+mfrError_t fwWriterFlush(fw_Writer_t *writer, int file)
+{
+    uint64_t start;
+    mfrError_t ret = fwWriterDrain(writer);
+
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    start = fwNowNs();
+    ret = fwTargetFlush(writer->file[file].target);
+    writer->stats->flushes++;
+    writer->stats->flushNs += fwNowNs() - start;
+    return ret;
+}
+
+void fwWriterDestroy(fw_Writer_t *writer)
+{
+    uint32_t i;
+
+    if (!writer)
+    {
+        return;
+    }
+    fwWriterDetach(writer);
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->work);
+    pthread_mutex_unlock(&writer->lock);
+    for (i = 0; i < writer->threadCount; i++)
+    {
+        pthread_join(writer->threads[i], NULL);
+    }
+#ifdef FW_HAVE_IO_URING
+    writerUringRelease(writer);
+#endif
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->work);
+    pthread_cond_destroy(&writer->completed);
+    if (writer->arena)
+    {
+        return;
+    }
+    free(writer->queue);
+    free(writer->finished);
+    free(writer->req);
+    free(writer->freeSlots);
+    free(writer->held);
+    free(writer);
+}
+
+size_t fwWriterSize(unsigned int depth)
+{
+    size_t slots = depth < 1 ? 1 : depth > FW_WRITER_MAX_DEPTH ? FW_WRITER_MAX_DEPTH : depth;
+
+    // with the alignment of every piece
+    return sizeof(fw_Writer_t) + slots * (sizeof(fw_WriteRequest_t) + 4 * sizeof(uint32_t)) + 6 * sizeof(uint64_t);
+}
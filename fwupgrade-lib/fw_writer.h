@@ -0,0 +1,72 @@
+/*--------------------------------------------------------------------
+  * If not stated otherwise in this file or this component's Licenses.txt file the
+* following copyright and licenses apply:
+*
+* Copyright 2020 RDK Management
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+
+  Asynchronous block writer. Keeps several writes in flight on the
+  targets, through io_uring when the kernel has it or a pool of pwrite
+  threads otherwise. Writes to a target attached as direct bypass the
+  page cache (O_DIRECT) whenever buffer, offset and length are aligned.
+  Completions are delivered on the thread calling into the writer.
+----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mfrApi.h>
+#include "fw_arena.h"
+#include "fw_target.h"
+#include "fw_throttle.h"
+
+#define FW_WRITER_ALIGN         4096
+#define FW_WRITER_MAX_DEPTH     64
+
+typedef struct fw_Writer fw_Writer_t;
+
+/* Called once per submitted write, when it is done with the buffer */
+typedef void (*fw_WriteDone_t)(void *ctx, void *cookie);
+
+typedef struct fw_WriterStats {
+    const char *backend;
+    uint32_t depth;             /* writes allowed in flight */
+    uint32_t maxInFlight;
+    uint64_t requests;
+    uint64_t inFlightSum;       /* in flight after each submission, for the mean queue depth */
+    uint64_t bytes;
+    uint64_t directBytes;       /* written around the page cache */
+    uint64_t latencyNs;         /* submission to completion, summed over the requests */
+    uint64_t maxLatencyNs;
+    uint64_t retries;           /* short writes resubmitted, interrupted writes */
+    uint64_t flushes;
+    uint64_t flushNs;
+} fw_WriterStats_t;
+
+mfrError_t fwWriterCreate(fw_Writer_t **writer, mfrWriteBackend_t backend, unsigned int depth, fw_Arena_t *arena);
+/* Hands the writer to a flash, throttle is the background mode its writes follow, NULL for none */
+void fwWriterBind(fw_Writer_t *writer, fw_WriteDone_t done, void *ctx, fw_WriterStats_t *stats,
+                  fw_Throttle_t *throttle);
+mfrError_t fwWriterDetach(fw_Writer_t *writer);
+mfrError_t fwWriterAttach(fw_Writer_t *writer, fw_Target_t *target, int direct, int *file);
+mfrError_t fwWriterSubmit(fw_Writer_t *writer, int file, const void *buf, size_t len, uint64_t offset, void *cookie);
+/* Delivers the completed writes, waiting for one when wait is set and writes are in flight */
+mfrError_t fwWriterReap(fw_Writer_t *writer, int wait);
+mfrError_t fwWriterDrain(fw_Writer_t *writer);
+mfrError_t fwWriterFlush(fw_Writer_t *writer, int file);
+void fwWriterDestroy(fw_Writer_t *writer);
+/* Memory a writer for depth writes in flight takes from an arena */
+size_t fwWriterSize(unsigned int depth);
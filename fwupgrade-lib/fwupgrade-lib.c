@@ -19,156 +19,886 @@
 
   During firmware upgrade, new image is downloaded to tmp from server
   The downloaded image is passed as argument to mfrWriteImage function
-  mfrWriteImage() creates a new thread to handle image update 
+  mfrWriteImage() queues the image update for the worker thread started
+  by mfrFWUpgradeInit(), which flashes the queued images one at a time
+  mfrWriteImageStream() queues an image still being downloaded, read
+  from a pipe or pulled from the downloader while it is flashed
 ----------------------------------------------------------------------*/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "string.h"
+// the library is built with hidden symbols, only the mfr API is exported
+#pragma GCC visibility push(default)
 #include <mfrApi.h>
+#pragma GCC visibility pop
+#include "fw_device.h"
+#include "fw_engine.h"
+#include "fw_hash.h"
+#include "fw_progress.h"
+#include "fw_throttle.h"
+#include "fw_unpack.h"
+
+#define FW_JOB_QUEUE_MAX        4
+#define FW_STREAM_NAME          "stream"
+
 typedef struct fw_Params {
-    const char *name;
-    const char *path;
+    char *package;                  /* path, or name in the log of a stream */
     mfrImageType_t type;
-    mfrUpgradeStatusNotify_t notify;
+    fw_Notify_t notify;
+    int stream;
+    mfrImageSource_t source;        /* stream: the caller's, with its own copy of the digest */
+    struct fw_Params *next;
 } fw_Params_t;
+
+static pthread_mutex_t g_upgradeLock = PTHREAD_MUTEX_INITIALIZER;
+static mfrFWUpgradeConfig_t g_config;
+static char *g_configStrings[10];
+/* job manager: a single worker flashes the queued upgrades one by one */
+static pthread_cond_t g_jobQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_jobDone = PTHREAD_COND_INITIALIZER;
+static pthread_t g_worker;
+static int g_workerStarted = 0;
+static int g_workerStop = 0;
+static fw_Params_t *g_jobHead = NULL;
+static fw_Params_t *g_jobTail = NULL;
+static unsigned int g_jobCount = 0;
+static fw_Params_t *g_jobRunning = NULL;
+static unsigned long g_jobsDone = 0;
+static fw_Progress_t *g_jobProgress = NULL;
+static fw_EngineBuffers_t g_buffers;
+static fw_EngineJob_t g_engineJob;
+/* active bank and partition layout, probed at init and kept while the device does not change */
+static fw_Device_t g_device;
+/* background mode, changed at any time, also while upgrading */
+static fw_Throttle_t g_throttle = FW_THROTTLE_INITIALIZER;
+/* counters of the running upgrade, owned by the worker, then of the last one */
+static fw_EngineStats_t *g_liveStats = NULL;
+static fw_EngineStats_t g_lastStats;
+static uint64_t g_upgradeStartNs = 0;
+static mfrUpgradeProgress_t g_upgradeProgress = mfrUPGRADE_PROGRESS_NOT_STARTED;
+static mfrError_t g_upgradeError = mfrERR_NONE;
+
 int main(void)
 {
     // nothing to do
 }
 
+static void fwFreeJob(fw_Params_t *job)
+{
+    if (job->stream && job->source.release)
+    {
+        // the caller gets the source back
+        job->source.release(job->source.ctx);
+    }
+    if (job->stream)
+    {
+        free((char *)job->source.sha256);
+    }
+    free(job->package);
+    free(job);
+}
+
+/* Final notification of a job dropped from the queue */
+static void fwAbortJob(fw_Params_t *job)
+{
+    fw_EngineStats_t stats;
+    fw_Progress_t progress;
+
+    printf("upgrade of %s cancelled before it started\n", job->package);
+    memset(&stats, 0, sizeof(stats));
+    memset(&progress, 0, sizeof(progress));
+    progress.notify = job->notify;
+    progress.stats = &stats;
+    progress.startNs = fwNowNs();
+    progress.lastNs = progress.startNs;
+    fwProgressNotify(&progress, mfrUPGRADE_PROGRESS_ABORTED, mfrERR_INVALID_STATE);
+    fwFreeJob(job);
+}
+
 /********************************************************************
-   Functiona Name: fwupgradeThread
-   Description   : thread handled for image upgrade
+   Functiona Name: fwRunJob
+   Description   : flashes one queued upgrade on the worker thread
    Input:    fw_Params_t
    Output:   None
+   Returns:  None
+
+*********************************************************************/
+
+static void fwRunJob(fw_Params_t *stParameters)
+{
+    mfrFWUpgradeConfig_t config;
+    fw_EngineStats_t stats;
+    fw_Progress_t progress;
+    struct stat st;
+    mfrError_t retVal;
+
+    pthread_mutex_lock(&g_upgradeLock);
+    fwEngineDefaults(&g_config, &config);
+    pthread_mutex_unlock(&g_upgradeLock);
+    if (fwEngineCheckLayout(&config, &g_device) == mfrERR_INVALID_STATE)
+    {
+        // the banks are not there yet, the script creates them and reboots
+        const char* script ="sh /lib/rdk/memory_partition.sh";
+        int status = system(script);
+        if (status < 0 || !WIFEXITED(status))
+        {
+            printf("%s did not run to its end \n", script);
+        }
+        else
+        {
+            printf("%s returned %d \n", script, WEXITSTATUS(status));
+        }
+        fwDeviceInvalidate(&g_device);
+    }
+
+    // progress is sampled from the engine counters at the client's interval
+    memset(&stats, 0, sizeof(stats));
+    if (stParameters->stream)
+    {
+        atomic_store(&stats.bytesTotal, stParameters->source.size);
+    }
+    else if (stat(stParameters->package, &st) == 0)
+    {
+        atomic_store(&stats.bytesTotal, (uint64_t)st.st_size);
+    }
+    fwProgressStart(&progress, &stParameters->notify, &stats);
+    pthread_mutex_lock(&g_upgradeLock);
+    g_jobProgress = &progress;
+    g_liveStats = &stats;
+    g_upgradeStartNs = fwNowNs();
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    printf("flashing %s\n", stParameters->package);
+    retVal = fwEngineFlash(&config, stParameters->package, stParameters->stream ? &stParameters->source : NULL,
+                           &g_engineJob, &stats);
+    fwProgressStop(&progress);
+    if (mfrERR_NONE != retVal)
+    {
+        printf("flashing %s failed\n", stParameters->package);
+    }
+
+    pthread_mutex_lock(&g_upgradeLock);
+    memcpy(&g_lastStats, &stats, sizeof(stats));
+    g_jobProgress = NULL;
+    g_liveStats = NULL;
+    g_upgradeProgress = mfrERR_NONE == retVal ? mfrUPGRADE_PROGRESS_COMPLETED : mfrUPGRADE_PROGRESS_ABORTED;
+    g_upgradeError = retVal;
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    fwProgressNotify(&progress, mfrERR_NONE == retVal ? mfrUPGRADE_PROGRESS_COMPLETED : mfrUPGRADE_PROGRESS_ABORTED,
+                     retVal);
+}
+
+/********************************************************************
+   Functiona Name: fwupgradeThread
+   Description   : worker of the job manager, runs the queued upgrades
+                   in order until mfrFWUpgradeTerm, which lets it
+                   finish the queue first
+   Input:    None
+   Output:   None
    Returns:  Void
 
 *********************************************************************/
 
 void* fwupgradeThread(void* fw_Params)
 {
+    (void)fw_Params;
     printf("fwupgradeThread handler\n");
-    fw_Params_t *stParameters = (fw_Params_t *)(fw_Params);
-    // filling up firmware parameters
-    const char* name = stParameters->name;
-    const char *path = stParameters->path;
-    mfrImageType_t type = stParameters->type;
-    mfrUpgradeStatusNotify_t notify = stParameters->notify;
-    mfrUpgradeStatus_t status;
-    
-    //If path or name is NULL return error.
-    if(!name || !path )
-    {
-       printf("name or path is not valid %s:%d \n", __FUNCTION__, __LINE__);
-       status.error = mfrERR_INVALID_PARAM;
-       status.progress = mfrUPGRADE_PROGRESS_ABORTED;
-       free((fw_Params_t* )fw_Params);
-       return NULL;
-    }
-
-    // filling up callback return values
-    status.progress = mfrUPGRADE_PROGRESS_NOT_STARTED;
-    status.error = mfrERR_NONE;
-    status.percentage = 0;
-    notify.cb(status, notify.cbData);
-    
-    int nSlash_space = 0;
-    int retVal = 0;
-    if (path[strlen(path) - 1] != '/')
-    {
-	    nSlash_space = 1;
+    pthread_mutex_lock(&g_upgradeLock);
+    for (;;)
+    {
+        while (!g_jobHead && !g_workerStop)
+        {
+            pthread_cond_wait(&g_jobQueued, &g_upgradeLock);
+        }
+        if (!g_jobHead)
+        {
+            break;
+        }
+        fw_Params_t *job = g_jobHead;
+        g_jobHead = job->next;
+        g_jobTail = g_jobHead ? g_jobTail : NULL;
+        g_jobCount--;
+        g_jobRunning = job;
+        // a cancellation only applies to the jobs queued when it was issued
+        fwEngineJobReset(&g_engineJob);
+        pthread_mutex_unlock(&g_upgradeLock);
+
+        fwRunJob(job);
+
+        pthread_mutex_lock(&g_upgradeLock);
+        g_jobRunning = NULL;
+        g_jobsDone++;
+        pthread_cond_broadcast(&g_jobDone);
+        fwFreeJob(job);
     }
-   
-    const char* script = "sh /lib/rdk/write_kernel_rootfs.sh "; 
-    //Form command for shell script, additional bytes for '\' if needed and '\0'
-    char *cmd = (char*)malloc((strlen(script) + strlen(path) + strlen(name) + nSlash_space + 1) * sizeof(char));
-    if (cmd)
-    {
-            
-	    status.progress = mfrUPGRADE_PROGRESS_STARTED;
-	    status.percentage = 10;
-	    notify.cb(status, notify.cbData);
-	    strcpy(cmd, script);
-	    strcat(cmd, path);
-	    if (nSlash_space)
-	    {
-		    strcat(cmd, "/");
-	    }
-	    strcat(cmd, name);
-	    status.percentage = 50;
-	    notify.cb(status, notify.cbData);
-            printf("calling write script\n");
-	    retVal = system(cmd);
-	    if (0 == retVal)
-	    {
-		    status.progress = mfrUPGRADE_PROGRESS_COMPLETED;
-		    status.error = mfrERR_NONE;
-		    status.percentage = 100;
-	    }
-	    else
-	    {
-            printf("calling write script failed\n");
-		    status.progress = mfrUPGRADE_PROGRESS_ABORTED;
-		    status.error = mfrERR_DECRYPTION_FAILED;
-		    status.percentage = 0;
-	    }
-	    free(cmd);
+    pthread_mutex_unlock(&g_upgradeLock);
+    return NULL;
+}
+
+/* Upgrade callbacks run on the worker or on the progress timer of its job, with g_upgradeLock held */
+static int fwInCallback(void)
+{
+    pthread_t self = pthread_self();
+
+    return g_workerStarted && (pthread_equal(self, g_worker) ||
+                               (g_jobProgress && g_jobProgress->running && pthread_equal(self, g_jobProgress->tid)));
+}
+
+/* Starts the worker, with g_upgradeLock held */
+static mfrError_t fwStartWorker(void)
+{
+    mfrFWUpgradeConfig_t config;
+    mfrError_t ret;
+
+    if (g_workerStarted)
+    {
+        return mfrERR_NONE;
+    }
+    // allocated once, the flashes reuse them as long as the configuration does not change
+    fwEngineDefaults(&g_config, &config);
+    ret = fwEngineBuffersAlloc(&g_buffers, &config, 1);
+    if (ret != mfrERR_NONE)
+    {
+        return ret;
+    }
+    fwEngineJobInit(&g_engineJob, &g_buffers, &g_device, &g_throttle);
+    // the first upgrade then starts from the cached layout
+    fwDeviceInvalidate(&g_device);
+    fwDeviceProbe(&g_device, &config);
+    g_workerStop = 0;
+    if (pthread_create(&g_worker, NULL, fwupgradeThread, NULL) != 0)
+    {
+        fwEngineJobRelease(&g_engineJob);
+        fwEngineBuffersFree(&g_buffers);
+        return mfrERR_GENERAL;
+    }
+    g_workerStarted = 1;
+    return mfrERR_NONE;
+}
+
+/* Hands the job to the worker, or frees it */
+static mfrError_t fwQueueJob(fw_Params_t *stParameters)
+{
+    mfrError_t ret;
+
+    pthread_mutex_lock(&g_upgradeLock);
+    // callers that skip mfrFWUpgradeInit get the worker on their first upgrade
+    ret = g_workerStop ? mfrERR_NOT_INITIALIZED : fwStartWorker();
+    if (ret == mfrERR_NONE && g_jobCount >= FW_JOB_QUEUE_MAX)
+    {
+        printf("%u upgrades already queued \n", g_jobCount);
+        ret = mfrERR_INVALID_STATE;
+    }
+    if (ret != mfrERR_NONE)
+    {
+        pthread_mutex_unlock(&g_upgradeLock);
+        // refused, the stream stays the caller's
+        stParameters->source.release = NULL;
+        fwFreeJob(stParameters);
+        return ret;
+    }
+    if (g_jobTail)
+    {
+        g_jobTail->next = stParameters;
     }
     else
     {
-        printf("Failed memory allocation %s:%d \n", __FUNCTION__, __LINE__);
-	    status.error = mfrERR_MALLOC_FAILED;
-	    status.progress = mfrUPGRADE_PROGRESS_ABORTED;
+        g_jobHead = stParameters;
     }
+    g_jobTail = stParameters;
+    g_jobCount++;
+    g_upgradeProgress = mfrUPGRADE_PROGRESS_STARTED;
+    printf("queued upgrade of %s\n", stParameters->package);
+    pthread_cond_signal(&g_jobQueued);
+    pthread_mutex_unlock(&g_upgradeLock);
+    return mfrERR_NONE;
+}
 
-    notify.cb(status, notify.cbData);
-    free((fw_Params_t* )fw_Params);
-    return NULL;
+/* Joins path and name, the caller frees the result */
+static char *fwPackagePath(const char *name, const char *path)
+{
+    size_t pathLen = strlen(path);
+    int nSlash_space = (pathLen && path[pathLen - 1] != '/') ? 1 : 0;
+    char *package = (char*)malloc(pathLen + nSlash_space + strlen(name) + 1);
+
+    if (package)
+    {
+        sprintf(package, "%s%s%s", path, nSlash_space ? "/" : "", name);
+    }
+    return package;
 }
 
 /**************************************************************************
-   Functiona Name: mfrWriteImage 
-   Description   : mfrWriteImage handles flashing new image to box
-   Input:    fw_Params_t
-   Output:   mfrUpgradeStatusNotify_t
-   Returns:  mfrERR_NONE 
+   Functiona Name: fwStartUpgrade
+   Description   : validates the request and queues it for the worker
+   Input:    name, path, type, fw_Notify_t
+   Output:   None
+   Returns:  mfrERR_NONE when the upgrade has been queued
 
 ***************************************************************************/
 
-mfrError_t mfrWriteImage(const char *name, const char *path, mfrImageType_t type, mfrUpgradeStatusNotify_t notify)
+static mfrError_t fwStartUpgrade(const char *name, const char *path, mfrImageType_t type, const fw_Notify_t *notify)
 {
    
-    if(!name || !path)
+    if(!name || !path || (!notify->cb && !notify->cbEx))
     {
        printf("name or path is NULL \n");
        return mfrERR_INVALID_PARAM;
     } 
-    const char* script ="sh /lib/rdk/memory_partition.sh";
-   
-    int retVal = system(script);
-    pthread_t tid;
-    fw_Params_t *stParameters = (fw_Params_t* )malloc(sizeof(fw_Params_t));
+    fw_Params_t *stParameters = (fw_Params_t* )calloc(1, sizeof(fw_Params_t));
     if (!stParameters)
     {
         return mfrERR_MALLOC_FAILED;
     }
-     
-    stParameters->name = name;
-    stParameters->path = path;
+
+    // the caller's strings do not have to outlive this call
+    stParameters->package = fwPackagePath(name, path);
+    if (!stParameters->package)
+    {
+        free(stParameters);
+        return mfrERR_MALLOC_FAILED;
+    }
     stParameters->type = type;
-    stParameters->notify = notify;
-            printf("created thread for handling\n");
-    pthread_create(&tid, NULL, fwupgradeThread, stParameters);
-    pthread_detach(tid);
+    stParameters->notify = *notify;
+    return fwQueueJob(stParameters);
+}
+
+/**************************************************************************
+   Functiona Name: mfrWriteImageStream
+   Description   : queues the upgrade of a package the caller streams,
+                   read while it is downloaded
+   Input:    mfrImageSource_t, type
+   Output:   mfrUpgradeStatusNotifyEx_t
+   Returns:  mfrERR_NONE when the upgrade has been queued
+
+***************************************************************************/
+
+mfrError_t mfrWriteImageStream(const mfrImageSource_t *source, mfrImageType_t type, mfrUpgradeStatusNotifyEx_t notify)
+{
+    fw_Params_t *stParameters;
+
+    if (!source || (source->fd < 0 && !source->read) || !notify.cb)
+    {
+        printf("source or callback is NULL \n");
+        return mfrERR_INVALID_PARAM;
+    }
+    if (source->sha256 && (strlen(source->sha256) != 2 * FW_SHA256_SIZE ||
+                           strspn(source->sha256, "0123456789abcdefABCDEF") != 2 * FW_SHA256_SIZE))
+    {
+        printf("%s is not a sha256 digest \n", source->sha256);
+        return mfrERR_INVALID_PARAM;
+    }
+    stParameters = (fw_Params_t *)calloc(1, sizeof(fw_Params_t));
+    if (!stParameters)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    stParameters->package = strdup(FW_STREAM_NAME);
+    stParameters->type = type;
+    stParameters->notify.cbEx = notify.cb;
+    stParameters->notify.cbData = notify.cbData;
+    stParameters->notify.interval = notify.interval;
+    stParameters->source = *source;
+    stParameters->source.sha256 = source->sha256 ? strdup(source->sha256) : NULL;
+    if (!stParameters->package || (source->sha256 && !stParameters->source.sha256))
+    {
+        free(stParameters->package);
+        free((char *)stParameters->source.sha256);
+        free(stParameters);
+        return mfrERR_MALLOC_FAILED;
+    }
+    stParameters->stream = 1;
+    return fwQueueJob(stParameters);
+}
+
+/**************************************************************************
+   Functiona Name: mfrWriteImage 
+   Description   : mfrWriteImage handles flashing new image to box
+   Input:    fw_Params_t
+   Output:   mfrUpgradeStatusNotify_t
+   Returns:  mfrERR_NONE 
+
+***************************************************************************/
+
+mfrError_t mfrWriteImage(const char *name, const char *path, mfrImageType_t type, mfrUpgradeStatusNotify_t notify)
+{
+    fw_Notify_t fwNotify = { notify.cb, NULL, notify.cbData, notify.interval };
+    return fwStartUpgrade(name, path, type, &fwNotify);
+}
+
+/**************************************************************************
+   Functiona Name: mfrWriteImageEx
+   Description   : same as mfrWriteImage, reporting mfrUpgradeStatusEx_t
+   Input:    name, path, type
+   Output:   mfrUpgradeStatusNotifyEx_t
+   Returns:  mfrERR_NONE
+
+***************************************************************************/
+
+mfrError_t mfrWriteImageEx(const char *name, const char *path, mfrImageType_t type, mfrUpgradeStatusNotifyEx_t notify)
+{
+    fw_Notify_t fwNotify = { NULL, notify.cb, notify.cbData, notify.interval };
+    return fwStartUpgrade(name, path, type, &fwNotify);
+}
+
+/**************************************************************************
+   Functiona Name: mfrVerifyImage
+   Description   : checks the package can be flashed: archive, sdimg
+                   layout and package digest, without writing anything
+   Input:    name, path
+   Output:   None
+   Returns:  mfrERR_NONE when the package is valid
+
+***************************************************************************/
+
+mfrError_t mfrVerifyImage(const char *name, const char *path)
+{
+    mfrFWUpgradeConfig_t config;
+    fw_EngineStats_t stats;
+    mfrError_t retVal;
+    char *package;
+
+    if (!name || !path)
+    {
+        printf("name or path is NULL \n");
+        return mfrERR_INVALID_PARAM;
+    }
+    package = fwPackagePath(name, path);
+    if (!package)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    pthread_mutex_lock(&g_upgradeLock);
+    fwEngineDefaults(&g_config, &config);
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    memset(&stats, 0, sizeof(stats));
+    retVal = fwEngineVerify(&config, package, &stats);
+    free(package);
+    return retVal;
+}
+
+static mfrError_t fwUnpackFileWrite(void *ctx, const void *data, size_t len)
+{
+    int fd = *(int *)ctx;
+    const char *p = (const char *)data;
+
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            printf("write of unpacked data failed: %s %s:%d \n", strerror(errno), __FUNCTION__, __LINE__);
+            return mfrERR_GENERAL;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
     return mfrERR_NONE;
 }
+
+/* Runs the unpacker on path/name with the configured thread count */
+static mfrError_t fwUnpackPackage(const char *name, const char *path, fw_UnpackWrite_t write, void *ctx)
+{
+    mfrFWUpgradeConfig_t config;
+    mfrError_t retVal;
+    char *package = fwPackagePath(name, path);
+
+    if (!package)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    pthread_mutex_lock(&g_upgradeLock);
+    fwEngineDefaults(&g_config, &config);
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    retVal = fwUnpack(package, fwThrottleThreads(&g_throttle, config.unpackThreads), write, ctx, NULL);
+    free(package);
+    return retVal;
+}
+
+/**************************************************************************
+   Functiona Name: mfrUnpackImage
+   Description   : decompresses path/name to out_path/out_name
+   Input:    name, path, out_name, out_path
+   Output:   unpacked file
+   Returns:  mfrERR_NONE on success
+
+***************************************************************************/
+
+mfrError_t mfrUnpackImage(const char *name, const char *path, const char *out_name, const char *out_path)
+{
+    mfrError_t retVal;
+    char *out;
+    int fd;
+
+    if (!name || !path || !out_name || !out_path)
+    {
+        printf("name or path is NULL \n");
+        return mfrERR_INVALID_PARAM;
+    }
+    out = fwPackagePath(out_name, out_path);
+    if (!out)
+    {
+        return mfrERR_MALLOC_FAILED;
+    }
+    fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        printf("failed to create %s %s:%d \n", out, __FUNCTION__, __LINE__);
+        free(out);
+        return mfrERR_INVALID_PARAM;
+    }
+    retVal = fwUnpackPackage(name, path, fwUnpackFileWrite, &fd);
+    if (close(fd) < 0 && mfrERR_NONE == retVal)
+    {
+        retVal = mfrERR_GENERAL;
+    }
+    if (mfrERR_NONE != retVal)
+    {
+        unlink(out);
+    }
+    free(out);
+    return retVal;
+}
+
+/**************************************************************************
+   Functiona Name: mfrUnpackImageEx
+   Description   : decompresses path/name to the caller's sink
+   Input:    name, path, mfrUnpackSink_t
+   Output:   None
+   Returns:  mfrERR_NONE on success
+
+***************************************************************************/
+
+mfrError_t mfrUnpackImageEx(const char *name, const char *path, mfrUnpackSink_t sink)
+{
+    if (!name || !path || !sink.write)
+    {
+        printf("name, path or sink is NULL \n");
+        return mfrERR_INVALID_PARAM;
+    }
+    return fwUnpackPackage(name, path, sink.write, sink.ctx);
+}
+
+/**************************************************************************
+   Functiona Name: mfrFWUpgradeSetConfig
+   Description   : keeps a private copy of the engine configuration
+   Input:    mfrFWUpgradeConfig_t, NULL restores the defaults
+   Output:   None
+   Returns:  mfrERR_NONE, mfrERR_INVALID_STATE while upgrading,
+             mfrERR_INVALID_PARAM for an unknown block or write
+             backend
+
+***************************************************************************/
+
+mfrError_t mfrFWUpgradeSetConfig(const mfrFWUpgradeConfig_t *config)
+{
+    const char **fields[] = {
+        &g_config.bootDevice, &g_config.bankDevice[0], &g_config.bankDevice[1],
+        &g_config.bankRootName[0], &g_config.bankRootName[1], &g_config.storageDevice,
+        &g_config.workDir, &g_config.cmdlinePath, &g_config.diskDevice, &g_config.tracePath,
+    };
+    mfrError_t ret = mfrERR_NONE;
+    size_t i;
+
+    if (config && (config->blockBackend > mfrBLOCK_BACKEND_FILE || config->writeBackend > mfrWRITE_BACKEND_SYNC))
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    pthread_mutex_lock(&g_upgradeLock);
+    if (g_jobHead || g_jobRunning)
+    {
+        pthread_mutex_unlock(&g_upgradeLock);
+        return mfrERR_INVALID_STATE;
+    }
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        free(g_configStrings[i]);
+        g_configStrings[i] = NULL;
+    }
+    // the devices may be others, the worker is idle
+    fwDeviceInvalidate(&g_device);
+    if (config)
+    {
+        g_config = *config;
+    }
+    else
+    {
+        memset(&g_config, 0, sizeof(g_config));
+    }
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        if (*fields[i])
+        {
+            g_configStrings[i] = strdup(*fields[i]);
+            if (!g_configStrings[i])
+            {
+                ret = mfrERR_MALLOC_FAILED;
+            }
+            *fields[i] = g_configStrings[i];
+        }
+    }
+    pthread_mutex_unlock(&g_upgradeLock);
+    return ret;
+}
+
+/**************************************************************************
+   Functiona Name: mfrGetUpgradeStatus
+   Description   : reports whether an upgrade is running and how the
+                   last one ended
+   Input:    None
+   Output:   mfrUpgradeProgress_t
+   Returns:  mfrERR_NONE
+
+***************************************************************************/
+
+mfrError_t mfrGetUpgradeStatus(mfrUpgradeProgress_t *pStatus)
+{
+    if (!pStatus)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    pthread_mutex_lock(&g_upgradeLock);
+    *pStatus = g_upgradeProgress;
+    pthread_mutex_unlock(&g_upgradeLock);
+    return mfrERR_NONE;
+}
+
+/**************************************************************************
+   Functiona Name: mfrGetUpgradeStats
+   Description   : counters of the running upgrade, or of the last one.
+                   The engine only updates its byte counters atomically,
+                   the rest is copied once it returned.
+   Input:    None
+   Output:   mfrUpgradeStats_t
+   Returns:  mfrERR_NONE
+
+***************************************************************************/
+
+mfrError_t mfrGetUpgradeStats(mfrUpgradeStats_t *stats)
+{
+    const fw_EngineStats_t *src;
+    struct rusage usage;
+    int i;
+
+    if (!stats)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&g_upgradeLock);
+    src = g_liveStats ? g_liveStats : &g_lastStats;
+    stats->progress = g_upgradeProgress;
+    stats->bytesTotal = atomic_load(&src->bytesTotal);
+    stats->bytesRead = atomic_load(&src->bytesConsumed);
+    stats->bytesDecompressed = atomic_load(&src->bytesDecompressed);
+    stats->bytesWritten = atomic_load(&src->bytesWritten);
+    stats->bytesSkipped = atomic_load(&src->bytesSkipped);
+    stats->bytesUnmapped = atomic_load(&src->bytesUnmapped);
+    stats->bytesResumed = atomic_load(&src->bytesResumed);
+    if (g_liveStats)
+    {
+        stats->elapsedMs = (fwNowNs() - g_upgradeStartNs) / 1000000;
+    }
+    else if (g_upgradeProgress != mfrUPGRADE_PROGRESS_NOT_STARTED)
+    {
+        const fw_WriterStats_t *write = &src->write;
+
+        stats->error = g_upgradeError;
+        stats->elapsedMs = src->totalNs / 1000000;
+        stats->prepareMs = src->prepareNs / 1000000;
+        stats->streamMs = src->pipelineNs / 1000000;
+        stats->readbackMs = src->readbackNs / 1000000;
+        stats->hashTreeMs = src->treeNs / 1000000;
+        stats->commitMs = src->commitNs / 1000000;
+        stats->bytesHashed = src->stage[FW_STAGE_HASH].bytes;
+        stats->writeRequests = write->requests;
+        stats->writeRetries = write->retries;
+        stats->writeLatencyAvgUs = write->requests ? write->latencyNs / write->requests / 1000 : 0;
+        stats->writeLatencyMaxUs = write->maxLatencyNs / 1000;
+        stats->peakWriteQueueDepth = write->maxInFlight;
+        stats->syncMs = write->flushNs / 1000000;
+        stats->throttleMs = src->throttleNs / 1000000;
+        stats->bufferBytes = src->bufferBytes;
+        stats->upgradePeakMemoryKB = src->peakResidentKB;
+        for (i = 0; i < FW_STAGE_COUNT && i < mfrUPGRADE_STAGE_MAX; i++)
+        {
+            stats->stage[i].blocks = src->stage[i].blocks;
+            stats->stage[i].bytes = src->stage[i].bytes;
+            stats->stage[i].stallInMs = src->stage[i].stallInNs / 1000000;
+            stats->stage[i].stallOutMs = src->stage[i].stallOutNs / 1000000;
+            stats->stage[i].peakQueueDepth = src->stage[i].peakQueue;
+        }
+    }
+    pthread_mutex_unlock(&g_upgradeLock);
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        stats->peakMemoryKB = (uint64_t)usage.ru_maxrss;
+    }
+    return mfrERR_NONE;
+}
+
+/**************************************************************************
+   Functiona Name: mfrSetUpgradeThrottle
+   Description   : sets the limits of the background mode, the running
+                   upgrade follows them from its next block on
+   Input:    mfrUpgradeThrottle_t, NULL for full speed
+   Output:   None
+   Returns:  mfrERR_NONE
+
+***************************************************************************/
+
+mfrError_t mfrSetUpgradeThrottle(const mfrUpgradeThrottle_t *throttle)
+{
+    fwThrottleSet(&g_throttle, throttle);
+    if (throttle && throttle->background)
+    {
+        printf("background mode: %llu bytes/s, %u threads, %s I/O, CPUs 0x%llx\n",
+               (unsigned long long)throttle->writeBytesPerSec, throttle->maxThreads,
+               throttle->idleIoPriority ? "idle" : "normal", (unsigned long long)throttle->cpuMask);
+    }
+    else
+    {
+        printf("background mode off\n");
+    }
+    return mfrERR_NONE;
+}
+
+mfrError_t mfrGetUpgradeThrottle(mfrUpgradeThrottle_t *throttle)
+{
+    if (!throttle)
+    {
+        return mfrERR_INVALID_PARAM;
+    }
+    fwThrottleGet(&g_throttle, throttle);
+    return mfrERR_NONE;
+}
+
+/**************************************************************************
+   Functiona Name: mfrFWUpgradeInit
+   Description   : starts the upgrade worker and allocates the pipeline
+                   blocks for the current configuration
+   Input:    None
+   Output:   None
+   Returns:  mfrERR_NONE when the worker is running
+
+***************************************************************************/
+
 mfrError_t mfrFWUpgradeInit(void)
 {
+    mfrError_t ret;
+
+    pthread_mutex_lock(&g_upgradeLock);
+    ret = g_workerStop ? mfrERR_INVALID_STATE : fwStartWorker();
+    pthread_mutex_unlock(&g_upgradeLock);
+    return ret;
+}
+
+/**************************************************************************
+   Functiona Name: mfrCancelUpgrade
+   Description   : drops the queued upgrades and stops the running one
+                   at its next block boundary, then waits for it
+   Input:    None
+   Output:   None
+   Returns:  mfrERR_NONE, mfrERR_INVALID_STATE when there is nothing
+             to cancel
+
+***************************************************************************/
+
+mfrError_t mfrCancelUpgrade(void)
+{
+    fw_Params_t *dropped;
+    unsigned long done;
+    int running;
+
+    pthread_mutex_lock(&g_upgradeLock);
+    dropped = g_jobHead;
+    running = g_jobRunning != NULL;
+    done = g_jobsDone;
+    if (!running && !dropped)
+    {
+        pthread_mutex_unlock(&g_upgradeLock);
+        return mfrERR_INVALID_STATE;
+    }
+    g_jobHead = NULL;
+    g_jobTail = NULL;
+    g_jobCount = 0;
+    if (running)
+    {
+        fwEngineCancel(&g_engineJob);
+    }
+    else
+    {
+        g_upgradeProgress = mfrUPGRADE_PROGRESS_ABORTED;
+        g_upgradeError = mfrERR_INVALID_STATE;
+    }
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    while (dropped)
+    {
+        fw_Params_t *next = dropped->next;
+        fwAbortJob(dropped);
+        dropped = next;
+    }
+    // a callback cancelling its own upgrade returns right away
+    pthread_mutex_lock(&g_upgradeLock);
+    while (running && g_jobsDone == done && !fwInCallback())
+    {
+        pthread_cond_wait(&g_jobDone, &g_upgradeLock);
+    }
+    pthread_mutex_unlock(&g_upgradeLock);
     return mfrERR_NONE;
 }
+
+/**************************************************************************
+   Functiona Name: mfrFWUpgradeTerm
+   Description   : lets the worker finish the running and the queued
+                   upgrades, stops it and frees the pipeline blocks.
+                   mfrCancelUpgrade first aborts them instead.
+   Input:    None
+   Output:   None
+   Returns:  mfrERR_NONE, mfrERR_INVALID_STATE from an upgrade callback
+
+***************************************************************************/
+
 mfrError_t mfrFWUpgradeTerm(void)
 {
+    pthread_mutex_lock(&g_upgradeLock);
+    if (!g_workerStarted || g_workerStop)
+    {
+        pthread_mutex_unlock(&g_upgradeLock);
+        return mfrERR_NONE;
+    }
+    if (fwInCallback())
+    {
+        pthread_mutex_unlock(&g_upgradeLock);
+        return mfrERR_INVALID_STATE;
+    }
+    g_workerStop = 1;
+    pthread_cond_signal(&g_jobQueued);
+    pthread_mutex_unlock(&g_upgradeLock);
+
+    pthread_join(g_worker, NULL);
+
+    pthread_mutex_lock(&g_upgradeLock);
+    fwEngineJobRelease(&g_engineJob);
+    fwEngineBuffersFree(&g_buffers);
+    g_workerStarted = 0;
+    g_workerStop = 0;
+    pthread_mutex_unlock(&g_upgradeLock);
     return mfrERR_NONE;
 }
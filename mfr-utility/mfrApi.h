@@ -51,6 +51,9 @@
  */
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -195,6 +198,32 @@ typedef struct _mfrUpgradeStatusNotify_t {
                     * @note Manufacturer must at least support notifying the upgrade status at the end. */
 } mfrUpgradeStatusNotify_t;
 
+/**
+ * @brief Extended upgrade status structure.
+ *
+ * This structure extends ::mfrUpgradeStatus_t with byte accurate progress, throughput and completion estimate.
+ */
+typedef struct _mfrUpgradeStatusEx_t {
+  mfrUpgradeStatus_t status;            /**< Basic upgrade status.                                           */
+  unsigned long long bytesConsumed;     /**< Image bytes consumed so far.                                    */
+  unsigned long long bytesTotal;        /**< Size of the image, 0 if unknown.                                */
+  unsigned long long bytesWritten;      /**< Bytes written to the flash memory so far.                       */
+  unsigned long long throughput;        /**< Image bytes consumed per second over the last interval.         */
+  unsigned long long avgThroughput;     /**< Image bytes consumed per second since the upgrade started.      */
+  int etaSeconds;                       /**< Estimated seconds to completion, -1 if unknown.                 */
+} mfrUpgradeStatusEx_t;
+
+/**
+ * @brief Extended upgrade status notification structure.
+ *
+ * Same as ::mfrUpgradeStatusNotify_t, with the callback receiving ::mfrUpgradeStatusEx_t.
+ */
+typedef struct _mfrUpgradeStatusNotifyEx_t {
+    void * cbData;
+    void (*cb) (mfrUpgradeStatusEx_t status, void *cbData); /**< Pointer to the callback function used to notify of the upgrade status. */
+    int interval;  /**< Interval in seconds between two successive callbacks, 0 to only report the final result. */
+} mfrUpgradeStatusNotifyEx_t;
+
 /**
  * @brief Initializes the MFRLibs sub-system.
  *
@@ -261,6 +290,9 @@ mfrError_t mfrGetSerializedData( mfrSerializedType_t type,  mfrSerializedData_t
  *  - The last invocation of notify function should have either @a progress set to ::mfrUPGRADE_PROGRESS_COMPLETED or
  *    ::mfrUPGRADE_PROGRESS_ABORTED with an appropriate error code set.
  *
+ * Upgrades are queued for the worker started by ::mfrFWUpgradeInit and flashed one at a time, in order. The
+ * worker is started by the first upgrade when the caller did not call ::mfrFWUpgradeInit.
+ *
  * @param [in] name    The filename of the image file.
  * @param [in] path    The path of the image file in the STB file system.
  * @param [in] type    The type (e.g. format, signature type) of the image.
@@ -270,6 +302,7 @@ mfrError_t mfrGetSerializedData( mfrSerializedType_t type,  mfrSerializedData_t
  *
  * @return Error code.
  * @retval ::mfrERR_NONE The image flashing process has been started successfully.
+ * @retval ::mfrERR_INVALID_STATE Too many upgrades are queued already.
  * @retval ::mfrError_t  Other specific code on error if the image flashing process has not started.
  *
  * @note All upgrades should be done in the alternate bank. The current bank should not be disturbed at any cost.
@@ -281,9 +314,15 @@ mfrError_t mfrWriteImage(const char *name,  const char *path, mfrImageType_t typ
 *    1) Validate headers, manufacturer, model.
 *    2) Perform Signature check.
 *
+* The whole package is decompressed and walked without writing anything. When a
+* <name>.sha256 file (sha256sum format) sits next to the image, the SHA-256 of the
+* image must match it.
+*
 * @param [in] name:  the path of the image file in the STB file system.
 * @param [in] path:  the directory name containing the image file.
 * @return Error Code:
+* @retval ::mfrERR_NONE              The image is well formed and its digest matches.
+* @retval ::mfrERR_DECRYPTION_FAILED The image is corrupted or its digest does not match.
 */
 mfrError_t mfrVerifyImage(const char *name, const char *path );
 /**
@@ -298,6 +337,9 @@ mfrError_t mfrVerifyImage(const char *name, const char *path );
 * @param [in] out_name:  the path of the unpacked file in the STB file system.
 * @param [in] out_path:  the filename of the image file.
 * @return Error Code:  If error code is returned, the image flashing is not initiated..
+*
+* @note gzip, zstd and xz images are detected by their magic bytes. Multi-member gzip, multi-frame zstd
+* and multi-block xz images are decompressed on several cores.
 */
 mfrError_t mfrUnpackImage(const char *name,     const char *path,
                           const char *out_name, const char *out_path);
@@ -327,9 +369,340 @@ mfrError_t mfrScrubAllBanks(void);
  */
 mfrError_t mfrGetUpgradeStatus(mfrUpgradeProgress_t *pStatus);
 
+/**
+ * @brief Starts the firmware upgrade worker.
+ *
+ * The worker flashes the upgrades queued by ::mfrWriteImage. The pipeline buffers are allocated here for the
+ * configuration set by ::mfrFWUpgradeSetConfig and reused by every upgrade until the configuration changes.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE           The worker is running.
+ * @retval ::mfrERR_INVALID_STATE  ::mfrFWUpgradeTerm is in progress.
+ * @retval ::mfrERR_MALLOC_FAILED  The buffers could not be allocated.
+ */
 mfrError_t mfrFWUpgradeInit(void);
 
+/**
+ * @brief Stops the firmware upgrade worker.
+ *
+ * The running and the queued upgrades are completed first and their final notification delivered before this
+ * function returns. Call ::mfrCancelUpgrade first to abort them instead.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The worker is stopped.
+ * @retval ::mfrERR_INVALID_STATE Called from an upgrade notification.
+ */
 mfrError_t mfrFWUpgradeTerm(void);
+
+/**
+ * @brief Cancels the running and the queued firmware upgrades.
+ *
+ * Queued upgrades are dropped. The running one stops at its next block boundary, after the writes in flight
+ * completed, and the active bank is left untouched. An upgrade already switching the boot partition is left to
+ * complete. Cancelled upgrades end with ::mfrUPGRADE_PROGRESS_ABORTED and ::mfrERR_INVALID_STATE. Unless called
+ * from an upgrade notification, this function returns once the final notifications have been delivered.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The upgrades have been cancelled.
+ * @retval ::mfrERR_INVALID_STATE No upgrade is running or queued.
+ */
+mfrError_t mfrCancelUpgrade(void);
+
+/**
+ * @brief Writes firmware image to the flash memory, reporting extended status.
+ *
+ * Same as ::mfrWriteImage, except that the notification callback receives ::mfrUpgradeStatusEx_t.
+ *
+ * @param [in] name    The filename of the image file.
+ * @param [in] path    The path of the image file in the STB file system.
+ * @param [in] type    The type (e.g. format, signature type) of the image.
+ * @param [in] notify  Notification structure holding the callback to provide extended status.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE The image flashing process has been started successfully.
+ * @retval ::mfrError_t  Other specific code on error if the image flashing process has not started.
+ */
+mfrError_t mfrWriteImageEx(const char *name, const char *path, mfrImageType_t type, mfrUpgradeStatusNotifyEx_t notify);
+
+/**
+ * @brief Source of the package flashed by ::mfrWriteImageStream.
+ *
+ * The package is pulled from read when it is set, otherwise read from fd until its end. A producer pushing
+ * the package, such as a downloader, writes it into a pipe or socket and passes the other end as fd. The
+ * upgrade consumes the package as it arrives and the producer blocks whenever flashing falls behind.
+ */
+typedef struct _mfrImageSource_t {
+    int fd;                         /**< Pipe, socket or file read to its end when read is NULL. It stays
+                                     *   owned by the caller, open until release is called.                  */
+    void *ctx;                      /**< Passed to read and release.                                        */
+    mfrError_t (*read)(void *ctx, void *buf, size_t len, size_t *got); /**< Waits for the next bytes of the
+                                     *   package and stores up to len of them in buf. *got is 0 at its end.
+                                     *   Any error code aborts the upgrade.                                  */
+    void (*release)(void *ctx);     /**< Optional, called once the upgrade is over with the source, also when
+                                     *   it is cancelled before it started.                                   */
+    uint64_t size;                  /**< Size of the package for the progress percentage, 0 if unknown.    */
+    const char *sha256;             /**< Expected SHA-256 of the package as 64 hex digits, NULL not to check
+                                     *   it. The bank is only switched over when it matches.                 */
+} mfrImageSource_t;
+
+/**
+ * @brief Writes a firmware image streamed by the caller to the flash memory.
+ *
+ * Same as ::mfrWriteImageEx for a package that does not have to be stored first: it is flashed while it is
+ * being downloaded. A cancelled upgrade stops reading fd at once, while a read callback has to return first.
+ *
+ * @param [in] source  Source of the package, copied.
+ * @param [in] type    The type (e.g. format, signature type) of the image.
+ * @param [in] notify  Notification structure holding the callback to provide extended status.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The image flashing process has been started, release will be called.
+ * @retval ::mfrERR_INVALID_PARAM The source has neither fd nor read, or sha256 is not a digest.
+ * @retval ::mfrError_t           Other specific code on error if the image flashing process has not started.
+ */
+mfrError_t mfrWriteImageStream(const mfrImageSource_t *source, mfrImageType_t type, mfrUpgradeStatusNotifyEx_t notify);
+
+/**
+ * @brief Destination of the data unpacked by ::mfrUnpackImageEx.
+ */
+typedef struct _mfrUnpackSink_t {
+    void *ctx;
+    mfrError_t (*write)(void *ctx, const void *data, size_t len); /**< Called in order with the unpacked data.
+                                                                       Any error code stops the unpacking. */
+} mfrUnpackSink_t;
+
+/**
+ * @brief Unpacks an image to a caller supplied sink.
+ *
+ * Same as ::mfrUnpackImage, except that the unpacked data is handed to the sink instead of a file.
+ *
+ * @param [in] name  The filename of the image file.
+ * @param [in] path  The path of the image file in the STB file system.
+ * @param [in] sink  Sink receiving the unpacked data, from a single thread at a time.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE                    The image has been unpacked.
+ * @retval ::mfrERR_DECRYPTION_FAILED       The image is corrupted.
+ * @retval ::mfrERR_OPERATION_NOT_SUPPORTED The image compression is not supported by this build.
+ */
+mfrError_t mfrUnpackImageEx(const char *name, const char *path, mfrUnpackSink_t sink);
+
+/**
+ * @brief Write backends of the firmware upgrade engine.
+ */
+typedef enum _mfrWriteBackend_t {
+    mfrWRITE_BACKEND_AUTO = 0,      /**< io_uring, or the thread pool when the kernel lacks io_uring. */
+    mfrWRITE_BACKEND_IO_URING,      /**< io_uring, with the same fallback as ::mfrWRITE_BACKEND_AUTO. */
+    mfrWRITE_BACKEND_THREADS,       /**< Pool of threads issuing pwrite.                            */
+    mfrWRITE_BACKEND_SYNC,          /**< One pwrite at a time from the writer stage.                */
+} mfrWriteBackend_t;
+
+/**
+ * @brief Block backends the firmware upgrade engine reaches the partitions through.
+ */
+typedef enum _mfrBlockBackend_t {
+    mfrBLOCK_BACKEND_AUTO = 0,      /**< mmc for block devices, file for anything else.              */
+    mfrBLOCK_BACKEND_MMC,           /**< Block devices only, geometry from the kernel.               */
+    mfrBLOCK_BACKEND_LOOP,          /**< Files are attached to loop devices while flashing, so a disk
+                                     *   image goes through the block layer like the eMMC. Block
+                                     *   devices are used as they are. Needs CAP_SYS_ADMIN.          */
+    mfrBLOCK_BACKEND_FILE,          /**< Regular files only, throttled by the device model.         */
+} mfrBlockBackend_t;
+
+/**
+ * @brief Firmware upgrade engine configuration.
+ *
+ * This structure describes the storage the upgrade engine flashes to. Any member left as NULL
+ * falls back to the default device layout of the box, so callers should zero-initialize it and
+ * only set what they need to override (e.g. file-backed images standing in for the eMMC).
+ */
+typedef struct _mfrFWUpgradeConfig_t {
+    const char *bootDevice;         /**< Shared boot (FAT) partition. Default "/dev/mmcblk0p1".               */
+    const char *bankDevice[2];      /**< Rootfs bank 0 and bank 1. Default "/dev/mmcblk0p2", "/dev/mmcblk0p3". */
+    const char *bankRootName[2];    /**< Value of root= on the kernel command line selecting each bank.
+                                     *   Defaults to the matching bankDevice.                                */
+    const char *storageDevice;      /**< Storage partition mounted on workDir. Default "/dev/mmcblk0p4".      */
+    const char *workDir;            /**< Directory used for staging the boot partition, which also keeps the
+                                     *   copies of its files for each bank in data_bkup_linux_bank0 and 1.
+                                     *   Default "/imageblk".                                                 */
+    const char *cmdlinePath;        /**< Kernel command line of the running image. Default "/proc/cmdline".   */
+    int deltaMode;                  /**< Non-zero to only write rootfs chunks that differ from the passive bank. */
+    unsigned int deltaChunkSize;    /**< Granularity of delta and sparse mode in bytes. Default 64KB.          */
+    int sparseMode;                 /**< Non-zero to only write the rootfs chunks holding data, as told by a
+                                     *   *.bmap file ahead of the sdimg in the package or by the ext2/3/4 block
+                                     *   bitmaps, and to discard the others on the bank.                     */
+    int resumeMode;                 /**< Non-zero to keep a journal of the rootfs written so far in workDir,
+                                     *   syncing the bank every 64MB. An upgrade interrupted by a crash or a
+                                     *   power cut then resumes where the journal left off when the same
+                                     *   package is flashed again to the same bank. The journal belongs to the
+                                     *   package digest, streams without one start over.                     */
+    int hashTree;                   /**< Non-zero to build the dm-verity hash tree of the rootfs while flashing
+                                     *   (format 1, SHA-256, 4KB blocks) and save it in workDir as
+                                     *   rootfs<bank>.verity, a veritysetup hash device, with its root hash in
+                                     *   rootfs<bank>.roothash. Delta mode then compares the image with the
+                                     *   tree of the passive bank instead of reading the bank back. In sparse
+                                     *   mode free space is hashed as zeros and zeroed on the bank rather than
+                                     *   discarded, by a discard only when the media guarantees it zeroes.
+                                     *   Not built with a memory budget.                                      */
+    unsigned int hashTreeThreads;   /**< Threads hashing the tree. Default one per online CPU.                */
+    unsigned int blockSize;         /**< Size of the blocks handed between pipeline stages, a multiple of 4KB.
+                                     *   Default 1MB.                                                          */
+    unsigned int readSize;          /**< Size of the reads from the package. Default 256KB.                    */
+    unsigned int queueDepth;        /**< Blocks queued between two pipeline stages. Default 4.                 */
+    int skipReadback;               /**< Non-zero to skip reading the written partitions back before the bank
+                                     *   switch.                                                               */
+    unsigned int verifyThreads;     /**< Threads reading the written partitions back. Default 4.               */
+    unsigned int unpackThreads;     /**< Threads decompressing in mfrUnpackImage. Default one per online CPU. */
+    const char *diskDevice;         /**< Whole device holding the partitions. Default "/dev/mmcblk0". The boot
+                                     *   partition, the banks and the storage partition are located in its
+                                     *   partition table by the number ending their device name, and written
+                                     *   as ranges of it. Empty string to only use the partition devices.     */
+    mfrWriteBackend_t writeBackend; /**< How the rootfs bank is written. Default ::mfrWRITE_BACKEND_AUTO.     */
+    unsigned int writeDepth;        /**< Writes kept in flight on the targets. Default 4, at most 64.          */
+    int bufferedWrites;             /**< Non-zero to write the bank through the page cache instead of O_DIRECT. */
+    mfrBlockBackend_t blockBackend; /**< How the partitions are reached. Default ::mfrBLOCK_BACKEND_AUTO.     */
+    unsigned int modelLatencyUs;    /**< Device model of file targets, so a flash to disk images takes as long
+                                     *   as on the box: latency of every request, overlapping between the
+                                     *   requests in flight. 0 for none.                                     */
+    unsigned int modelReadKBps;     /**< Device model: read bandwidth, shared by the targets. 0 for unlimited. */
+    unsigned int modelWriteKBps;    /**< Device model: write bandwidth, shared by the targets. 0 for unlimited. */
+    unsigned int modelFlushUs;      /**< Device model: time a sync takes once the transfers are done.         */
+    unsigned int memoryBudgetKB;    /**< Hard limit on the memory of an upgrade, 0 for none. The pipeline is
+                                     *   allocated from one arena of this size before flashing and nothing
+                                     *   is allocated per block: queue depths, block sizes and threads are
+                                     *   scaled down to fit. Upgrades fail with ::mfrERR_INVALID_PARAM when
+                                     *   even the smallest pipeline does not fit, about 1MB.                 */
+    const char *tracePath;          /**< Chrome trace JSON written after every upgrade by builds with
+                                     *   FWUPGRADE_TRACE. Default "/tmp/fwupgrade-trace.json", empty string
+                                     *   to disable. Ignored by other builds.                                 */
+} mfrFWUpgradeConfig_t;
+
+/**
+ * @brief Sets the firmware upgrade engine configuration.
+ *
+ * The configuration is copied and applies to upgrades started after this call.
+ *
+ * @param [in] config  Configuration to apply, or NULL to restore the defaults.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The configuration has been applied.
+ * @retval ::mfrERR_INVALID_STATE An upgrade is in progress.
+ * @retval ::mfrERR_INVALID_PARAM blockBackend is not one of ::mfrBlockBackend_t or writeBackend is not one of
+ *                                ::mfrWriteBackend_t.
+ */
+mfrError_t mfrFWUpgradeSetConfig(const mfrFWUpgradeConfig_t *config);
+
+/**
+ * @brief Stages of the firmware upgrade pipeline, each running on its own thread.
+ */
+typedef enum _mfrUpgradeStage_t {
+    mfrUPGRADE_STAGE_READ = 0,      /**< Reads the package.                                    */
+    mfrUPGRADE_STAGE_DECOMPRESS,    /**< Inflates the package and cuts the image into blocks.  */
+    mfrUPGRADE_STAGE_HASH,          /**< Checksums the blocks, compares them in delta mode.     */
+    mfrUPGRADE_STAGE_WRITE,         /**< Writes the blocks to the targets.                      */
+    mfrUPGRADE_STAGE_MAX,
+} mfrUpgradeStage_t;
+
+/**
+ * @brief Counters of one pipeline stage.
+ */
+typedef struct _mfrUpgradeStageStats_t {
+    uint64_t blocks;                /**< Blocks handled.                                            */
+    uint64_t bytes;                 /**< Bytes handed to the next stage, submitted by the write stage. */
+    uint64_t stallInMs;             /**< Time spent waiting for the previous stage.                 */
+    uint64_t stallOutMs;            /**< Time spent waiting for room in the next stage.             */
+    uint32_t peakQueueDepth;        /**< Most blocks queued in front of the stage.                  */
+} mfrUpgradeStageStats_t;
+
+/**
+ * @brief Counters of the current or last firmware upgrade.
+ *
+ * While the upgrade runs only the progress, the elapsed time and the byte counters are updated.
+ * Everything else is filled in once it is over.
+ */
+typedef struct _mfrUpgradeStats_t {
+    mfrUpgradeProgress_t progress;  /**< Same as ::mfrGetUpgradeStatus.                          */
+    mfrError_t error;               /**< Result of the last upgrade once it is over.             */
+    uint64_t elapsedMs;             /**< Since the upgrade started, its duration once it is over. */
+    uint64_t prepareMs;             /**< Opening the package, locating the banks.                */
+    uint64_t streamMs;              /**< Streaming the package to the passive bank.              */
+    uint64_t readbackMs;            /**< Reading the bank back.                                  */
+    uint64_t hashTreeMs;            /**< Hash tree: upper levels and saving it, the leaves are
+                                     *   hashed while streaming.                                  */
+    uint64_t commitMs;              /**< Switching the boot partition over.                      */
+    uint64_t bytesTotal;            /**< Size of the package.                                    */
+    uint64_t bytesRead;             /**< Package bytes read.                                     */
+    uint64_t bytesDecompressed;     /**< Archive bytes inflated.                                 */
+    uint64_t bytesHashed;           /**< Image bytes checksummed.                                */
+    uint64_t bytesWritten;          /**< Bytes written to the targets.                           */
+    uint64_t bytesSkipped;          /**< Delta mode: bytes already up to date on the bank.       */
+    uint64_t bytesUnmapped;         /**< Sparse mode: free space of the rootfs, not written.     */
+    uint64_t bytesResumed;          /**< Resume mode: written by an interrupted upgrade already.  */
+    uint64_t writeRequests;         /**< Writes issued on the targets.                           */
+    uint64_t writeRetries;          /**< Short or interrupted writes that had to be reissued.    */
+    uint64_t writeLatencyAvgUs;
+    uint64_t writeLatencyMaxUs;
+    uint32_t peakWriteQueueDepth;   /**< Most writes in flight at once.                          */
+    uint64_t syncMs;                /**< Time spent syncing the targets.                         */
+    uint64_t throttleMs;            /**< Time the writes were held back by the background mode.  */
+    uint64_t bufferBytes;           /**< Memory allocated for the pipeline blocks, the whole arena
+                                     *   with a memory budget.                                    */
+    uint64_t peakMemoryKB;          /**< Peak resident set size of the process.                  */
+    uint64_t upgradePeakMemoryKB;   /**< Peak resident set size sampled during the last upgrade. */
+    mfrUpgradeStageStats_t stage[mfrUPGRADE_STAGE_MAX];
+} mfrUpgradeStats_t;
+
+/**
+ * @brief Gets the counters of the current or last firmware upgrade.
+ *
+ * @param [out] stats  Counters, all zero with ::mfrUPGRADE_PROGRESS_NOT_STARTED before the first upgrade.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The counters have been retrieved.
+ * @retval ::mfrERR_INVALID_PARAM stats is NULL.
+ */
+mfrError_t mfrGetUpgradeStats(mfrUpgradeStats_t *stats);
+
+/**
+ * @brief Limits of the background mode, see ::mfrSetUpgradeThrottle.
+ */
+typedef struct _mfrUpgradeThrottle_t {
+    int background;                 /**< Non-zero to apply the limits below, zero to upgrade at full speed.  */
+    uint64_t writeBytesPerSec;      /**< Sustained write bandwidth on the targets, 0 for no limit. An upgrade
+                                     *   then takes at most the image size over this rate plus the readback. */
+    uint64_t writeBurstBytes;       /**< Bytes written at once after an idle period. Default a quarter second
+                                     *   at writeBytesPerSec.                                                */
+    unsigned int maxThreads;        /**< Most threads decompressing in ::mfrUnpackImage or reading the banks
+                                     *   back, 0 for no cap.                                                 */
+    int idleIoPriority;             /**< Non-zero to issue the upgrade I/O in the idle class, served when no
+                                     *   other process uses the disk. Leave it off where the disk is never
+                                     *   idle and rely on writeBytesPerSec instead.                          */
+    uint64_t cpuMask;               /**< CPUs 0 to 63 the upgrade threads run on, 0 for any.                 */
+} mfrUpgradeThrottle_t;
+
+/**
+ * @brief Sets the limits of the background mode.
+ *
+ * The limits apply to the running upgrade from its next block on and to the upgrades after it, so an
+ * orchestrator can lift them when the box goes to standby. May be called from an upgrade notification.
+ *
+ * @param [in] throttle  New limits, NULL for full speed.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE The limits are in force.
+ */
+mfrError_t mfrSetUpgradeThrottle(const mfrUpgradeThrottle_t *throttle);
+
+/**
+ * @brief Gets the limits of the background mode.
+ *
+ * @param [out] throttle  Limits in force.
+ *
+ * @return Error code.
+ * @retval ::mfrERR_NONE          The limits have been retrieved.
+ * @retval ::mfrERR_INVALID_PARAM throttle is NULL.
+ */
+mfrError_t mfrGetUpgradeThrottle(mfrUpgradeThrottle_t *throttle);
 /* End of MFRLIBS_HAL_API doxygen group */
 /**
  * @}